@@ -0,0 +1,154 @@
+#ifndef __ACTIVATION_POOL_HPP__
+#define __ACTIVATION_POOL_HPP__
+
+// Activation scratch shared by the execution contexts of one device. Contexts created without
+// device memory enqueue through a lease on the pool: leases are handed out one at a time and
+// order their work after the previous holder's on the device, so the models never touch the
+// scratch concurrently and the device holds the largest activation workspace once instead of
+// once per context. Device calls are injected so the policy runs without a GPU.
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace pool {
+
+class ActivationPool {
+ public:
+  struct Device {
+    std::function<void *(size_t bytes)> allocate;  // nullptr when the device is out of memory
+    std::function<void(void *memory)> free;
+    std::function<void(void *stream)> wait;    // stream waits for the last recorded use
+    std::function<void(void *stream)> record;  // marks the end of a use on stream
+    std::function<void()> synchronize;         // host waits for the last recorded use
+  };
+
+  struct User {
+    int id = -1;
+    std::string name;
+    size_t bytes = 0;
+  };
+
+  // Exclusive use of the scratch for one enqueue, the next holder runs after it on the device.
+  class Lease {
+   public:
+    Lease(ActivationPool &pool, void *stream)
+        : pool_(&pool), stream_(stream), lock_(pool.lock_) {
+      if (pool_->device_.wait) pool_->device_.wait(stream_);
+    }
+    Lease(Lease &&other)
+        : pool_(other.pool_), stream_(other.stream_), lock_(std::move(other.lock_)) {
+      other.pool_ = nullptr;
+    }
+    Lease(const Lease &other) = delete;
+    Lease &operator=(const Lease &other) = delete;
+    virtual ~Lease() {
+      if (pool_ && pool_->device_.record) pool_->device_.record(stream_);
+    }
+
+    inline void *memory() const { return pool_->memory_; }
+    inline size_t bytes() const { return pool_->capacity_; }
+
+   private:
+    ActivationPool *pool_;
+    void *stream_;
+    std::unique_lock<std::mutex> lock_;
+  };
+
+  explicit ActivationPool(const Device &device) : device_(device) {}
+  ActivationPool(const ActivationPool &other) = delete;
+  ActivationPool &operator=(const ActivationPool &other) = delete;
+  virtual ~ActivationPool() { release(); }
+
+  // Registers a context needing bytes of scratch and grows the scratch to fit it, -1 when the
+  // larger scratch can not be allocated. Growing waits for the work of the other users.
+  int attach(const std::string &name, size_t bytes) {
+    std::unique_lock<std::mutex> l(lock_);
+    if (bytes > capacity_ && !reserve(bytes)) return -1;
+
+    User user;
+    user.id = next_id_++;
+    user.name = name;
+    user.bytes = bytes;
+    users_.push_back(user);
+    return user.id;
+  }
+
+  // the scratch keeps its size until the last user has left
+  void detach(int id) {
+    std::unique_lock<std::mutex> l(lock_);
+    users_.erase(std::remove_if(users_.begin(), users_.end(),
+                                [&](const User &user) { return user.id == id; }),
+                 users_.end());
+    if (users_.empty()) release();
+  }
+
+  Lease acquire(void *stream) { return Lease(*this, stream); }
+
+  size_t capacity() {
+    std::unique_lock<std::mutex> l(lock_);
+    return capacity_;
+  }
+
+  // the scratch a new pool of the current users would need
+  size_t required() {
+    std::unique_lock<std::mutex> l(lock_);
+    size_t bytes = 0;
+    for (auto &user : users_) bytes = std::max(bytes, user.bytes);
+    return bytes;
+  }
+
+  // bytes the users would hold with private workspaces
+  size_t private_bytes() {
+    std::unique_lock<std::mutex> l(lock_);
+    size_t bytes = 0;
+    for (auto &user : users_) bytes += user.bytes;
+    return bytes;
+  }
+
+  std::vector<User> users() {
+    std::unique_lock<std::mutex> l(lock_);
+    return users_;
+  }
+
+ private:
+  // with lock_ held, the current users keep the old scratch when the larger one does not fit
+  bool reserve(size_t bytes) {
+    size_t previous = capacity_;
+    release();
+    if (allocate(bytes)) return true;
+    if (previous > 0) allocate(previous);
+    return false;
+  }
+
+  bool allocate(size_t bytes) {
+    memory_ = device_.allocate ? device_.allocate(bytes) : nullptr;
+    if (memory_ == nullptr) return false;
+    capacity_ = bytes;
+    return true;
+  }
+
+  // with lock_ held
+  void release() {
+    if (memory_ == nullptr) return;
+    if (device_.synchronize) device_.synchronize();
+    if (device_.free) device_.free(memory_);
+    memory_ = nullptr;
+    capacity_ = 0;
+  }
+
+  Device device_;
+  std::mutex lock_;
+  void *memory_ = nullptr;
+  size_t capacity_ = 0;
+  std::vector<User> users_;
+  int next_id_ = 0;
+};
+
+};  // namespace pool
+
+#endif  // __ACTIVATION_POOL_HPP__
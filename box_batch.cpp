@@ -0,0 +1,127 @@
+#include "box_batch.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace yolo {
+
+using namespace std;
+
+static size_t align64(size_t n) { return (n + 63) / 64 * 64; }
+
+BoxBatch::BoxBatch(BoxBatch &&other) { *this = move(other); }
+
+BoxBatch &BoxBatch::operator=(BoxBatch &&other) {
+  if (this == &other) return *this;
+  arena_ = move(other.arena_);
+  capacity_ = other.capacity_;
+  column_bytes_ = other.column_bytes_;
+  image_offset_ = other.image_offset_;
+  mask_offset_ = other.mask_offset_;
+  mask_capacity_ = other.mask_capacity_;
+  mask_used_ = other.mask_used_;
+  num_images_ = other.num_images_;
+  max_boxes_ = other.max_boxes_;
+  size_ = other.size_;
+  last_image_ = other.last_image_;
+
+  other.capacity_ = 0;
+  other.column_bytes_ = other.image_offset_ = other.mask_offset_ = 0;
+  other.mask_capacity_ = other.mask_used_ = 0;
+  other.num_images_ = other.max_boxes_ = other.size_ = other.last_image_ = 0;
+  return *this;
+}
+
+void BoxBatch::reset(int num_images, int num_boxes, size_t mask_bytes) {
+  num_images = max(num_images, 0);
+  num_boxes = max(num_boxes, 0);
+  column_bytes_ = align64(num_boxes * sizeof(float));
+  image_offset_ = column_bytes_ * NumColumns;
+  mask_offset_ = image_offset_ + align64((num_images + 1) * sizeof(int32_t));
+
+  size_t bytes = mask_offset_ + mask_bytes;
+  if (bytes > capacity_) {
+    arena_.reset(new unsigned char[bytes]);
+    capacity_ = bytes;
+  }
+
+  num_images_ = num_images;
+  max_boxes_ = num_boxes;
+  mask_capacity_ = mask_bytes;
+  mask_used_ = 0;
+  size_ = 0;
+  last_image_ = 0;
+  image_first()[0] = 0;
+}
+
+int BoxBatch::append(int image, float left, float top, float right, float bottom,
+                     float confidence, int class_label) {
+  if (size_ >= max_boxes_ || image < last_image_ || image >= num_images_) return -1;
+
+  int32_t *first = image_first();
+  for (int i = last_image_ + 1; i <= image; ++i) first[i] = size_;
+  last_image_ = image;
+
+  int index = size_++;
+  ((float *)column_ptr(Left))[index] = left;
+  ((float *)column_ptr(Top))[index] = top;
+  ((float *)column_ptr(Right))[index] = right;
+  ((float *)column_ptr(Bottom))[index] = bottom;
+  ((float *)column_ptr(Confidence))[index] = confidence;
+  ((int32_t *)column_ptr(Label))[index] = class_label;
+  ((int32_t *)column_ptr(MaskOffset))[index] = -1;
+  ((int32_t *)column_ptr(MaskWidth))[index] = 0;
+  ((int32_t *)column_ptr(MaskHeight))[index] = 0;
+  return index;
+}
+
+unsigned char *BoxBatch::attach_mask(int index, int width, int height) {
+  size_t bytes = (size_t)width * height;
+  if (index < 0 || index >= size_ || width <= 0 || height <= 0 ||
+      mask_used_ + bytes > mask_capacity_)
+    return nullptr;
+
+  unsigned char *mask = arena_.get() + mask_offset_ + mask_used_;
+  ((int32_t *)column_ptr(MaskOffset))[index] = (int32_t)mask_used_;
+  ((int32_t *)column_ptr(MaskWidth))[index] = width;
+  ((int32_t *)column_ptr(MaskHeight))[index] = height;
+  mask_used_ += bytes;
+  return mask;
+}
+
+int BoxBatch::begin(int image) const {
+  if (image < 0 || image >= num_images_) return 0;
+  return image <= last_image_ ? image_first()[image] : size_;
+}
+
+int BoxBatch::end(int image) const {
+  if (image < 0 || image >= num_images_) return 0;
+  return image < last_image_ ? image_first()[image + 1] : size_;
+}
+
+BoxView BoxBatch::operator[](int index) const {
+  BoxView view;
+  view.left = left()[index];
+  view.top = top()[index];
+  view.right = right()[index];
+  view.bottom = bottom()[index];
+  view.confidence = confidence()[index];
+  view.class_label = labels()[index];
+  view.mask_width = column_i(MaskWidth)[index];
+  view.mask_height = column_i(MaskHeight)[index];
+  int offset = column_i(MaskOffset)[index];
+  view.mask = offset >= 0 ? mask_data() + offset : nullptr;
+  return view;
+}
+
+size_t BoxBatch::copy_column(Column column, int first, int count, void *dst) const {
+  if (first < 0 || count <= 0 || first >= size_ || column < 0 || column >= NumColumns) return 0;
+
+  count = min(count, size_ - first);
+  size_t bytes = count * sizeof(float);
+  memcpy(dst, column_ptr(column) + first * sizeof(float), bytes);
+  return bytes;
+}
+
+};  // namespace yolo
@@ -0,0 +1,132 @@
+#ifndef __BOX_BATCH_HPP__
+#define __BOX_BATCH_HPP__
+
+// Results of one batch packed in a single arena as struct of arrays. Coordinates, scores,
+// labels and mask geometry are one column each, masks are concatenated after the columns.
+// A batch costs one allocation (none when a BoxBatch is reused) and a column copies to a
+// caller array with one memcpy.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+
+namespace yolo {
+
+struct BoxView {
+  float left, top, right, bottom, confidence;
+  int class_label;
+  int mask_width, mask_height;  // 0 without mask
+  const unsigned char *mask;    // mask_width * mask_height bytes, nullptr without mask
+};
+
+class BoxBatch {
+ public:
+  // every column holds 4 byte elements, float up to Confidence, int32_t afterwards
+  enum Column : int {
+    Left = 0,
+    Top = 1,
+    Right = 2,
+    Bottom = 3,
+    Confidence = 4,
+    Label = 5,
+    MaskOffset = 6,  // byte offset in mask_data(), -1 without mask
+    MaskWidth = 7,
+    MaskHeight = 8,
+    NumColumns = 9
+  };
+
+  class Range {
+   public:
+    class iterator {
+     public:
+      iterator(const BoxBatch *batch, int index) : batch_(batch), index_(index) {}
+      inline BoxView operator*() const { return (*batch_)[index_]; }
+      inline iterator &operator++() {
+        ++index_;
+        return *this;
+      }
+      inline bool operator!=(const iterator &other) const { return index_ != other.index_; }
+
+     private:
+      const BoxBatch *batch_;
+      int index_;
+    };
+
+    Range(const BoxBatch *batch, int first, int last)
+        : batch_(batch), first_(first), last_(last) {}
+    inline iterator begin() const { return iterator(batch_, first_); }
+    inline iterator end() const { return iterator(batch_, last_); }
+    inline int first() const { return first_; }
+    inline int size() const { return last_ - first_; }
+
+   private:
+    const BoxBatch *batch_;
+    int first_, last_;
+  };
+
+  BoxBatch() = default;
+  BoxBatch(BoxBatch &&other);
+  BoxBatch &operator=(BoxBatch &&other);
+  BoxBatch(const BoxBatch &other) = delete;
+  BoxBatch &operator=(const BoxBatch &other) = delete;
+
+  // Lays out room for num_boxes boxes over num_images images and mask_bytes of masks and
+  // empties the batch. The arena is kept when it is large enough.
+  void reset(int num_images, int num_boxes, size_t mask_bytes = 0);
+
+  // Appends a box to image, images are filled in increasing order. Returns the box index or
+  // -1 when the batch is full.
+  int append(int image, float left, float top, float right, float bottom, float confidence,
+             int class_label);
+
+  // Reserves the mask of box index in the mask area, nullptr when it does not fit.
+  unsigned char *attach_mask(int index, int width, int height);
+
+  inline int num_images() const { return num_images_; }
+  inline int size() const { return size_; }
+  inline bool empty() const { return size_ == 0; }
+  inline size_t capacity_bytes() const { return capacity_; }
+
+  // boxes of image are [begin(image), end(image))
+  int begin(int image) const;
+  int end(int image) const;
+  inline int count(int image) const { return end(image) - begin(image); }
+
+  inline const float *column_f(Column column) const { return (const float *)column_ptr(column); }
+  inline const int32_t *column_i(Column column) const {
+    return (const int32_t *)column_ptr(column);
+  }
+  inline const float *left() const { return column_f(Left); }
+  inline const float *top() const { return column_f(Top); }
+  inline const float *right() const { return column_f(Right); }
+  inline const float *bottom() const { return column_f(Bottom); }
+  inline const float *confidence() const { return column_f(Confidence); }
+  inline const int32_t *labels() const { return column_i(Label); }
+  inline const unsigned char *mask_data() const { return arena_.get() + mask_offset_; }
+  inline unsigned char *mask_data() { return arena_.get() + mask_offset_; }
+  inline size_t mask_bytes() const { return mask_used_; }
+
+  BoxView operator[](int index) const;
+  inline Range all() const { return Range(this, 0, size_); }
+  inline Range image(int image) const { return Range(this, begin(image), end(image)); }
+
+  // copies count elements of column starting at box first to dst, returns the bytes copied
+  size_t copy_column(Column column, int first, int count, void *dst) const;
+
+ private:
+  inline unsigned char *column_ptr(Column column) const {
+    return arena_.get() + column * column_bytes_;
+  }
+  inline int32_t *image_first() const { return (int32_t *)(arena_.get() + image_offset_); }
+
+  std::unique_ptr<unsigned char[]> arena_;
+  size_t capacity_ = 0;
+  size_t column_bytes_ = 0, image_offset_ = 0, mask_offset_ = 0;
+  size_t mask_capacity_ = 0, mask_used_ = 0;
+  int num_images_ = 0, max_boxes_ = 0, size_ = 0, last_image_ = 0;
+};
+
+};  // namespace yolo
+
+#endif  // __BOX_BATCH_HPP__
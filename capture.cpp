@@ -0,0 +1,234 @@
+#include "capture.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "infer.hpp"
+#include "postprocess.hpp"
+
+namespace capture {
+
+using namespace std;
+
+static uint64_t upbound(uint64_t n, uint64_t align = CAPTURE_ALIGNMENT) {
+  return (n + align - 1) / align * align;
+}
+
+static uint64_t segment_numel(const FrameHeader &header) {
+  return (uint64_t)header.segment_dims[0] * header.segment_dims[1] * header.segment_dims[2];
+}
+
+class WriterImpl : public Writer {
+ public:
+  FILE *handle_ = nullptr;
+
+  virtual ~WriterImpl() { close(); }
+
+  bool open(const string &file) {
+    handle_ = fopen(file.c_str(), "wb");
+    if (handle_ == nullptr) {
+      INFO("Failed to open capture file %s", file.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  bool write_section(const void *data, uint64_t bytes) {
+    static const char zeros[CAPTURE_ALIGNMENT] = {0};
+    if (bytes > 0 && fwrite(data, 1, bytes, handle_) != bytes) return false;
+    uint64_t padding = upbound(bytes) - bytes;
+    return padding == 0 || fwrite(zeros, 1, padding, handle_) == padding;
+  }
+
+  virtual bool write(const FrameHeader &header, const float *bbox, const float *segment,
+                     const float *class_thresholds) override {
+    if (handle_ == nullptr) return false;
+
+    FrameHeader h = header;
+    h.magic = CAPTURE_MAGIC;
+    h.version = CAPTURE_VERSION;
+    uint64_t bbox_bytes = (uint64_t)h.bbox_dims[0] * h.bbox_dims[1] * sizeof(float);
+    uint64_t segment_bytes = segment ? segment_numel(h) * sizeof(float) : 0;
+    uint64_t thresholds_bytes = class_thresholds ? h.num_classes * sizeof(float) : 0;
+    if (segment_bytes == 0) memset(h.segment_dims, 0, sizeof(h.segment_dims));
+
+    h.bbox_offset = upbound(sizeof(FrameHeader));
+    h.segment_offset = h.bbox_offset + upbound(bbox_bytes);
+    h.thresholds_offset = h.segment_offset + upbound(segment_bytes);
+    h.frame_bytes = h.thresholds_offset + upbound(thresholds_bytes);
+
+    bool ok = write_section(&h, sizeof(h)) && write_section(bbox, bbox_bytes) &&
+              write_section(segment, segment_bytes) &&
+              write_section(class_thresholds, thresholds_bytes);
+    if (!ok) INFO("Failed to write capture frame");
+    return ok;
+  }
+
+  virtual void close() override {
+    if (handle_) {
+      fclose(handle_);
+      handle_ = nullptr;
+    }
+  }
+};
+
+class ReaderImpl : public Reader {
+ public:
+  const unsigned char *data_ = nullptr;
+  uint64_t bytes_ = 0;
+  vector<uint64_t> offsets_;
+#ifdef _WIN32
+  HANDLE file_ = INVALID_HANDLE_VALUE;
+  HANDLE mapping_ = nullptr;
+#endif
+
+  virtual ~ReaderImpl() {
+#ifdef _WIN32
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_) CloseHandle(mapping_);
+    if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+#else
+    if (data_) munmap((void *)data_, bytes_);
+#endif
+  }
+
+  bool map(const string &file) {
+#ifdef _WIN32
+    file_ = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0) return false;
+    mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_ == nullptr) return false;
+    data_ = (const unsigned char *)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+    bytes_ = size.QuadPart;
+#else
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd == -1) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+      ::close(fd);
+      return false;
+    }
+    void *ptr = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (ptr == MAP_FAILED) return false;
+    data_ = (const unsigned char *)ptr;
+    bytes_ = info.st_size;
+#endif
+    return data_ != nullptr;
+  }
+
+  bool open(const string &file) {
+    if (!map(file)) {
+      INFO("Failed to map capture file %s", file.c_str());
+      return false;
+    }
+
+    uint64_t offset = 0;
+    while (offset + sizeof(FrameHeader) <= bytes_) {
+      const FrameHeader *header = (const FrameHeader *)(data_ + offset);
+      if (header->magic != CAPTURE_MAGIC || header->version != CAPTURE_VERSION ||
+          header->frame_bytes == 0 || offset + header->frame_bytes > bytes_) {
+        INFO("Invalid capture frame at offset %llu of %s", (unsigned long long)offset,
+             file.c_str());
+        break;
+      }
+      offsets_.push_back(offset);
+      offset += header->frame_bytes;
+    }
+    return !offsets_.empty();
+  }
+
+  virtual int size() override { return offsets_.size(); }
+
+  virtual Frame frame(int index) override {
+    Frame output;
+    if (index < 0 || index >= (int)offsets_.size()) return output;
+
+    const unsigned char *base = data_ + offsets_[index];
+    output.header = (const FrameHeader *)base;
+    output.bbox = (const float *)(base + output.header->bbox_offset);
+    if (segment_numel(*output.header) > 0)
+      output.segment = (const float *)(base + output.header->segment_offset);
+    if (output.header->thresholds_offset < output.header->frame_bytes)
+      output.class_thresholds = (const float *)(base + output.header->thresholds_offset);
+    return output;
+  }
+};
+
+std::shared_ptr<Writer> create_writer(const std::string &file) {
+  shared_ptr<WriterImpl> instance(new WriterImpl());
+  if (!instance->open(file)) instance.reset();
+  return instance;
+}
+
+std::shared_ptr<Reader> open_reader(const std::string &file) {
+  shared_ptr<ReaderImpl> instance(new ReaderImpl());
+  if (!instance->open(file)) instance.reset();
+  return instance;
+}
+
+static ReplayOutput replay_host(const Frame &frame) {
+  ReplayOutput output;
+  const FrameHeader &h = *frame.header;
+  yolo::Type type = (yolo::Type)h.type;
+  int cdim = h.bbox_dims[1];
+
+  vector<float> thresholds;
+  const float *class_thresholds = frame.class_thresholds;
+  if (class_thresholds == nullptr) {
+    thresholds.assign(h.num_classes, h.confidence_threshold);
+    class_thresholds = thresholds.data();
+  }
+
+  vector<float> boxarray(1 + yolo::MAX_IMAGE_BOXES * yolo::NUM_BOX_ELEMENT, 0.0f);
+  yolo::host::decode(frame.bbox, h.bbox_dims[0], h.num_classes, cdim, h.confidence_threshold,
+                     class_thresholds, h.d2i, boxarray.data(), yolo::MAX_IMAGE_BOXES, type);
+  yolo::host::fast_nms(boxarray.data(), yolo::MAX_IMAGE_BOXES, h.nms_threshold);
+
+  int count = min(yolo::MAX_IMAGE_BOXES, (int)boxarray[0]);
+  for (int i = 0; i < count; ++i) {
+    const float *pbox = &boxarray[1 + i * yolo::NUM_BOX_ELEMENT];
+    if ((int)pbox[6] != 1) continue;
+    output.boxes.emplace_back(pbox[0], pbox[1], pbox[2], pbox[3], pbox[4], (int)pbox[5]);
+    if (frame.segment == nullptr) continue;
+
+    Mask mask;
+    yolo::MaskRegion region = yolo::mask_region(h.i2d, pbox, h.network_width, h.network_height,
+                                                h.segment_dims[2], h.segment_dims[1]);
+    if (region.width > 0 && region.height > 0) {
+      int row_index = pbox[7];
+      mask.width = region.width;
+      mask.height = region.height;
+      mask.data.resize(mask.width * mask.height);
+      yolo::host::decode_single_mask(region.left, region.top,
+                                     frame.bbox + row_index * cdim + h.num_classes + 4,
+                                     frame.segment, h.segment_dims[2], h.segment_dims[1],
+                                     mask.data.data(), h.segment_dims[0], mask.width,
+                                     mask.height);
+    }
+    output.masks.push_back(mask);
+  }
+  return output;
+}
+
+ReplayOutput replay(const Frame &frame, Backend backend) {
+  if (frame.header == nullptr || frame.bbox == nullptr) return ReplayOutput();
+  if (backend == Backend::Device) return replay_device(frame);
+  return replay_host(frame);
+}
+
+};  // namespace capture
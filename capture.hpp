@@ -0,0 +1,88 @@
+#ifndef __CAPTURE_HPP__
+#define __CAPTURE_HPP__
+
+// Capture format of network head tensors, to replay post-processing (decode, NMS, masks)
+// without an engine. A file is a sequence of frames, each one a FrameHeader followed by its
+// payload; every section starts on a CAPTURE_ALIGNMENT boundary so a mapped file is used
+// in place.
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "yolo.hpp"
+
+namespace capture {
+
+const uint32_t CAPTURE_MAGIC = 0x31484359;  // "YCH1"
+const uint32_t CAPTURE_VERSION = 1;
+const int CAPTURE_ALIGNMENT = 64;
+
+struct FrameHeader {
+  uint32_t magic = CAPTURE_MAGIC;
+  uint32_t version = CAPTURE_VERSION;
+  uint64_t frame_bytes = 0;  // header and payload, offset of the next frame
+  int32_t type = 0;          // yolo::Type
+  int32_t num_classes = 0;
+  int32_t image_width = 0, image_height = 0;
+  int32_t network_width = 0, network_height = 0;
+  int32_t bbox_dims[2] = {0, 0};        // anchors, output_cdim
+  int32_t segment_dims[3] = {0, 0, 0};  // mask_dim, height, width, zero without segment
+  float i2d[6] = {0}, d2i[6] = {0};
+  float confidence_threshold = 0, nms_threshold = 0;
+  uint64_t bbox_offset = 0;  // from the start of the frame
+  uint64_t segment_offset = 0;
+  uint64_t thresholds_offset = 0;  // num_classes per class thresholds
+};
+
+// one frame, pointers into the mapped file or the caller's memory
+struct Frame {
+  const FrameHeader *header = nullptr;
+  const float *bbox = nullptr;
+  const float *segment = nullptr;
+  const float *class_thresholds = nullptr;
+};
+
+class Writer {
+ public:
+  virtual ~Writer() = default;
+
+  // header offsets and frame_bytes are filled by write
+  virtual bool write(const FrameHeader &header, const float *bbox, const float *segment,
+                     const float *class_thresholds) = 0;
+  virtual void close() = 0;
+};
+
+class Reader {
+ public:
+  virtual ~Reader() = default;
+  virtual int size() = 0;
+  virtual Frame frame(int index) = 0;
+};
+
+std::shared_ptr<Writer> create_writer(const std::string &file);
+std::shared_ptr<Reader> open_reader(const std::string &file);
+
+enum class Backend : int { Host = 0, Device = 1 };
+
+struct Mask {
+  int width = 0, height = 0;
+  std::vector<unsigned char> data;
+};
+
+struct ReplayOutput {
+  yolo::BoxArray boxes;
+  std::vector<Mask> masks;  // index aligned with boxes for segment frames, empty otherwise
+};
+
+// decode, NMS and mask decoding of one captured frame
+ReplayOutput replay(const Frame &frame, Backend backend);
+
+// Device backend, implemented next to the kernels in yolo.cu
+ReplayOutput replay_device(const Frame &frame);
+
+};  // namespace capture
+
+#endif  // __CAPTURE_HPP__
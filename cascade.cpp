@@ -0,0 +1,91 @@
+#include "cascade.hpp"
+
+#include <math.h>
+
+#include <algorithm>
+
+namespace yolo {
+
+using namespace std;
+
+void crop_affine(float left, float top, float right, float bottom, int dst_width,
+                 int dst_height, float padding, bool letterbox, float d2i[6], int image_width,
+                 int image_height) {
+  float pad_x = (right - left) * padding;
+  float pad_y = (bottom - top) * padding;
+  left -= pad_x;
+  top -= pad_y;
+  right += pad_x;
+  bottom += pad_y;
+  if (image_width > 0 && image_height > 0) {
+    left = max(left, 0.0f);
+    top = max(top, 0.0f);
+    right = min(right, (float)image_width);
+    bottom = min(bottom, (float)image_height);
+  }
+
+  float crop_width = max(right - left, 1.0f);
+  float crop_height = max(bottom - top, 1.0f);
+  float scale_x = dst_width / crop_width;
+  float scale_y = dst_height / crop_height;
+  if (letterbox) scale_x = scale_y = min(scale_x, scale_y);
+
+  // same pixel center convention as AffineMatrix::compute, the crop origin moved to left/top
+  float offset_x = -scale_x * (left + crop_width * 0.5f) + dst_width * 0.5f + scale_x * 0.5f - 0.5f;
+  float offset_y =
+      -scale_y * (top + crop_height * 0.5f) + dst_height * 0.5f + scale_y * 0.5f - 0.5f;
+
+  d2i[0] = 1.0f / scale_x;
+  d2i[1] = 0;
+  d2i[2] = -offset_x / scale_x;
+  d2i[3] = 0;
+  d2i[4] = 1.0f / scale_y;
+  d2i[5] = -offset_y / scale_y;
+}
+
+vector<CropJob> crop_jobs(const vector<Image> &images, const vector<BoxArray> &boxes,
+                          int dst_width, int dst_height, float padding, bool letterbox) {
+  vector<CropJob> jobs;
+  for (int ib = 0; ib < (int)boxes.size(); ++ib) {
+    int image_width = ib < (int)images.size() ? images[ib].width : 0;
+    int image_height = ib < (int)images.size() ? images[ib].height : 0;
+    for (int i = 0; i < (int)boxes[ib].size(); ++i) {
+      const Box &box = boxes[ib][i];
+      CropJob job;
+      job.image = ib;
+      job.box = i;
+      crop_affine(box.left, box.top, box.right, box.bottom, dst_width, dst_height, padding,
+                  letterbox, job.d2i, image_width, image_height);
+      jobs.push_back(job);
+    }
+  }
+  return jobs;
+}
+
+vector<pair<int, int>> crop_batches(int num_crops, int max_batch) {
+  vector<pair<int, int>> batches;
+  max_batch = max(max_batch, 1);
+  for (int first = 0; first < num_crops; first += max_batch)
+    batches.emplace_back(first, min(first + max_batch, num_crops));
+  return batches;
+}
+
+int classify_scores(const float *output, int num_classes, bool softmax, float *scores) {
+  if (num_classes <= 0) return -1;
+
+  int label = max_element(output, output + num_classes) - output;
+  if (!softmax) {
+    copy(output, output + num_classes, scores);
+    return label;
+  }
+
+  float highest = output[label], sum = 0;
+  for (int i = 0; i < num_classes; ++i) {
+    scores[i] = exp(output[i] - highest);
+    sum += scores[i];
+  }
+  for (int i = 0; i < num_classes; ++i) scores[i] /= sum;
+  return label;
+}
+
+};  // namespace yolo
@@ -0,0 +1,41 @@
+#ifndef __CASCADE_HPP__
+#define __CASCADE_HPP__
+
+// Host side of the detect -> classify cascade: one crop job per kept box with the affine that
+// maps the classifier input to the image, and the split of the jobs into classifier forwards.
+// The crops themselves are warped on the device from the staged detector input (yolo.cu).
+
+#include <utility>
+#include <vector>
+
+#include "yolo.hpp"
+
+namespace yolo {
+
+struct CropJob {
+  int image = 0, box = 0;  // boxes[image][box]
+  float d2i[6];            // classifier input to image, 2x3 matrix
+};
+
+// Crop of the box grown by padding * size on every side, scaled to dst_width x dst_height.
+// Letterbox keeps the aspect ratio and centers the crop, otherwise the crop is stretched. With
+// an image size the padded crop is clamped to the image, 0 leaves it as it is.
+void crop_affine(float left, float top, float right, float bottom, int dst_width,
+                 int dst_height, float padding, bool letterbox, float d2i[6],
+                 int image_width = 0, int image_height = 0);
+
+// jobs of every box of every image, in order, clamped to the size of images[image]
+std::vector<CropJob> crop_jobs(const std::vector<Image> &images,
+                               const std::vector<BoxArray> &boxes, int dst_width, int dst_height,
+                               float padding, bool letterbox);
+
+// [first, last) crops of every classifier forward, max_batch crops at most
+std::vector<std::pair<int, int>> crop_batches(int num_crops, int max_batch);
+
+// Scores of one crop from the classifier output, softmax of the logits when asked. Returns the
+// best class.
+int classify_scores(const float *output, int num_classes, bool softmax, float *scores);
+
+};  // namespace yolo
+
+#endif  // __CASCADE_HPP__
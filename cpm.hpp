@@ -3,29 +3,210 @@
 
 // Comsumer Producer Model
 
+#include <stdint.h>
+
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
+#include <functional>
 #include <future>
 #include <memory>
-#include <queue>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 namespace cpm {
 
+// Runs continuations on its own thread once their completion source reports the work done, in
+// push order, so that the submitting thread never blocks on the device. The source is any
+// blocking call: cudaEventSynchronize for a stream, a latch for a simulated device.
+class CompletionQueue {
+ public:
+  typedef std::function<void()> Task;
+
+  CompletionQueue() = default;
+  CompletionQueue(const CompletionQueue &other) = delete;
+  CompletionQueue &operator=(const CompletionQueue &other) = delete;
+  virtual ~CompletionQueue() { stop(); }
+
+  // returns the ticket of this entry, see wait
+  uint64_t push(const Task &wait, const Task &continuation) {
+    uint64_t ticket = 0;
+    {
+      std::unique_lock<std::mutex> l(lock_);
+      if (worker_ == nullptr) {
+        run_ = true;
+        worker_ = std::make_shared<std::thread>(&CompletionQueue::worker, this);
+      }
+      queue_.push_back(Entry{wait, continuation});
+      ticket = ++submitted_;
+    }
+    cond_.notify_one();
+    return ticket;
+  }
+
+  // blocks until the continuation of ticket has run, never call it from a continuation
+  void wait(uint64_t ticket) {
+    std::unique_lock<std::mutex> l(lock_);
+    done_.wait(l, [&]() { return completed_ >= ticket; });
+  }
+
+  void drain() {
+    uint64_t ticket = 0;
+    {
+      std::unique_lock<std::mutex> l(lock_);
+      ticket = submitted_;
+    }
+    wait(ticket);
+  }
+
+  uint64_t submitted() {
+    std::unique_lock<std::mutex> l(lock_);
+    return submitted_;
+  }
+
+  uint64_t completed() {
+    std::unique_lock<std::mutex> l(lock_);
+    return completed_;
+  }
+
+  // runs everything pushed so far, then joins the thread
+  void stop() {
+    std::shared_ptr<std::thread> worker;
+    {
+      std::unique_lock<std::mutex> l(lock_);
+      run_ = false;
+      worker = worker_;
+      worker_.reset();
+    }
+    cond_.notify_one();
+    if (worker) worker->join();
+  }
+
+ private:
+  struct Entry {
+    Task wait, continuation;
+  };
+
+  void worker() {
+    for (;;) {
+      Entry entry;
+      {
+        std::unique_lock<std::mutex> l(lock_);
+        cond_.wait(l, [&]() { return !run_ || !queue_.empty(); });
+        if (queue_.empty()) return;
+        entry = std::move(queue_.front());
+        queue_.pop_front();
+      }
+
+      if (entry.wait) entry.wait();
+      if (entry.continuation) entry.continuation();
+      {
+        std::unique_lock<std::mutex> l(lock_);
+        completed_++;
+      }
+      done_.notify_all();
+    }
+  }
+
+  std::mutex lock_;
+  std::condition_variable cond_, done_;
+  std::deque<Entry> queue_;
+  std::shared_ptr<std::thread> worker_;
+  bool run_ = false;
+  uint64_t submitted_ = 0, completed_ = 0;
+};
+
+enum class Status : int {
+  Queued = 0,
+  Running = 1,
+  Done = 2,
+  DeadlineExceeded = 3,  // expired in the queue, never reached the model
+  Cancelled = 4,
+  Stopped = 5  // still queued when the instance stopped
+};
+
+typedef std::chrono::steady_clock::time_point Deadline;
+
+struct CommitOptions {
+  int priority = 0;  // higher first, in commit order within a priority
+  Deadline deadline = Deadline::max();  // absolute, the item is dropped once it has passed
+};
+
+// Shared by a queued item and its Handle. Whoever moves the status out of Queued fulfils the
+// promise, so a cancel racing with the worker completes the item exactly once.
+template <typename Result>
+struct ItemState {
+  std::promise<Result> pro;
+  std::atomic<int> status{(int)Status::Queued};
+
+  bool transition(Status from, Status to) {
+    int expected = (int)from;
+    return status.compare_exchange_strong(expected, (int)to);
+  }
+
+  bool finish(Status from, Status to, const Result &result) {
+    if (!transition(from, to)) return false;
+    pro.set_value(result);
+    return true;
+  }
+};
+
+template <typename Result>
+class Handle {
+ public:
+  Handle() = default;
+  Handle(const std::shared_ptr<ItemState<Result>> &state)
+      : future(state->pro.get_future()), state_(state) {}
+
+  // holds Result() unless the status ends as Done
+  std::shared_future<Result> future;
+
+  inline bool valid() const { return state_ != nullptr; }
+  inline Status status() const {
+    return state_ ? (Status)state_->status.load() : Status::Cancelled;
+  }
+
+  // withdraws the item while it is queued, false once the worker has taken it
+  bool cancel() { return state_ && state_->finish(Status::Queued, Status::Cancelled, Result()); }
+
+ private:
+  std::shared_ptr<ItemState<Result>> state_;
+};
+
+// Batches committed inputs into Model::forwards on a worker thread. Items are taken by priority,
+// then in commit order; an item whose deadline passed while it was queued completes with
+// Result() and Status::DeadlineExceeded instead of taking device time.
 template <typename Result, typename Input, typename Model>
 class Instance {
  protected:
   struct Item {
     Input input;
-    std::shared_ptr<std::promise<Result>> pro;
+    std::shared_ptr<ItemState<Result>> state;
+    int priority = 0;
+    uint64_t sequence = 0;
+    Deadline deadline = Deadline::max();
+  };
+
+  // heap order of input_queue_, the top is the highest priority committed first
+  struct ItemOrder {
+    bool operator()(const Item &a, const Item &b) const {
+      if (a.priority != b.priority) return a.priority < b.priority;
+      return a.sequence > b.sequence;
+    }
   };
 
   std::condition_variable cond_;
-  std::queue<Item> input_queue_;
+  std::vector<Item> input_queue_;
+  uint64_t sequence_ = 0;
   std::mutex queue_lock_;
   std::shared_ptr<std::thread> worker_;
   volatile bool run_ = false;
   volatile int max_items_processed_ = 0;
+  int max_pending_ = 1;
+  int in_flight_ = 0;  // batches of async_worker still running, guarded by queue_lock_
   void *stream_ = nullptr;
 
  public:
@@ -36,11 +217,8 @@ class Instance {
     cond_.notify_one();
     {
       std::unique_lock<std::mutex> l(queue_lock_);
-      while (!input_queue_.empty()) {
-        auto &item = input_queue_.front();
-        if (item.pro) item.pro->set_value(Result());
-        input_queue_.pop();
-      }
+      for (auto &item : input_queue_) item.state->finish(Status::Queued, Status::Stopped, Result());
+      input_queue_.clear();
     };
 
     if (worker_) {
@@ -50,33 +228,42 @@ class Instance {
   }
 
   virtual std::shared_future<Result> commit(const Input &input) {
-    Item item;
-    item.input = input;
-    item.pro.reset(new std::promise<Result>());
+    return commit(input, CommitOptions()).future;
+  }
+
+  virtual Handle<Result> commit(const Input &input, const CommitOptions &options) {
+    Handle<Result> handle;
     {
       std::unique_lock<std::mutex> __lock_(queue_lock_);
-      input_queue_.push(item);
+      handle = push(input, options);
     }
     cond_.notify_one();
-    return item.pro->get_future();
+    return handle;
   }
 
   virtual std::vector<std::shared_future<Result>> commits(const std::vector<Input> &inputs) {
     std::vector<std::shared_future<Result>> output;
+    for (auto &handle : commits(inputs, CommitOptions())) output.emplace_back(handle.future);
+    return output;
+  }
+
+  virtual std::vector<Handle<Result>> commits(const std::vector<Input> &inputs,
+                                              const CommitOptions &options) {
+    std::vector<Handle<Result>> output;
     {
       std::unique_lock<std::mutex> __lock_(queue_lock_);
-      for (int i = 0; i < (int)inputs.size(); ++i) {
-        Item item;
-        item.input = inputs[i];
-        item.pro.reset(new std::promise<Result>());
-        output.emplace_back(item.pro->get_future());
-        input_queue_.push(item);
-      }
+      for (int i = 0; i < (int)inputs.size(); ++i) output.emplace_back(push(inputs[i], options));
     }
     cond_.notify_one();
     return output;
   }
 
+  // items waiting for the worker, cancelled ones included until the worker skips them
+  int queued() {
+    std::unique_lock<std::mutex> l(queue_lock_);
+    return (int)input_queue_.size();
+  }
+
   template <typename LoadMethod>
   bool start(const LoadMethod &loadmethod, int max_items_processed = 1, void *stream = nullptr) {
     stop();
@@ -89,7 +276,62 @@ class Instance {
     return status.get_future().get();
   }
 
+  // Same as start, but the worker submits through Model::forwards_async and goes on with the
+  // next batch while up to max_pending batches are still running on the device. The batches
+  // complete on a CompletionQueue, in submit order.
+  template <typename LoadMethod>
+  bool start_async(const LoadMethod &loadmethod, int max_items_processed = 1,
+                   void *stream = nullptr, int max_pending = 2) {
+    stop();
+
+    this->stream_ = stream;
+    this->max_items_processed_ = max_items_processed;
+    this->max_pending_ = std::max(1, max_pending);
+    std::promise<bool> status;
+    worker_ = std::make_shared<std::thread>(&Instance::async_worker<LoadMethod>, this,
+                                            std::ref(loadmethod), std::ref(status));
+    return status.get_future().get();
+  }
+
  private:
+  // with queue_lock_ held
+  Handle<Result> push(const Input &input, const CommitOptions &options) {
+    Item item;
+    item.input = input;
+    item.state = std::make_shared<ItemState<Result>>();
+    item.priority = options.priority;
+    item.sequence = sequence_++;
+    item.deadline = options.deadline;
+
+    Handle<Result> handle(item.state);
+    input_queue_.emplace_back(std::move(item));
+    std::push_heap(input_queue_.begin(), input_queue_.end(), ItemOrder());
+    return handle;
+  }
+
+  // with queue_lock_ held, moves up to max_size items to the worker in priority order. Expired
+  // items complete as DeadlineExceeded here, cancelled ones are dropped, neither costs a forward.
+  void take_items(std::vector<Item> &fetch_items, int max_size) {
+    fetch_items.clear();
+    auto now = std::chrono::steady_clock::now();
+    while ((int)fetch_items.size() < max_size && !input_queue_.empty()) {
+      std::pop_heap(input_queue_.begin(), input_queue_.end(), ItemOrder());
+      Item item = std::move(input_queue_.back());
+      input_queue_.pop_back();
+
+      if (item.deadline < now) {
+        item.state->finish(Status::Queued, Status::DeadlineExceeded, Result());
+        continue;
+      }
+      if (item.state->transition(Status::Queued, Status::Running))
+        fetch_items.emplace_back(std::move(item));
+    }
+  }
+
+  static void complete(Item &item, const Result &result) {
+    item.state->finish(Status::Running, Status::Done, result);
+  }
+
   template <typename LoadMethod>
   void worker(const LoadMethod &loadmethod, std::promise<bool> &status) {
     std::shared_ptr<Model> model = loadmethod();
@@ -109,13 +351,8 @@ class Instance {
                      [](Item &item) { return item.input; });
 
       auto ret = model->forwards(inputs, stream_);
-      for (int i = 0; i < (int)fetch_items.size(); ++i) {
-        if (i < (int)ret.size()) {
-          fetch_items[i].pro->set_value(ret[i]);
-        } else {
-          fetch_items[i].pro->set_value(Result());
-        }
-      }
+      for (int i = 0; i < (int)fetch_items.size(); ++i)
+        complete(fetch_items[i], i < (int)ret.size() ? ret[i] : Result());
       inputs.clear();
       fetch_items.clear();
     }
@@ -123,28 +360,93 @@ class Instance {
     run_ = false;
   }
 
-  virtual bool get_items_and_wait(std::vector<Item> &fetch_items, int max_size) {
-    std::unique_lock<std::mutex> l(queue_lock_);
-    cond_.wait(l, [&]() { return !run_ || !input_queue_.empty(); });
+  struct Pending {
+    std::shared_future<std::vector<Result>> future;
+    std::vector<Item> items;
+  };
 
-    if (!run_) return false;
+  static void fulfil(Pending &pending) {
+    auto ret = pending.future.get();
+    for (int i = 0; i < (int)pending.items.size(); ++i)
+      complete(pending.items[i], i < (int)ret.size() ? ret[i] : Result());
+  }
 
-    fetch_items.clear();
-    for (int i = 0; i < max_size && !input_queue_.empty(); ++i) {
-      fetch_items.emplace_back(std::move(input_queue_.front()));
-      input_queue_.pop();
+  template <typename LoadMethod>
+  void async_worker(const LoadMethod &loadmethod, std::promise<bool> &status) {
+    std::shared_ptr<Model> model = loadmethod();
+    if (model == nullptr) {
+      status.set_value(false);
+      return;
     }
-    return true;
+
+    in_flight_ = 0;
+    run_ = true;
+    status.set_value(true);
+
+    // the worker never waits for the device, only for room below max_pending
+    CompletionQueue completions;
+    std::vector<Item> fetch_items;
+    std::vector<Input> inputs;
+    while (get_items_below_pending(fetch_items, max_items_processed_)) {
+      inputs.resize(fetch_items.size());
+      std::transform(fetch_items.begin(), fetch_items.end(), inputs.begin(),
+                     [](Item &item) { return item.input; });
+
+      auto batch = std::make_shared<Pending>();
+      batch->future = model->forwards_async(inputs, stream_);
+      batch->items = std::move(fetch_items);
+      completions.push([batch]() { batch->future.wait(); },
+                       [this, batch]() {
+                         fulfil(*batch);
+                         {
+                           std::unique_lock<std::mutex> l(queue_lock_);
+                           in_flight_--;
+                         }
+                         cond_.notify_one();
+                       });
+      inputs.clear();
+      fetch_items.clear();
+    }
+
+    completions.stop();
+    model.reset();
+    run_ = false;
   }
 
-  virtual bool get_item_and_wait(Item &fetch_item) {
+  // get_items_and_wait once fewer than max_pending_ batches are in flight, counts the batch
+  bool get_items_below_pending(std::vector<Item> &fetch_items, int max_size) {
     std::unique_lock<std::mutex> l(queue_lock_);
-    cond_.wait(l, [&]() { return !run_ || !input_queue_.empty(); });
+    for (;;) {
+      cond_.wait(l, [&]() {
+        return !run_ || (!input_queue_.empty() && in_flight_ < max_pending_);
+      });
+      if (!run_) return false;
+
+      take_items(fetch_items, max_size);
+      if (!fetch_items.empty()) {
+        in_flight_++;
+        return true;
+      }
+    }
+  }
 
-    if (!run_) return false;
+  virtual bool get_items_and_wait(std::vector<Item> &fetch_items, int max_size) {
+    std::unique_lock<std::mutex> l(queue_lock_);
+    for (;;) {
+      cond_.wait(l, [&]() { return !run_ || !input_queue_.empty(); });
+      if (!run_) return false;
+
+      // the queue may hold nothing but expired or cancelled items
+      take_items(fetch_items, max_size);
+      if (!fetch_items.empty()) return true;
+    }
+  }
+
+  virtual bool get_item_and_wait(Item &fetch_item) {
+    std::vector<Item> fetch_items;
+    if (!get_items_and_wait(fetch_items, 1)) return false;
 
-    fetch_item = std::move(input_queue_.front());
-    input_queue_.pop();
+    fetch_item = std::move(fetch_items[0]);
     return true;
   }
 };
@@ -0,0 +1,135 @@
+#ifndef __DEVICE_POOL_HPP__
+#define __DEVICE_POOL_HPP__
+
+// One model instance per device, every request is dispatched to the device with the least
+// work in flight. Switching device is injected so the policy runs without a GPU.
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace pool {
+
+template <typename Model>
+class DevicePool {
+ public:
+  typedef std::function<void(int device_id)> DeviceSelector;
+
+  struct Slot {
+    int index = 0;
+    int device_id = 0;
+    std::shared_ptr<Model> model;
+    std::mutex lock;  // a model instance runs one request at a time
+    std::atomic<int> in_flight{0};
+    std::atomic<unsigned long long> dispatched{0};
+  };
+
+  // Exclusive use of one slot, released on destruction.
+  class Lease {
+   public:
+    Lease() = default;
+    Lease(const std::shared_ptr<Slot> &slot, const DeviceSelector &selector) : slot_(slot) {
+      lock_ = std::unique_lock<std::mutex>(slot_->lock);
+      if (selector) selector(slot_->device_id);
+    }
+    Lease(Lease &&other) : slot_(std::move(other.slot_)), lock_(std::move(other.lock_)) {
+      other.slot_.reset();
+    }
+    Lease(const Lease &other) = delete;
+    Lease &operator=(const Lease &other) = delete;
+    virtual ~Lease() {
+      if (lock_.owns_lock()) lock_.unlock();
+      if (slot_) slot_->in_flight--;
+    }
+
+    inline bool valid() const { return slot_ != nullptr; }
+    inline int index() const { return slot_->index; }
+    inline int device_id() const { return slot_->device_id; }
+    inline Model *operator->() const { return slot_->model.get(); }
+    inline Model &operator*() const { return *slot_->model; }
+
+    // Keeps the slot counted in flight until the returned handle and its copies are gone, for
+    // work enqueued under the lease that completes after the lease is released.
+    std::shared_ptr<void> hold() const {
+      std::shared_ptr<Slot> slot = slot_;
+      slot->in_flight++;
+      return std::shared_ptr<void>(slot.get(), [slot](void *) { slot->in_flight--; });
+    }
+
+   private:
+    std::shared_ptr<Slot> slot_;
+    std::unique_lock<std::mutex> lock_;
+  };
+
+  explicit DevicePool(DeviceSelector selector = nullptr) : selector_(selector) {}
+  DevicePool(const DevicePool &other) = delete;
+  DevicePool &operator=(const DevicePool &other) = delete;
+
+  void add(int device_id, const std::shared_ptr<Model> &model) {
+    std::shared_ptr<Slot> slot(new Slot());
+    slot->device_id = device_id;
+    slot->model = model;
+    std::unique_lock<std::mutex> l(dispatch_lock_);
+    slot->index = slots_.size();
+    slots_.push_back(slot);
+  }
+
+  inline int size() const { return slots_.size(); }
+  inline int device_id(int index) const { return slots_[index]->device_id; }
+  inline int in_flight(int index) const { return slots_[index]->in_flight; }
+  inline unsigned long long dispatched(int index) const { return slots_[index]->dispatched; }
+
+  // least in flight first, then least dispatched so idle devices take turns
+  int pick() const {
+    int best = -1;
+    for (int i = 0; i < (int)slots_.size(); ++i) {
+      if (best == -1) {
+        best = i;
+        continue;
+      }
+      int a = slots_[i]->in_flight, b = slots_[best]->in_flight;
+      if (a < b || (a == b && slots_[i]->dispatched < slots_[best]->dispatched)) best = i;
+    }
+    return best;
+  }
+
+  // blocks while the chosen device is busy, invalid lease when the pool is empty
+  Lease acquire() {
+    std::shared_ptr<Slot> slot;
+    {
+      std::unique_lock<std::mutex> l(dispatch_lock_);
+      int index = pick();
+      if (index == -1) return Lease();
+      slot = reserve(index);
+    }
+    return Lease(slot, selector_);
+  }
+
+  Lease acquire(int index) {
+    std::shared_ptr<Slot> slot;
+    {
+      std::unique_lock<std::mutex> l(dispatch_lock_);
+      if (index < 0 || index >= (int)slots_.size()) return Lease();
+      slot = reserve(index);
+    }
+    return Lease(slot, selector_);
+  }
+
+ private:
+  std::shared_ptr<Slot> reserve(int index) {
+    auto &slot = slots_[index];
+    slot->in_flight++;
+    slot->dispatched++;
+    return slot;
+  }
+
+  DeviceSelector selector_;
+  std::mutex dispatch_lock_;
+  std::vector<std::shared_ptr<Slot>> slots_;
+};
+
+};  // namespace pool
+
+#endif  // __DEVICE_POOL_HPP__
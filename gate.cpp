@@ -0,0 +1,114 @@
+#include "gate.hpp"
+
+#include <math.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GATE_USE_SSE2
+#endif
+
+namespace gate {
+
+using namespace std;
+
+static uint64_t sum_bytes(const unsigned char *p, int count) {
+  uint64_t sum = 0;
+  int i = 0;
+#ifdef GATE_USE_SSE2
+  __m128i zero = _mm_setzero_si128();
+  __m128i acc = _mm_setzero_si128();
+  for (; i + 16 <= count; i += 16)
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(p + i)), zero));
+  sum = (uint32_t)_mm_cvtsi128_si32(acc) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#endif
+  for (; i < count; ++i) sum += p[i];
+  return sum;
+}
+
+// sum of 16 bit values mapped to 8 bit levels through the window
+static double sum_window(const uint16_t *p, int count, float low, float scale) {
+  double sum = 0;
+  for (int i = 0; i < count; ++i) sum += min(max((p[i] - low) * scale, 0.0f), 255.0f);
+  return sum;
+}
+
+Signature compute_signature(const void *data, int width, int height, size_t stride,
+                            int bytes_per_pixel, int grid, float window_low, float window_high) {
+  Signature signature;
+  if (data == nullptr || width <= 0 || height <= 0 || grid <= 0) return signature;
+
+  signature.grid_width = min(grid, width);
+  signature.grid_height = min(grid, height);
+  signature.blocks.assign(signature.grid_width * signature.grid_height, 0.0f);
+
+  // the mean of the two bytes of a 16 bit value is not monotonic in the value
+  bool mono16 = bytes_per_pixel == 2;
+  float scale = 255.0f / max(window_high - window_low, 1.0f);
+  const unsigned char *pdata = (const unsigned char *)data;
+  vector<double> sums(signature.grid_width);
+  for (int by = 0; by < signature.grid_height; ++by) {
+    int y0 = by * height / signature.grid_height;
+    int y1 = (by + 1) * height / signature.grid_height;
+    fill(sums.begin(), sums.end(), 0);
+    for (int y = y0; y < y1; ++y) {
+      const unsigned char *line = pdata + y * stride;
+      for (int bx = 0; bx < signature.grid_width; ++bx) {
+        int x0 = bx * width / signature.grid_width;
+        int x1 = (bx + 1) * width / signature.grid_width;
+        if (mono16)
+          sums[bx] += sum_window((const uint16_t *)line + x0, x1 - x0, window_low, scale);
+        else
+          sums[bx] += sum_bytes(line + x0 * bytes_per_pixel, (x1 - x0) * bytes_per_pixel);
+      }
+    }
+
+    for (int bx = 0; bx < signature.grid_width; ++bx) {
+      int x0 = bx * width / signature.grid_width;
+      int x1 = (bx + 1) * width / signature.grid_width;
+      double count = (double)(y1 - y0) * (x1 - x0) * (mono16 ? 1 : bytes_per_pixel);
+      signature.blocks[by * signature.grid_width + bx] = (float)(sums[bx] / count);
+    }
+  }
+  return signature;
+}
+
+float signature_distance(const Signature &a, const Signature &b) {
+  if (a.empty() || a.grid_width != b.grid_width || a.grid_height != b.grid_height) return -1;
+
+  float distance = 0;
+  for (size_t i = 0; i < a.blocks.size(); ++i)
+    distance = max(distance, fabsf(a.blocks[i] - b.blocks[i]));
+  return distance;
+}
+
+bool ChangeGate::lookup(const Signature &signature, yolo::BoxArray &output) {
+  if (skipped_ < config_.max_skips) {
+    float distance = signature_distance(reference_, signature);
+    if (distance >= 0 && distance <= config_.tolerance) {
+      skipped_++;
+      hits_++;
+      output = result_;
+      return true;
+    }
+  }
+  misses_++;
+  return false;
+}
+
+void ChangeGate::store(const Signature &signature, const yolo::BoxArray &result) {
+  reference_ = signature;
+  result_ = result;
+  skipped_ = 0;
+}
+
+void ChangeGate::reset() {
+  reference_ = Signature();
+  result_.clear();
+  skipped_ = 0;
+  hits_ = 0;
+  misses_ = 0;
+}
+
+};  // namespace gate
@@ -0,0 +1,63 @@
+#ifndef __GATE_HPP__
+#define __GATE_HPP__
+
+// Change detection gate: a block mean signature of the raw frame is compared against the
+// last frame that went through inference, unchanged frames reuse its result.
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "yolo.hpp"
+
+namespace gate {
+
+struct Signature {
+  int grid_width = 0, grid_height = 0;
+  std::vector<float> blocks;  // mean 8 bit level of every block, row major
+
+  bool empty() const { return blocks.empty(); }
+};
+
+// grid x grid block means over a packed image, bytes_per_pixel is 4 for NI RGB32 (mean of the
+// bytes) or 2 for NI U16, whose values are mapped from [window_low, window_high] to 0..255
+// and clamped first, like the warp kernels do (yolo::Image::window_low)
+Signature compute_signature(const void *data, int width, int height, size_t stride,
+                            int bytes_per_pixel, int grid = 16, float window_low = 0,
+                            float window_high = 65535);
+
+// largest block mean difference, negative when the signatures are not comparable
+float signature_distance(const Signature &a, const Signature &b);
+
+struct Config {
+  float tolerance = 2.0f;  // max block mean difference, in 8 bit levels
+  int max_skips = 100;     // force an inference after this many consecutive hits
+  int grid = 16;
+};
+
+class ChangeGate {
+ public:
+  explicit ChangeGate(const Config &config = Config()) : config_(config) {}
+
+  // true and output filled with the cached result when the frame is unchanged
+  bool lookup(const Signature &signature, yolo::BoxArray &output);
+
+  // record the signature and result of a frame that went through inference
+  void store(const Signature &signature, const yolo::BoxArray &result);
+
+  void reset();
+  inline const Config &config() const { return config_; }
+  inline uint64_t hits() const { return hits_; }
+  inline uint64_t misses() const { return misses_; }
+
+ private:
+  Config config_;
+  Signature reference_;
+  yolo::BoxArray result_;
+  int skipped_ = 0;
+  uint64_t hits_ = 0, misses_ = 0;
+};
+
+};  // namespace gate
+
+#endif  // __GATE_HPP__
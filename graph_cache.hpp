@@ -0,0 +1,102 @@
+#ifndef __GRAPH_CACHE_HPP__
+#define __GRAPH_CACHE_HPP__
+
+// Bookkeeping for captured CUDA graphs. Executable graphs are kept as opaque handles so
+// this file has no CUDA dependency.
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <vector>
+
+namespace yolo {
+
+// Everything a captured launch sequence depends on: the batch, the input shapes and every
+// device / pinned host address baked into the kernel arguments.
+struct GraphKey {
+  int batch = 0;
+  std::vector<int> shapes;
+  std::vector<const void *> addresses;
+
+  bool operator==(const GraphKey &other) const {
+    return batch == other.batch && shapes == other.shapes && addresses == other.addresses;
+  }
+  bool operator!=(const GraphKey &other) const { return !(*this == other); }
+};
+
+enum class GraphLookup : int {
+  Hit = 0,     // replay the cached exec as is
+  Update = 1,  // same batch, different shapes/addresses: recapture and try exec update
+  Miss = 2     // nothing cached for this batch
+};
+
+// One executable graph per batch size.
+class GraphCache {
+ public:
+  typedef std::function<void(void *exec)> Destroyer;
+
+  explicit GraphCache(Destroyer destroyer = nullptr) : destroyer_(destroyer) {}
+  GraphCache(const GraphCache &other) = delete;
+  GraphCache &operator=(const GraphCache &other) = delete;
+  virtual ~GraphCache() { clear(); }
+
+  GraphLookup lookup(const GraphKey &key, void **exec) {
+    auto iter = entries_.find(key.batch);
+    if (iter == entries_.end()) {
+      misses_++;
+      if (exec) *exec = nullptr;
+      return GraphLookup::Miss;
+    }
+
+    if (exec) *exec = iter->second.exec;
+    if (iter->second.key != key) {
+      updates_++;
+      return GraphLookup::Update;
+    }
+    hits_++;
+    return GraphLookup::Hit;
+  }
+
+  // Takes ownership of exec. A different exec previously stored for the batch is destroyed.
+  void store(const GraphKey &key, void *exec) {
+    Entry &entry = entries_[key.batch];
+    if (entry.exec && entry.exec != exec) destroy(entry.exec);
+    entry.key = key;
+    entry.exec = exec;
+  }
+
+  void erase(int batch) {
+    auto iter = entries_.find(batch);
+    if (iter == entries_.end()) return;
+    destroy(iter->second.exec);
+    entries_.erase(iter);
+  }
+
+  void clear() {
+    for (auto &item : entries_) destroy(item.second.exec);
+    entries_.clear();
+  }
+
+  inline size_t size() const { return entries_.size(); }
+  inline size_t hits() const { return hits_; }
+  inline size_t updates() const { return updates_; }
+  inline size_t misses() const { return misses_; }
+
+ private:
+  struct Entry {
+    GraphKey key;
+    void *exec = nullptr;
+  };
+
+  void destroy(void *exec) {
+    if (exec && destroyer_) destroyer_(exec);
+  }
+
+  Destroyer destroyer_;
+  std::map<int, Entry> entries_;
+  size_t hits_ = 0, updates_ = 0, misses_ = 0;
+};
+
+};  // namespace yolo
+
+#endif  // __GRAPH_CACHE_HPP__
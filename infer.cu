@@ -1,13 +1,15 @@
 
 #include <NvInfer.h>
 #include <cuda_runtime.h>
-#include <stdarg.h>
 
 #include <fstream>
+#include <map>
+#include <mutex>
 #include <numeric>
 #include <sstream>
 #include <unordered_map>
 
+#include "activation_pool.hpp"
 #include "infer.hpp"
 #include "Windows.h"
 
@@ -20,9 +22,9 @@ using namespace nvinfer1;
   do {                                                                                     \
     auto ___call__ret_code__ = (call);                                                     \
     if (___call__ret_code__ != cudaSuccess) {                                              \
-      INFO("CUDA Runtime error💥 %s # %s, code = %s [ %d ]", #call,                         \
-           cudaGetErrorString(___call__ret_code__), cudaGetErrorName(___call__ret_code__), \
-           ___call__ret_code__);                                                           \
+      INFOF("CUDA Runtime error💥 %s # %s, code = %s [ %d ]", #call,                        \
+            cudaGetErrorString(___call__ret_code__), cudaGetErrorName(___call__ret_code__), \
+            ___call__ret_code__);                                                          \
       abort();                                                                             \
     }                                                                                      \
   } while (0)
@@ -33,52 +35,24 @@ using namespace nvinfer1;
     checkRuntime(cudaPeekAtLastError()); \
   } while (0)
 
-#define Assert(op)                 \
-  do {                             \
-    bool cond = !(!(op));          \
-    if (!cond) {                   \
-      INFO("Assert failed, " #op); \
-      abort();                     \
-    }                              \
+#define Assert(op)                  \
+  do {                              \
+    bool cond = !(!(op));           \
+    if (!cond) {                    \
+      INFOF("Assert failed, " #op); \
+      abort();                      \
+    }                               \
   } while (0)
 
-#define Assertf(op, ...)                             \
-  do {                                               \
-    bool cond = !(!(op));                            \
-    if (!cond) {                                     \
-      INFO("Assert failed, " #op " : " __VA_ARGS__); \
-      abort();                                       \
-    }                                                \
+#define Assertf(op, ...)                              \
+  do {                                                \
+    bool cond = !(!(op));                             \
+    if (!cond) {                                      \
+      INFOF("Assert failed, " #op " : " __VA_ARGS__); \
+      abort();                                        \
+    }                                                 \
   } while (0)
 
-static string file_name(const string &path, bool include_suffix) {
-  if (path.empty()) return "";
-
-  int p = path.rfind('/');
-  int e = path.rfind('\\');
-  p = max(p, e);
-  p += 1;
-
-  // include suffix
-  if (include_suffix) return path.substr(p);
-
-  int u = path.rfind('.');
-  if (u == -1) return path.substr(p);
-
-  if (u <= p) u = path.size();
-  return path.substr(p, u - p);
-}
-
-void __log_func(const char *file, int line, const char *fmt, ...) {
-  va_list vl;
-  va_start(vl, fmt);
-  char buffer[2048];
-  string filename = file_name(file, true);
-  int n = snprintf(buffer, sizeof(buffer), "[%s:%d]: ", filename.c_str(), line);
-  vsnprintf(buffer + n, sizeof(buffer) - n, fmt, vl);
-  fprintf(stdout, "%s\n", buffer);
-}
-
 static std::string format_shape(const Dims &shape) {
   stringstream output;
   char buf[64];
@@ -146,6 +120,11 @@ void BaseMemory::reference(void *cpu, size_t cpu_bytes, void *gpu, size_t gpu_by
   this->owner_gpu_ = !(gpu && gpu_bytes > 0);
 }
 
+AllocationCounter &allocations() {
+  static AllocationCounter counter;
+  return counter;
+}
+
 BaseMemory::~BaseMemory() { release(); }
 
 void *BaseMemory::gpu_realloc(size_t bytes) {
@@ -154,6 +133,7 @@ void *BaseMemory::gpu_realloc(size_t bytes) {
 
     gpu_capacity_ = bytes;
     checkRuntime(cudaMalloc(&gpu_, bytes));
+    allocations().record(true, bytes);
     // checkRuntime(cudaMemset(gpu_, 0, size));
   }
   gpu_bytes_ = bytes;
@@ -166,6 +146,7 @@ void *BaseMemory::cpu_realloc(size_t bytes) {
 
     cpu_capacity_ = bytes;
     checkRuntime(cudaMallocHost(&cpu_, bytes));
+    allocations().record(false, bytes);
     Assert(cpu_ != nullptr);
     // memset(cpu_, 0, size);
   }
@@ -204,10 +185,10 @@ class __native_nvinfer_logger : public ILogger {
  public:
   virtual void log(Severity severity, const char *msg) noexcept override {
     if (severity == Severity::kINTERNAL_ERROR) {
-      INFO("NVInfer INTERNAL_ERROR: %s", msg);
+      INFOF("NVInfer INTERNAL_ERROR: %s", msg);
       abort();
     } else if (severity == Severity::kERROR) {
-      INFO("NVInfer: %s", msg);
+      INFOE("NVInfer: %s", msg);
     }
     // else  if (severity == Severity::kWARNING) {
     //     INFO("NVInfer: %s", msg);
@@ -222,6 +203,15 @@ class __native_nvinfer_logger : public ILogger {
 };
 static __native_nvinfer_logger gLogger;
 
+class __native_layer_profiler : public IProfiler {
+ public:
+  virtual void reportLayerTime(const char *layerName, float ms) noexcept override {
+    layers_.record(layerName, ms);
+  }
+
+  LayerProfiler layers_;
+};
+
 template <typename _T>
 static void destroy_nvidia_pointer(_T *ptr) {
   if (ptr) ptr->destroy();
@@ -249,7 +239,7 @@ class __native_engine_context {
  public:
   virtual ~__native_engine_context() { destroy(); }
 
-  bool construct(const void *pdata, size_t size) {
+  bool construct(const void *pdata, size_t size, bool without_device_memory = false) {
     destroy();
 
     if (pdata == nullptr || size == 0) return false;
@@ -261,8 +251,11 @@ class __native_engine_context {
                                       destroy_nvidia_pointer<ICudaEngine>);
     if (engine_ == nullptr) return false;
 
-    context_ = shared_ptr<IExecutionContext>(engine_->createExecutionContext(),
-                                             destroy_nvidia_pointer<IExecutionContext>);
+    // the workspace of a context without device memory is set before every enqueue
+    IExecutionContext *context = without_device_memory
+                                     ? engine_->createExecutionContextWithoutDeviceMemory()
+                                     : engine_->createExecutionContext();
+    context_ = shared_ptr<IExecutionContext>(context, destroy_nvidia_pointer<IExecutionContext>);
     return context_ != nullptr;
   }
 
@@ -279,16 +272,96 @@ class __native_engine_context {
   shared_ptr<IRuntime> runtime_ = nullptr;
 };
 
+DeviceScope::DeviceScope(int device_id) {
+  checkRuntime(cudaGetDevice(&previous_));
+  if (previous_ != device_id) checkRuntime(cudaSetDevice(device_id));
+  device_id_ = device_id;
+}
+
+DeviceScope::~DeviceScope() {
+  if (previous_ != device_id_) checkRuntime(cudaSetDevice(previous_));
+}
+
+static mutex g_activation_lock;
+static map<int, shared_ptr<pool::ActivationPool>> g_activation_pools;
+
+// the pool of a device lives as long as the process, the scratch only while it has users
+static shared_ptr<pool::ActivationPool> activation_pool(int device_id) {
+  unique_lock<mutex> l(g_activation_lock);
+  auto &instance = g_activation_pools[device_id];
+  if (instance) return instance;
+
+  cudaEvent_t last_use = nullptr;
+  {
+    DeviceScope scope(device_id);
+    checkRuntime(cudaEventCreateWithFlags(&last_use, cudaEventDisableTiming));
+  }
+
+  pool::ActivationPool::Device device;
+  device.allocate = [device_id](size_t bytes) -> void * {
+    DeviceScope scope(device_id);
+    void *memory = nullptr;
+    if (cudaMalloc(&memory, bytes) != cudaSuccess) {
+      cudaGetLastError();
+      return nullptr;
+    }
+    allocations().record(true, bytes);
+    return memory;
+  };
+  device.free = [device_id](void *memory) {
+    DeviceScope scope(device_id);
+    checkRuntime(cudaFree(memory));
+  };
+  device.wait = [last_use](void *stream) {
+    checkRuntime(cudaStreamWaitEvent((cudaStream_t)stream, last_use, 0));
+  };
+  device.record = [last_use](void *stream) {
+    checkRuntime(cudaEventRecord(last_use, (cudaStream_t)stream));
+  };
+  device.synchronize = [last_use]() { checkRuntime(cudaEventSynchronize(last_use)); };
+  instance = make_shared<pool::ActivationPool>(device);
+  return instance;
+}
+
+std::vector<ActivationUsage> activation_usage() {
+  std::vector<ActivationUsage> output;
+  unique_lock<mutex> l(g_activation_lock);
+  for (auto &item : g_activation_pools) {
+    for (auto &user : item.second->users()) {
+      ActivationUsage usage;
+      usage.device_id = item.first;
+      usage.name = user.name;
+      usage.bytes = user.bytes;
+      output.push_back(usage);
+    }
+  }
+  return output;
+}
+
+size_t activation_pool_bytes(int device_id) {
+  unique_lock<mutex> l(g_activation_lock);
+  auto iter = g_activation_pools.find(device_id);
+  return iter == g_activation_pools.end() ? 0 : iter->second->capacity();
+}
+
 class InferImpl : public Infer {
  public:
   shared_ptr<__native_engine_context> context_;
   unordered_map<string, int> binding_name_to_index_;
+  shared_ptr<pool::ActivationPool> activations_;
+  int activation_id_ = -1;
+  shared_ptr<__native_layer_profiler> profiler_;
+  bool profiling_ = false;
 
-  virtual ~InferImpl() = default;
+  virtual ~InferImpl() {
+    // the context goes before its scratch
+    context_.reset();
+    if (activations_) activations_->detach(activation_id_);
+  }
 
-  bool construct(const void *data, size_t size) {
+  bool construct(const void *data, size_t size, bool without_device_memory = false) {
     context_ = make_shared<__native_engine_context>();
-    if (!context_->construct(data, size)) {
+    if (!context_->construct(data, size, without_device_memory)) {
       return false;
     }
 
@@ -296,13 +369,32 @@ class InferImpl : public Infer {
     return true;
   }
 
-  bool load(const string &file) {
+  bool load(const string &file, bool share_activations) {
     auto data = load_file(file);
     if (data.empty()) {
       INFO("An empty file has been loaded. Please confirm your file path: %s", file.c_str());
       return false;
     }
-    return this->construct(data.data(), data.size());
+    if (!this->construct(data.data(), data.size(), share_activations)) return false;
+    if (!share_activations) return true;
+
+    int device_id = 0;
+    checkRuntime(cudaGetDevice(&device_id));
+    auto activations = activation_pool(device_id);
+    size_t bytes = activation_bytes();
+    activation_id_ = activations->attach(file, bytes);
+    if (activation_id_ == -1) {
+      INFOE("Failed to allocate %.2f MB of shared activations for %s on device %d",
+            bytes / 1024.0f / 1024.0f, file.c_str(), device_id);
+      return false;
+    }
+    activations_ = activations;
+    INFO("Shared activations of %s: %.2f MB, device %d holds %.2f MB for %d models "
+         "(%.2f MB private)",
+         file.c_str(), bytes / 1024.0f / 1024.0f, device_id,
+         activations->capacity() / 1024.0f / 1024.0f, (int)activations->users().size(),
+         activations->private_bytes() / 1024.0f / 1024.0f);
+    return true;
   }
 
   void setup() {
@@ -323,12 +415,60 @@ class InferImpl : public Infer {
     return iter->second;
   }
 
+  virtual std::string name(int ibinding) override {
+    return this->context_->engine_->getBindingName(ibinding);
+  }
+
   virtual bool forward(const std::vector<void *> &bindings, void *stream,
                        void *input_consum_event) override {
+    if (profiling_) {
+      if (!enqueue(bindings, stream, input_consum_event)) return false;
+      // the layer times are known once the stream has finished
+      checkRuntime(cudaStreamSynchronize((cudaStream_t)stream));
+      this->context_->context_->reportToProfiler();
+      profiler_->layers_.end_run();
+      return true;
+    }
+    return enqueue(bindings, stream, input_consum_event);
+  }
+
+  bool enqueue(const std::vector<void *> &bindings, void *stream, void *input_consum_event) {
+    if (activations_) {
+      // the lease orders this enqueue after the previous user of the scratch on the device
+      auto lease = activations_->acquire(stream);
+      this->context_->context_->setDeviceMemory(lease.memory());
+      return this->context_->context_->enqueueV2((void **)bindings.data(), (cudaStream_t)stream,
+                                                 (cudaEvent_t *)input_consum_event);
+    }
     return this->context_->context_->enqueueV2((void**)bindings.data(), (cudaStream_t)stream,
                                                (cudaEvent_t *)input_consum_event);
   }
 
+  virtual size_t activation_bytes() override {
+    return this->context_->engine_->getDeviceMemorySize();
+  }
+
+  virtual bool shares_activations() override { return activations_ != nullptr; }
+
+  virtual void set_profiling(bool enable) override {
+    auto context = this->context_->context_;
+    if (enable) {
+      if (profiler_ == nullptr) profiler_ = make_shared<__native_layer_profiler>();
+      profiler_->layers_.reset();
+      context->setEnqueueEmitsProfile(false);
+      context->setProfiler(profiler_.get());
+    } else if (profiling_) {
+      context->setProfiler(nullptr);
+    }
+    profiling_ = enable;
+  }
+
+  virtual bool profiling() override { return profiling_; }
+
+  virtual LayerReport layer_report() override {
+    return profiler_ ? profiler_->layers_.report() : LayerReport();
+  }
+
   virtual std::vector<int> run_dims(const std::string &name) override {
     return run_dims(index(name));
   }
@@ -392,6 +532,8 @@ class InferImpl : public Infer {
 
   virtual void print() override {
     INFO("Infer %p [%s]", this, has_dynamic_dim() ? "DynamicShape" : "StaticShape");
+    INFO("Activations: %.2f MB%s", activation_bytes() / 1024.0f / 1024.0f,
+         shares_activations() ? ", shared" : "");
 
     int num_input = 0;
     int num_output = 0;
@@ -419,17 +561,17 @@ class InferImpl : public Infer {
   }
 };
 
-Infer *loadraw(const std::string &file) {
+Infer *loadraw(const std::string &file, bool share_activations) {
   InferImpl *impl = new InferImpl();
-  if (!impl->load(file)) {
+  if (!impl->load(file, share_activations)) {
     delete impl;
     impl = nullptr;
   }
   return impl;
 }
 
-std::shared_ptr<Infer> load(const std::string &file) {
-  return std::shared_ptr<InferImpl>((InferImpl *)loadraw(file));
+std::shared_ptr<Infer> load(const std::string &file, bool share_activations) {
+  return std::shared_ptr<InferImpl>((InferImpl *)loadraw(file, share_activations));
 }
 
 std::string format_shape(const std::vector<int> &shape) {
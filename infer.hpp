@@ -1,15 +1,16 @@
 #ifndef __INFER_HPP__
 #define __INFER_HPP__
 
+#include <atomic>
 #include <initializer_list>
 #include <memory>
 #include <string>
 #include <vector>
 
-namespace trt {
+#include "logger.hpp"
+#include "profiler.hpp"
 
-#define INFO(...) trt::__log_func(__FILE__, __LINE__, __VA_ARGS__)
-void __log_func(const char *file, int line, const char *fmt, ...);
+namespace trt {
 
 enum class DType : int { FLOAT = 0, HALF = 1, INT8 = 2, INT32 = 3, BOOL = 4, UINT8 = 5 };
 
@@ -25,6 +26,42 @@ class Timer {
   void *stream_;
 };
 
+// Device and pinned host allocations of the process, a steady state forward leaves it unchanged.
+class AllocationCounter {
+ public:
+  void record(bool device, size_t bytes) {
+    if (device) {
+      device_allocations_++;
+      device_bytes_ += bytes;
+    } else {
+      host_allocations_++;
+      host_bytes_ += bytes;
+    }
+  }
+
+  inline unsigned long long device_allocations() const { return device_allocations_; }
+  inline unsigned long long host_allocations() const { return host_allocations_; }
+  inline unsigned long long device_bytes() const { return device_bytes_; }
+  inline unsigned long long host_bytes() const { return host_bytes_; }
+  inline unsigned long long total() const { return device_allocations_ + host_allocations_; }
+
+ private:
+  std::atomic<unsigned long long> device_allocations_{0}, host_allocations_{0};
+  std::atomic<unsigned long long> device_bytes_{0}, host_bytes_{0};
+};
+
+AllocationCounter &allocations();
+
+// Makes device_id current on the calling thread for its lifetime, then restores the previous one.
+class DeviceScope {
+ public:
+  explicit DeviceScope(int device_id);
+  virtual ~DeviceScope();
+
+ private:
+  int previous_ = 0, device_id_ = 0;
+};
+
 class BaseMemory {
  public:
   BaseMemory() = default;
@@ -74,6 +111,7 @@ class Infer {
   virtual bool forward(const std::vector<void *> &bindings, void *stream = nullptr,
                        void *input_consum_event = nullptr) = 0;
   virtual int index(const std::string &name) = 0;
+  virtual std::string name(int ibinding) = 0;
   virtual std::vector<int> run_dims(const std::string &name) = 0;
   virtual std::vector<int> run_dims(int ibinding) = 0;
   virtual std::vector<int> static_dims(const std::string &name) = 0;
@@ -88,9 +126,32 @@ class Infer {
   virtual DType dtype(int ibinding) = 0;
   virtual bool has_dynamic_dim() = 0;
   virtual void print() = 0;
+  // activation workspace of the engine, held by the shared pool of its device when shared
+  virtual size_t activation_bytes() = 0;
+  virtual bool shares_activations() = 0;
+
+  // Aggregate the per-layer times of the following forwards, each of which then waits for its
+  // stream. Enabling starts over from no runs, the report stays readable after disabling.
+  virtual void set_profiling(bool enable) = 0;
+  virtual bool profiling() = 0;
+  virtual LayerReport layer_report() = 0;
 };
 
-std::shared_ptr<Infer> load(const std::string &file);
+// Contexts of models loaded with shared activations get no workspace of their own, they take
+// turns on one scratch per device sized for the largest of them (activation_pool.hpp).
+std::shared_ptr<Infer> load(const std::string &file, bool share_activations = false);
+
+struct ActivationUsage {
+  int device_id = 0;
+  std::string name;  // engine file
+  size_t bytes = 0;
+};
+
+// models loaded with shared activations and their workspace sizes, of every device
+std::vector<ActivationUsage> activation_usage();
+// scratch held by the shared pool of the device
+size_t activation_pool_bytes(int device_id);
+
 std::string format_shape(const std::vector<int> &shape);
 
 }  // namespace trt
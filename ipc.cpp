@@ -0,0 +1,383 @@
+#include "ipc.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "logger.hpp"
+
+namespace ipc {
+
+using namespace std;
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+              "shared memory counters must be lock free");
+
+static size_t align_up(size_t n, size_t align) { return (n + align - 1) / align * align; }
+
+static size_t header_bytes() { return align_up(sizeof(ChannelHeader), 64); }
+static size_t slot_header_bytes() { return align_up(sizeof(SlotHeader), 64); }
+
+static uint32_t ring_size_of(int num_slots) {
+  uint32_t size = 1;
+  while (size < (uint32_t)num_slots) size <<= 1;
+  return size;
+}
+
+static string segment_name(const string &name) {
+#ifdef _WIN32
+  return "Local\\yolo_" + name;
+#else
+  return "/yolo_" + name;
+#endif
+}
+
+size_t channel_bytes(const ChannelConfig &config) {
+  size_t ring = align_up(ring_size_of(config.num_slots) * sizeof(RingCell), 64);
+  size_t frame = (size_t)config.max_width * config.max_height * 3;
+  size_t slot = align_up(slot_header_bytes() +
+                             align_up((size_t)config.max_boxes * sizeof(RemoteBox), 64) + frame,
+                         4096);
+  return align_up(header_bytes() + ring, 4096) + slot * config.num_slots;
+}
+
+uint32_t current_pid() {
+#ifdef _WIN32
+  return GetCurrentProcessId();
+#else
+  return getpid();
+#endif
+}
+
+bool process_alive(uint32_t pid) {
+  if (pid == 0) return false;
+#ifdef _WIN32
+  HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, pid);
+  if (process == nullptr) return false;
+  bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+  CloseHandle(process);
+  return alive;
+#else
+  return kill(pid, 0) == 0 || errno == EPERM;
+#endif
+}
+
+SharedMemory::~SharedMemory() { close(); }
+
+bool SharedMemory::create(const string &name, size_t bytes) {
+  close();
+  name_ = segment_name(name);
+#ifdef _WIN32
+  handle_ = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                               (DWORD)((uint64_t)bytes >> 32), (DWORD)bytes, name_.c_str());
+  if (handle_ == nullptr) {
+    INFOE("Failed to create shared memory %s, error %d", name_.c_str(), (int)GetLastError());
+    return false;
+  }
+  data_ = MapViewOfFile(handle_, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+#else
+  // a segment left by a crashed server is replaced, its clients reconnect
+  shm_unlink(name_.c_str());
+  int fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+  if (fd == -1) {
+    INFOE("Failed to create shared memory %s, errno %d", name_.c_str(), errno);
+    return false;
+  }
+  fchmod(fd, 0666);
+  if (ftruncate(fd, bytes) != 0) {
+    INFOE("Failed to size shared memory %s to %llu bytes", name_.c_str(),
+          (unsigned long long)bytes);
+    ::close(fd);
+    shm_unlink(name_.c_str());
+    return false;
+  }
+  data_ = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data_ == MAP_FAILED) data_ = nullptr;
+#endif
+  if (data_ == nullptr) {
+    INFOE("Failed to map shared memory %s", name_.c_str());
+    close();
+    return false;
+  }
+  size_ = bytes;
+  owner_ = true;
+  return true;
+}
+
+bool SharedMemory::open(const string &name) {
+  close();
+  name_ = segment_name(name);
+#ifdef _WIN32
+  handle_ = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name_.c_str());
+  if (handle_ == nullptr) return false;
+  data_ = MapViewOfFile(handle_, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+  MEMORY_BASIC_INFORMATION info;
+  if (data_ && VirtualQuery(data_, &info, sizeof(info)) == sizeof(info)) size_ = info.RegionSize;
+#else
+  int fd = shm_open(name_.c_str(), O_RDWR, 0);
+  if (fd == -1) return false;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    size_ = st.st_size;
+    data_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data_ == MAP_FAILED) data_ = nullptr;
+  }
+  ::close(fd);
+#endif
+  if (data_ == nullptr || size_ < sizeof(ChannelHeader)) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void SharedMemory::close() {
+#ifdef _WIN32
+  if (data_) UnmapViewOfFile(data_);
+  if (handle_) CloseHandle((HANDLE)handle_);
+#else
+  if (data_) munmap(data_, size_);
+  if (owner_) shm_unlink(name_.c_str());
+#endif
+  data_ = nullptr;
+  handle_ = nullptr;
+  size_ = 0;
+  owner_ = false;
+}
+
+Doorbell::~Doorbell() {
+#ifdef _WIN32
+  if (event_) CloseHandle((HANDLE)event_);
+#endif
+}
+
+bool Doorbell::open(const string &name, atomic<uint32_t> *word) {
+  word_ = word;
+#ifdef _WIN32
+  string event_name = segment_name(name);
+  event_ = CreateEventA(nullptr, FALSE, FALSE, event_name.c_str());
+  if (event_ == nullptr) {
+    INFOE("Failed to open event %s, error %d", event_name.c_str(), (int)GetLastError());
+    return false;
+  }
+#endif
+  return true;
+}
+
+void Doorbell::ring() {
+  word_->fetch_add(1, memory_order_release);
+#ifdef _WIN32
+  SetEvent((HANDLE)event_);
+#else
+  syscall(SYS_futex, (uint32_t *)word_, FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+#endif
+}
+
+bool Doorbell::wait(uint32_t seen, int timeout_ms) {
+  auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+  while (value() == seen) {
+    auto remaining = chrono::duration_cast<chrono::milliseconds>(
+                         deadline - chrono::steady_clock::now())
+                         .count();
+    if (remaining <= 0) return false;
+#ifdef _WIN32
+    WaitForSingleObject((HANDLE)event_, (DWORD)remaining);
+#else
+    struct timespec timeout;
+    timeout.tv_sec = remaining / 1000;
+    timeout.tv_nsec = (remaining % 1000) * 1000000;
+    // returns at once when the counter moved since it was read
+    syscall(SYS_futex, (uint32_t *)word_, FUTEX_WAIT, seen, &timeout, nullptr, 0);
+#endif
+  }
+  return true;
+}
+
+bool Channel::create(const string &name, const ChannelConfig &config) {
+  size_t bytes = channel_bytes(config);
+  if (!memory_.create(name, bytes)) return false;
+
+  memset(memory_.data(), 0, bytes);
+  ChannelHeader *h = header();
+  h->version = CHANNEL_VERSION;
+  h->num_slots = config.num_slots;
+  h->ring_size = ring_size_of(config.num_slots);
+  h->frame_bytes = (size_t)config.max_width * config.max_height * 3;
+  h->slot_bytes = align_up(slot_header_bytes() +
+                               align_up((size_t)config.max_boxes * sizeof(RemoteBox), 64) +
+                               h->frame_bytes,
+                           4096);
+  h->slots_offset = align_up(header_bytes() + h->ring_size * sizeof(RingCell), 4096);
+  h->max_width = config.max_width;
+  h->max_height = config.max_height;
+  h->max_boxes = config.max_boxes;
+  h->num_classes = config.num_classes;
+  h->server_pid.store(current_pid());
+  for (uint32_t i = 0; i < h->ring_size; ++i) ring()[i].sequence.store(i);
+  if (!open_doorbells(name)) return false;
+
+  // clients check the magic last
+  atomic_thread_fence(memory_order_release);
+  h->magic = CHANNEL_MAGIC;
+  return true;
+}
+
+bool Channel::connect(const string &name) {
+  if (!memory_.open(name)) return false;
+
+  ChannelHeader *h = header();
+  atomic_thread_fence(memory_order_acquire);
+  if (h->magic != CHANNEL_MAGIC || h->version != CHANNEL_VERSION) {
+    INFOE("Shared memory of %s is not a version %d channel", name.c_str(), CHANNEL_VERSION);
+    memory_.close();
+    return false;
+  }
+  if (memory_.size() < h->slots_offset + h->slot_bytes * h->num_slots) {
+    INFOE("Shared memory of %s is truncated", name.c_str());
+    memory_.close();
+    return false;
+  }
+  // left behind by a server that has exited
+  if (!process_alive(h->server_pid.load())) {
+    memory_.close();
+    return false;
+  }
+  return open_doorbells(name);
+}
+
+bool Channel::open_doorbells(const string &name) {
+  if (!wake_.open(name + "_wake", &header()->wake)) return false;
+  doorbells_.clear();
+  for (int i = 0; i < num_slots(); ++i) {
+    doorbells_.emplace_back(new Doorbell());
+    if (!doorbells_.back()->open(name + "_slot" + to_string(i), &slot(i)->done)) return false;
+  }
+  return true;
+}
+
+RingCell *Channel::ring() const {
+  return (RingCell *)((uint8_t *)memory_.data() + header_bytes());
+}
+
+SlotHeader *Channel::slot(int index) const {
+  return (SlotHeader *)((uint8_t *)memory_.data() + header()->slots_offset +
+                        index * header()->slot_bytes);
+}
+
+RemoteBox *Channel::boxes(int index) const {
+  return (RemoteBox *)((uint8_t *)slot(index) + slot_header_bytes());
+}
+
+uint8_t *Channel::frame(int index) const {
+  return (uint8_t *)boxes(index) + align_up(header()->max_boxes * sizeof(RemoteBox), 64);
+}
+
+int Channel::claim() {
+  for (int i = 0; i < num_slots(); ++i) {
+    uint32_t expected = (uint32_t)SlotState::Free;
+    SlotHeader *s = slot(i);
+    if (s->state.compare_exchange_strong(expected, (uint32_t)SlotState::Idle)) {
+      s->owner_pid = current_pid();
+      return i;
+    }
+  }
+  return -1;
+}
+
+void Channel::release(int index) {
+  SlotHeader *s = slot(index);
+  s->owner_pid = 0;
+  s->state.store((uint32_t)SlotState::Free);
+}
+
+// Bounded multi producer ring (Vyukov) as in logger.cpp. A slot has one request at most and
+// the ring is at least as large as the slot count, so a push always finds a cell.
+void Channel::submit(int index) {
+  ChannelHeader *h = header();
+  slot(index)->state.store((uint32_t)SlotState::Pending, memory_order_release);
+
+  uint64_t pos = h->enqueue.load(memory_order_relaxed);
+  for (;;) {
+    RingCell &cell = ring()[pos & (h->ring_size - 1)];
+    uint64_t seq = cell.sequence.load(memory_order_acquire);
+    int64_t diff = (int64_t)seq - (int64_t)pos;
+    if (diff == 0) {
+      if (h->enqueue.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+        cell.slot = index;
+        cell.sequence.store(pos + 1, memory_order_release);
+        break;
+      }
+    } else if (diff < 0) {
+      this_thread::yield();
+      pos = h->enqueue.load(memory_order_relaxed);
+    } else {
+      pos = h->enqueue.load(memory_order_relaxed);
+    }
+  }
+  wake_.ring();
+}
+
+bool Channel::wait_done(int index, uint32_t seen, int timeout_ms) {
+  return doorbells_[index]->wait(seen, timeout_ms);
+}
+
+int Channel::pop() {
+  ChannelHeader *h = header();
+  uint64_t pos = h->dequeue.load(memory_order_relaxed);
+  RingCell &cell = ring()[pos & (h->ring_size - 1)];
+  if (cell.sequence.load(memory_order_acquire) != pos + 1) return -1;
+
+  int index = cell.slot;
+  cell.sequence.store(pos + h->ring_size, memory_order_release);
+  h->dequeue.store(pos + 1, memory_order_relaxed);
+  return index >= 0 && index < num_slots() ? index : -1;
+}
+
+bool Channel::wait_request(uint32_t seen, int timeout_ms) { return wake_.wait(seen, timeout_ms); }
+
+void Channel::complete(int index, int status, int num_boxes) {
+  SlotHeader *s = slot(index);
+  s->status = status;
+  s->num_boxes = num_boxes;
+  s->state.store((uint32_t)SlotState::Done, memory_order_release);
+  doorbells_[index]->ring();
+}
+
+int Channel::sweep() {
+  int freed = 0;
+  for (int i = 0; i < num_slots(); ++i) {
+    SlotHeader *s = slot(i);
+    uint32_t state = s->state.load();
+    if (state != (uint32_t)SlotState::Idle && state != (uint32_t)SlotState::Done) continue;
+    if (process_alive(s->owner_pid)) continue;
+    if (s->state.compare_exchange_strong(state, (uint32_t)SlotState::Free)) freed++;
+  }
+  return freed;
+}
+
+void Channel::shutdown() {
+  header()->server_pid.store(0);
+  for (auto &doorbell : doorbells_) doorbell->ring();
+}
+
+};  // namespace ipc
@@ -0,0 +1,157 @@
+#ifndef __IPC_HPP__
+#define __IPC_HPP__
+
+// Shared memory channel between yolo_server and its clients (remote.hpp). One named segment
+// per served model holds a header, a ring of pending requests and one slot per client with
+// its frame and results. Clients copy a frame into their slot and push the slot index, the
+// server pops requests of every client into one batch, writes the boxes back and rings the
+// slot's doorbell. Doorbells are futexes on Linux and named events on Windows, no sockets.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ipc {
+
+const uint32_t CHANNEL_MAGIC = 0x594c4f31;  // "YLO1"
+const uint32_t CHANNEL_VERSION = 1;
+
+enum class SlotState : uint32_t { Free = 0, Idle = 1, Pending = 2, Done = 3 };
+
+struct RemoteBox {
+  float left, top, right, bottom, confidence;
+  int32_t class_label;
+  int32_t sub_label;
+  float sub_confidence;
+};
+
+struct ChannelHeader {
+  uint32_t magic, version;
+  uint32_t num_slots, ring_size;  // ring_size is a power of two >= num_slots
+  uint64_t slots_offset, slot_bytes, frame_bytes;
+  int32_t max_width, max_height;  // largest frame, bgr
+  int32_t max_boxes;
+  int32_t num_classes;
+  std::atomic<uint32_t> server_pid;  // 0 once the server has left
+  std::atomic<uint32_t> heartbeat;   // advanced by the server while it runs
+  std::atomic<uint64_t> enqueue, dequeue;
+  std::atomic<uint32_t> wake;  // server doorbell, advanced on every request
+};
+
+struct RingCell {
+  std::atomic<uint64_t> sequence;
+  int32_t slot;
+};
+
+struct SlotHeader {
+  std::atomic<uint32_t> state;
+  std::atomic<uint32_t> done;  // client doorbell, advanced when the results are written
+  uint32_t owner_pid;
+  int32_t width, height;
+  int32_t status;  // 0 after a successful forward
+  int32_t num_boxes;
+};
+
+struct ChannelConfig {
+  int num_slots = 16;
+  int max_width = 1920, max_height = 1080;
+  int max_boxes = 1024;
+  int num_classes = 0;
+};
+
+uint32_t current_pid();
+bool process_alive(uint32_t pid);
+
+// Named shared memory segment, removed when the creator closes it
+class SharedMemory {
+ public:
+  SharedMemory() = default;
+  SharedMemory(const SharedMemory &other) = delete;
+  SharedMemory &operator=(const SharedMemory &other) = delete;
+  virtual ~SharedMemory();
+
+  bool create(const std::string &name, size_t bytes);
+  bool open(const std::string &name);
+  void close();
+  inline void *data() const { return data_; }
+  inline size_t size() const { return size_; }
+
+ private:
+  std::string name_;
+  void *data_ = nullptr;
+  size_t size_ = 0;
+  bool owner_ = false;
+  void *handle_ = nullptr;  // file mapping on Windows
+};
+
+// Wakes a waiter of a 32 bit counter in shared memory, across processes
+class Doorbell {
+ public:
+  Doorbell() = default;
+  Doorbell(const Doorbell &other) = delete;
+  Doorbell &operator=(const Doorbell &other) = delete;
+  virtual ~Doorbell();
+
+  bool open(const std::string &name, std::atomic<uint32_t> *word);
+  void ring();
+  // false on timeout, true once the counter is no longer seen
+  bool wait(uint32_t seen, int timeout_ms);
+  inline uint32_t value() const { return word_->load(std::memory_order_acquire); }
+
+ private:
+  std::atomic<uint32_t> *word_ = nullptr;
+  void *event_ = nullptr;  // named auto reset event on Windows
+};
+
+class Channel {
+ public:
+  // server side, replaces a segment left behind by a previous server of the same name
+  bool create(const std::string &name, const ChannelConfig &config);
+  // client side
+  bool connect(const std::string &name);
+
+  inline ChannelHeader *header() const { return (ChannelHeader *)memory_.data(); }
+  SlotHeader *slot(int index) const;
+  RemoteBox *boxes(int index) const;
+  uint8_t *frame(int index) const;
+  inline int num_slots() const { return header()->num_slots; }
+
+  // client: claims a free slot for this process, -1 when all are taken
+  int claim();
+  void release(int index);
+  // client: pushes a request of the slot, its frame and size are written already
+  void submit(int index);
+  // client: waits for the results of the slot, false on timeout
+  bool wait_done(int index, uint32_t seen, int timeout_ms);
+  inline uint32_t done_value(int index) const { return doorbells_[index]->value(); }
+
+  // server: next pending slot, -1 when the ring is empty
+  int pop();
+  // server: waits for a request after the wake counter was seen, false on timeout
+  bool wait_request(uint32_t seen, int timeout_ms);
+  inline uint32_t wake_value() const { return wake_.value(); }
+  void complete(int index, int status, int num_boxes);
+  // server: frees the slots of clients that exited without releasing them
+  int sweep();
+  // server: announces that the channel is no longer served
+  void shutdown();
+
+ private:
+  bool open_doorbells(const std::string &name);
+  RingCell *ring() const;
+
+  SharedMemory memory_;
+  Doorbell wake_;
+  std::vector<std::unique_ptr<Doorbell>> doorbells_;
+};
+
+// bytes of a channel segment with this configuration
+size_t channel_bytes(const ChannelConfig &config);
+
+};  // namespace ipc
+
+#endif  // __IPC_HPP__
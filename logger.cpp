@@ -0,0 +1,339 @@
+#include "logger.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+namespace trt {
+
+using namespace std;
+
+const int LOG_RING_SIZE = 4096;  // power of two
+const int LOG_DRAIN_INTERVAL_MS = 2;
+
+std::atomic<int> __log_min_level((int)LogLevel::Info);
+std::atomic<bool> __log_async(true);
+static std::atomic<int> g_rate_limit(20);
+
+static long long now_ms() {
+  return chrono::duration_cast<chrono::milliseconds>(
+             chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// now_ms as of the last pass of the drain thread (every LOG_DRAIN_INTERVAL_MS or less), so the
+// rate limiters do not read the clock per message. 0 while the thread is not running.
+static std::atomic<long long> g_coarse_ms(0);
+
+static long long coarse_ms() {
+  long long now = g_coarse_ms.load(memory_order_relaxed);
+  return now != 0 ? now : now_ms();
+}
+
+static const char *file_name(const char *path) {
+  const char *name = path;
+  for (const char *p = path; *p; ++p)
+    if (*p == '/' || *p == '\\') name = p + 1;
+  return name;
+}
+
+bool LogRateLimiter::allow() {
+  int limit = g_rate_limit.load(memory_order_relaxed);
+  if (limit <= 0) return true;
+  return allow(limit, coarse_ms());
+}
+
+// Fixed one second window, the thread that moves the window resets the count. Once the window
+// is used up, calls only read the limiter and never write its cache line.
+bool LogRateLimiter::allow(int limit, long long now) {
+  long long window = window_.load(memory_order_relaxed);
+  if (now - window >= 1000) {
+    if (window_.compare_exchange_strong(window, now)) count_.store(0, memory_order_relaxed);
+  } else if (count_.load(memory_order_relaxed) >= limit) {
+    return false;
+  }
+  return count_.fetch_add(1, memory_order_relaxed) < limit;
+}
+
+static long long arg_signed(const LogArg &arg) {
+  switch (arg.kind) {
+    case LogArg::Unsigned: return (long long)arg.u;
+    case LogArg::Float: return (long long)arg.d;
+    case LogArg::Pointer: return (long long)(uintptr_t)arg.p;
+    default: return arg.i;
+  }
+}
+
+static double arg_float(const LogArg &arg) {
+  switch (arg.kind) {
+    case LogArg::Signed: return (double)arg.i;
+    case LogArg::Unsigned: return (double)arg.u;
+    default: return arg.d;
+  }
+}
+
+// printf of the captured arguments, one conversion at a time. Length modifiers of the format are
+// replaced by the width the argument was stored with.
+static void format_message(const LogRecord &r, string &out) {
+  char spec[64], buffer[512];
+  int iarg = 0;
+  const char *p = r.fmt;
+  while (*p) {
+    if (*p != '%') {
+      out.push_back(*p++);
+      continue;
+    }
+    if (p[1] == '%') {
+      out.push_back('%');
+      p += 2;
+      continue;
+    }
+
+    int n = 0;
+    spec[n++] = *p++;
+    while (*p && strchr("-+ #0123456789.*", *p)) {
+      if (*p == '*') {
+        long long value = iarg < r.num_args ? arg_signed(r.args[iarg++]) : 0;
+        if (n < (int)sizeof(spec) - 16) n += snprintf(spec + n, 12, "%d", (int)value);
+      } else if (n < (int)sizeof(spec) - 4) {
+        spec[n++] = *p;
+      }
+      ++p;
+    }
+    while (*p && strchr("hlLqjzt", *p)) ++p;
+    char conv = *p;
+    if (conv == 0) break;
+    ++p;
+
+    if (iarg >= r.num_args) {
+      out += "<?>";
+      continue;
+    }
+    const LogArg &arg = r.args[iarg++];
+    buffer[0] = 0;
+    switch (conv) {
+      case 'd':
+      case 'i':
+      case 'u':
+      case 'o':
+      case 'x':
+      case 'X':
+        spec[n++] = 'l';
+        spec[n++] = 'l';
+        spec[n++] = conv;
+        spec[n] = 0;
+        if (conv == 'd' || conv == 'i')
+          snprintf(buffer, sizeof(buffer), spec, arg_signed(arg));
+        else
+          snprintf(buffer, sizeof(buffer), spec, (unsigned long long)arg_signed(arg));
+        break;
+      case 'c':
+        spec[n++] = conv;
+        spec[n] = 0;
+        snprintf(buffer, sizeof(buffer), spec, (int)arg_signed(arg));
+        break;
+      case 'e':
+      case 'E':
+      case 'f':
+      case 'F':
+      case 'g':
+      case 'G':
+      case 'a':
+      case 'A':
+        spec[n++] = conv;
+        spec[n] = 0;
+        snprintf(buffer, sizeof(buffer), spec, arg_float(arg));
+        break;
+      case 's':
+        spec[n++] = conv;
+        spec[n] = 0;
+        snprintf(buffer, sizeof(buffer), spec,
+                 arg.kind == LogArg::Text ? r.text + arg.text : "<?>");
+        break;
+      case 'p':
+        spec[n++] = conv;
+        spec[n] = 0;
+        snprintf(buffer, sizeof(buffer), spec, arg.kind == LogArg::Pointer ? arg.p : nullptr);
+        break;
+      default:
+        snprintf(buffer, sizeof(buffer), "<%%%c>", conv);
+        break;
+    }
+    out += buffer;
+  }
+}
+
+// Bounded multi producer queue (Vyukov). Producers claim a cell with a CAS on the enqueue
+// position and publish it through the cell sequence, the single consumer runs under drain_lock_.
+class Logger {
+ public:
+  Logger() : cells_(new Cell[LOG_RING_SIZE]) {
+    for (int i = 0; i < LOG_RING_SIZE; ++i) cells_[i].sequence.store(i, memory_order_relaxed);
+
+    // never joined from a destructor, that would deadlock on the loader lock when the dll
+    // unloads, see shutdown()
+    worker_ = thread(&Logger::run, this);
+  }
+
+  LogRecord *begin(uint64_t *position) {
+    uint64_t pos = enqueue_.load(memory_order_relaxed);
+    for (;;) {
+      Cell &cell = cells_[pos & (LOG_RING_SIZE - 1)];
+      uint64_t seq = cell.sequence.load(memory_order_acquire);
+      int64_t diff = (int64_t)seq - (int64_t)pos;
+      if (diff == 0) {
+        if (enqueue_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+          *position = pos;
+          return &cell.record;
+        }
+      } else if (diff < 0) {
+        dropped_.fetch_add(1, memory_order_relaxed);
+        dropped_total_.fetch_add(1, memory_order_relaxed);
+        return nullptr;
+      } else {
+        pos = enqueue_.load(memory_order_relaxed);
+      }
+    }
+  }
+
+  void end(uint64_t position) {
+    cells_[position & (LOG_RING_SIZE - 1)].sequence.store(position + 1, memory_order_release);
+  }
+
+  void sync(const LogRecord &record) {
+    unique_lock<mutex> l(drain_lock_);
+    drain();
+    write(record);
+    fflush(sink_);
+  }
+
+  void flush() {
+    unique_lock<mutex> l(drain_lock_);
+    drain();
+  }
+
+  // at exit the drain thread may have been killed while holding the lock, never wait for it
+  void flush_at_exit() {
+    unique_lock<mutex> l(drain_lock_, try_to_lock);
+    if (l.owns_lock()) drain();
+  }
+
+  void set_file(const string &file) {
+    unique_lock<mutex> l(drain_lock_);
+    drain();
+    FILE *handle = stdout;
+    if (!file.empty()) {
+      handle = fopen(file.c_str(), "a");
+      if (handle == nullptr) {
+        fprintf(sink_, "[logger]: Failed to open log file %s\n", file.c_str());
+        fflush(sink_);
+        return;
+      }
+    }
+    if (sink_ != stdout) fclose(sink_);
+    sink_ = handle;
+  }
+
+  // called outside the loader lock, e.g. from release_model, the thread is gone before the
+  // code it runs is unmapped
+  void shutdown() {
+    unique_lock<mutex> l(shutdown_lock_);
+    if (!worker_.joinable()) return;
+    __log_async.store(false);
+    stop_.store(true);
+    worker_.join();
+    g_coarse_ms.store(0, memory_order_relaxed);
+    flush();
+  }
+
+  unsigned long long dropped() const { return dropped_total_.load(); }
+
+ private:
+  struct Cell {
+    atomic<uint64_t> sequence;
+    LogRecord record;
+  };
+
+  void run() {
+    while (!stop_.load(memory_order_relaxed)) {
+      g_coarse_ms.store(now_ms(), memory_order_relaxed);
+      bool busy = false;
+      {
+        unique_lock<mutex> l(drain_lock_);
+        busy = drain();
+      }
+      if (!busy) this_thread::sleep_for(chrono::milliseconds(LOG_DRAIN_INTERVAL_MS));
+    }
+  }
+
+  // with drain_lock_ held, returns whether anything was written
+  bool drain() {
+    int written = 0;
+    for (;;) {
+      Cell &cell = cells_[dequeue_ & (LOG_RING_SIZE - 1)];
+      uint64_t seq = cell.sequence.load(memory_order_acquire);
+      if (seq != dequeue_ + 1) break;
+
+      write(cell.record);
+      cell.sequence.store(dequeue_ + LOG_RING_SIZE, memory_order_release);
+      dequeue_++;
+      written++;
+    }
+
+    unsigned long long dropped = dropped_.exchange(0, memory_order_relaxed);
+    if (dropped > 0) {
+      fprintf(sink_, "[logger]: %llu messages dropped, the ring is full\n", dropped);
+      written++;
+    }
+    if (written > 0) fflush(sink_);
+    return written > 0;
+  }
+
+  void write(const LogRecord &record) {
+    static const char *prefixes[] = {"[debug]", "", "[warning]", "[error]", "[fatal]"};
+    line_.clear();
+    format_message(record, line_);
+    fprintf(sink_, "%s[%s:%d]: %s\n", prefixes[(int)record.level], file_name(record.file),
+            record.line, line_.c_str());
+  }
+
+  Cell *cells_;
+  atomic<uint64_t> enqueue_{0};
+  atomic<unsigned long long> dropped_{0};  // since the last drain
+  atomic<unsigned long long> dropped_total_{0};
+  uint64_t dequeue_ = 0;
+  mutex drain_lock_;
+  FILE *sink_ = stdout;
+  string line_;
+  thread worker_;
+  atomic<bool> stop_{false};
+  mutex shutdown_lock_;
+};
+
+// leaked on purpose, records may still be logged while static objects are destroyed
+static Logger *logger() {
+  static Logger *instance = nullptr;
+  static once_flag once;
+  call_once(once, [] {
+    instance = new Logger();
+    atexit([] { instance->flush_at_exit(); });
+  });
+  return instance;
+}
+
+LogRecord *__log_begin(uint64_t *position) { return logger()->begin(position); }
+void __log_end(uint64_t position) { logger()->end(position); }
+void __log_sync(const LogRecord &record) { logger()->sync(record); }
+
+void set_log_level(LogLevel level) { __log_min_level.store((int)level); }
+void set_log_file(const std::string &file) { logger()->set_file(file); }
+void set_log_rate_limit(int messages_per_second) { g_rate_limit.store(messages_per_second); }
+void log_flush() { logger()->flush(); }
+void log_shutdown() { logger()->shutdown(); }
+unsigned long long log_dropped() { return logger()->dropped(); }
+
+};  // namespace trt
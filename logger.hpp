@@ -0,0 +1,201 @@
+#ifndef __LOGGER_HPP__
+#define __LOGGER_HPP__
+
+// Asynchronous logger. A call site copies its format pointer and raw arguments into a slot of a
+// lock-free ring, a background thread formats and writes them to the sink (stdout or a file).
+// Formats must be string literals, they are read after the call returns. Fatal messages are
+// written synchronously, after everything queued before them, so they survive abort().
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <type_traits>
+
+namespace trt {
+
+enum class LogLevel : int { Debug = 0, Info = 1, Warning = 2, Error = 3, Fatal = 4 };
+
+const int LOG_MAX_ARGS = 16;
+const int LOG_TEXT_BYTES = 256;  // string arguments of one record, truncated beyond
+
+struct LogArg {
+  enum Kind : int { Signed = 0, Unsigned = 1, Float = 2, Pointer = 3, Text = 4 };
+  Kind kind;
+  union {
+    long long i;
+    unsigned long long u;
+    double d;
+    const void *p;
+    int text;  // offset in LogRecord::text
+  };
+};
+
+struct LogRecord {
+  LogLevel level;
+  const char *file;
+  int line;
+  const char *fmt;
+  int num_args;
+  int text_used;
+  LogArg args[LOG_MAX_ARGS];
+  char text[LOG_TEXT_BYTES];
+};
+
+// Allows limit messages per second per call site, the limit is global, 0 means unlimited.
+// Constant initialized, so the function static in the macros below costs no guard.
+class LogRateLimiter {
+ public:
+  constexpr LogRateLimiter() : window_(0), count_(0) {}
+  bool allow();
+  bool allow(int limit, long long now_ms);
+
+ private:
+  std::atomic<long long> window_;
+  std::atomic<int> count_;
+};
+
+void set_log_level(LogLevel level);
+void set_log_file(const std::string &file);  // empty for stdout
+void set_log_rate_limit(int messages_per_second);
+void log_flush();                  // blocks until every queued message is written
+unsigned long long log_dropped();  // messages lost to a full ring
+
+// Stops and joins the background thread after writing what is queued, to be called before the
+// library is unloaded. Later messages are written synchronously by the thread logging them.
+void log_shutdown();
+
+extern std::atomic<int> __log_min_level;
+inline bool log_enabled(LogLevel level) {
+  return (int)level >= __log_min_level.load(std::memory_order_relaxed);
+}
+
+extern std::atomic<bool> __log_async;  // false after log_shutdown
+
+LogRecord *__log_begin(uint64_t *position);  // nullptr when the ring is full
+void __log_end(uint64_t position);
+void __log_sync(const LogRecord &record);
+
+inline LogArg *__log_next(LogRecord &r) {
+  return r.num_args < LOG_MAX_ARGS ? &r.args[r.num_args++] : nullptr;
+}
+
+inline void __log_text(LogRecord &r, const char *value) {
+  LogArg *arg = __log_next(r);
+  if (arg == nullptr) return;
+  if (value == nullptr) value = "(null)";
+
+  arg->kind = LogArg::Text;
+  arg->text = LOG_TEXT_BYTES - 1;  // the last byte stays zero, an empty string
+  int room = LOG_TEXT_BYTES - 1 - r.text_used;
+  if (room <= 0) return;
+
+  int n = 0;
+  while (n < room - 1 && value[n]) {
+    r.text[r.text_used + n] = value[n];
+    ++n;
+  }
+  r.text[r.text_used + n] = 0;
+  arg->text = r.text_used;
+  r.text_used += n + 1;
+}
+
+inline void __log_arg(LogRecord &r, const std::string &value) { __log_text(r, value.c_str()); }
+
+template <typename T>
+inline void __log_arg(LogRecord &r, T value,
+                      typename std::enable_if<std::is_integral<T>::value>::type * = 0) {
+  LogArg *arg = __log_next(r);
+  if (arg == nullptr) return;
+  if (std::is_signed<T>::value) {
+    arg->kind = LogArg::Signed;
+    arg->i = (long long)value;
+  } else {
+    arg->kind = LogArg::Unsigned;
+    arg->u = (unsigned long long)value;
+  }
+}
+
+template <typename T>
+inline void __log_arg(LogRecord &r, T value,
+                      typename std::enable_if<std::is_enum<T>::value>::type * = 0) {
+  LogArg *arg = __log_next(r);
+  if (arg == nullptr) return;
+  arg->kind = LogArg::Signed;
+  arg->i = (long long)value;
+}
+
+template <typename T>
+inline void __log_arg(LogRecord &r, T value,
+                      typename std::enable_if<std::is_floating_point<T>::value>::type * = 0) {
+  LogArg *arg = __log_next(r);
+  if (arg == nullptr) return;
+  arg->kind = LogArg::Float;
+  arg->d = (double)value;
+}
+
+template <typename T>
+inline void __log_arg(LogRecord &r, T value,
+                      typename std::enable_if<std::is_pointer<T>::value>::type * = 0) {
+  typedef typename std::remove_cv<typename std::remove_pointer<T>::type>::type Pointee;
+  if (std::is_same<Pointee, char>::value) {
+    __log_text(r, (const char *)value);
+    return;
+  }
+
+  LogArg *arg = __log_next(r);
+  if (arg == nullptr) return;
+  arg->kind = LogArg::Pointer;
+  arg->p = (const void *)value;
+}
+
+inline void __log_pack(LogRecord &r) {}
+
+template <typename T, typename... Args>
+inline void __log_pack(LogRecord &r, T value, Args... args) {
+  __log_arg(r, value);
+  __log_pack(r, args...);
+}
+
+template <typename... Args>
+void __log_func(LogLevel level, const char *file, int line, const char *fmt, Args... args) {
+  LogRecord local;
+  uint64_t position = 0;
+  LogRecord *record = &local;
+  bool async = level != LogLevel::Fatal && __log_async.load(std::memory_order_relaxed);
+  if (async) {
+    record = __log_begin(&position);
+    if (record == nullptr) return;
+  }
+
+  record->level = level;
+  record->file = file;
+  record->line = line;
+  record->fmt = fmt;
+  record->num_args = 0;
+  record->text_used = 0;
+  record->text[LOG_TEXT_BYTES - 1] = 0;
+  __log_pack(*record, args...);
+
+  if (async)
+    __log_end(position);
+  else
+    __log_sync(local);
+}
+
+#define __TRT_LOG(level, ...)                                  \
+  do {                                                         \
+    static trt::LogRateLimiter ___log_limiter__;               \
+    if (trt::log_enabled(level) && ___log_limiter__.allow())   \
+      trt::__log_func(level, __FILE__, __LINE__, __VA_ARGS__); \
+  } while (0)
+
+#define INFOD(...) __TRT_LOG(trt::LogLevel::Debug, __VA_ARGS__)
+#define INFO(...) __TRT_LOG(trt::LogLevel::Info, __VA_ARGS__)
+#define INFOW(...) __TRT_LOG(trt::LogLevel::Warning, __VA_ARGS__)
+#define INFOE(...) __TRT_LOG(trt::LogLevel::Error, __VA_ARGS__)
+#define INFOF(...) trt::__log_func(trt::LogLevel::Fatal, __FILE__, __LINE__, __VA_ARGS__)
+
+};  // namespace trt
+
+#endif  // __LOGGER_HPP__
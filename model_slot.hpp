@@ -0,0 +1,101 @@
+#ifndef __MODEL_SLOT_HPP__
+#define __MODEL_SLOT_HPP__
+
+// The model callers run on, replaceable while they run. Callers take a snapshot with get() and
+// use it until they return, a swap publishes the next model atomically: calls in flight finish
+// on the previous one, which is released with the last snapshot, and the following calls get
+// the next one. reload() loads and warms the next model on a thread of its own so that the
+// callers never wait for a deserialization. The loader is injected and may be a stub. The owner
+// joins the loader thread with wait() before the code it runs is unloaded.
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace model {
+
+enum class ReloadStatus : int { Idle = 0, Loading = 1, Done = 2, Failed = 3 };
+
+template <typename T>
+class Slot {
+ public:
+  typedef std::function<std::shared_ptr<T>()> Loader;
+
+  Slot() = default;
+  Slot(const Slot &other) = delete;
+  Slot &operator=(const Slot &other) = delete;
+  // Never blocks: the slot may be a global of a dll, destroyed under the loader lock where
+  // joining a thread deadlocks. Call wait() before, e.g. from an unload export; a reload still
+  // running here is detached and publishes into the state it shares, released after it.
+  virtual ~Slot() {
+    if (worker_.joinable()) worker_.detach();
+  }
+
+  // nullptr when no model is published
+  std::shared_ptr<T> get() const { return std::atomic_load(&state_->current); }
+
+  // publishes next, returns the previous model which stays valid for its holders
+  std::shared_ptr<T> exchange(std::shared_ptr<T> next) {
+    return state_->exchange(std::move(next));
+  }
+
+  void reset() { exchange(nullptr); }
+
+  // Runs loader in the background and publishes what it returns, a nullptr leaves the current
+  // model in place and ends in Failed. false when a reload is still running.
+  bool reload(const Loader &loader) {
+    std::unique_lock<std::mutex> l(lock_);
+    if (state_->status == ReloadStatus::Loading) return false;
+    if (worker_.joinable()) worker_.join();
+
+    state_->status = ReloadStatus::Loading;
+    std::shared_ptr<State> state = state_;
+    worker_ = std::thread([state, loader]() {
+      std::shared_ptr<T> next;
+      try {
+        next = loader();
+      } catch (...) {
+        next = nullptr;
+      }
+      bool loaded = next != nullptr;
+      // the previous model goes with the last caller still holding it
+      if (loaded) state->exchange(std::move(next));
+      state->status = loaded ? ReloadStatus::Done : ReloadStatus::Failed;
+    });
+    return true;
+  }
+
+  ReloadStatus status() const { return state_->status; }
+  // count of the models published so far, a caller sees a swap as a change of it
+  unsigned int generation() const { return state_->generation; }
+
+  // waits for the running reload
+  void wait() {
+    std::unique_lock<std::mutex> l(lock_);
+    if (worker_.joinable()) worker_.join();
+  }
+
+ private:
+  // shared with the loader thread, which never touches the slot itself
+  struct State {
+    std::shared_ptr<T> current;
+    std::atomic<unsigned int> generation{0};
+    std::atomic<ReloadStatus> status{ReloadStatus::Idle};
+
+    std::shared_ptr<T> exchange(std::shared_ptr<T> next) {
+      std::shared_ptr<T> previous = std::atomic_exchange(&current, next);
+      generation++;
+      return previous;
+    }
+  };
+
+  std::shared_ptr<State> state_ = std::make_shared<State>();
+  std::mutex lock_;  // of worker_
+  std::thread worker_;
+};
+
+};  // namespace model
+
+#endif  // __MODEL_SLOT_HPP__
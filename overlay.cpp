@@ -0,0 +1,236 @@
+#include "overlay.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OVERLAY_USE_SSE2
+#endif
+
+namespace overlay {
+
+using namespace std;
+
+const unsigned char MASK_LEVEL = 128;  // sigmoid 0.5, see yolo::mask_level
+
+uint32_t pack_color(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+  uint8_t bytes[4] = {r, g, b, a};
+  uint32_t color;
+  memcpy(&color, bytes, sizeof(color));
+  return color;
+}
+
+static void fill_span(uint32_t *pixel, int count, uint32_t color) {
+  int i = 0;
+#ifdef OVERLAY_USE_SSE2
+  __m128i value = _mm_set1_epi32((int)color);
+  for (; i + 16 <= count; i += 16) {
+    _mm_storeu_si128((__m128i *)(pixel + i), value);
+    _mm_storeu_si128((__m128i *)(pixel + i + 4), value);
+    _mm_storeu_si128((__m128i *)(pixel + i + 8), value);
+    _mm_storeu_si128((__m128i *)(pixel + i + 12), value);
+  }
+  for (; i + 4 <= count; i += 4) _mm_storeu_si128((__m128i *)(pixel + i), value);
+#endif
+  for (; i < count; ++i) pixel[i] = color;
+}
+
+void fill_rect(Canvas &canvas, int left, int top, int right, int bottom, uint32_t color) {
+  left = max(left, 0);
+  top = max(top, 0);
+  right = min(right, canvas.width);
+  bottom = min(bottom, canvas.height);
+  if (canvas.data == nullptr || left >= right || top >= bottom) return;
+
+  for (int y = top; y < bottom; ++y) {
+    uint32_t *line = (uint32_t *)(canvas.data + y * canvas.stride);
+    fill_span(line + left, right - left, color);
+  }
+}
+
+void stroke_rect(Canvas &canvas, int left, int top, int right, int bottom, int thickness,
+                 uint32_t color) {
+  int lo = thickness / 2;
+  int hi = thickness - lo;
+  fill_rect(canvas, left - lo, top - lo, right + hi, top + hi, color);
+  fill_rect(canvas, left - lo, bottom - lo, right + hi, bottom + hi, color);
+  fill_rect(canvas, left - lo, top + hi, left + hi, bottom - lo, color);
+  fill_rect(canvas, right - lo, top + hi, right + hi, bottom - lo, color);
+}
+
+// mask bytes of box covering the box, width x height, nullptr without mask
+static const unsigned char *box_mask(const yolo::Box &box, int &width, int &height,
+                                     vector<unsigned char> &buffer) {
+  if (box.seg && box.seg->data) {
+    width = box.seg->width;
+    height = box.seg->height;
+    return box.seg->data;
+  }
+  if (box.rle == nullptr || box.rle->width <= 0 || box.rle->height <= 0) return nullptr;
+
+  width = box.rle->width;
+  height = box.rle->height;
+  buffer.assign((size_t)width * height, 0);
+  size_t p = 0;
+  unsigned char value = 0;
+  for (uint32_t run : box.rle->counts) {
+    size_t end = min(p + run, buffer.size());
+    if (value) fill(buffer.begin() + p, buffer.begin() + end, value);
+    p = end;
+    value = 255 - value;
+  }
+  return buffer.data();
+}
+
+void blend_mask(Canvas &canvas, const yolo::Box &box, uint32_t color) {
+  vector<unsigned char> buffer;
+  int mask_width = 0, mask_height = 0;
+  const unsigned char *mask = box_mask(box, mask_width, mask_height, buffer);
+  int left = box.left, top = box.top, right = box.right, bottom = box.bottom;
+  int box_width = right - left, box_height = bottom - top;
+  if (mask == nullptr || canvas.data == nullptr || box_width <= 0 || box_height <= 0) return;
+
+  unsigned char rgb[4];
+  memcpy(rgb, &color, sizeof(rgb));
+  int x0 = max(left, 0), x1 = min(right, canvas.width);
+  int y0 = max(top, 0), y1 = min(bottom, canvas.height);
+  for (int y = y0; y < y1; ++y) {
+    const unsigned char *row = mask + (size_t)((y - top) * mask_height / box_height) * mask_width;
+    unsigned char *pixel = canvas.data + y * canvas.stride + x0 * 4;
+    for (int x = x0; x < x1; ++x, pixel += 4) {
+      if (row[(x - left) * mask_width / box_width] < MASK_LEVEL) continue;
+      pixel[0] = (pixel[0] + rgb[0] + 1) / 2;
+      pixel[1] = (pixel[1] + rgb[1] + 1) / 2;
+      pixel[2] = (pixel[2] + rgb[2] + 1) / 2;
+    }
+  }
+}
+
+Font bake_font(double font_scale, int font_thickness) {
+  const int font_face = cv::FONT_HERSHEY_SIMPLEX;
+  int pad = font_thickness + 1;
+  Font font;
+  font.thickness = font_thickness;
+  for (int c = FIRST_GLYPH; c <= LAST_GLYPH; ++c) {
+    string text(1, (char)c);
+    int baseline = 0;
+    cv::Size size = cv::getTextSize(text, font_face, font_scale, font_thickness, &baseline);
+
+    int ascent = size.height + font_thickness;
+    int width = size.width + pad * 2;
+    int height = ascent + baseline + pad * 2;
+    cv::Mat mask = cv::Mat::zeros(height, width, CV_8UC1);
+    cv::putText(mask, text, cv::Point(pad, pad + ascent), font_face, font_scale,
+                cv::Scalar::all(255), font_thickness, cv::LINE_AA);
+
+    // getTextSize adds the thickness once per string, not per glyph
+    Glyph &glyph = font.glyphs[c - FIRST_GLYPH];
+    glyph.advance = size.width - font_thickness;
+    glyph.width = width;
+    glyph.height = height;
+    glyph.offset_x = -pad;
+    glyph.offset_y = -pad - ascent;
+    glyph.offset = font.atlas.size();
+    for (int y = 0; y < height; ++y)
+      font.atlas.insert(font.atlas.end(), mask.ptr<unsigned char>(y),
+                        mask.ptr<unsigned char>(y) + width);
+  }
+  return font;
+}
+
+class RendererImpl : public Renderer {
+ public:
+  int box_thickness_ = 5;
+  Font font_;
+
+  const Glyph &glyph(char c) const {
+    if (c < FIRST_GLYPH || c > LAST_GLYPH) c = '?';
+    return font_.glyphs[c - FIRST_GLYPH];
+  }
+
+  virtual int text_width(const char *text) override {
+    int width = 0;
+    for (const char *p = text; *p; ++p) width += glyph(*p).advance;
+    return width + font_.thickness;
+  }
+
+  virtual void draw_text(Canvas &canvas, int x, int baseline, const char *text,
+                         uint32_t color) override {
+    unsigned char rgb[4];
+    memcpy(rgb, &color, sizeof(rgb));
+
+    for (const char *p = text; *p; x += glyph(*p).advance, ++p) {
+      const Glyph &g = glyph(*p);
+      int gx = x + g.offset_x;
+      int gy = baseline + g.offset_y;
+      int x0 = max(gx, 0), x1 = min(gx + g.width, canvas.width);
+      int y0 = max(gy, 0), y1 = min(gy + g.height, canvas.height);
+      for (int y = y0; y < y1; ++y) {
+        const unsigned char *alpha = &font_.atlas[g.offset + (y - gy) * g.width + (x0 - gx)];
+        unsigned char *pixel = canvas.data + y * canvas.stride + x0 * 4;
+        for (int ix = x0; ix < x1; ++ix, ++alpha, pixel += 4) {
+          int a = *alpha;
+          if (a == 0) continue;
+          int ia = 255 - a;
+          pixel[0] = (pixel[0] * ia + rgb[0] * a + 127) / 255;
+          pixel[1] = (pixel[1] * ia + rgb[1] * a + 127) / 255;
+          pixel[2] = (pixel[2] * ia + rgb[2] * a + 127) / 255;
+        }
+      }
+    }
+  }
+
+  virtual void draw_boxes(Canvas &canvas, const yolo::BoxArray &boxes,
+                          const vector<string> &class_names) override {
+    for (auto &obj : boxes) {
+      if (obj.seg == nullptr && obj.rle == nullptr) continue;
+      uint8_t b, g, r;
+      tie(b, g, r) = yolo::random_color(obj.class_label);
+      blend_mask(canvas, obj, pack_color(r, g, b));
+    }
+
+    const uint32_t black = pack_color(0, 0, 0);
+    char caption[256];
+    for (auto &obj : boxes) {
+      uint8_t b, g, r;
+      tie(b, g, r) = yolo::random_color(obj.class_label);
+      uint32_t color = pack_color(r, g, b);
+
+      int left = obj.left, top = obj.top, right = obj.right, bottom = obj.bottom;
+      stroke_rect(canvas, left, top, right, bottom, box_thickness_, color);
+
+      if (obj.class_label >= 0 && obj.class_label < (int)class_names.size())
+        snprintf(caption, sizeof(caption), "%s %.2f", class_names[obj.class_label].c_str(),
+                 obj.confidence);
+      else
+        snprintf(caption, sizeof(caption), "%d %.2f", obj.class_label, obj.confidence);
+      if (obj.sub_label >= 0) {
+        size_t used = strlen(caption);
+        snprintf(caption + used, sizeof(caption) - used, " | %d %.2f", obj.sub_label,
+                 obj.sub_confidence);
+      }
+
+      int width = text_width(caption) + 10;
+      fill_rect(canvas, left - 3, top - 33, left + width + 1, top + 1, color);
+      draw_text(canvas, left, top - 5, caption, black);
+    }
+  }
+};
+
+std::shared_ptr<Renderer> create_renderer(int box_thickness, double font_scale,
+                                          int font_thickness) {
+  return create_renderer(bake_font(font_scale, font_thickness), box_thickness);
+}
+
+std::shared_ptr<Renderer> create_renderer(const Font &font, int box_thickness) {
+  shared_ptr<RendererImpl> instance(new RendererImpl());
+  instance->box_thickness_ = box_thickness;
+  instance->font_ = font;
+  return instance;
+}
+
+};  // namespace overlay
@@ -0,0 +1,79 @@
+#ifndef __OVERLAY_HPP__
+#define __OVERLAY_HPP__
+
+// Draws detection results straight into a 4 bytes per pixel image (the NI RGB32 buffer),
+// without converting or copying the frame.
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "yolo.hpp"
+
+namespace overlay {
+
+struct Canvas {
+  unsigned char *data = nullptr;
+  int width = 0, height = 0;
+  size_t stride = 0;  // bytes per line, >= width * 4
+
+  Canvas() = default;
+  Canvas(void *data, int width, int height, size_t stride)
+      : data((unsigned char *)data), width(width), height(height), stride(stride) {}
+};
+
+// byte order of one pixel in memory: r, g, b, a
+uint32_t pack_color(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 255);
+
+// fill [left, right) x [top, bottom), clipped to the canvas
+void fill_rect(Canvas &canvas, int left, int top, int right, int bottom, uint32_t color);
+
+// outline centered on the rectangle edges, same geometry as cv::rectangle with thickness
+void stroke_rect(Canvas &canvas, int left, int top, int right, int bottom, int thickness,
+                 uint32_t color);
+
+// half way blend of color over the pixels of the box where its mask (Box::seg from 128 up or
+// Box::rle, both covering the box) is foreground, nearest sampled
+void blend_mask(Canvas &canvas, const yolo::Box &box, uint32_t color);
+
+const int FIRST_GLYPH = 32;  // printable ascii
+const int LAST_GLYPH = 126;
+
+struct Glyph {
+  int advance = 0;
+  int width = 0, height = 0;
+  int offset_x = 0, offset_y = 0;  // top left relative to pen position and baseline
+  size_t offset = 0;               // into Font::atlas
+};
+
+// alpha coverage of every printable ascii glyph
+struct Font {
+  int thickness = 0;  // stroke width, added once to the width of a text
+  Glyph glyphs[LAST_GLYPH - FIRST_GLYPH + 1];
+  std::vector<unsigned char> atlas;
+};
+
+// rasterizes the glyphs once with cv::putText in the Hershey simplex font
+Font bake_font(double font_scale = 1.0, int font_thickness = 2);
+
+class Renderer {
+ public:
+  virtual ~Renderer() = default;
+  virtual int text_width(const char *text) = 0;
+  virtual void draw_text(Canvas &canvas, int x, int baseline, const char *text,
+                         uint32_t color) = 0;
+
+  // mask of every box that has one, then box outline plus "name confidence" caption
+  virtual void draw_boxes(Canvas &canvas, const yolo::BoxArray &boxes,
+                          const std::vector<std::string> &class_names) = 0;
+};
+
+std::shared_ptr<Renderer> create_renderer(int box_thickness = 5, double font_scale = 1.0,
+                                          int font_thickness = 2);
+std::shared_ptr<Renderer> create_renderer(const Font &font, int box_thickness = 5);
+
+};  // namespace overlay
+
+#endif  // __OVERLAY_HPP__
@@ -0,0 +1,498 @@
+#include "postprocess.hpp"
+
+#include <ctype.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace yolo {
+
+using namespace std;
+
+namespace host {
+
+static void affine_project(const float *matrix, float x, float y, float *ox, float *oy) {
+  *ox = matrix[0] * x + matrix[1] * y + matrix[2];
+  *oy = matrix[3] * x + matrix[4] * y + matrix[5];
+}
+
+static float box_iou(float aleft, float atop, float aright, float abottom, float bleft,
+                     float btop, float bright, float bbottom) {
+  float cleft = max(aleft, bleft);
+  float ctop = max(atop, btop);
+  float cright = min(aright, bright);
+  float cbottom = min(abottom, bbottom);
+
+  float c_area = max(cright - cleft, 0.0f) * max(cbottom - ctop, 0.0f);
+  if (c_area == 0.0f) return 0.0f;
+
+  float a_area = max(0.0f, aright - aleft) * max(0.0f, abottom - atop);
+  float b_area = max(0.0f, bright - bleft) * max(0.0f, bbottom - btop);
+  return c_area / (a_area + b_area - c_area);
+}
+
+void decode(const float *predict, int num_bboxes, int num_classes, int output_cdim,
+            float confidence_threshold, const float *class_thresholds,
+            const float *invert_affine_matrix, float *parray, int max_image_boxes, Type type) {
+  bool is_v8 = type == Type::V8 || type == Type::V8Seg;
+  for (int position = 0; position < num_bboxes; ++position) {
+    const float *pitem = predict + output_cdim * position;
+    float objectness = 1.0f;
+    const float *class_confidence = pitem + 4;
+    if (!is_v8) {
+      objectness = pitem[4];
+      if (objectness < confidence_threshold) continue;
+      class_confidence = pitem + 5;
+    }
+
+    float confidence = -1.0f;
+    int label = -1;
+    for (int i = 0; i < num_classes; ++i) {
+      float score = class_confidence[i] * objectness;
+      if (score > confidence && score >= class_thresholds[i]) {
+        confidence = score;
+        label = i;
+      }
+    }
+    if (label < 0) continue;
+
+    int index = (int)parray[0];
+    parray[0] = index + 1;
+    if (index >= max_image_boxes) continue;
+
+    float cx = pitem[0];
+    float cy = pitem[1];
+    float width = pitem[2];
+    float height = pitem[3];
+    float left = cx - width * 0.5f;
+    float top = cy - height * 0.5f;
+    float right = cx + width * 0.5f;
+    float bottom = cy + height * 0.5f;
+    affine_project(invert_affine_matrix, left, top, &left, &top);
+    affine_project(invert_affine_matrix, right, bottom, &right, &bottom);
+
+    float *pout_item = parray + 1 + index * NUM_BOX_ELEMENT;
+    *pout_item++ = left;
+    *pout_item++ = top;
+    *pout_item++ = right;
+    *pout_item++ = bottom;
+    *pout_item++ = confidence;
+    *pout_item++ = label;
+    *pout_item++ = 1;  // 1 = keep, 0 = ignore
+    if (is_v8) *pout_item++ = position;
+  }
+}
+
+void end_to_end(int num_dets, const float *boxes, const float *scores, const void *classes,
+                bool integer_classes, int max_detections, float confidence_threshold,
+                const float *class_thresholds, int num_classes,
+                const float *invert_affine_matrix, float *parray) {
+  int count = min(max(num_dets, 0), max_detections);
+  parray[0] = count;
+  for (int position = 0; position < count; ++position) {
+    const float *pbox = boxes + position * 4;
+    float confidence = scores[position];
+    int label = integer_classes ? ((const int *)classes)[position]
+                                : (int)((const float *)classes)[position];
+    bool keep = confidence >= confidence_threshold &&
+                (label < 0 || label >= num_classes || confidence >= class_thresholds[label]);
+
+    float left, top, right, bottom;
+    affine_project(invert_affine_matrix, pbox[0], pbox[1], &left, &top);
+    affine_project(invert_affine_matrix, pbox[2], pbox[3], &right, &bottom);
+
+    float *pout_item = parray + 1 + position * NUM_BOX_ELEMENT;
+    *pout_item++ = left;
+    *pout_item++ = top;
+    *pout_item++ = right;
+    *pout_item++ = bottom;
+    *pout_item++ = confidence;
+    *pout_item++ = label;
+    *pout_item++ = keep ? 1 : 0;
+    *pout_item++ = position;
+  }
+}
+
+// one instantiation of the decode kernels in yolo.cu, CLASSES 0 loops over num_classes
+template <int CLASSES, bool OBJECTNESS>
+static void decode_rows(const float *predict, int num_bboxes, int num_classes, int output_cdim,
+                        float confidence_threshold, const float *class_thresholds,
+                        const float *invert_affine_matrix, float *parray, int max_image_boxes) {
+  const int count = CLASSES > 0 ? CLASSES : num_classes;
+  for (int position = 0; position < num_bboxes; ++position) {
+    const float *pitem = predict + output_cdim * position;
+    float objectness = 1.0f;
+    if (OBJECTNESS) {
+      objectness = pitem[4];
+      if (objectness < confidence_threshold) continue;
+    }
+
+    const float *class_confidence = pitem + (OBJECTNESS ? 5 : 4);
+    float confidence = -1.0f;
+    int label = -1;
+    for (int i = 0; i < count; ++i) {
+      float score = class_confidence[i] * objectness;
+      if (score > confidence && score >= class_thresholds[i]) {
+        confidence = score;
+        label = i;
+      }
+    }
+    if (label < 0) continue;
+
+    int index = (int)parray[0];
+    parray[0] = index + 1;
+    if (index >= max_image_boxes) continue;
+
+    float left = pitem[0] - pitem[2] * 0.5f;
+    float top = pitem[1] - pitem[3] * 0.5f;
+    float right = pitem[0] + pitem[2] * 0.5f;
+    float bottom = pitem[1] + pitem[3] * 0.5f;
+    affine_project(invert_affine_matrix, left, top, &left, &top);
+    affine_project(invert_affine_matrix, right, bottom, &right, &bottom);
+
+    float *pout_item = parray + 1 + index * NUM_BOX_ELEMENT;
+    *pout_item++ = left;
+    *pout_item++ = top;
+    *pout_item++ = right;
+    *pout_item++ = bottom;
+    *pout_item++ = confidence;
+    *pout_item++ = label;
+    *pout_item++ = 1;  // 1 = keep, 0 = ignore
+    if (!OBJECTNESS) *pout_item++ = position;
+  }
+}
+
+template <bool OBJECTNESS>
+static void decode_classes(const float *predict, int num_bboxes, int num_classes, int output_cdim,
+                           float confidence_threshold, const float *class_thresholds,
+                           const float *invert_affine_matrix, float *parray,
+                           int max_image_boxes, int classes) {
+  auto function = decode_rows<0, OBJECTNESS>;
+  switch (classes) {
+    case 1:
+      function = decode_rows<1, OBJECTNESS>;
+      break;
+    case 2:
+      function = decode_rows<2, OBJECTNESS>;
+      break;
+    case 4:
+      function = decode_rows<4, OBJECTNESS>;
+      break;
+    case 80:
+      function = decode_rows<80, OBJECTNESS>;
+      break;
+    default:
+      break;
+  }
+  function(predict, num_bboxes, num_classes, output_cdim, confidence_threshold, class_thresholds,
+           invert_affine_matrix, parray, max_image_boxes);
+}
+
+void decode(const float *predict, int num_bboxes, int num_classes, int output_cdim,
+            float confidence_threshold, const float *class_thresholds,
+            const float *invert_affine_matrix, float *parray, int max_image_boxes,
+            const DecodeVariant &variant) {
+  if (variant.objectness)
+    decode_classes<true>(predict, num_bboxes, num_classes, output_cdim, confidence_threshold,
+                         class_thresholds, invert_affine_matrix, parray, max_image_boxes,
+                         variant.classes);
+  else
+    decode_classes<false>(predict, num_bboxes, num_classes, output_cdim, confidence_threshold,
+                          class_thresholds, invert_affine_matrix, parray, max_image_boxes,
+                          variant.classes);
+}
+
+void fast_nms(float *parray, int max_image_boxes, float threshold) {
+  int count = min((int)parray[0], max_image_boxes);
+
+  // flags are written after the pass, the kernel reads keepflags of no other box
+  vector<char> keep(count, 1);
+  for (int position = 0; position < count; ++position) {
+    const float *pcurrent = parray + 1 + position * NUM_BOX_ELEMENT;
+    for (int i = 0; i < count; ++i) {
+      const float *pitem = parray + 1 + i * NUM_BOX_ELEMENT;
+      if (i == position || pcurrent[5] != pitem[5]) continue;
+
+      if (pitem[4] >= pcurrent[4]) {
+        if (pitem[4] == pcurrent[4] && i < position) continue;
+
+        float iou = box_iou(pcurrent[0], pcurrent[1], pcurrent[2], pcurrent[3], pitem[0],
+                            pitem[1], pitem[2], pitem[3]);
+        if (iou > threshold) {
+          keep[position] = 0;
+          break;
+        }
+      }
+    }
+  }
+
+  for (int position = 0; position < count; ++position) {
+    if (!keep[position]) parray[1 + position * NUM_BOX_ELEMENT + 6] = 0;
+  }
+}
+
+void decode(const float *predict, int num_images, int num_bboxes, int num_classes,
+            int output_cdim, float confidence_threshold, const float *class_thresholds,
+            const float *invert_affine_matrices, float *parrays, size_t stride,
+            int max_image_boxes, const DecodeVariant &variant) {
+  for (int ib = 0; ib < num_images; ++ib) {
+    float *parray = parrays + ib * stride;
+    parray[0] = 0;
+    decode(predict + (size_t)ib * num_bboxes * output_cdim, num_bboxes, num_classes, output_cdim,
+           confidence_threshold, class_thresholds, invert_affine_matrices + ib * 6, parray,
+           max_image_boxes, variant);
+  }
+}
+
+void fast_nms(float *parrays, size_t stride, int num_images, int max_image_boxes,
+              float threshold) {
+  for (int ib = 0; ib < num_images; ++ib)
+    fast_nms(parrays + ib * stride, max_image_boxes, threshold);
+}
+
+void decode_single_mask(int left, int top, const float *mask_weights, const float *mask_predict,
+                        int mask_width, int mask_height, unsigned char *mask_out, int mask_dim,
+                        int out_width, int out_height) {
+  for (int dy = 0; dy < out_height; ++dy) {
+    for (int dx = 0; dx < out_width; ++dx) {
+      int sx = left + dx;
+      int sy = top + dy;
+      if (sx < 0 || sx >= mask_width || sy < 0 || sy >= mask_height) {
+        mask_out[dy * out_width + dx] = 0;
+        continue;
+      }
+
+      float cumprod = 0;
+      for (int ic = 0; ic < mask_dim; ++ic)
+        cumprod += mask_predict[(ic * mask_height + sy) * mask_width + sx] * mask_weights[ic];
+
+      float alpha = 1.0f / (1.0f + exp(-cumprod));
+      mask_out[dy * out_width + dx] = alpha * 255;
+    }
+  }
+}
+
+void encode_rle(const unsigned char *mask, int width, int height, unsigned char level,
+                MaskRLE &output) {
+  output.width = width;
+  output.height = height;
+  output.counts.clear();
+  int pixels = width * height;
+  bool foreground = false;
+  uint32_t run = 0;
+  for (int p = 0; p < pixels; ++p) {
+    if ((mask[p] >= level) != foreground) {
+      output.counts.push_back(run);
+      foreground = !foreground;
+      run = 0;
+    }
+    run++;
+  }
+  output.counts.push_back(run);
+}
+
+void rle_from_transitions(const unsigned int *transitions, int count, int width, int height,
+                          MaskRLE &output) {
+  output.width = width;
+  output.height = height;
+  output.counts.resize(count + 1);
+  uint32_t previous = 0;
+  for (int i = 0; i < count; ++i) {
+    output.counts[i] = transitions[i] - previous;
+    previous = transitions[i];
+  }
+  output.counts[count] = (uint32_t)(width * height) - previous;
+}
+
+void decode_rle(const MaskRLE &rle, unsigned char *mask) {
+  size_t p = 0;
+  unsigned char value = 0;
+  for (uint32_t run : rle.counts) {
+    memset(mask + p, value, run);
+    p += run;
+    value = 255 - value;
+  }
+}
+
+void collect(const float *parray, int max_image_boxes, BoxArray &output) {
+  int count = min(max_image_boxes, (int)parray[0]);
+  output.clear();
+  output.reserve(count);
+  for (int i = 0; i < count; ++i) {
+    const float *pbox = parray + 1 + i * NUM_BOX_ELEMENT;
+    if ((int)pbox[6] != 1) continue;
+    output.emplace_back(pbox[0], pbox[1], pbox[2], pbox[3], pbox[4], (int)pbox[5]);
+  }
+}
+
+int count_kept(const float *parray, int max_image_boxes) {
+  int count = min(max_image_boxes, (int)parray[0]);
+  int kept = 0;
+  for (int i = 0; i < count; ++i) kept += (int)parray[1 + i * NUM_BOX_ELEMENT + 6] == 1;
+  return kept;
+}
+
+void count(const float *parray, int max_image_boxes, int num_classes, const CountZone *zones,
+           int num_zones, int *counts) {
+  int count = min(max_image_boxes, (int)parray[0]);
+  for (int i = 0; i < count; ++i) {
+    const float *pbox = parray + 1 + i * NUM_BOX_ELEMENT;
+    int label = pbox[5];
+    if ((int)pbox[6] != 1 || label < 0 || label >= num_classes) continue;
+
+    counts[label]++;
+    float cx = (pbox[0] + pbox[2]) * 0.5f;
+    float cy = (pbox[1] + pbox[3]) * 0.5f;
+    for (int z = 0; z < num_zones; ++z) {
+      const CountZone &zone = zones[z];
+      if (cx >= zone.left && cx < zone.right && cy >= zone.top && cy < zone.bottom)
+        counts[(1 + z) * num_classes + label]++;
+    }
+  }
+}
+
+void collect(const float *parrays, size_t stride, int num_images, int max_image_boxes,
+             BoxBatch &output) {
+  int total = 0;
+  for (int ib = 0; ib < num_images; ++ib)
+    total += count_kept(parrays + ib * stride, max_image_boxes);
+
+  output.reset(num_images, total);
+  for (int ib = 0; ib < num_images; ++ib) {
+    const float *parray = parrays + ib * stride;
+    int count = min(max_image_boxes, (int)parray[0]);
+    for (int i = 0; i < count; ++i) {
+      const float *pbox = parray + 1 + i * NUM_BOX_ELEMENT;
+      if ((int)pbox[6] != 1) continue;
+      output.append(ib, pbox[0], pbox[1], pbox[2], pbox[3], pbox[4], (int)pbox[5]);
+    }
+  }
+}
+
+};  // namespace host
+
+DecodeVariant select_decode(int num_classes, int output_cdim, Type type) {
+  DecodeVariant variant;
+  variant.objectness = !(type == Type::V8 || type == Type::V8Seg);
+  if (num_classes == 1 || num_classes == 2 || num_classes == 4 || num_classes == 80)
+    variant.classes = num_classes;
+  variant.vectorized = output_cdim % 4 == 0;
+  return variant;
+}
+
+const char *type_name(Type type) {
+  switch (type) {
+    case Type::V5:
+      return "YoloV5";
+    case Type::V3:
+      return "YoloV3";
+    case Type::V7:
+      return "YoloV7";
+    case Type::X:
+      return "YoloX";
+    case Type::V8:
+      return "YoloV8";
+    default:
+      return "Unknow";
+  }
+}
+
+std::tuple<uint8_t, uint8_t, uint8_t> hsv2bgr(float h, float s, float v) {
+  const int h_i = static_cast<int>(h * 6);
+  const float f = h * 6 - h_i;
+  const float p = v * (1 - s);
+  const float q = v * (1 - f * s);
+  const float t = v * (1 - (1 - f) * s);
+  float r, g, b;
+  switch (h_i) {
+    case 0:
+      r = v, g = t, b = p;
+      break;
+    case 1:
+      r = q, g = v, b = p;
+      break;
+    case 2:
+      r = p, g = v, b = t;
+      break;
+    case 3:
+      r = p, g = q, b = v;
+      break;
+    case 4:
+      r = t, g = p, b = v;
+      break;
+    case 5:
+      r = v, g = p, b = q;
+      break;
+    default:
+      r = 1, g = 1, b = 1;
+      break;
+  }
+  return make_tuple(static_cast<uint8_t>(b * 255), static_cast<uint8_t>(g * 255),
+                    static_cast<uint8_t>(r * 255));
+}
+
+std::tuple<uint8_t, uint8_t, uint8_t> random_color(int id) {
+  float h_plane = ((((unsigned int)id << 2) ^ 0x937151) % 100) / 100.0f;
+  float s_plane = ((((unsigned int)id << 3) ^ 0x315793) % 100) / 100.0f;
+  return hsv2bgr(h_plane, s_plane, 1);
+}
+
+static bool contains(const string &name, const char *word) {
+  string lower = name;
+  for (auto &c : lower) c = tolower(c);
+  return lower.find(word) != string::npos;
+}
+
+EndToEndBindings find_end_to_end(const vector<BindingInfo> &outputs) {
+  if (outputs.size() != 4) return EndToEndBindings();
+
+  // positions in outputs
+  int num_dets = -1, boxes = -1, scores = -1, classes = -1;
+  for (int i = 0; i < 4; ++i) {
+    const string &name = outputs[i].name;
+    if (contains(name, "num"))
+      num_dets = i;
+    else if (contains(name, "box"))
+      boxes = i;
+    else if (contains(name, "score"))
+      scores = i;
+    else if (contains(name, "class"))
+      classes = i;
+  }
+
+  if (num_dets < 0 || boxes < 0 || scores < 0 || classes < 0) {
+    num_dets = boxes = scores = classes = -1;
+    for (int i = 0; i < 4; ++i) {
+      const vector<int> &dims = outputs[i].dims;
+      if (dims.size() == 3 && dims[2] == 4)
+        boxes = i;
+      else if (dims.size() == 1 || (dims.size() == 2 && dims[1] == 1))
+        num_dets = i;
+      else if (dims.size() == 2 && outputs[i].integer)
+        classes = i;
+      else if (dims.size() == 2)
+        scores = i;
+    }
+    if (num_dets < 0 || boxes < 0 || scores < 0 || classes < 0) return EndToEndBindings();
+  }
+
+  const BindingInfo &b = outputs[boxes], &s = outputs[scores], &c = outputs[classes];
+  const BindingInfo &n = outputs[num_dets];
+  bool valid = b.dims.size() == 3 && b.dims[1] > 0 && b.dims[2] == 4 && !b.integer &&
+               s.dims.size() == 2 && s.dims[1] == b.dims[1] && !s.integer &&
+               c.dims.size() == 2 && c.dims[1] == b.dims[1] && n.integer &&
+               (n.dims.size() == 1 || (n.dims.size() == 2 && n.dims[1] == 1));
+  if (!valid) return EndToEndBindings();
+
+  EndToEndBindings found;
+  found.num_dets = n.index;
+  found.boxes = b.index;
+  found.scores = s.index;
+  found.classes = c.index;
+  found.max_detections = b.dims[1];
+  found.integer_classes = c.integer;
+  return found;
+}
+
+};  // namespace yolo
@@ -0,0 +1,184 @@
+#ifndef __POSTPROCESS_HPP__
+#define __POSTPROCESS_HPP__
+
+// Host reference of the box decode and NMS kernels in yolo.cu. Works on the same boxarray
+// layout: parray[0] is the candidate count, followed by max_image_boxes * NUM_BOX_ELEMENT.
+
+#include <algorithm>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "yolo.hpp"
+
+namespace yolo {
+
+const int NUM_BOX_ELEMENT = 8;  // left, top, right, bottom, confidence, class,
+                                // keepflag, row_index(output)
+const int MAX_IMAGE_BOXES = 1024;
+
+// letterbox mapping between the image and the network input
+struct AffineMatrix {
+  float i2d[6];  // image to dst(network), 2x3 matrix
+  float d2i[6];  // dst to image, 2x3 matrix
+
+  void compute(const std::tuple<int, int> &from, const std::tuple<int, int> &to) {
+    float scale_x = std::get<0>(to) / (float)std::get<0>(from);
+    float scale_y = std::get<1>(to) / (float)std::get<1>(from);
+    float scale = std::min(scale_x, scale_y);
+    i2d[0] = scale;
+    i2d[1] = 0;
+    i2d[2] = -scale * std::get<0>(from) * 0.5 + std::get<0>(to) * 0.5 + scale * 0.5 - 0.5;
+    i2d[3] = 0;
+    i2d[4] = scale;
+    i2d[5] = -scale * std::get<1>(from) * 0.5 + std::get<1>(to) * 0.5 + scale * 0.5 - 0.5;
+
+    double D = i2d[0] * i2d[4] - i2d[1] * i2d[3];
+    D = D != 0. ? double(1.) / D : double(0.);
+    double A11 = i2d[4] * D, A22 = i2d[0] * D, A12 = -i2d[1] * D, A21 = -i2d[3] * D;
+    double b1 = -A11 * i2d[2] - A12 * i2d[5];
+    double b2 = -A21 * i2d[2] - A22 * i2d[5];
+
+    d2i[0] = A11;
+    d2i[1] = A12;
+    d2i[2] = b1;
+    d2i[3] = A21;
+    d2i[4] = A22;
+    d2i[5] = b2;
+  }
+};
+
+// Where the mask of one kept box is decoded: left/top in segment head coordinates and the
+// output size. pbox is a boxarray item in image coordinates.
+struct MaskRegion {
+  float left = 0, top = 0;
+  int width = 0, height = 0;
+};
+
+inline MaskRegion mask_region(const float *i2d, const float *pbox, int network_width,
+                              int network_height, int segment_width, int segment_height) {
+  float left = i2d[0] * pbox[0] + i2d[1] * pbox[1] + i2d[2];
+  float top = i2d[3] * pbox[0] + i2d[4] * pbox[1] + i2d[5];
+  float right = i2d[0] * pbox[2] + i2d[1] * pbox[3] + i2d[2];
+  float bottom = i2d[3] * pbox[2] + i2d[4] * pbox[3] + i2d[5];
+
+  float scale_to_predict_x = segment_width / (float)network_width;
+  float scale_to_predict_y = segment_height / (float)network_height;
+  MaskRegion region;
+  region.left = left * scale_to_predict_x;
+  region.top = top * scale_to_predict_y;
+  region.width = (right - left) * scale_to_predict_x + 0.5f;
+  region.height = (bottom - top) * scale_to_predict_y + 0.5f;
+  return region;
+}
+
+// Decode compiled for one head, chosen once at load: the class loop is unrolled for the class
+// counts most models have and the head type decides the objectness column at compile time.
+struct DecodeVariant {
+  int classes = 0;          // 1, 2, 4 or 80, 0 for the loop over the runtime class count
+  bool objectness = false;  // v5 style head, the class scores follow an objectness column
+  bool vectorized = false;  // rows are 16 byte aligned, the kernel reads them as float4
+};
+
+DecodeVariant select_decode(int num_classes, int output_cdim, Type type);
+
+// mask bytes (sigmoid * 255) from this level up are foreground at a probability threshold
+inline unsigned char mask_level(float threshold) {
+  int level = (int)(threshold * 255 + 0.5f);
+  return (unsigned char)std::min(std::max(level, 1), 255);
+}
+
+// One output binding of an engine, as seen by the loader
+struct BindingInfo {
+  int index = -1;
+  std::string name;
+  std::vector<int> dims;
+  bool integer = false;  // int32 elements
+};
+
+// Outputs of an engine exported with the EfficientNMS or BatchedNMS plugin: num_dets [N, 1],
+// boxes [N, K, 4] as left, top, right, bottom in network input pixels, scores [N, K] and
+// classes [N, K], int32 for EfficientNMS and float for BatchedNMS. Fields are binding indices.
+struct EndToEndBindings {
+  int num_dets = -1, boxes = -1, scores = -1, classes = -1;
+  int max_detections = 0;  // K
+  bool integer_classes = true;
+
+  inline bool valid() const { return max_detections > 0; }
+};
+
+// Recognises the four end-to-end outputs by name (num*, *box*, *score*, *class*) or, when the
+// names are not conclusive, by shape and type. Invalid when outputs is anything else.
+EndToEndBindings find_end_to_end(const std::vector<BindingInfo> &outputs);
+
+namespace host {
+
+// class_thresholds has num_classes entries, a class is kept when its score reaches its
+// threshold, +inf disables the class. confidence_threshold is the smallest enabled one.
+void decode(const float *predict, int num_bboxes, int num_classes, int output_cdim,
+            float confidence_threshold, const float *class_thresholds,
+            const float *invert_affine_matrix, float *parray, int max_image_boxes, Type type);
+
+// Same as decode through the instantiation of variant (select_decode), the reference of the
+// specialized decode kernels. variant.vectorized only changes the loads of the kernels.
+void decode(const float *predict, int num_bboxes, int num_classes, int output_cdim,
+            float confidence_threshold, const float *class_thresholds,
+            const float *invert_affine_matrix, float *parray, int max_image_boxes,
+            const DecodeVariant &variant);
+
+void fast_nms(float *parray, int max_image_boxes, float threshold);
+
+// Reference of the batched decode and NMS launches: num_images heads num_bboxes * output_cdim
+// floats apart, their d2i 6 floats apart and boxarrays stride floats apart. The counters are
+// zeroed here like the strided memset of the device.
+void decode(const float *predict, int num_images, int num_bboxes, int num_classes,
+            int output_cdim, float confidence_threshold, const float *class_thresholds,
+            const float *invert_affine_matrices, float *parrays, size_t stride,
+            int max_image_boxes, const DecodeVariant &variant);
+void fast_nms(float *parrays, size_t stride, int num_images, int max_image_boxes,
+              float threshold);
+
+// sigmoid(mask_weights @ mask_predict) of one box, mask_predict is [mask_dim, height, width]
+void decode_single_mask(int left, int top, const float *mask_weights, const float *mask_predict,
+                        int mask_width, int mask_height, unsigned char *mask_out, int mask_dim,
+                        int out_width, int out_height);
+
+// Reference of the device mask encoder: runs of the bytes below level and from level up.
+void encode_rle(const unsigned char *mask, int width, int height, unsigned char level,
+                MaskRLE &output);
+
+// Runs from the positions where foreground starts or ends (the pixel before the first one is
+// background), what the device encoder copies back.
+void rle_from_transitions(const unsigned int *transitions, int count, int width, int height,
+                          MaskRLE &output);
+
+// 0 / 255 bitmap of width * height
+void decode_rle(const MaskRLE &rle, unsigned char *mask);
+
+// kept boxes of one boxarray, without segmentation
+void collect(const float *parray, int max_image_boxes, BoxArray &output);
+
+// Un-letterboxes the detections of one image of an end-to-end engine into a boxarray of
+// max_detections items, in the engine order. A detection is kept when its score reaches
+// confidence_threshold and, for labels below num_classes, its class threshold.
+void end_to_end(int num_dets, const float *boxes, const float *scores, const void *classes,
+                bool integer_classes, int max_detections, float confidence_threshold,
+                const float *class_thresholds, int num_classes,
+                const float *invert_affine_matrix, float *parray);
+
+// number of boxes kept by NMS in one boxarray
+int count_kept(const float *parray, int max_image_boxes);
+
+// Reference of the count kernel: counts has num_classes * (1 + num_zones) zeroed entries, the
+// classes first, then the classes of every zone. Labels outside [0, num_classes) are skipped.
+void count(const float *parray, int max_image_boxes, int num_classes, const CountZone *zones,
+           int num_zones, int *counts);
+
+// kept boxes of num_images boxarrays, stride floats apart, packed without segmentation
+void collect(const float *parrays, size_t stride, int num_images, int max_image_boxes,
+             BoxBatch &output);
+
+};  // namespace host
+};  // namespace yolo
+
+#endif  // __POSTPROCESS_HPP__
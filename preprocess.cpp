@@ -0,0 +1,146 @@
+#include "preprocess.hpp"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace yolo {
+
+using namespace std;
+
+PixelSource pixel_source(const Image &image) {
+  PixelSource source;
+  source.format = image.format;
+  if (image.format == PixelFormat::Gray16) {
+    source.low = image.window_low;
+    source.scale = 255.0f / max(image.window_high - image.window_low, 1.0f);
+  }
+  return source;
+}
+
+namespace host {
+
+void pack(const Image &image, uint8_t *dst) {
+  size_t line = (size_t)image.width * bytes_per_pixel(image.format);
+  size_t stride = image.stride > 0 ? image.stride : line;
+  const uint8_t *src = (const uint8_t *)image.bgrptr;
+  if (stride == line) {
+    memcpy(dst, src, line * image.height);
+    return;
+  }
+  for (int y = 0; y < image.height; ++y) memcpy(dst + y * line, src + y * stride, line);
+}
+
+// one channel of one tap, see gray_tap in yolo.cu
+static float gray_tap(const uint8_t *packed, int width, int x, int y,
+                      const PixelSource &source) {
+  if (source.format == PixelFormat::Gray8) return packed[(size_t)y * width + x];
+  float raw = ((const uint16_t *)packed)[(size_t)y * width + x];
+  return min(max((raw - source.low) * source.scale, 0.0f), 255.0f);
+}
+
+void demosaic(const uint8_t *src, int line, int width, int height, int x, int y, uint8_t bgr[3]) {
+  if (width < 3 || height < 3) {
+    bgr[0] = bgr[1] = bgr[2] = src[y * line + x];
+    return;
+  }
+
+  x = min(max(x, 1), width - 2);
+  y = min(max(y, 1), height - 2);
+  const uint8_t *p = src + (size_t)y * line + x;
+  int r, g, b;
+  if ((x & 1) == (y & 1)) {
+    // r or b site, the other two come from the cross and the diagonals
+    int center = p[0];
+    int cross = (p[-1] + p[1] + p[-line] + p[line] + 2) >> 2;
+    int diagonal = (p[-line - 1] + p[-line + 1] + p[line - 1] + p[line + 1] + 2) >> 2;
+    g = cross;
+    r = (y & 1) ? diagonal : center;
+    b = (y & 1) ? center : diagonal;
+  } else {
+    // g site, r lies along its row on the r rows
+    int horizontal = (p[-1] + p[1] + 1) >> 1;
+    int vertical = (p[-line] + p[line] + 1) >> 1;
+    g = p[0];
+    r = (y & 1) ? vertical : horizontal;
+    b = (y & 1) ? horizontal : vertical;
+  }
+  bgr[0] = b;
+  bgr[1] = g;
+  bgr[2] = r;
+}
+
+void sample(const uint8_t *packed, int width, int height, const PixelSource &source, float x,
+            float y, uint8_t const_value, float out[3]) {
+  if (x <= -1 || x >= width || y <= -1 || y >= height) {
+    out[0] = out[1] = out[2] = const_value;
+    return;
+  }
+
+  int y_low = floorf(y);
+  int x_low = floorf(x);
+  int y_high = y_low + 1;
+  int x_high = x_low + 1;
+  float ly = y - y_low, lx = x - x_low;
+  float hy = 1 - ly, hx = 1 - lx;
+  float w[4] = {hy * hx, hy * lx, ly * hx, ly * lx};
+  int xs[4] = {x_low, x_high, x_low, x_high};
+  int ys[4] = {y_low, y_low, y_high, y_high};
+
+  if (source.format == PixelFormat::BGR || source.format == PixelFormat::BayerRG8) {
+    uint8_t taps[4][3];
+    for (int i = 0; i < 4; ++i) {
+      bool inside = xs[i] >= 0 && xs[i] < width && ys[i] >= 0 && ys[i] < height;
+      if (!inside)
+        taps[i][0] = taps[i][1] = taps[i][2] = const_value;
+      else if (source.format == PixelFormat::BayerRG8)
+        demosaic(packed, width, width, height, xs[i], ys[i], taps[i]);
+      else
+        memcpy(taps[i], packed + ((size_t)ys[i] * width + xs[i]) * 3, 3);
+    }
+    for (int c = 0; c < 3; ++c)
+      out[c] = floorf(w[0] * taps[0][c] + w[1] * taps[1][c] + w[2] * taps[2][c] +
+                      w[3] * taps[3][c] + 0.5f);
+    return;
+  }
+
+  float value = 0;
+  for (int i = 0; i < 4; ++i) {
+    bool inside = xs[i] >= 0 && xs[i] < width && ys[i] >= 0 && ys[i] < height;
+    value += w[i] * (inside ? gray_tap(packed, width, xs[i], ys[i], source) : const_value);
+  }
+  out[0] = out[1] = out[2] = floorf(value + 0.5f);
+}
+
+void to_bgr(const Image &image, uint8_t *bgr) {
+  if (image.format == PixelFormat::BGR) {
+    pack(image, bgr);
+    return;
+  }
+
+  PixelSource source = pixel_source(image);
+  size_t stride = image.stride > 0 ? image.stride
+                                   : (size_t)image.width * bytes_per_pixel(image.format);
+  if (image.format == PixelFormat::BayerRG8) {
+    const uint8_t *src = (const uint8_t *)image.bgrptr;
+    for (int y = 0; y < image.height; ++y) {
+      for (int x = 0; x < image.width; ++x)
+        demosaic(src, (int)stride, image.width, image.height, x, y,
+                 bgr + ((size_t)y * image.width + x) * 3);
+    }
+    return;
+  }
+
+  for (int y = 0; y < image.height; ++y) {
+    const uint8_t *line = (const uint8_t *)image.bgrptr + y * stride;
+    for (int x = 0; x < image.width; ++x) {
+      uint8_t value = (uint8_t)floorf(gray_tap(line, image.width, x, 0, source) + 0.5f);
+      uint8_t *pixel = bgr + ((size_t)y * image.width + x) * 3;
+      pixel[0] = pixel[1] = pixel[2] = value;
+    }
+  }
+}
+
+};  // namespace host
+};  // namespace yolo
@@ -0,0 +1,50 @@
+#ifndef __PREPROCESS_HPP__
+#define __PREPROCESS_HPP__
+
+// Host side of the input stage: packing the caller's rows into the staging buffer, and the
+// reference of the bilinear sampler of the warp kernels in yolo.cu for every PixelFormat.
+// Bayer mosaics are demosaiced per tap of the sampler, there is no full size bgr image.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "yolo.hpp"
+
+namespace yolo {
+
+// How the warp kernels read a staged image. Gray16 values become (raw - low) * scale clamped
+// to 0..255, the 8 bit formats are used as they are.
+struct PixelSource {
+  PixelFormat format = PixelFormat::BGR;
+  float low = 0, scale = 1;
+};
+
+PixelSource pixel_source(const Image &image);
+
+// bytes of the image with packed rows, what is uploaded per image
+inline size_t packed_bytes(const Image &image) {
+  return (size_t)image.width * image.height * bytes_per_pixel(image.format);
+}
+
+namespace host {
+
+// Bilinear demosaic of one pixel of a RGGB mosaic with rows of line bytes, the same as OpenCV's
+// COLOR_BayerBG2BGR (OpenCV names the pattern after its second row and column) including the
+// border, which repeats the nearest inner pixel. Mosaics under 3x3 come out gray.
+void demosaic(const uint8_t *src, int line, int width, int height, int x, int y, uint8_t bgr[3]);
+
+// copies the rows of image into dst without their padding
+void pack(const Image &image, uint8_t *dst);
+
+// Bilinear sample at (x, y) of a packed image like the warp kernels before normalization:
+// out is b, g, r in 0..255, const_value for taps outside of the image.
+void sample(const uint8_t *packed, int width, int height, const PixelSource &source, float x,
+            float y, uint8_t const_value, float out[3]);
+
+// packed bgr copy of an image of any format
+void to_bgr(const Image &image, uint8_t *bgr);
+
+};  // namespace host
+};  // namespace yolo
+
+#endif  // __PREPROCESS_HPP__
@@ -0,0 +1,127 @@
+#include "profiler.hpp"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <fstream>
+
+namespace trt {
+
+using namespace std;
+
+void LayerProfiler::record(const char *layer, float ms) {
+  unique_lock<mutex> l(lock_);
+  string name = layer ? layer : "";
+  auto iter = index_.find(name);
+  if (iter == index_.end()) {
+    iter = index_.emplace(name, (int)layers_.size()).first;
+    layers_.emplace_back();
+    layers_.back().name = name;
+  }
+
+  LayerTime &item = layers_[iter->second];
+  item.min_ms = item.calls == 0 ? ms : min(item.min_ms, ms);
+  item.max_ms = item.calls == 0 ? ms : max(item.max_ms, ms);
+  item.total_ms += ms;
+  item.calls++;
+}
+
+void LayerProfiler::end_run() {
+  unique_lock<mutex> l(lock_);
+  runs_++;
+}
+
+void LayerProfiler::reset() {
+  unique_lock<mutex> l(lock_);
+  index_.clear();
+  layers_.clear();
+  runs_ = 0;
+}
+
+LayerReport LayerProfiler::report() const {
+  LayerReport output;
+  {
+    unique_lock<mutex> l(lock_);
+    output.runs = runs_;
+    output.layers = layers_;
+  }
+
+  for (auto &item : output.layers) output.total_ms += item.total_ms;
+  // engine order among equal totals
+  stable_sort(output.layers.begin(), output.layers.end(),
+              [](const LayerTime &a, const LayerTime &b) { return a.total_ms > b.total_ms; });
+  return output;
+}
+
+string format_table(const LayerReport &report, int top) {
+  int rows = (int)report.layers.size();
+  if (top > 0) rows = min(rows, top);
+
+  size_t width = 5;
+  for (int i = 0; i < rows; ++i) width = max(width, report.layers[i].name.size());
+  width = min(width, (size_t)64);
+
+  string output;
+  char line[256];
+  snprintf(line, sizeof(line), "%d runs, %.4f ms per run\n", report.runs, report.run_ms());
+  output += line;
+  snprintf(line, sizeof(line), "%-*s %10s %10s %10s %10s %7s\n", (int)width, "Layer", "avg ms",
+           "min ms", "max ms", "total ms", "%");
+  output += line;
+  for (int i = 0; i < rows; ++i) {
+    const LayerTime &item = report.layers[i];
+    string name = item.name.size() > width ? item.name.substr(0, width - 3) + "..." : item.name;
+    float percent = report.total_ms > 0 ? item.total_ms * 100 / report.total_ms : 0;
+    snprintf(line, sizeof(line), "%-*s %10.4f %10.4f %10.4f %10.3f %6.2f%%\n", (int)width,
+             name.c_str(), item.average_ms(), item.min_ms, item.max_ms, item.total_ms, percent);
+    output += line;
+  }
+  return output;
+}
+
+static string json_string(const string &value) {
+  string output = "\"";
+  char escape[8];
+  for (unsigned char c : value) {
+    if (c == '"' || c == '\\') {
+      output += '\\';
+      output += c;
+    } else if (c < 0x20) {
+      snprintf(escape, sizeof(escape), "\\u%04x", c);
+      output += escape;
+    } else {
+      output += c;
+    }
+  }
+  return output + "\"";
+}
+
+string format_json(const LayerReport &report) {
+  string output;
+  char buf[256];
+  snprintf(buf, sizeof(buf), "{\n  \"runs\": %d,\n  \"run_ms\": %.6f,\n  \"layers\": [",
+           report.runs, report.run_ms());
+  output += buf;
+  for (int i = 0; i < (int)report.layers.size(); ++i) {
+    const LayerTime &item = report.layers[i];
+    float percent = report.total_ms > 0 ? item.total_ms * 100 / report.total_ms : 0;
+    output += i == 0 ? "\n    {\"name\": " : ",\n    {\"name\": ";
+    output += json_string(item.name);
+    snprintf(buf, sizeof(buf),
+             ", \"calls\": %d, \"average_ms\": %.6f, \"min_ms\": %.6f, \"max_ms\": %.6f, "
+             "\"total_ms\": %.6f, \"percent\": %.3f}",
+             item.calls, item.average_ms(), item.min_ms, item.max_ms, item.total_ms, percent);
+    output += buf;
+  }
+  output += report.layers.empty() ? "]\n}\n" : "\n  ]\n}\n";
+  return output;
+}
+
+bool save_json(const LayerReport &report, const string &file) {
+  ofstream out(file, ios::out | ios::binary);
+  if (!out.is_open()) return false;
+  out << format_json(report);
+  return out.good();
+}
+
+};  // namespace trt
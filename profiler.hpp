@@ -0,0 +1,52 @@
+#ifndef __PROFILER_HPP__
+#define __PROFILER_HPP__
+
+// Per-layer engine times aggregated over runs. trt::Infer feeds it from a TensorRT IProfiler
+// (Infer::set_profiling), aggregation and reports have no CUDA dependency.
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace trt {
+
+struct LayerTime {
+  std::string name;
+  int calls = 0;  // runs that reported the layer
+  float total_ms = 0, min_ms = 0, max_ms = 0;
+
+  inline float average_ms() const { return calls > 0 ? total_ms / calls : 0; }
+};
+
+struct LayerReport {
+  int runs = 0;
+  float total_ms = 0;             // every layer of every run
+  std::vector<LayerTime> layers;  // largest total first
+
+  inline float run_ms() const { return runs > 0 ? total_ms / runs : 0; }
+};
+
+class LayerProfiler {
+ public:
+  void record(const char *layer, float ms);
+  // closes the run whose layers were recorded since the previous one
+  void end_run();
+  void reset();
+  LayerReport report() const;
+
+ private:
+  mutable std::mutex lock_;
+  std::unordered_map<std::string, int> index_;
+  std::vector<LayerTime> layers_;  // in the order of the first run
+  int runs_ = 0;
+};
+
+// text table of the top rows (all of them for 0) with the share of every layer
+std::string format_table(const LayerReport &report, int top = 0);
+std::string format_json(const LayerReport &report);
+bool save_json(const LayerReport &report, const std::string &file);
+
+};  // namespace trt
+
+#endif  // __PROFILER_HPP__
@@ -0,0 +1,308 @@
+#include "remote.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include "ipc.hpp"
+#include "logger.hpp"
+#include "preprocess.hpp"
+
+namespace yolo {
+
+using namespace std;
+
+const int REMOTE_WAIT_SLICE_MS = 200;
+const int REMOTE_HEARTBEAT_TIMEOUT_MS = 3000;  // the server beats at least every 100 ms
+
+class RemoteInferImpl : public Infer {
+ public:
+  string name_;
+  int timeout_ms_ = 0;
+  unique_ptr<ipc::Channel> channel_;
+  int slot_ = -1;
+  mutex lock_;
+
+  virtual ~RemoteInferImpl() { close(); }
+
+  bool open() {
+    close();
+    channel_.reset(new ipc::Channel());
+    if (!channel_->connect(name_)) {
+      channel_.reset();
+      return false;
+    }
+
+    slot_ = channel_->claim();
+    if (slot_ == -1) {
+      INFOE("All %d slots of server %s are taken.", channel_->num_slots(), name_.c_str());
+      channel_.reset();
+      return false;
+    }
+    return true;
+  }
+
+  void close() {
+    if (channel_ && slot_ != -1) channel_->release(slot_);
+    channel_.reset();
+    slot_ = -1;
+  }
+
+  // still attached to a running server through our own slot
+  bool attached() {
+    if (channel_ == nullptr || slot_ == -1) return false;
+    ipc::ChannelHeader *header = channel_->header();
+    return header->server_pid.load() != 0 && channel_->slot(slot_)->owner_pid == ipc::current_pid();
+  }
+
+  // with lock_ held, one frame through the server
+  bool request(const Image &image, BoxArray &output) {
+    output.clear();
+    if (!attached() && !open()) {
+      INFOE("Server %s is not running.", name_.c_str());
+      return false;
+    }
+
+    ipc::ChannelHeader *header = channel_->header();
+    if (image.width <= 0 || image.height <= 0 || image.width > header->max_width ||
+        image.height > header->max_height) {
+      INFOE("Image %dx%d exceeds the %dx%d frames of server %s", image.width, image.height,
+            header->max_width, header->max_height, name_.c_str());
+      return false;
+    }
+
+    ipc::SlotHeader *slot = channel_->slot(slot_);
+    slot->width = image.width;
+    slot->height = image.height;
+    // frames of the channel are bgr, the server sees every source format as such
+    host::to_bgr(image, channel_->frame(slot_));
+
+    uint32_t seen = channel_->done_value(slot_);
+    channel_->submit(slot_);
+
+    uint32_t heartbeat = header->heartbeat.load();
+    int waited = 0, stale = 0;
+    while (!channel_->wait_done(slot_, seen, REMOTE_WAIT_SLICE_MS)) {
+      waited += REMOTE_WAIT_SLICE_MS;
+      uint32_t beat = header->heartbeat.load();
+      stale = beat == heartbeat ? stale + REMOTE_WAIT_SLICE_MS : 0;
+      heartbeat = beat;
+      if (header->server_pid.load() == 0 || stale >= REMOTE_HEARTBEAT_TIMEOUT_MS ||
+          waited >= timeout_ms_) {
+        INFOE("Server %s did not answer within %d ms.", name_.c_str(), waited);
+        // the server may still write into the slot, the next call claims a new one
+        channel_.reset();
+        slot_ = -1;
+        return false;
+      }
+    }
+
+    if (slot->state.load(memory_order_acquire) != (uint32_t)ipc::SlotState::Done ||
+        slot->status != 0) {
+      INFOE("Server %s failed to forward the frame.", name_.c_str());
+      return false;
+    }
+
+    int count = min(slot->num_boxes, header->max_boxes);
+    const ipc::RemoteBox *boxes = channel_->boxes(slot_);
+    output.reserve(count);
+    for (int i = 0; i < count; ++i) {
+      const ipc::RemoteBox &item = boxes[i];
+      output.emplace_back(item.left, item.top, item.right, item.bottom, item.confidence,
+                          item.class_label);
+      output.back().sub_label = item.sub_label;
+      output.back().sub_confidence = item.sub_confidence;
+    }
+    return true;
+  }
+
+  virtual BoxArray forward(const Image &image, void *stream = nullptr) override {
+    auto output = forwards({image}, stream);
+    if (output.empty()) return {};
+    return output[0];
+  }
+
+  // the server batches across clients, the images of one call go through the slot in turn
+  virtual vector<BoxArray> forwards(const vector<Image> &images, void *stream = nullptr) override {
+    unique_lock<mutex> l(lock_);
+    vector<BoxArray> output(images.size());
+    for (int i = 0; i < (int)images.size(); ++i) {
+      if (!request(images[i], output[i])) return {};
+    }
+    return output;
+  }
+
+  virtual shared_future<vector<BoxArray>> forwards_async(const vector<Image> &images,
+                                                         void *stream = nullptr) override {
+    promise<vector<BoxArray>> result;
+    result.set_value(forwards(images, stream));
+    return result.get_future().share();
+  }
+
+  virtual BoxBatch forwards_packed(const vector<Image> &images, void *stream = nullptr) override {
+    BoxBatch output;
+    auto arrays = forwards(images, stream);
+    int total = 0;
+    for (auto &boxes : arrays) total += boxes.size();
+
+    output.reset(arrays.size(), total);
+    for (int ib = 0; ib < (int)arrays.size(); ++ib) {
+      for (auto &box : arrays[ib])
+        output.append(ib, box.left, box.top, box.right, box.bottom, box.confidence,
+                      box.class_label);
+    }
+    return output;
+  }
+
+  virtual future<BoxBatch> forwards_packed_async(const vector<Image> &images,
+                                                 void *stream = nullptr) override {
+    promise<BoxBatch> result;
+    result.set_value(forwards_packed(images, stream));
+    return result.get_future();
+  }
+
+  virtual bool use_cuda_graph(bool enable) override {
+    INFOW("CUDA graphs of server %s are configured on the server.", name_.c_str());
+    return false;
+  }
+
+  virtual bool capture(const string &file) override {
+    INFOW("Capture of server %s is configured on the server.", name_.c_str());
+    return false;
+  }
+
+  virtual bool set_cascade(const string &classifier_file, const CascadeOptions &options) override {
+    INFOW("The cascade of server %s is configured on the server.", name_.c_str());
+    return false;
+  }
+
+  virtual bool set_profiling(bool enable) override {
+    INFOW("Profiling of server %s is not available to clients.", name_.c_str());
+    return false;
+  }
+
+  virtual trt::LayerReport layer_report() override { return trt::LayerReport(); }
+
+  virtual bool set_mask_encoding(MaskEncoding encoding, float threshold) override {
+    INFOW("Server %s does not send masks.", name_.c_str());
+    return false;
+  }
+
+  // the server sends the boxes, they are counted here
+  virtual vector<Counts> count(const vector<Image> &images, const vector<CountZone> &zones,
+                               void *stream = nullptr) override {
+    int num_classes = this->num_classes();
+    auto arrays = forwards(images, stream);
+    vector<Counts> output(arrays.size());
+    for (int ib = 0; ib < (int)arrays.size(); ++ib) {
+      Counts &counts = output[ib];
+      counts.classes.assign(num_classes, 0);
+      counts.zones.assign(zones.size() * num_classes, 0);
+      for (auto &box : arrays[ib]) {
+        if (box.class_label < 0 || box.class_label >= num_classes) continue;
+        counts.classes[box.class_label]++;
+        float cx = (box.left + box.right) * 0.5f;
+        float cy = (box.top + box.bottom) * 0.5f;
+        for (int z = 0; z < (int)zones.size(); ++z) {
+          const CountZone &zone = zones[z];
+          if (cx >= zone.left && cx < zone.right && cy >= zone.top && cy < zone.bottom)
+            counts.zones[z * num_classes + box.class_label]++;
+        }
+      }
+    }
+    return output;
+  }
+
+  virtual int num_classes() override {
+    unique_lock<mutex> l(lock_);
+    return channel_ ? channel_->header()->num_classes : 0;
+  }
+
+  virtual bool set_class_thresholds(const vector<float> &thresholds,
+                                    const vector<uint8_t> &enabled = {}) override {
+    INFOW("Class thresholds of server %s are configured on the server.", name_.c_str());
+    return false;
+  }
+};
+
+shared_ptr<Infer> connect(const string &name, int timeout_ms) {
+  shared_ptr<RemoteInferImpl> instance(new RemoteInferImpl());
+  instance->name_ = name;
+  instance->timeout_ms_ = timeout_ms;
+  if (!instance->open()) {
+    INFOE("Failed to connect to server %s", name.c_str());
+    instance.reset();
+  }
+  return instance;
+}
+
+void serve(ipc::Channel &channel, Infer &infer, const string &name, int max_batch,
+           int window_us, const atomic<bool> &running) {
+  ipc::ChannelHeader *header = channel.header();
+  vector<int> batch;
+  vector<Image> images;
+  auto last_sweep = chrono::steady_clock::now();
+  while (running) {
+    uint32_t seen = channel.wake_value();
+    int index = channel.pop();
+    header->heartbeat.fetch_add(1);
+    if (index == -1) {
+      auto now = chrono::steady_clock::now();
+      if (now - last_sweep > chrono::seconds(1)) {
+        int freed = channel.sweep();
+        if (freed > 0) INFO("Freed %d slots of exited clients of %s", freed, name.c_str());
+        last_sweep = now;
+      }
+      channel.wait_request(seen, 100);
+      continue;
+    }
+
+    batch.assign(1, index);
+    auto deadline = chrono::steady_clock::now() + chrono::microseconds(window_us);
+    while ((int)batch.size() < max_batch) {
+      int next = channel.pop();
+      if (next != -1) {
+        batch.push_back(next);
+        continue;
+      }
+      if (chrono::steady_clock::now() >= deadline) break;
+      this_thread::yield();
+    }
+
+    images.clear();
+    vector<int> valid;
+    for (int slot : batch) {
+      ipc::SlotHeader *s = channel.slot(slot);
+      if (s->width <= 0 || s->height <= 0 || s->width > header->max_width ||
+          s->height > header->max_height) {
+        channel.complete(slot, -1, 0);
+        continue;
+      }
+      images.emplace_back(channel.frame(slot), s->width, s->height);
+      valid.push_back(slot);
+    }
+    if (valid.empty()) continue;
+
+    // the frames are read in place from shared memory
+    auto results = infer.forwards(images);
+    bool ok = results.size() == valid.size();
+    for (int i = 0; i < (int)valid.size(); ++i) {
+      int count = 0;
+      if (ok) {
+        ipc::RemoteBox *boxes = channel.boxes(valid[i]);
+        count = min((int)results[i].size(), header->max_boxes);
+        for (int j = 0; j < count; ++j) {
+          const Box &box = results[i][j];
+          boxes[j] = {box.left,       box.top,         box.right,     box.bottom,
+                      box.confidence, box.class_label, box.sub_label, box.sub_confidence};
+        }
+      }
+      channel.complete(valid[i], ok ? 0 : -1, count);
+    }
+  }
+}
+
+};  // namespace yolo
@@ -0,0 +1,33 @@
+#ifndef __REMOTE_HPP__
+#define __REMOTE_HPP__
+
+// yolo::Infer served by a yolo_server process over shared memory (ipc.hpp). The client loads
+// no engine and creates no CUDA context, a crash of the server fails the calls instead of
+// aborting the caller. Frames go through the slot claimed at connect and are batched by the
+// server with the frames of other clients.
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "ipc.hpp"
+#include "yolo.hpp"
+
+namespace yolo {
+
+// Connects to the model the server publishes as name, nullptr when it is not served or all of
+// its slots are taken. A call fails when the server has not answered within timeout_ms, the
+// next call reconnects. Boxes only: no masks or layer profiling, and class thresholds, cascade,
+// CUDA graphs and capture are configured on the server.
+std::shared_ptr<Infer> connect(const std::string &name, int timeout_ms = 10000);
+
+// Server side of the channel: answers its requests with infer until running turns false. The
+// pending frames of all clients, up to max_batch of them arriving within window_us of the
+// first, go through one forwards call and are read in place from shared memory. name is for
+// the log only.
+void serve(ipc::Channel &channel, Infer &infer, const std::string &name, int max_batch,
+           int window_us, const std::atomic<bool> &running);
+
+};  // namespace yolo
+
+#endif  // __REMOTE_HPP__
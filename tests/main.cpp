@@ -0,0 +1,93 @@
+// Host unit tests of the CPU parts of detect_lay: post-processing references, tracker, gate,
+// overlay, logger, queues and the capture format. No engine or device is needed.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "test.hpp"
+
+using namespace std;
+
+namespace test {
+
+struct Case {
+  const char *name;
+  Function function;
+};
+
+static vector<Case> &cases() {
+  static vector<Case> instance;
+  return instance;
+}
+
+static int g_failures = 0;
+static string g_golden_dir = "tests/golden";
+static bool g_update_golden = false;
+
+Registrar::Registrar(const char *name, Function function) {
+  cases().push_back(Case{name, function});
+}
+
+void fail(const char *file, int line, const char *expression) {
+  printf("  %s:%d: CHECK(%s) failed\n", file, line, expression);
+  g_failures++;
+}
+
+const string &golden_dir() { return g_golden_dir; }
+bool update_golden() { return g_update_golden; }
+
+};  // namespace test
+
+static void usage(const char *program) {
+  printf(
+      "Usage: %s [options] [filter]\n"
+      "  filter                run the cases whose name contains it\n"
+      "  --golden <dir>        golden files, default tests/golden\n"
+      "  --update-golden       rewrite the golden files from the current output\n"
+      "  --list                print the case names\n",
+      program);
+}
+
+int main(int argc, char **argv) {
+  string filter;
+  bool list = false;
+  for (int i = 1; i < argc; ++i) {
+    string key = argv[i];
+    if (key == "--help" || key == "-h") {
+      usage(argv[0]);
+      return 0;
+    } else if (key == "--golden" && i + 1 < argc) {
+      test::g_golden_dir = argv[++i];
+    } else if (key == "--update-golden") {
+      test::g_update_golden = true;
+    } else if (key == "--list") {
+      list = true;
+    } else {
+      filter = key;
+    }
+  }
+
+  int passed = 0, failed = 0;
+  for (auto &item : test::cases()) {
+    if (!filter.empty() && strstr(item.name, filter.c_str()) == nullptr) continue;
+    if (list) {
+      printf("%s\n", item.name);
+      continue;
+    }
+
+    int before = test::g_failures;
+    item.function();
+    bool ok = test::g_failures == before;
+    printf("[%s] %s\n", ok ? "  OK  " : " FAIL ", item.name);
+    if (ok)
+      passed++;
+    else
+      failed++;
+  }
+
+  if (!list) printf("%d passed, %d failed\n", passed, failed);
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,41 @@
+#ifndef __TEST_HPP__
+#define __TEST_HPP__
+
+// Minimal registry of the yolo_tests cases. A failed CHECK is reported with its location and
+// the case goes on, the case fails when any of its checks did.
+
+#include <math.h>
+
+#include <string>
+
+namespace test {
+
+typedef void (*Function)();
+
+struct Registrar {
+  Registrar(const char *name, Function function);
+};
+
+void fail(const char *file, int line, const char *expression);
+
+// directory of the golden files, see yolo_tests --help
+const std::string &golden_dir();
+// true with --update-golden: cases write their golden files instead of comparing
+bool update_golden();
+
+};  // namespace test
+
+#define TEST(name)                                             \
+  static void test_##name();                                   \
+  static test::Registrar registrar_##name(#name, test_##name); \
+  static void test_##name()
+
+#define CHECK(condition)                                          \
+  do {                                                            \
+    if (!(condition)) test::fail(__FILE__, __LINE__, #condition); \
+  } while (0)
+
+#define CHECK_EQ(a, b) CHECK((a) == (b))
+#define CHECK_NEAR(a, b, eps) CHECK(fabs((double)(a) - (double)(b)) <= (double)(eps))
+
+#endif  // __TEST_HPP__
@@ -0,0 +1,177 @@
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "activation_pool.hpp"
+#include "test.hpp"
+
+using namespace std;
+
+namespace {
+
+// Device of the pool: allocations are plain host blocks up to limit live bytes, waits and
+// records are logged with their stream in call order.
+struct StubDevice {
+  mutex lock;
+  size_t limit = SIZE_MAX, live = 0;
+  int allocations = 0, frees = 0, synchronizes = 0;
+  map<void *, size_t> blocks;
+  vector<pair<char, intptr_t>> events;  // 'w'ait or 'r'ecord, stream
+
+  pool::ActivationPool::Device device() {
+    pool::ActivationPool::Device device;
+    device.allocate = [this](size_t bytes) -> void * {
+      unique_lock<mutex> l(lock);
+      if (live + bytes > limit) return nullptr;
+      void *memory = new char[bytes];
+      blocks[memory] = bytes;
+      live += bytes;
+      allocations++;
+      return memory;
+    };
+    device.free = [this](void *memory) {
+      unique_lock<mutex> l(lock);
+      live -= blocks[memory];
+      blocks.erase(memory);
+      delete[](char *) memory;
+      frees++;
+    };
+    device.wait = [this](void *stream) {
+      unique_lock<mutex> l(lock);
+      events.emplace_back('w', (intptr_t)stream);
+    };
+    device.record = [this](void *stream) {
+      unique_lock<mutex> l(lock);
+      events.emplace_back('r', (intptr_t)stream);
+    };
+    device.synchronize = [this]() {
+      unique_lock<mutex> l(lock);
+      synchronizes++;
+    };
+    return device;
+  }
+};
+
+};  // namespace
+
+TEST(activation_pool_sized_for_the_largest_context) {
+  StubDevice stub;
+  {
+    pool::ActivationPool pool(stub.device());
+    int a = pool.attach("a.engine", 100);
+    int b = pool.attach("b.engine", 50);
+    CHECK(a >= 0 && b >= 0 && a != b);
+    CHECK_EQ(pool.capacity(), 100u);
+    CHECK_EQ(stub.allocations, 1);
+
+    // a larger context regrows the scratch after the work of the others
+    int c = pool.attach("c.engine", 300);
+    CHECK(c >= 0);
+    CHECK_EQ(pool.capacity(), 300u);
+    CHECK_EQ(stub.allocations, 2);
+    CHECK_EQ(stub.frees, 1);
+    CHECK_EQ(stub.synchronizes, 1);
+    CHECK_EQ(stub.live, 300u);
+    CHECK_EQ(pool.required(), 300u);
+    CHECK_EQ(pool.private_bytes(), 450u);
+    CHECK_EQ(pool.users().size(), 3u);
+    {
+      auto lease = pool.acquire(nullptr);
+      CHECK(lease.memory() != nullptr);
+      CHECK_EQ(lease.bytes(), 300u);
+    }
+
+    // the scratch keeps its size until the last user leaves
+    pool.detach(c);
+    CHECK_EQ(pool.capacity(), 300u);
+    CHECK_EQ(pool.required(), 100u);
+    pool.detach(a);
+    pool.detach(b);
+    CHECK_EQ(pool.capacity(), 0u);
+    CHECK_EQ(stub.live, 0u);
+
+    // and is allocated again for the next one
+    CHECK(pool.attach("d.engine", 10) >= 0);
+    CHECK_EQ(stub.live, 10u);
+  }
+  // the pool frees it when destroyed
+  CHECK_EQ(stub.live, 0u);
+  CHECK_EQ(stub.allocations, stub.frees);
+}
+
+TEST(activation_pool_failed_growth_keeps_the_scratch) {
+  StubDevice stub;
+  stub.limit = 200;
+  pool::ActivationPool pool(stub.device());
+  int a = pool.attach("a.engine", 150);
+  CHECK(a >= 0);
+
+  // 250 bytes do not fit, the users go on with the previous 150
+  CHECK_EQ(pool.attach("b.engine", 250), -1);
+  CHECK_EQ(pool.capacity(), 150u);
+  CHECK_EQ(stub.live, 150u);
+  CHECK_EQ(pool.users().size(), 1u);
+  CHECK_EQ(pool.required(), 150u);
+  {
+    auto lease = pool.acquire(nullptr);
+    CHECK(lease.memory() != nullptr);
+    CHECK_EQ(lease.bytes(), 150u);
+  }
+
+  // a context that fits is still accepted, a first allocation failing is reported too
+  CHECK(pool.attach("c.engine", 200) >= 0);
+  CHECK_EQ(pool.capacity(), 200u);
+  StubDevice empty;
+  empty.limit = 0;
+  pool::ActivationPool none(empty.device());
+  CHECK_EQ(none.attach("a.engine", 1), -1);
+  CHECK_EQ(none.capacity(), 0u);
+  CHECK(none.users().empty());
+}
+
+TEST(activation_pool_leases_take_turns) {
+  StubDevice stub;
+  pool::ActivationPool pool(stub.device());
+  CHECK(pool.attach("a.engine", 64) >= 0);
+
+  atomic<int> inside{0}, overlaps{0};
+  vector<thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < 200; ++i) {
+        auto lease = pool.acquire((void *)(intptr_t)(t + 1));
+        if (inside.fetch_add(1) != 0) overlaps++;
+        this_thread::yield();
+        inside.fetch_sub(1);
+      }
+    });
+  }
+  for (auto &thread : threads) thread.join();
+  CHECK_EQ(overlaps.load(), 0);
+
+  // every holder waits for the previous record on its stream and records once, in turn
+  CHECK_EQ(stub.events.size(), 2u * 4 * 200);
+  bool paired = true;
+  for (size_t i = 0; i + 1 < stub.events.size(); i += 2) {
+    paired = paired && stub.events[i].first == 'w' && stub.events[i + 1].first == 'r' &&
+             stub.events[i].second == stub.events[i + 1].second;
+  }
+  CHECK(paired);
+
+  // a moved lease records once, when its last owner goes
+  stub.events.clear();
+  {
+    auto first = pool.acquire((void *)7);
+    pool::ActivationPool::Lease second(move(first));
+    CHECK_EQ(stub.events.size(), 1u);
+  }
+  CHECK_EQ(stub.events.size(), 2u);
+  CHECK(stub.events[1] == make_pair('r', (intptr_t)7));
+}
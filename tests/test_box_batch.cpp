@@ -0,0 +1,173 @@
+#include <string.h>
+
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "box_batch.hpp"
+#include "test.hpp"
+
+using namespace std;
+using namespace yolo;
+
+// one allocation per batch: copies are refused at compile time, moves hand the arena over
+static_assert(!is_copy_constructible<BoxBatch>::value, "BoxBatch is move only");
+static_assert(!is_copy_assignable<BoxBatch>::value, "BoxBatch is move only");
+static_assert(is_move_constructible<BoxBatch>::value, "BoxBatch is movable");
+static_assert(is_move_assignable<BoxBatch>::value, "BoxBatch is movable");
+
+TEST(box_batch_append_by_image) {
+  BoxBatch batch;
+  batch.reset(4, 8);
+  CHECK(batch.empty());
+  CHECK_EQ(batch.append(0, 1, 2, 3, 4, 0.9f, 7), 0);
+  CHECK_EQ(batch.append(0, 5, 6, 7, 8, 0.8f, 1), 1);
+  // image 1 has no box, image 2 two
+  CHECK_EQ(batch.append(2, 9, 10, 11, 12, 0.7f, 2), 2);
+  CHECK_EQ(batch.append(2, 13, 14, 15, 16, 0.6f, 3), 3);
+  // images are filled in increasing order, a late box and a bad image are refused
+  CHECK_EQ(batch.append(1, 0, 0, 1, 1, 0.5f, 0), -1);
+  CHECK_EQ(batch.append(4, 0, 0, 1, 1, 0.5f, 0), -1);
+  CHECK_EQ(batch.append(-1, 0, 0, 1, 1, 0.5f, 0), -1);
+
+  CHECK_EQ(batch.size(), 4);
+  CHECK_EQ(batch.count(0), 2);
+  CHECK_EQ(batch.count(1), 0);
+  CHECK_EQ(batch.count(2), 2);
+  CHECK_EQ(batch.count(3), 0);
+  CHECK_EQ(batch.begin(1), 2);
+  CHECK_EQ(batch.begin(3), 4);
+  CHECK_EQ(batch.count(9), 0);
+
+  BoxView view = batch[3];
+  CHECK_EQ(view.left, 13);
+  CHECK_EQ(view.bottom, 16);
+  CHECK_NEAR(view.confidence, 0.6f, 1e-6);
+  CHECK_EQ(view.class_label, 3);
+  CHECK(view.mask == nullptr);
+  CHECK_EQ(view.mask_width, 0);
+
+  vector<int> labels;
+  for (auto box : batch.image(2)) labels.push_back(box.class_label);
+  CHECK(labels == vector<int>({2, 3}));
+  CHECK_EQ(batch.image(1).size(), 0);
+  CHECK_EQ(batch.all().size(), 4);
+}
+
+TEST(box_batch_overflow_past_capacity) {
+  BoxBatch batch;
+  batch.reset(2, 3, 8);
+  CHECK_EQ(batch.append(0, 0, 0, 1, 1, 0.9f, 0), 0);
+  CHECK_EQ(batch.append(1, 0, 0, 1, 1, 0.9f, 0), 1);
+  CHECK_EQ(batch.append(1, 0, 0, 1, 1, 0.9f, 0), 2);
+  CHECK_EQ(batch.append(1, 0, 0, 1, 1, 0.9f, 0), -1);
+  CHECK_EQ(batch.size(), 3);
+  CHECK_EQ(batch.count(1), 2);
+
+  // 8 bytes of masks: a 2x3 fits, a second one does not, nor do bad boxes or sizes
+  CHECK(batch.attach_mask(0, 2, 3) != nullptr);
+  CHECK(batch.attach_mask(1, 2, 2) == nullptr);
+  CHECK(batch.attach_mask(1, 1, 2) != nullptr);
+  CHECK_EQ(batch.mask_bytes(), 8u);
+  CHECK(batch.attach_mask(2, 1, 1) == nullptr);
+  CHECK(batch.attach_mask(3, 1, 1) == nullptr);
+  CHECK(batch.attach_mask(-1, 1, 1) == nullptr);
+  CHECK(batch.attach_mask(2, 0, 1) == nullptr);
+  CHECK(batch[2].mask == nullptr);
+}
+
+TEST(box_batch_attach_mask) {
+  BoxBatch batch;
+  batch.reset(1, 4, 64);
+  batch.append(0, 0, 0, 4, 4, 0.9f, 0);
+  batch.append(0, 0, 0, 2, 2, 0.8f, 1);
+  batch.append(0, 0, 0, 3, 3, 0.7f, 2);
+
+  unsigned char *first = batch.attach_mask(0, 4, 3);
+  unsigned char *third = batch.attach_mask(2, 2, 5);
+  CHECK(first != nullptr && third != nullptr);
+  memset(first, 1, 12);
+  memset(third, 3, 10);
+
+  // masks are concatenated in attach order, the offsets index mask_data()
+  CHECK_EQ(batch.column_i(BoxBatch::MaskOffset)[0], 0);
+  CHECK_EQ(batch.column_i(BoxBatch::MaskOffset)[1], -1);
+  CHECK_EQ(batch.column_i(BoxBatch::MaskOffset)[2], 12);
+  CHECK_EQ(batch.mask_bytes(), 22u);
+
+  BoxView view = batch[2];
+  CHECK_EQ(view.mask_width, 2);
+  CHECK_EQ(view.mask_height, 5);
+  CHECK(view.mask == batch.mask_data() + 12);
+  CHECK_EQ(view.mask[0], 3);
+  CHECK_EQ(view.mask[9], 3);
+  CHECK_EQ(batch[0].mask[11], 1);
+  CHECK(batch[1].mask == nullptr);
+}
+
+TEST(box_batch_copy_column) {
+  BoxBatch batch;
+  batch.reset(1, 5);
+  for (int i = 0; i < 5; ++i) batch.append(0, (float)i, 0, 10, 10, 0.5f, 10 + i);
+
+  float left[5] = {0};
+  CHECK_EQ(batch.copy_column(BoxBatch::Left, 0, 5, left), 5 * sizeof(float));
+  for (int i = 0; i < 5; ++i) CHECK_EQ(left[i], i);
+
+  // clamped to the boxes there are, nothing for a range outside them or a bad column
+  int32_t labels[5] = {-1, -1, -1, -1, -1};
+  CHECK_EQ(batch.copy_column(BoxBatch::Label, 3, 10, labels), 2 * sizeof(int32_t));
+  CHECK_EQ(labels[0], 13);
+  CHECK_EQ(labels[1], 14);
+  CHECK_EQ(labels[2], -1);
+  CHECK_EQ(batch.copy_column(BoxBatch::Label, 5, 1, labels), 0u);
+  CHECK_EQ(batch.copy_column(BoxBatch::Label, -1, 1, labels), 0u);
+  CHECK_EQ(batch.copy_column(BoxBatch::Label, 0, 0, labels), 0u);
+  CHECK_EQ(batch.copy_column(BoxBatch::NumColumns, 0, 1, labels), 0u);
+
+  int32_t offsets[5] = {0};
+  batch.copy_column(BoxBatch::MaskOffset, 0, 5, offsets);
+  for (int i = 0; i < 5; ++i) CHECK_EQ(offsets[i], -1);
+}
+
+TEST(box_batch_move_and_reuse) {
+  BoxBatch batch;
+  batch.reset(2, 4, 16);
+  batch.append(0, 1, 1, 2, 2, 0.9f, 5);
+  batch.append(1, 3, 3, 4, 4, 0.8f, 6);
+  memset(batch.attach_mask(1, 4, 4), 9, 16);
+  const float *columns = batch.left();
+  size_t capacity = batch.capacity_bytes();
+
+  // the arena moves along, the source is left empty
+  BoxBatch moved(move(batch));
+  CHECK(moved.left() == columns);
+  CHECK_EQ(moved.size(), 2);
+  CHECK_EQ(moved.count(1), 1);
+  CHECK_EQ(moved[1].class_label, 6);
+  CHECK_EQ(moved[1].mask[15], 9);
+  CHECK(batch.empty());
+  CHECK_EQ(batch.num_images(), 0);
+  CHECK_EQ(batch.capacity_bytes(), 0u);
+  CHECK_EQ(batch.count(0), 0);
+
+  BoxBatch assigned;
+  assigned = move(moved);
+  CHECK(assigned.left() == columns);
+  CHECK_EQ(assigned[0].class_label, 5);
+  CHECK(moved.empty());
+
+  // a reset that fits keeps the arena, a larger one replaces it
+  assigned.reset(1, 2, 8);
+  CHECK(assigned.left() == columns);
+  CHECK_EQ(assigned.capacity_bytes(), capacity);
+  CHECK(assigned.empty());
+  CHECK_EQ(assigned.mask_bytes(), 0u);
+  assigned.reset(8, 1024, 4096);
+  CHECK(assigned.capacity_bytes() > capacity);
+  CHECK_EQ(assigned.num_images(), 8);
+
+  // a moved from batch is usable again after a reset
+  batch.reset(1, 1);
+  CHECK_EQ(batch.append(0, 0, 0, 1, 1, 0.5f, 0), 0);
+}
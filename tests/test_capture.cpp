@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "capture.hpp"
+#include "postprocess.hpp"
+#include "test.hpp"
+
+using namespace std;
+
+// The device backend is built next to the kernels in yolo.cu, which these tests do not link.
+namespace capture {
+ReplayOutput replay_device(const Frame &frame) { return ReplayOutput(); }
+};  // namespace capture
+
+static vector<float> head(int num_bboxes, int cdim, unsigned seed) {
+  vector<float> output(num_bboxes * cdim);
+  unsigned state = seed;
+  for (int i = 0; i < num_bboxes; ++i) {
+    float *row = &output[i * cdim];
+    for (int c = 0; c < cdim; ++c) {
+      state = state * 1664525u + 1013904223u;
+      float unit = (state >> 8) / 16777216.0f;
+      row[c] = c < 2 ? 10 + unit * 300 : c < 4 ? 8 + unit * 40 : unit;
+    }
+  }
+  return output;
+}
+
+static capture::FrameHeader header(yolo::Type type, int num_classes, int num_bboxes, int cdim) {
+  capture::FrameHeader h;
+  h.type = (int)type;
+  h.num_classes = num_classes;
+  h.image_width = 640;
+  h.image_height = 480;
+  h.network_width = 320;
+  h.network_height = 320;
+  h.bbox_dims[0] = num_bboxes;
+  h.bbox_dims[1] = cdim;
+  yolo::AffineMatrix affine;
+  affine.compute(make_tuple(640, 480), make_tuple(320, 320));
+  memcpy(h.i2d, affine.i2d, sizeof(h.i2d));
+  memcpy(h.d2i, affine.d2i, sizeof(h.d2i));
+  h.confidence_threshold = 0.6f;
+  h.nms_threshold = 0.5f;
+  return h;
+}
+
+TEST(capture_round_trip_and_host_replay) {
+  const char *file = "yolo_tests_capture.bin";
+  const int num_classes = 3, num_bboxes = 64, mask_dim = 2, mask_size = 8;
+  const int cdim = num_classes + 4, seg_cdim = cdim + mask_dim;
+
+  auto detect_head = head(num_bboxes, cdim, 3);
+  const float thresholds[num_classes] = {0.6f, 0.9f, 0.6f};
+  capture::FrameHeader detect = header(yolo::Type::V8, num_classes, num_bboxes, cdim);
+
+  auto seg_head = head(num_bboxes, seg_cdim, 4);
+  vector<float> segment(mask_dim * mask_size * mask_size);
+  for (size_t i = 0; i < segment.size(); ++i) segment[i] = (float)(i % 7) - 3;
+  capture::FrameHeader seg = header(yolo::Type::V8Seg, num_classes, num_bboxes, seg_cdim);
+  seg.segment_dims[0] = mask_dim;
+  seg.segment_dims[1] = mask_size;
+  seg.segment_dims[2] = mask_size;
+
+  auto writer = capture::create_writer(file);
+  CHECK(writer != nullptr);
+  if (writer == nullptr) return;
+  CHECK(writer->write(detect, detect_head.data(), nullptr, thresholds));
+  CHECK(writer->write(seg, seg_head.data(), segment.data(), nullptr));
+  writer->close();
+
+  auto reader = capture::open_reader(file);
+  CHECK(reader != nullptr);
+  if (reader != nullptr) {
+    CHECK_EQ(reader->size(), 2);
+
+    capture::Frame first = reader->frame(0);
+    CHECK(first.header != nullptr && first.header->num_classes == num_classes);
+    CHECK(first.header->bbox_offset % capture::CAPTURE_ALIGNMENT == 0);
+    CHECK(first.segment == nullptr);
+    CHECK(memcmp(first.bbox, detect_head.data(), detect_head.size() * sizeof(float)) == 0);
+    CHECK(first.class_thresholds != nullptr && first.class_thresholds[1] == 0.9f);
+    CHECK(memcmp(first.header->d2i, detect.d2i, sizeof(detect.d2i)) == 0);
+
+    // host replay is decode, NMS and collect of the recorded head
+    vector<float> parray(1 + yolo::MAX_IMAGE_BOXES * yolo::NUM_BOX_ELEMENT, 0.0f);
+    yolo::host::decode(detect_head.data(), num_bboxes, num_classes, cdim, 0.6f, thresholds,
+                       detect.d2i, parray.data(), yolo::MAX_IMAGE_BOXES, yolo::Type::V8);
+    yolo::host::fast_nms(parray.data(), yolo::MAX_IMAGE_BOXES, 0.5f);
+    yolo::BoxArray expected;
+    yolo::host::collect(parray.data(), yolo::MAX_IMAGE_BOXES, expected);
+
+    capture::ReplayOutput replayed = capture::replay(first, capture::Backend::Host);
+    CHECK(!expected.empty());
+    CHECK_EQ(replayed.boxes.size(), expected.size());
+    for (size_t i = 0; i < expected.size() && i < replayed.boxes.size(); ++i) {
+      CHECK_EQ(replayed.boxes[i].left, expected[i].left);
+      CHECK_EQ(replayed.boxes[i].bottom, expected[i].bottom);
+      CHECK_EQ(replayed.boxes[i].confidence, expected[i].confidence);
+      CHECK_EQ(replayed.boxes[i].class_label, expected[i].class_label);
+    }
+    CHECK(replayed.masks.empty());
+
+    // without recorded thresholds every class uses the confidence threshold
+    capture::Frame second = reader->frame(1);
+    CHECK(second.segment != nullptr && second.class_thresholds == nullptr);
+    CHECK(memcmp(second.segment, segment.data(), segment.size() * sizeof(float)) == 0);
+    capture::ReplayOutput masked = capture::replay(second, capture::Backend::Host);
+    CHECK(!masked.boxes.empty());
+    CHECK_EQ(masked.masks.size(), masked.boxes.size());
+    for (auto &mask : masked.masks)
+      CHECK_EQ(mask.data.size(), (size_t)mask.width * mask.height);
+
+    CHECK(reader->frame(2).header == nullptr);
+  }
+  reader.reset();
+  remove(file);
+}
+
+TEST(capture_rejects_missing_file) {
+  CHECK(capture::open_reader("yolo_tests_missing.bin") == nullptr);
+}
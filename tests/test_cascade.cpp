@@ -0,0 +1,163 @@
+#include <utility>
+#include <vector>
+
+#include "cascade.hpp"
+#include "test.hpp"
+
+using namespace std;
+using namespace yolo;
+
+// image coordinates of the classifier input point (x, y), pixel centers are integers
+static void map_point(const float d2i[6], float x, float y, float &ix, float &iy) {
+  ix = d2i[0] * x + d2i[1] * y + d2i[2];
+  iy = d2i[3] * x + d2i[4] * y + d2i[5];
+}
+
+// the outer edges of the classifier input and the image rectangle they cover
+static void covered(const float d2i[6], int dst_width, int dst_height, float &left, float &top,
+                    float &right, float &bottom) {
+  map_point(d2i, -0.5f, -0.5f, left, top);
+  map_point(d2i, dst_width - 0.5f, dst_height - 0.5f, right, bottom);
+  left += 0.5f;
+  top += 0.5f;
+  right += 0.5f;
+  bottom += 0.5f;
+}
+
+static Image sized(int width, int height) {
+  Image image;
+  image.width = width;
+  image.height = height;
+  return image;
+}
+
+TEST(cascade_crop_stretch_and_padding) {
+  float d2i[6], left, top, right, bottom;
+  crop_affine(100, 50, 200, 150, 50, 25, 0, false, d2i);
+  covered(d2i, 50, 25, left, top, right, bottom);
+  CHECK_NEAR(left, 100, 1e-3);
+  CHECK_NEAR(top, 50, 1e-3);
+  CHECK_NEAR(right, 200, 1e-3);
+  CHECK_NEAR(bottom, 150, 1e-3);
+  CHECK_NEAR(d2i[0], 2, 1e-6);
+  CHECK_NEAR(d2i[4], 4, 1e-6);
+  CHECK_EQ(d2i[1], 0);
+  CHECK_EQ(d2i[3], 0);
+
+  // a quarter of the size on every side
+  crop_affine(100, 50, 200, 150, 50, 50, 0.25f, false, d2i);
+  covered(d2i, 50, 50, left, top, right, bottom);
+  CHECK_NEAR(left, 75, 1e-3);
+  CHECK_NEAR(top, 25, 1e-3);
+  CHECK_NEAR(right, 225, 1e-3);
+  CHECK_NEAR(bottom, 175, 1e-3);
+}
+
+TEST(cascade_crop_letterbox_centers_the_box) {
+  // 100 x 50 into 64 x 64: one scale, the box fills the width and is centered vertically
+  float d2i[6], left, top, right, bottom, cx, cy;
+  crop_affine(100, 150, 200, 200, 64, 64, 0, true, d2i);
+  CHECK_NEAR(d2i[0], d2i[4], 1e-6);
+  CHECK_NEAR(d2i[0], 100.0f / 64, 1e-6);
+  covered(d2i, 64, 64, left, top, right, bottom);
+  CHECK_NEAR(left, 100, 1e-3);
+  CHECK_NEAR(right, 200, 1e-3);
+  CHECK_NEAR(top, 125, 1e-3);
+  CHECK_NEAR(bottom, 225, 1e-3);
+  map_point(d2i, 31.5f, 31.5f, cx, cy);
+  CHECK_NEAR(cx + 0.5f, 150, 1e-3);
+  CHECK_NEAR(cy + 0.5f, 175, 1e-3);
+
+  // a degenerate box still gives a finite matrix
+  crop_affine(10, 10, 10, 10, 32, 32, 0, true, d2i);
+  CHECK_NEAR(d2i[0], 1.0f / 32, 1e-6);
+}
+
+TEST(cascade_crop_clamped_at_image_edges) {
+  float d2i[6], left, top, right, bottom;
+  // the padding of a box in the top left corner would reach outside the image
+  crop_affine(0, 0, 100, 40, 50, 20, 0.5f, false, d2i, 640, 480);
+  covered(d2i, 50, 20, left, top, right, bottom);
+  CHECK_NEAR(left, 0, 1e-3);
+  CHECK_NEAR(top, 0, 1e-3);
+  CHECK_NEAR(right, 150, 1e-3);
+  CHECK_NEAR(bottom, 60, 1e-3);
+
+  // and in the bottom right one
+  crop_affine(600, 440, 640, 480, 20, 20, 0.5f, false, d2i, 640, 480);
+  covered(d2i, 20, 20, left, top, right, bottom);
+  CHECK_NEAR(left, 580, 1e-3);
+  CHECK_NEAR(top, 420, 1e-3);
+  CHECK_NEAR(right, 640, 1e-3);
+  CHECK_NEAR(bottom, 480, 1e-3);
+
+  // without an image size the padding is kept
+  crop_affine(0, 0, 100, 40, 50, 20, 0.5f, false, d2i);
+  covered(d2i, 50, 20, left, top, right, bottom);
+  CHECK_NEAR(left, -50, 1e-3);
+  CHECK_NEAR(bottom, 60, 1e-3);
+}
+
+TEST(cascade_crop_jobs_per_image) {
+  vector<BoxArray> boxes(3);
+  boxes[0].emplace_back(0, 0, 100, 100, 0.9f, 0);
+  boxes[0].emplace_back(10, 10, 20, 20, 0.8f, 1);
+  boxes[2].emplace_back(300, 300, 400, 400, 0.7f, 2);
+  vector<Image> images = {sized(640, 480), sized(640, 480), sized(320, 320)};
+
+  auto jobs = crop_jobs(images, boxes, 32, 32, 0.5f, false);
+  CHECK_EQ(jobs.size(), 3u);
+  CHECK_EQ(jobs[0].image, 0);
+  CHECK_EQ(jobs[0].box, 0);
+  CHECK_EQ(jobs[1].image, 0);
+  CHECK_EQ(jobs[1].box, 1);
+  CHECK_EQ(jobs[2].image, 2);
+  CHECK_EQ(jobs[2].box, 0);
+
+  // every job is clamped to its own image, the third box lies outside its 320 x 320
+  float left, top, right, bottom;
+  covered(jobs[0].d2i, 32, 32, left, top, right, bottom);
+  CHECK_NEAR(left, 0, 1e-3);
+  CHECK_NEAR(right, 150, 1e-3);
+  covered(jobs[1].d2i, 32, 32, left, top, right, bottom);
+  CHECK_NEAR(left, 5, 1e-3);
+  CHECK_NEAR(right, 25, 1e-3);
+  covered(jobs[2].d2i, 32, 32, left, top, right, bottom);
+  CHECK_NEAR(left, 250, 1e-3);
+  CHECK_NEAR(right, 320, 1e-3);
+
+  CHECK(crop_jobs(images, vector<BoxArray>(2), 32, 32, 0, true).empty());
+}
+
+TEST(cascade_batches_split_at_max_batch) {
+  auto batches = crop_batches(10, 4);
+  CHECK_EQ(batches.size(), 3u);
+  CHECK(batches[0] == make_pair(0, 4));
+  CHECK(batches[1] == make_pair(4, 8));
+  CHECK(batches[2] == make_pair(8, 10));
+
+  batches = crop_batches(8, 4);
+  CHECK_EQ(batches.size(), 2u);
+  CHECK(batches[1] == make_pair(4, 8));
+
+  batches = crop_batches(3, 16);
+  CHECK_EQ(batches.size(), 1u);
+  CHECK(batches[0] == make_pair(0, 3));
+
+  CHECK(crop_batches(0, 4).empty());
+  // a max_batch under 1 runs the crops one by one
+  CHECK_EQ(crop_batches(3, 0).size(), 3u);
+}
+
+TEST(cascade_classify_scores) {
+  const float logits[3] = {1, 3, 2};
+  float scores[3];
+  CHECK_EQ(classify_scores(logits, 3, true, scores), 1);
+  CHECK_NEAR(scores[0] + scores[1] + scores[2], 1, 1e-6);
+  CHECK(scores[1] > scores[2] && scores[2] > scores[0]);
+  CHECK_NEAR(scores[1] / scores[2], exp(1.0), 1e-4);
+
+  CHECK_EQ(classify_scores(logits, 3, false, scores), 1);
+  CHECK_EQ(scores[2], 2);
+  CHECK_EQ(classify_scores(logits, 0, true, scores), -1);
+}
@@ -0,0 +1,253 @@
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cpm.hpp"
+#include "test.hpp"
+
+using namespace std;
+
+// Doubles its inputs and records them in order. The first forward blocks until released, so
+// the following commits pile up in the queue behind it.
+class FakeModel {
+ public:
+  vector<int> seen;
+  mutex lock;
+  condition_variable cond;
+  bool blocked = true, started = false;
+
+  vector<int> forwards(const vector<int> &inputs, void *stream) {
+    unique_lock<mutex> l(lock);
+    started = true;
+    cond.notify_all();
+    cond.wait(l, [&]() { return !blocked; });
+    vector<int> output;
+    for (int input : inputs) {
+      seen.push_back(input);
+      output.push_back(input * 2);
+    }
+    return output;
+  }
+
+  void wait_started() {
+    unique_lock<mutex> l(lock);
+    cond.wait(l, [&]() { return started; });
+  }
+
+  void release() {
+    unique_lock<mutex> l(lock);
+    blocked = false;
+    cond.notify_all();
+  }
+};
+
+typedef cpm::Instance<int, int, FakeModel> FakeInstance;
+
+static cpm::CommitOptions priority(int value) {
+  cpm::CommitOptions options;
+  options.priority = value;
+  return options;
+}
+
+TEST(cpm_priority_then_commit_order) {
+  auto model = make_shared<FakeModel>();
+  FakeInstance instance;
+  CHECK(instance.start([&]() { return model; }, 1));
+
+  auto first = instance.commit(1, priority(0));
+  model->wait_started();
+  auto low = instance.commit(10, priority(0));
+  auto high_a = instance.commit(20, priority(5));
+  auto mid = instance.commit(30, priority(1));
+  auto high_b = instance.commit(21, priority(5));
+  CHECK_EQ(instance.queued(), 4);
+
+  model->release();
+  CHECK_EQ(low.future.get(), 20);
+  CHECK_EQ(high_a.future.get(), 40);
+  CHECK_EQ(first.status(), cpm::Status::Done);
+  CHECK_EQ(mid.status(), cpm::Status::Done);
+  CHECK_EQ(high_b.status(), cpm::Status::Done);
+  instance.stop();
+
+  const vector<int> expected = {1, 20, 21, 30, 10};
+  CHECK(model->seen == expected);
+}
+
+TEST(cpm_deadline_and_cancel) {
+  auto model = make_shared<FakeModel>();
+  FakeInstance instance;
+  CHECK(instance.start([&]() { return model; }, 4));
+
+  auto first = instance.commit(1, cpm::CommitOptions());
+  model->wait_started();
+
+  cpm::CommitOptions expired;
+  expired.deadline = chrono::steady_clock::now() - chrono::milliseconds(1);
+  auto late = instance.commit(2, expired);
+  auto cancelled = instance.commit(3, cpm::CommitOptions());
+  auto kept = instance.commit(4, cpm::CommitOptions());
+  CHECK(cancelled.cancel());
+  CHECK(!cancelled.cancel());
+  CHECK_EQ(cancelled.status(), cpm::Status::Cancelled);
+  CHECK_EQ(cancelled.future.get(), 0);
+
+  model->release();
+  CHECK_EQ(kept.future.get(), 8);
+  CHECK_EQ(late.future.get(), 0);
+  CHECK_EQ(late.status(), cpm::Status::DeadlineExceeded);
+  CHECK(!kept.cancel());
+  CHECK_EQ(kept.status(), cpm::Status::Done);
+  instance.stop();
+
+  const vector<int> expected = {1, 4};
+  CHECK(model->seen == expected);
+}
+
+TEST(cpm_stop_completes_queued_items) {
+  auto model = make_shared<FakeModel>();
+  FakeInstance instance;
+  CHECK(instance.start([&]() { return model; }, 1));
+
+  auto first = instance.commit(1, cpm::CommitOptions());
+  model->wait_started();
+  auto queued = instance.commit(2, cpm::CommitOptions());
+
+  // stop joins the worker, so the blocked forward is released from another thread
+  thread releaser([&]() {
+    while (instance.queued() != 0) this_thread::yield();
+    model->release();
+  });
+  instance.stop();
+  releaser.join();
+
+  CHECK_EQ(queued.status(), cpm::Status::Stopped);
+  CHECK_EQ(queued.future.get(), 0);
+  CHECK_EQ(first.future.get(), 2);
+}
+
+TEST(cpm_load_failure) {
+  FakeInstance instance;
+  CHECK(!instance.start([]() { return shared_ptr<FakeModel>(); }));
+}
+
+// Simulated device for start_async: every forwards_async is a batch the test completes, in any
+// order, through finish(). Records how many batches were in flight at most.
+class FakeAsyncModel {
+ public:
+  mutex lock;
+  condition_variable cond;
+  vector<vector<int>> batches;
+  vector<shared_ptr<promise<vector<int>>>> results;
+  int running = 0, max_running = 0;
+
+  shared_future<vector<int>> forwards_async(const vector<int> &inputs, void *stream) {
+    unique_lock<mutex> l(lock);
+    auto result = make_shared<promise<vector<int>>>();
+    batches.push_back(inputs);
+    results.push_back(result);
+    running++;
+    max_running = max(max_running, running);
+    cond.notify_all();
+    return result->get_future().share();
+  }
+
+  // blocks until count batches were submitted
+  void wait_submitted(int count) {
+    unique_lock<mutex> l(lock);
+    cond.wait(l, [&]() { return (int)batches.size() >= count; });
+  }
+
+  int submitted() {
+    unique_lock<mutex> l(lock);
+    return batches.size();
+  }
+
+  void finish(int batch) {
+    shared_ptr<promise<vector<int>>> result;
+    vector<int> output;
+    {
+      unique_lock<mutex> l(lock);
+      result = results[batch];
+      for (int input : batches[batch]) output.push_back(input * 2);
+      running--;
+    }
+    result->set_value(output);
+  }
+};
+
+typedef cpm::Instance<int, int, FakeAsyncModel> FakeAsyncInstance;
+
+static bool is_ready(const shared_future<int> &future) {
+  return future.wait_for(chrono::seconds(0)) == future_status::ready;
+}
+
+TEST(cpm_async_keeps_max_pending_in_flight_and_completes_in_order) {
+  auto model = make_shared<FakeAsyncModel>();
+  FakeAsyncInstance instance;
+  CHECK(instance.start_async([&]() { return model; }, 1, nullptr, 2));
+
+  vector<cpm::Handle<int>> handles;
+  for (int i = 0; i < 4; ++i) handles.push_back(instance.commit(i + 1, cpm::CommitOptions()));
+
+  // two batches go to the device without any completing, the rest wait for room
+  model->wait_submitted(2);
+  this_thread::sleep_for(chrono::milliseconds(20));
+  CHECK_EQ(model->submitted(), 2);
+  CHECK_EQ(instance.queued(), 2);
+
+  // the second batch finishes first, its future waits for the first one
+  model->finish(1);
+  this_thread::sleep_for(chrono::milliseconds(20));
+  CHECK(!is_ready(handles[1].future));
+  CHECK_EQ(model->submitted(), 2);
+
+  model->finish(0);
+  CHECK_EQ(handles[0].future.get(), 2);
+  CHECK_EQ(handles[1].future.get(), 4);
+
+  // a new commit while a batch is in flight is taken without waiting for it
+  model->wait_submitted(4);
+  CHECK_EQ(instance.queued(), 0);
+  model->finish(2);
+  CHECK_EQ(handles[2].future.get(), 6);
+  auto late = instance.commit(5, cpm::CommitOptions());
+  model->wait_submitted(5);
+  CHECK(!is_ready(handles[3].future));
+
+  model->finish(3);
+  model->finish(4);
+  CHECK_EQ(handles[3].future.get(), 8);
+  CHECK_EQ(late.future.get(), 10);
+  instance.stop();
+
+  CHECK_EQ(model->max_running, 2);
+  for (int i = 0; i < 4; ++i) CHECK_EQ(handles[i].status(), cpm::Status::Done);
+}
+
+TEST(completion_queue_runs_in_push_order) {
+  cpm::CompletionQueue queue;
+  mutex lock;
+  vector<int> order;
+  uint64_t last = 0;
+  for (int i = 0; i < 16; ++i) {
+    last = queue.push([]() { this_thread::yield(); },
+                      [&, i]() {
+                        unique_lock<mutex> l(lock);
+                        order.push_back(i);
+                      });
+  }
+  queue.wait(last);
+  CHECK_EQ(queue.completed(), 16u);
+  CHECK_EQ(order.size(), 16u);
+  for (int i = 0; i < (int)order.size(); ++i) CHECK_EQ(order[i], i);
+
+  queue.push(nullptr, [&]() { order.push_back(16); });
+  queue.drain();
+  CHECK_EQ(order.back(), 16);
+  queue.stop();
+}
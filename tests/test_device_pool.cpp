@@ -0,0 +1,58 @@
+#include <memory>
+#include <vector>
+
+#include "device_pool.hpp"
+#include "test.hpp"
+
+using namespace std;
+
+struct PoolModel {
+  int id = 0;
+};
+
+static shared_ptr<PoolModel> model(int id) {
+  auto instance = make_shared<PoolModel>();
+  instance->id = id;
+  return instance;
+}
+
+TEST(device_pool_picks_least_loaded) {
+  vector<int> selected;
+  pool::DevicePool<PoolModel> devices([&](int device_id) { selected.push_back(device_id); });
+  devices.add(3, model(0));
+  devices.add(5, model(1));
+
+  {
+    auto first = devices.acquire();
+    CHECK(first.valid() && first.index() == 0 && first.device_id() == 3);
+    CHECK_EQ(devices.in_flight(0), 1);
+  }
+  // both idle, the one dispatched less often goes next
+  auto second = devices.acquire();
+  CHECK(second.valid() && second.index() == 1 && second->id == 1);
+  CHECK(selected.size() == 2 && selected[1] == 5);
+  CHECK(!pool::DevicePool<PoolModel>().acquire().valid());
+  CHECK(!devices.acquire(2).valid());
+}
+
+TEST(device_pool_hold_outlives_lease) {
+  pool::DevicePool<PoolModel> devices;
+  devices.add(0, model(0));
+  devices.add(1, model(1));
+
+  // async work enqueued under the lease keeps device 0 busy after the lease is gone
+  shared_ptr<void> hold;
+  {
+    auto lease = devices.acquire();
+    hold = lease.hold();
+  }
+  CHECK_EQ(devices.in_flight(0), 1);
+  shared_ptr<void> copy = hold;
+  hold.reset();
+  CHECK_EQ(devices.in_flight(0), 1);
+  CHECK_EQ(devices.acquire().index(), 1);
+  CHECK_EQ(devices.acquire().index(), 1);  // still less in flight than device 0
+
+  copy.reset();
+  CHECK_EQ(devices.in_flight(0), 0);
+}
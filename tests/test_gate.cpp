@@ -0,0 +1,141 @@
+#include <stdint.h>
+
+#include <vector>
+
+#include "gate.hpp"
+#include "test.hpp"
+
+using namespace std;
+
+// RGB32 frame with rows padded to stride bytes, the padding is noise that must be ignored
+static vector<uint8_t> frame(int width, int height, size_t stride, uint8_t value) {
+  vector<uint8_t> data(stride * height);
+  for (size_t i = 0; i < data.size(); ++i) data[i] = (uint8_t)(i * 37);
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width * 4; ++x) data[y * stride + x] = value;
+  return data;
+}
+
+TEST(gate_signature_block_means) {
+  const int width = 64, height = 32;
+  const size_t stride = width * 4 + 12;
+  auto data = frame(width, height, stride, 10);
+  // brighten the top left block of a 4 x 4 grid
+  for (int y = 0; y < 8; ++y)
+    for (int x = 0; x < 16 * 4; ++x) data[y * stride + x] = 90;
+
+  gate::Signature signature = gate::compute_signature(data.data(), width, height, stride, 4, 4);
+  CHECK_EQ(signature.grid_width, 4);
+  CHECK_EQ(signature.grid_height, 4);
+  CHECK_EQ(signature.blocks.size(), 16u);
+  CHECK_NEAR(signature.blocks[0], 90, 1e-4);
+  for (size_t i = 1; i < signature.blocks.size(); ++i) CHECK_NEAR(signature.blocks[i], 10, 1e-4);
+
+  // the grid never exceeds the image
+  gate::Signature tiny = gate::compute_signature(data.data(), 3, 2, stride, 4, 16);
+  CHECK_EQ(tiny.grid_width, 3);
+  CHECK_EQ(tiny.grid_height, 2);
+  CHECK(gate::compute_signature(nullptr, width, height, stride, 4).empty());
+}
+
+TEST(gate_signature_u8_frames) {
+  const int width = 40, height = 20;
+  const size_t stride = 48;
+  vector<uint8_t> data(stride * height, 255);  // padding
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x) data[y * stride + x] = x < width / 2 ? 30 : 200;
+
+  gate::Signature signature = gate::compute_signature(data.data(), width, height, stride, 1, 2);
+  CHECK_EQ(signature.blocks.size(), 4u);
+  CHECK_NEAR(signature.blocks[0], 30, 1e-4);
+  CHECK_NEAR(signature.blocks[1], 200, 1e-4);
+  CHECK_NEAR(signature.blocks[2], 30, 1e-4);
+  CHECK_NEAR(signature.blocks[3], 200, 1e-4);
+}
+
+// U16 frame of one value, rows padded with noise
+static vector<uint16_t> frame16(int width, int height, size_t stride, uint16_t value) {
+  vector<uint16_t> data(stride / 2 * height, 0xA5A5);
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x) data[y * stride / 2 + x] = value;
+  return data;
+}
+
+TEST(gate_signature_u16_frames) {
+  const int width = 32, height = 16;
+  const size_t stride = width * 2 + 8;
+  auto signature = [&](uint16_t value, float low, float high) {
+    auto data = frame16(width, height, stride, value);
+    return gate::compute_signature(data.data(), width, height, stride, 2, 4, low, high);
+  };
+
+  // values, not bytes: 255 and 256 are one level apart, not 127 levels
+  gate::Signature a = signature(255, 0, 65535), b = signature(256, 0, 65535);
+  CHECK(gate::signature_distance(a, b) < 0.01f);
+  CHECK_NEAR(signature(65535, 0, 65535).blocks[0], 255, 1e-3);
+
+  // a 12 bit window maps like the warp kernels, clamped outside of it
+  CHECK_NEAR(signature(2048, 0, 4095).blocks[5], 2048 * 255.0f / 4095, 1e-3);
+  CHECK_NEAR(signature(5000, 0, 4095).blocks[5], 255, 1e-4);
+  CHECK_NEAR(signature(100, 1000, 2000).blocks[5], 0, 1e-4);
+
+  // monotonic in the value, so the tolerance means the same as for 8 bit frames
+  float last = -1;
+  for (int value = 0; value < 4096; value += 64) {
+    float level = signature(value, 0, 4095).blocks[0];
+    CHECK(level > last);
+    last = level;
+  }
+  gate::Signature still = signature(1000, 0, 4095), moved = signature(1100, 0, 4095);
+  CHECK_NEAR(gate::signature_distance(still, moved), 100 * 255.0f / 4095, 1e-3);
+}
+
+TEST(gate_distance) {
+  const int width = 32, height = 32;
+  auto a = frame(width, height, width * 4, 100);
+  auto b = a;
+  b[5 * width * 4 + 7] = 255;  // one byte of one block
+
+  gate::Signature sa = gate::compute_signature(a.data(), width, height, width * 4, 4, 4);
+  gate::Signature sb = gate::compute_signature(b.data(), width, height, width * 4, 4, 4);
+  // one byte among the 8 x 8 x 4 of its block
+  CHECK_NEAR(gate::signature_distance(sa, sb), 155.0 / 256, 1e-4);
+  CHECK_EQ(gate::signature_distance(sa, sa), 0);
+
+  gate::Signature other = gate::compute_signature(a.data(), width, height, width * 4, 4, 8);
+  CHECK(gate::signature_distance(sa, other) < 0);
+  CHECK(gate::signature_distance(gate::Signature(), sa) < 0);
+}
+
+TEST(gate_hits_misses_and_max_skips) {
+  const int width = 32, height = 32;
+  gate::Config config;
+  config.tolerance = 2;
+  config.max_skips = 3;
+  gate::ChangeGate change_gate(config);
+
+  auto still = frame(width, height, width * 4, 50);
+  auto moved = frame(width, height, width * 4, 60);
+  gate::Signature s = gate::compute_signature(still.data(), width, height, width * 4, 4);
+  gate::Signature m = gate::compute_signature(moved.data(), width, height, width * 4, 4);
+
+  yolo::BoxArray result = {yolo::Box(1, 2, 3, 4, 0.9f, 0)}, output;
+  CHECK(!change_gate.lookup(s, output));
+  change_gate.store(s, result);
+  for (int i = 0; i < 3; ++i) {
+    output.clear();
+    CHECK(change_gate.lookup(s, output));
+    CHECK(output.size() == 1 && output[0].right == 3);
+  }
+  // forced through after max_skips hits
+  CHECK(!change_gate.lookup(s, output));
+  change_gate.store(s, result);
+  CHECK(!change_gate.lookup(m, output));
+  CHECK_EQ(change_gate.hits(), 3u);
+  CHECK_EQ(change_gate.misses(), 3u);
+
+  change_gate.reset();
+  CHECK(!change_gate.lookup(s, output));
+  CHECK_EQ(change_gate.hits(), 0u);
+  CHECK_EQ(change_gate.misses(), 1u);
+}
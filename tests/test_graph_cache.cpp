@@ -0,0 +1,60 @@
+#include <vector>
+
+#include "graph_cache.hpp"
+#include "test.hpp"
+
+using namespace std;
+using namespace yolo;
+
+static GraphKey key(int batch, int width, const void *input) {
+  GraphKey output;
+  output.batch = batch;
+  output.shapes = {batch, 3, width, width};
+  output.addresses = {input};
+  return output;
+}
+
+TEST(graph_cache_lookup_update_and_destroy) {
+  vector<void *> destroyed;
+  int a = 0, b = 0, c = 0;
+  {
+    GraphCache cache([&](void *exec) { destroyed.push_back(exec); });
+    void *exec = &c;
+    CHECK(cache.lookup(key(1, 640, &a), &exec) == GraphLookup::Miss);
+    CHECK(exec == nullptr);
+
+    cache.store(key(1, 640, &a), &a);
+    CHECK(cache.lookup(key(1, 640, &a), &exec) == GraphLookup::Hit);
+    CHECK(exec == &a);
+
+    // same batch, moved input: the cached exec is offered for an update
+    CHECK(cache.lookup(key(1, 640, &b), &exec) == GraphLookup::Update);
+    CHECK(exec == &a);
+    CHECK(cache.lookup(key(1, 320, &a), &exec) == GraphLookup::Update);
+
+    // an updated exec is stored again as is, a replaced one is destroyed
+    cache.store(key(1, 640, &b), &a);
+    CHECK(destroyed.empty());
+    CHECK(cache.lookup(key(1, 640, &b), nullptr) == GraphLookup::Hit);
+    cache.store(key(1, 640, &b), &b);
+    CHECK_EQ(destroyed.size(), 1u);
+    CHECK(destroyed.back() == &a);
+
+    cache.store(key(4, 640, &a), &c);
+    CHECK_EQ(cache.size(), 2u);
+    CHECK(cache.lookup(key(4, 640, &a), &exec) == GraphLookup::Hit);
+    CHECK(exec == &c);
+
+    cache.erase(4);
+    CHECK(destroyed.back() == &c);
+    cache.erase(8);
+    CHECK_EQ(cache.size(), 1u);
+
+    CHECK_EQ(cache.hits(), 3u);
+    CHECK_EQ(cache.updates(), 2u);
+    CHECK_EQ(cache.misses(), 1u);
+  }
+  // the destructor releases what is left
+  CHECK_EQ(destroyed.size(), 3u);
+  CHECK(destroyed.back() == &b);
+}
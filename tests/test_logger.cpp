@@ -0,0 +1,65 @@
+#include <stdio.h>
+
+#include <string>
+
+#include "logger.hpp"
+#include "test.hpp"
+
+TEST(log_rate_limiter_caps_a_window) {
+  trt::LogRateLimiter limiter;
+  int allowed = 0;
+  for (int i = 0; i < 50; ++i) allowed += limiter.allow(20, 10000 + i);
+  CHECK_EQ(allowed, 20);
+  CHECK(!limiter.allow(20, 10999));
+}
+
+TEST(log_rate_limit_zero_is_unlimited) {
+  trt::LogRateLimiter limiter;
+  trt::set_log_rate_limit(0);
+  int allowed = 0;
+  for (int i = 0; i < 1000; ++i) allowed += limiter.allow();
+  trt::set_log_rate_limit(20);
+  CHECK_EQ(allowed, 1000);
+}
+
+TEST(log_rate_limiter_resets_with_the_window) {
+  trt::LogRateLimiter limiter;
+  int allowed = 0;
+  for (int i = 0; i < 30; ++i) allowed += limiter.allow(20, 10000 + i);
+  CHECK_EQ(allowed, 20);
+  CHECK(!limiter.allow(20, 10999));
+
+  // a full budget again one second after the window started, counted from the new start
+  allowed = 0;
+  for (int i = 0; i < 30; ++i) allowed += limiter.allow(20, 11000 + i);
+  CHECK_EQ(allowed, 20);
+  CHECK(!limiter.allow(20, 11999));
+  CHECK(limiter.allow(20, 12000));
+
+  // a quiet period longer than a window
+  allowed = 0;
+  for (int i = 0; i < 30; ++i) allowed += limiter.allow(20, 60000);
+  CHECK_EQ(allowed, 20);
+}
+
+TEST(log_shutdown_writes_later_messages_synchronously) {
+  const char *file = "yolo_tests_logger.log";
+  remove(file);
+  trt::set_log_file(file);
+  INFO("queued %d", 1);
+  trt::log_shutdown();
+  trt::log_shutdown();
+  INFO("after shutdown %s", "sync");
+  trt::set_log_file("");
+
+  std::string text;
+  FILE *handle = fopen(file, "r");
+  CHECK(handle != nullptr);
+  if (handle == nullptr) return;
+  char line[256];
+  while (fgets(line, sizeof(line), handle)) text += line;
+  fclose(handle);
+  remove(file);
+  CHECK(text.find("queued 1") != std::string::npos);
+  CHECK(text.find("after shutdown sync") != std::string::npos);
+}
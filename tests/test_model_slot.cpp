@@ -0,0 +1,147 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "model_slot.hpp"
+#include "test.hpp"
+
+using namespace std;
+
+TEST(model_slot_reload_publishes_in_the_background) {
+  model::Slot<int> slot;
+  slot.exchange(make_shared<int>(1));
+  auto snapshot = slot.get();
+  CHECK_EQ(slot.generation(), 1u);
+
+  mutex lock;
+  condition_variable cond;
+  bool go = false;
+  CHECK(slot.reload([&]() {
+    unique_lock<mutex> l(lock);
+    cond.wait(l, [&]() { return go; });
+    return make_shared<int>(2);
+  }));
+  // callers keep the current model while the next one loads, a second reload is refused
+  CHECK(slot.status() == model::ReloadStatus::Loading);
+  CHECK_EQ(*slot.get(), 1);
+  CHECK(!slot.reload([]() { return make_shared<int>(3); }));
+
+  {
+    unique_lock<mutex> l(lock);
+    go = true;
+  }
+  cond.notify_all();
+  slot.wait();
+  CHECK(slot.status() == model::ReloadStatus::Done);
+  CHECK_EQ(*slot.get(), 2);
+  CHECK_EQ(slot.generation(), 2u);
+  CHECK_EQ(*snapshot, 1);  // still valid for its holder
+}
+
+TEST(model_slot_failed_reload_keeps_the_model) {
+  model::Slot<int> slot;
+  slot.exchange(make_shared<int>(1));
+  CHECK(slot.reload([]() { return shared_ptr<int>(); }));
+  slot.wait();
+  CHECK(slot.status() == model::ReloadStatus::Failed);
+  CHECK_EQ(*slot.get(), 1);
+
+  CHECK(slot.reload([]() -> shared_ptr<int> { throw 1; }));
+  slot.wait();
+  CHECK(slot.status() == model::ReloadStatus::Failed);
+  CHECK_EQ(slot.generation(), 1u);
+
+  slot.reset();
+  CHECK(slot.get() == nullptr);
+}
+
+namespace {
+
+// every value equals id once constructed, a reader that sees a mix saw a torn model
+struct Versioned {
+  explicit Versioned(int id) : id(id), values(256, id) {}
+  int id;
+  vector<int> values;
+};
+
+bool complete(const Versioned &model) {
+  if ((int)model.values.size() != 256) return false;
+  for (int value : model.values)
+    if (value != model.id) return false;
+  return true;
+}
+
+};  // namespace
+
+TEST(model_slot_readers_see_whole_models_during_swaps) {
+  model::Slot<Versioned> slot;
+  slot.exchange(make_shared<Versioned>(0));
+
+  atomic<bool> stop{false};
+  atomic<int> torn{0}, empty{0}, backwards{0};
+  atomic<long long> reads{0};
+  vector<thread> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back([&]() {
+      int last = 0;
+      while (!stop) {
+        auto model = slot.get();
+        if (model == nullptr) {
+          empty++;
+          continue;
+        }
+        if (!complete(*model)) torn++;
+        // ids only grow, a reader never goes back to an older model
+        if (model->id < last) backwards++;
+        last = model->id;
+        reads++;
+      }
+    });
+  }
+
+  int next = 1;
+  for (int i = 0; i < 200; ++i) {
+    if (i % 2 == 0) {
+      slot.exchange(make_shared<Versioned>(next++));
+    } else {
+      int id = next++;
+      CHECK(slot.reload([id]() { return make_shared<Versioned>(id); }));
+      slot.wait();
+    }
+  }
+  while (reads < 1000) this_thread::yield();
+  stop = true;
+  for (auto &reader : readers) reader.join();
+
+  CHECK_EQ(torn.load(), 0);
+  CHECK_EQ(empty.load(), 0);
+  CHECK_EQ(backwards.load(), 0);
+  CHECK_EQ(slot.get()->id, next - 1);
+  CHECK_EQ(slot.generation(), (unsigned int)next);
+}
+
+TEST(model_slot_destroyed_while_reloading) {
+  struct Model {
+    explicit Model(atomic<bool> *released) : released(released) {}
+    ~Model() { *released = true; }
+    atomic<bool> *released;
+  };
+
+  atomic<bool> go{false}, released{false};
+  {
+    model::Slot<Model> slot;
+    CHECK(slot.reload([&]() {
+      while (!go) this_thread::yield();
+      return make_shared<Model>(&released);
+    }));
+  }
+  // the detached loader publishes into the state it shares, the model goes with it
+  go = true;
+  auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+  while (!released && chrono::steady_clock::now() < deadline) this_thread::yield();
+  CHECK(released);
+}
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "overlay.hpp"
+#include "test.hpp"
+
+using namespace std;
+
+static const uint8_t BACKGROUND = 7;
+
+struct Image {
+  int width, height;
+  size_t stride;
+  vector<uint8_t> data;
+
+  Image(int width, int height, size_t stride)
+      : width(width), height(height), stride(stride), data(stride * height, BACKGROUND) {}
+
+  overlay::Canvas canvas() { return overlay::Canvas(data.data(), width, height, stride); }
+  uint32_t pixel(int x, int y) const {
+    uint32_t value;
+    memcpy(&value, &data[y * stride + x * 4], 4);
+    return value;
+  }
+};
+
+TEST(overlay_pack_color_byte_order) {
+  uint32_t color = overlay::pack_color(1, 2, 3);
+  uint8_t bytes[4];
+  memcpy(bytes, &color, 4);
+  CHECK(bytes[0] == 1 && bytes[1] == 2 && bytes[2] == 3 && bytes[3] == 255);
+}
+
+TEST(overlay_fill_rect_clips_and_keeps_padding) {
+  Image image(37, 9, 37 * 4 + 8);
+  overlay::Canvas canvas = image.canvas();
+  uint32_t red = overlay::pack_color(255, 0, 0);
+  overlay::fill_rect(canvas, -5, 2, 100, 4, red);
+  overlay::fill_rect(canvas, 10, 10, 20, 20, red);  // below the canvas
+  overlay::fill_rect(canvas, 3, 7, 3, 9, red);      // empty
+
+  uint32_t background;
+  memset(&background, BACKGROUND, 4);
+  for (int y = 0; y < image.height; ++y) {
+    for (int x = 0; x < image.width; ++x)
+      CHECK_EQ(image.pixel(x, y), y >= 2 && y < 4 ? red : background);
+    for (size_t i = image.width * 4; i < image.stride; ++i)
+      CHECK_EQ(image.data[y * image.stride + i], BACKGROUND);
+  }
+}
+
+TEST(overlay_stroke_rect_geometry) {
+  // thickness 5 spreads 2 pixels outside and 3 inside of every edge, like cv::rectangle
+  Image image(40, 40, 40 * 4);
+  overlay::Canvas canvas = image.canvas();
+  uint32_t green = overlay::pack_color(0, 255, 0);
+  overlay::stroke_rect(canvas, 10, 10, 30, 25, 5, green);
+
+  for (int y = 0; y < image.height; ++y) {
+    for (int x = 0; x < image.width; ++x) {
+      bool outer = x >= 8 && x < 33 && y >= 8 && y < 28;
+      bool inner = x >= 13 && x < 28 && y >= 13 && y < 23;
+      CHECK_EQ(image.pixel(x, y) == green, outer && !inner);
+    }
+  }
+}
+
+// Fixed 5 x 7 glyphs with alpha levels 0, 85, 170 and 255, so the golden image does not depend
+// on how the installed OpenCV rasterizes the Hershey font.
+static overlay::Font test_font() {
+  static const unsigned char levels[4] = {0, 85, 170, 255};
+  overlay::Font font;
+  font.thickness = 1;
+  for (int c = overlay::FIRST_GLYPH; c <= overlay::LAST_GLYPH; ++c) {
+    overlay::Glyph &glyph = font.glyphs[c - overlay::FIRST_GLYPH];
+    glyph.advance = 6;
+    glyph.width = 5;
+    glyph.height = 7;
+    glyph.offset_x = 0;
+    glyph.offset_y = -7;
+    glyph.offset = font.atlas.size();
+    for (int y = 0; y < 7; ++y)
+      for (int x = 0; x < 5; ++x) font.atlas.push_back(levels[(c * 7 + x * 3 + y * 5) % 4]);
+  }
+  return font;
+}
+
+static string read_file(const string &file) {
+  FILE *handle = fopen(file.c_str(), "rb");
+  if (handle == nullptr) return string();
+  string data;
+  char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), handle)) > 0) data.append(buffer, n);
+  fclose(handle);
+  return data;
+}
+
+// PAM of the visible pixels, the row padding is checked separately
+static string to_pam(const Image &image) {
+  char header[128];
+  snprintf(header, sizeof(header),
+           "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n",
+           image.width, image.height);
+  string data = header;
+  for (int y = 0; y < image.height; ++y)
+    data.append((const char *)&image.data[y * image.stride], image.width * 4);
+  return data;
+}
+
+static uint32_t blend(uint32_t pixel, uint32_t color) {
+  uint8_t p[4], c[4];
+  memcpy(p, &pixel, 4);
+  memcpy(c, &color, 4);
+  for (int i = 0; i < 3; ++i) p[i] = (p[i] + c[i] + 1) / 2;
+  memcpy(&pixel, p, 4);
+  return pixel;
+}
+
+static uint32_t class_color(int label) {
+  uint8_t b, g, r;
+  tie(b, g, r) = yolo::random_color(label);
+  return overlay::pack_color(r, g, b);
+}
+
+TEST(overlay_golden_boxes_labels_masks) {
+  Image image(160, 96, 160 * 4 + 16);
+  for (int y = 0; y < image.height; ++y) {
+    for (int x = 0; x < image.width; ++x) {
+      uint32_t value = overlay::pack_color(x * 3, y * 5, (x + y) & 255);
+      memcpy(&image.data[y * image.stride + x * 4], &value, 4);
+    }
+  }
+  Image background = image;
+
+  // a 6 x 6 mask over box 1, row y is foreground up to 6 - y
+  auto rle = make_shared<yolo::MaskRLE>();
+  rle->width = 6;
+  rle->height = 6;
+  rle->counts = {0};
+  for (int y = 0; y < 6; ++y) rle->counts.insert(rle->counts.end(), {6u - y, (uint32_t)y});
+
+  yolo::BoxArray boxes;
+  boxes.emplace_back(20, 40, 70, 80, 0.87f, 0);
+  boxes.emplace_back(90, 42, 150, 90, 0.5f, 7);  // no class name
+  boxes.back().sub_label = 2;
+  boxes.back().sub_confidence = 0.25f;
+  boxes.back().rle = rle;
+  boxes.emplace_back(-10, 5, 30, 20, 0.99f, 1);  // caption above the canvas
+  vector<string> class_names = {"cat", "dog"};
+
+  auto renderer = overlay::create_renderer(test_font(), 3);
+  CHECK_EQ(renderer->text_width("cat 0.87"), 8 * 6 + 1);
+  overlay::Canvas canvas = image.canvas();
+  renderer->draw_boxes(canvas, boxes, class_names);
+
+  for (int y = 0; y < image.height; ++y)
+    for (size_t i = image.width * 4; i < image.stride; ++i)
+      CHECK_EQ(image.data[y * image.stride + i], BACKGROUND);
+
+  // caption background of box 0 right of the text, outline, untouched inside
+  CHECK_EQ(image.pixel(20 + 49 + 9, 20), class_color(0));
+  CHECK_EQ(image.pixel(20, 60), class_color(0));
+  CHECK_EQ(image.pixel(45, 60), background.pixel(45, 60));
+  // mask of box 1: cell (0, 5) is foreground, cell (5, 5) is not
+  CHECK_EQ(image.pixel(93, 86), blend(background.pixel(93, 86), class_color(7)));
+  CHECK_EQ(image.pixel(147, 86), background.pixel(147, 86));
+
+  string golden = test::golden_dir() + "/overlay_rgb32.pam";
+  string actual = to_pam(image);
+  if (test::update_golden()) {
+    FILE *handle = fopen(golden.c_str(), "wb");
+    CHECK(handle != nullptr);
+    if (handle == nullptr) return;
+    fwrite(actual.data(), 1, actual.size(), handle);
+    fclose(handle);
+    return;
+  }
+  string expected = read_file(golden);
+  CHECK(!expected.empty());
+  CHECK(actual == expected);
+}
@@ -0,0 +1,395 @@
+#include <math.h>
+#include <string.h>
+
+#include <limits>
+#include <vector>
+
+#include "postprocess.hpp"
+#include "test.hpp"
+
+using namespace std;
+using namespace yolo;
+
+static const float IDENTITY[6] = {1, 0, 0, 0, 1, 0};
+
+static vector<float> boxarray(int num_images = 1, size_t stride = 0) {
+  if (stride == 0) stride = 1 + MAX_IMAGE_BOXES * NUM_BOX_ELEMENT;
+  return vector<float>(stride * num_images, 0.0f);
+}
+
+static const float *item(const vector<float> &parray, int index, size_t offset = 0) {
+  return &parray[offset + 1 + index * NUM_BOX_ELEMENT];
+}
+
+// deterministic head of rows [cx, cy, w, h, (objectness), classes...] with ties and empty rows
+static vector<float> random_head(int num_bboxes, int num_classes, bool objectness,
+                                 unsigned seed) {
+  int cdim = num_classes + (objectness ? 5 : 4);
+  vector<float> head(num_bboxes * cdim);
+  unsigned state = seed;
+  auto next = [&]() {
+    state = state * 1664525u + 1013904223u;
+    return (state >> 8) / 16777216.0f;
+  };
+  for (int i = 0; i < num_bboxes; ++i) {
+    float *row = &head[i * cdim];
+    row[0] = 20 + next() * 600;
+    row[1] = 20 + next() * 600;
+    row[2] = 10 + next() * 80;
+    row[3] = 10 + next() * 80;
+    float *scores = row + 4;
+    if (objectness) *scores++ = next();
+    for (int c = 0; c < num_classes; ++c) scores[c] = floorf(next() * 8) / 8;
+  }
+  return head;
+}
+
+TEST(decode_v8_class_thresholds) {
+  // d2i scales by 2 and shifts by (1, 3)
+  const float d2i[6] = {2, 0, 1, 0, 2, 3};
+  const float inf = numeric_limits<float>::infinity();
+  const float thresholds[3] = {0.7f, 0.25f, inf};
+  const float head[] = {
+      50, 50, 20, 10, 0.1f, 0.9f, 0.3f,   // class 1
+      10, 10, 4,  4,  0.6f, 0.2f, 0.1f,   // every class below its threshold
+      30, 40, 10, 20, 0.8f, 0.1f, 0.95f,  // class 2 is disabled, class 0 remains
+  };
+
+  auto parray = boxarray();
+  host::decode(head, 3, 3, 7, 0.25f, thresholds, d2i, parray.data(), MAX_IMAGE_BOXES, Type::V8);
+  CHECK_EQ(parray[0], 2);
+
+  const float *a = item(parray, 0);
+  CHECK_EQ(a[0], 81);
+  CHECK_EQ(a[1], 93);
+  CHECK_EQ(a[2], 121);
+  CHECK_EQ(a[3], 113);
+  CHECK_NEAR(a[4], 0.9f, 1e-6);
+  CHECK_EQ(a[5], 1);
+  CHECK_EQ(a[6], 1);
+  CHECK_EQ(a[7], 0);
+
+  const float *b = item(parray, 1);
+  CHECK_NEAR(b[4], 0.8f, 1e-6);
+  CHECK_EQ(b[5], 0);
+  CHECK_EQ(b[7], 2);
+}
+
+TEST(decode_v5_objectness) {
+  const float thresholds[2] = {0.25f, 0.25f};
+  const float head[] = {
+      10, 10, 4, 4, 0.2f, 1.0f, 1.0f,  // objectness below the threshold
+      10, 10, 4, 4, 0.5f, 0.4f, 0.8f,  // class 1 at 0.4
+      10, 10, 4, 4, 0.5f, 0.3f, 0.4f,  // both scores below 0.25 after objectness
+  };
+  auto parray = boxarray();
+  host::decode(head, 3, 2, 7, 0.25f, thresholds, IDENTITY, parray.data(), MAX_IMAGE_BOXES,
+               Type::V5);
+  CHECK_EQ(parray[0], 1);
+  CHECK_NEAR(item(parray, 0)[4], 0.4f, 1e-6);
+  CHECK_EQ(item(parray, 0)[5], 1);
+  CHECK_EQ(item(parray, 0)[0], 8);
+  CHECK_EQ(item(parray, 0)[3], 12);
+}
+
+TEST(decode_counts_past_max_boxes) {
+  const float thresholds[1] = {0.25f};
+  vector<float> head;
+  for (int i = 0; i < 10; ++i) head.insert(head.end(), {10.0f * i, 10, 4, 4, 0.9f});
+
+  auto parray = boxarray(1, 1 + 4 * NUM_BOX_ELEMENT);
+  host::decode(head.data(), 10, 1, 5, 0.25f, thresholds, IDENTITY, parray.data(), 4, Type::V8);
+  CHECK_EQ(parray[0], 10);  // the kernel counts every candidate, items stop at max
+  CHECK_EQ(item(parray, 3)[7], 3);
+
+  BoxArray output;
+  host::collect(parray.data(), 4, output);
+  CHECK_EQ(output.size(), 4u);
+}
+
+TEST(select_decode_variants) {
+  DecodeVariant v8 = select_decode(80, 84, Type::V8);
+  CHECK_EQ(v8.classes, 80);
+  CHECK(!v8.objectness);
+  CHECK(v8.vectorized);
+
+  DecodeVariant v5 = select_decode(3, 8, Type::V5);
+  CHECK_EQ(v5.classes, 0);
+  CHECK(v5.objectness);
+  CHECK(v5.vectorized);
+
+  DecodeVariant seg = select_decode(2, 6 + 32, Type::V8Seg);
+  CHECK_EQ(seg.classes, 2);
+  CHECK(!seg.objectness);
+  CHECK(!seg.vectorized);
+}
+
+TEST(decode_variants_match_generic) {
+  const int class_counts[] = {1, 2, 3, 4, 7, 80};
+  for (int objectness = 0; objectness < 2; ++objectness) {
+    for (int num_classes : class_counts) {
+      Type type = objectness ? Type::V5 : Type::V8;
+      int cdim = num_classes + (objectness ? 5 : 4);
+      auto head = random_head(300, num_classes, objectness != 0, 17 + num_classes);
+      vector<float> thresholds(num_classes, 0.25f);
+      if (num_classes > 1) thresholds[num_classes / 2] = numeric_limits<float>::infinity();
+
+      auto expected = boxarray(), actual = boxarray();
+      host::decode(head.data(), 300, num_classes, cdim, 0.25f, thresholds.data(), IDENTITY,
+                   expected.data(), MAX_IMAGE_BOXES, type);
+      host::decode(head.data(), 300, num_classes, cdim, 0.25f, thresholds.data(), IDENTITY,
+                   actual.data(), MAX_IMAGE_BOXES, select_decode(num_classes, cdim, type));
+      CHECK(expected[0] > 0);
+      CHECK(memcmp(expected.data(), actual.data(), expected.size() * sizeof(float)) == 0);
+    }
+  }
+}
+
+static void put_box(vector<float> &parray, int index, float left, float top, float right,
+                    float bottom, float confidence, int label, size_t offset = 0) {
+  float *p = &parray[offset + 1 + index * NUM_BOX_ELEMENT];
+  float values[NUM_BOX_ELEMENT] = {left, top, right, bottom, confidence, (float)label, 1,
+                                   (float)index};
+  memcpy(p, values, sizeof(values));
+  parray[offset] = max(parray[offset], (float)(index + 1));
+}
+
+TEST(fast_nms_same_class_only) {
+  auto parray = boxarray();
+  put_box(parray, 0, 0, 0, 100, 100, 0.6f, 0);
+  put_box(parray, 1, 5, 5, 100, 100, 0.9f, 0);    // iou 0.9 with 0, suppresses it
+  put_box(parray, 2, 0, 0, 100, 100, 0.5f, 1);    // other class
+  put_box(parray, 3, 200, 0, 300, 100, 0.4f, 0);  // no overlap
+  put_box(parray, 4, 200, 0, 300, 100, 0.4f, 1);
+  put_box(parray, 5, 200, 0, 300, 100, 0.4f, 1);  // tie, the later box is kept like the kernel
+  host::fast_nms(parray.data(), MAX_IMAGE_BOXES, 0.5f);
+
+  const int expected[6] = {0, 1, 1, 1, 0, 1};
+  for (int i = 0; i < 6; ++i) CHECK_EQ(item(parray, i)[6], expected[i]);
+  CHECK_EQ(host::count_kept(parray.data(), MAX_IMAGE_BOXES), 4);
+}
+
+TEST(batched_decode_nms_match_single) {
+  const int num_images = 3, num_bboxes = 200, num_classes = 4, cdim = 8;
+  const size_t stride = 32 + MAX_IMAGE_BOXES * NUM_BOX_ELEMENT;
+  vector<float> heads, matrices;
+  for (int ib = 0; ib < num_images; ++ib) {
+    auto head = random_head(num_bboxes, num_classes, false, 101 + ib);
+    heads.insert(heads.end(), head.begin(), head.end());
+    float d2i[6] = {1.5f + ib, 0, (float)ib, 0, 1.5f + ib, 2.0f * ib};
+    matrices.insert(matrices.end(), d2i, d2i + 6);
+  }
+  vector<float> thresholds(num_classes, 0.3f);
+  DecodeVariant variant = select_decode(num_classes, cdim, Type::V8);
+
+  auto batched = boxarray(num_images, stride);
+  for (auto &value : batched) value = -1;  // the counters are zeroed by decode
+  host::decode(heads.data(), num_images, num_bboxes, num_classes, cdim, 0.3f, thresholds.data(),
+               matrices.data(), batched.data(), stride, MAX_IMAGE_BOXES, variant);
+  host::fast_nms(batched.data(), stride, num_images, MAX_IMAGE_BOXES, 0.45f);
+
+  for (int ib = 0; ib < num_images; ++ib) {
+    auto single = boxarray();
+    host::decode(&heads[ib * num_bboxes * cdim], num_bboxes, num_classes, cdim, 0.3f,
+                 thresholds.data(), &matrices[ib * 6], single.data(), MAX_IMAGE_BOXES, Type::V8);
+    host::fast_nms(single.data(), MAX_IMAGE_BOXES, 0.45f);
+
+    const float *p = &batched[ib * stride];
+    int count = (int)single[0];
+    CHECK(count > 0);
+    CHECK_EQ(p[0], single[0]);
+    CHECK(memcmp(p + 1, &single[1], count * NUM_BOX_ELEMENT * sizeof(float)) == 0);
+  }
+}
+
+TEST(mask_level_rounds_and_clamps) {
+  CHECK_EQ(mask_level(0.5f), 128);
+  CHECK_EQ(mask_level(0.0f), 1);
+  CHECK_EQ(mask_level(1.0f), 255);
+  CHECK_EQ(mask_level(2.0f), 255);
+}
+
+TEST(encode_rle_runs) {
+  // 4 x 3, foreground from level 128
+  const unsigned char mask[12] = {200, 255, 0,   10,   //
+                                  127, 128, 128, 128,  //
+                                  0,   0,   0,   255};
+  MaskRLE rle;
+  host::encode_rle(mask, 4, 3, 128, rle);
+  CHECK_EQ(rle.width, 4);
+  CHECK_EQ(rle.height, 3);
+  const uint32_t expected[] = {0, 2, 3, 3, 3, 1};
+  CHECK_EQ(rle.counts.size(), 6u);
+  for (size_t i = 0; i < rle.counts.size() && i < 6; ++i) CHECK_EQ(rle.counts[i], expected[i]);
+
+  unsigned char decoded[12];
+  host::decode_rle(rle, decoded);
+  for (int i = 0; i < 12; ++i) CHECK_EQ(decoded[i], mask[i] >= 128 ? 255 : 0);
+
+  const unsigned char empty[6] = {0};
+  host::encode_rle(empty, 3, 2, 128, rle);
+  CHECK_EQ(rle.counts.size(), 1u);
+  CHECK_EQ(rle.counts[0], 6u);
+}
+
+TEST(rle_from_transitions_matches_encode) {
+  vector<unsigned char> mask(37 * 11);
+  unsigned state = 5;
+  for (auto &value : mask) {
+    state = state * 1103515245u + 12345u;
+    value = (state >> 16) % 7 < 3 ? 255 : 0;
+  }
+
+  MaskRLE expected;
+  host::encode_rle(mask.data(), 37, 11, 128, expected);
+
+  // what the device copies back: the positions where a run ends, the last run excluded
+  vector<unsigned int> transitions;
+  unsigned int position = 0;
+  for (size_t i = 0; i + 1 < expected.counts.size(); ++i) {
+    position += expected.counts[i];
+    transitions.push_back(position);
+  }
+  MaskRLE actual;
+  host::rle_from_transitions(transitions.data(), transitions.size(), 37, 11, actual);
+  CHECK_EQ(actual.width, 37);
+  CHECK_EQ(actual.height, 11);
+  CHECK(actual.counts == expected.counts);
+
+  MaskRLE background;
+  host::rle_from_transitions(nullptr, 0, 4, 4, background);
+  CHECK_EQ(background.counts.size(), 1u);
+  CHECK_EQ(background.counts[0], 16u);
+}
+
+TEST(end_to_end_unletterbox_and_thresholds) {
+  const float d2i[6] = {2, 0, 10, 0, 2, 20};
+  const float boxes[] = {0, 0, 10, 10, 5, 5, 15, 25, 1, 1, 2, 2, 3, 3, 4, 4};
+  const float scores[] = {0.9f, 0.5f, 0.3f, 0.95f};
+  const int classes[] = {0, 1, 7, 1};
+  const float class_thresholds[2] = {0.3f, 0.6f};
+
+  auto parray = boxarray();
+  // num_dets above max_detections is clamped
+  host::end_to_end(9, boxes, scores, classes, true, 3, 0.25f, class_thresholds, 2, d2i,
+                   parray.data());
+  CHECK_EQ(parray[0], 3);
+
+  const float *a = item(parray, 0);
+  CHECK_EQ(a[0], 10);
+  CHECK_EQ(a[1], 20);
+  CHECK_EQ(a[2], 30);
+  CHECK_EQ(a[3], 40);
+  CHECK_EQ(a[6], 1);
+  CHECK_EQ(item(parray, 1)[6], 0);  // below the threshold of class 1
+  CHECK_EQ(item(parray, 2)[5], 7);
+  CHECK_EQ(item(parray, 2)[6], 1);  // unknown class, only the global threshold applies
+  CHECK_EQ(item(parray, 2)[7], 2);
+
+  const float float_classes[] = {0, 1, 7, 1};
+  auto same = boxarray();
+  host::end_to_end(3, boxes, scores, float_classes, false, 3, 0.25f, class_thresholds, 2, d2i,
+                   same.data());
+  CHECK(memcmp(parray.data(), same.data(), (1 + 3 * NUM_BOX_ELEMENT) * sizeof(float)) == 0);
+
+  host::end_to_end(-1, boxes, scores, classes, true, 3, 0.25f, class_thresholds, 2, d2i,
+                   parray.data());
+  CHECK_EQ(parray[0], 0);
+}
+
+static BindingInfo binding(int index, const char *name, vector<int> dims, bool integer) {
+  BindingInfo info;
+  info.index = index;
+  info.name = name;
+  info.dims = dims;
+  info.integer = integer;
+  return info;
+}
+
+TEST(find_end_to_end_bindings) {
+  // EfficientNMS, in a shuffled order
+  vector<BindingInfo> efficient = {
+      binding(4, "det_scores", {1, 100}, false), binding(1, "num_dets", {1, 1}, true),
+      binding(3, "det_classes", {1, 100}, true), binding(2, "det_boxes", {1, 100, 4}, false)};
+  EndToEndBindings found = find_end_to_end(efficient);
+  CHECK(found.valid());
+  CHECK_EQ(found.num_dets, 1);
+  CHECK_EQ(found.boxes, 2);
+  CHECK_EQ(found.classes, 3);
+  CHECK_EQ(found.scores, 4);
+  CHECK_EQ(found.max_detections, 100);
+  CHECK(found.integer_classes);
+
+  // BatchedNMS has float classes
+  vector<BindingInfo> batched = {
+      binding(1, "num_detections", {1, 1}, true), binding(2, "nmsed_boxes", {1, 50, 4}, false),
+      binding(3, "nmsed_scores", {1, 50}, false), binding(4, "nmsed_classes", {1, 50}, false)};
+  found = find_end_to_end(batched);
+  CHECK(found.valid());
+  CHECK_EQ(found.max_detections, 50);
+  CHECK(!found.integer_classes);
+
+  // names that say nothing, recognised by shape and type
+  vector<BindingInfo> anonymous = {
+      binding(1, "output0", {1, 100, 4}, false), binding(2, "output1", {1}, true),
+      binding(3, "output2", {1, 100}, false), binding(4, "output3", {1, 100}, true)};
+  found = find_end_to_end(anonymous);
+  CHECK(found.valid());
+  CHECK_EQ(found.boxes, 1);
+  CHECK_EQ(found.num_dets, 2);
+  CHECK_EQ(found.scores, 3);
+  CHECK_EQ(found.classes, 4);
+
+  vector<BindingInfo> mismatched = efficient;
+  mismatched[0].dims = {1, 99};
+  CHECK(!find_end_to_end(mismatched).valid());
+  CHECK(!find_end_to_end({binding(1, "output0", {1, 84, 8400}, false)}).valid());
+}
+
+TEST(count_classes_and_zones) {
+  auto parray = boxarray();
+  put_box(parray, 0, 0, 0, 20, 20, 0.9f, 0);    // center (10, 10)
+  put_box(parray, 1, 40, 0, 60, 20, 0.9f, 1);   // center (50, 10), on the left zone edge
+  put_box(parray, 2, 80, 0, 120, 20, 0.9f, 1);  // center (100, 10), on the right zone edge
+  put_box(parray, 3, 0, 0, 20, 20, 0.9f, 2);
+  put_box(parray, 4, 0, 0, 20, 20, 0.9f, 3);    // outside [0, num_classes)
+  put_box(parray, 5, 0, 0, 20, 20, 0.9f, -1);
+  put_box(parray, 6, 0, 0, 20, 20, 0.9f, 0);
+  parray[1 + 6 * NUM_BOX_ELEMENT + 6] = 0;  // suppressed
+
+  CountZone zones[2] = {CountZone(50, 0, 100, 100), CountZone(0, 0, 1000, 1000)};
+  int counts[3 * 3] = {0};
+  host::count(parray.data(), MAX_IMAGE_BOXES, 3, zones, 2, counts);
+  const int expected[9] = {1, 2, 1,   // classes
+                           0, 1, 0,   // zone 0
+                           1, 2, 1};  // zone 1
+  for (int i = 0; i < 9; ++i) CHECK_EQ(counts[i], expected[i]);
+}
+
+TEST(collect_single_and_batch) {
+  const size_t stride = 1 + 8 * NUM_BOX_ELEMENT;
+  auto parrays = boxarray(3, stride);
+  put_box(parrays, 0, 1, 2, 3, 4, 0.9f, 2, 0);
+  put_box(parrays, 1, 5, 6, 7, 8, 0.8f, 1, 0);
+  parrays[1 + 1 * NUM_BOX_ELEMENT + 6] = 0;
+  put_box(parrays, 0, 9, 10, 11, 12, 0.7f, 0, 2 * stride);
+  put_box(parrays, 1, 13, 14, 15, 16, 0.6f, 3, 2 * stride);
+
+  BoxArray single;
+  host::collect(parrays.data(), 8, single);
+  CHECK_EQ(single.size(), 1u);
+  CHECK_EQ(single[0].left, 1);
+  CHECK_EQ(single[0].bottom, 4);
+  CHECK_EQ(single[0].class_label, 2);
+
+  BoxBatch batch;
+  host::collect(parrays.data(), stride, 3, 8, batch);
+  CHECK_EQ(batch.num_images(), 3);
+  CHECK_EQ(batch.size(), 3);
+  CHECK_EQ(batch.count(0), 1);
+  CHECK_EQ(batch.count(1), 0);
+  CHECK_EQ(batch.count(2), 2);
+  CHECK_EQ(batch[batch.begin(2) + 1].top, 14);
+  CHECK_EQ(batch[batch.begin(2) + 1].class_label, 3);
+  CHECK(batch[0].mask == nullptr);
+}
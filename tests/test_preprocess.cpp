@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "preprocess.hpp"
+#include "test.hpp"
+
+using namespace std;
+using namespace yolo;
+
+namespace {
+
+// the mosaic of the golden files, any pattern without structure would do
+vector<uint8_t> mosaic(int width, int height, int stride) {
+  vector<uint8_t> pixels((size_t)stride * height, 0xEE);
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x)
+      pixels[y * stride + x] = (x * 37 + y * 91 + x * y * 13 + 7) & 255;
+  return pixels;
+}
+
+// rgb pixels of a P7 RGB file, empty when it can not be read
+vector<uint8_t> read_pam_rgb(const string &file, int width, int height) {
+  FILE *handle = fopen(file.c_str(), "rb");
+  if (handle == nullptr) return {};
+  string data;
+  char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), handle)) > 0) data.append(buffer, n);
+  fclose(handle);
+
+  const string end = "ENDHDR\n";
+  size_t body = data.find(end);
+  if (body == string::npos || data.size() - body - end.size() != (size_t)width * height * 3)
+    return {};
+  return vector<uint8_t>(data.begin() + body + end.size(), data.end());
+}
+
+};  // namespace
+
+TEST(preprocess_pack_drops_the_row_padding) {
+  // 3 x 2 bgr rows of 12 bytes
+  vector<uint8_t> bgr(24, 0xEE);
+  for (int y = 0; y < 2; ++y)
+    for (int i = 0; i < 9; ++i) bgr[y * 12 + i] = y * 9 + i;
+  vector<uint8_t> packed(18, 0);
+  host::pack(Image(bgr.data(), 3, 2, PixelFormat::BGR, 12), packed.data());
+  for (int i = 0; i < 18; ++i) CHECK_EQ(packed[i], i);
+  CHECK_EQ(packed_bytes(Image(bgr.data(), 3, 2)), 18u);
+
+  // 3 x 2 Gray16 rows of 8 bytes, odd width
+  uint16_t gray16[8] = {1, 2, 3, 0xEEEE, 4, 5, 6, 0xEEEE};
+  uint16_t packed16[6] = {0};
+  Image image16(gray16, 3, 2, PixelFormat::Gray16, 8);
+  CHECK_EQ(packed_bytes(image16), 12u);
+  host::pack(image16, (uint8_t *)packed16);
+  for (int i = 0; i < 6; ++i) CHECK_EQ(packed16[i], i + 1);
+
+  // packed rows are copied as they are
+  uint8_t gray[5] = {9, 8, 7, 6, 5}, copy[5] = {0};
+  host::pack(Image(gray, 5, 1, PixelFormat::Gray8), copy);
+  CHECK(memcmp(gray, copy, 5) == 0);
+}
+
+TEST(preprocess_gray16_window) {
+  Image image(nullptr, 1, 1, PixelFormat::Gray16);
+  image.window_low = 1000;
+  image.window_high = 2000;
+  PixelSource source = pixel_source(image);
+  CHECK(source.format == PixelFormat::Gray16);
+  CHECK_NEAR(source.low, 1000, 1e-6);
+  CHECK_NEAR(source.scale, 0.255, 1e-6);
+
+  // an empty window does not divide by zero, 8 bit formats keep the identity
+  image.window_high = image.window_low;
+  CHECK_NEAR(pixel_source(image).scale, 255, 1e-6);
+  Image gray8(nullptr, 1, 1, PixelFormat::Gray8);
+  gray8.window_low = 50;
+  CHECK_NEAR(pixel_source(gray8).low, 0, 1e-6);
+  CHECK_NEAR(pixel_source(gray8).scale, 1, 1e-6);
+
+  // below, inside and above the window, in a padded odd sized image
+  uint16_t pixels[2 * 4] = {500, 1500, 3000, 0xEEEE, 1000, 2000, 1250, 0xEEEE};
+  Image windowed(pixels, 3, 2, PixelFormat::Gray16, 8);
+  windowed.window_low = 1000;
+  windowed.window_high = 2000;
+  uint8_t bgr[18];
+  host::to_bgr(windowed, bgr);
+  const uint8_t expected[6] = {0, 128, 255, 0, 255, 64};
+  for (int i = 0; i < 6; ++i) {
+    CHECK_EQ(bgr[i * 3], expected[i]);
+    CHECK_EQ(bgr[i * 3 + 1], expected[i]);
+    CHECK_EQ(bgr[i * 3 + 2], expected[i]);
+  }
+
+  uint16_t packed[6];
+  host::pack(windowed, (uint8_t *)packed);
+  float out[3];
+  host::sample((const uint8_t *)packed, 3, 2, pixel_source(windowed), 1, 0, 114, out);
+  CHECK_EQ(out[0], 128);
+  // halfway between 1500 and 3000: 127.5 and 255 average to 191.25
+  host::sample((const uint8_t *)packed, 3, 2, pixel_source(windowed), 1.5f, 0, 114, out);
+  CHECK_EQ(out[0], 191);
+  CHECK_EQ(out[2], 191);
+}
+
+TEST(preprocess_sample_gray8_and_edges) {
+  const uint8_t gray[4] = {0, 100, 200, 50};
+  PixelSource source;
+  source.format = PixelFormat::Gray8;
+  float out[3];
+  host::sample(gray, 2, 2, source, 1, 1, 114, out);
+  CHECK_EQ(out[0], 50);
+  host::sample(gray, 2, 2, source, 0.5f, 0, 114, out);
+  CHECK_EQ(out[0], 50);
+  host::sample(gray, 2, 2, source, 0.5f, 0.5f, 114, out);
+  CHECK_EQ(out[0], 88);  // 87.5 rounds up
+  CHECK(out[0] == out[1] && out[1] == out[2]);
+
+  // taps outside of the image take const_value, a full pixel outside is const_value only
+  host::sample(gray, 2, 2, source, -0.5f, 0, 114, out);
+  CHECK_EQ(out[0], 57);
+  host::sample(gray, 2, 2, source, 1.5f, 1, 114, out);
+  CHECK_EQ(out[0], 82);
+  host::sample(gray, 2, 2, source, -1, 0, 114, out);
+  CHECK_EQ(out[0], 114);
+  host::sample(gray, 2, 2, source, 0, 2, 114, out);
+  CHECK_EQ(out[2], 114);
+}
+
+TEST(preprocess_sample_bgr) {
+  // 3 x 1, channels kept apart
+  const uint8_t bgr[9] = {10, 20, 30, 40, 50, 60, 255, 0, 1};
+  PixelSource source;
+  float out[3];
+  host::sample(bgr, 3, 1, source, 1, 0, 114, out);
+  CHECK_EQ(out[0], 40);
+  CHECK_EQ(out[1], 50);
+  CHECK_EQ(out[2], 60);
+  host::sample(bgr, 3, 1, source, 1.5f, 0, 114, out);
+  CHECK_EQ(out[0], 148);  // 147.5
+  CHECK_EQ(out[1], 25);
+  CHECK_EQ(out[2], 31);  // 30.5
+  // the last column and row blend with const_value
+  host::sample(bgr, 3, 1, source, 2, 0.5f, 0, out);
+  CHECK_EQ(out[0], 128);  // 127.5
+  CHECK_EQ(out[1], 0);
+  CHECK_EQ(out[2], 1);  // 0.5
+}
+
+// Reference: cv2.cvtColor(mosaic, cv2.COLOR_BayerBG2BGR) of OpenCV, saved as RGB. The files are
+// not rewritten by --update-golden, they do not come from this code.
+TEST(preprocess_demosaic_matches_opencv) {
+  const int sizes[2][2] = {{9, 7}, {8, 6}};
+  for (auto &size : sizes) {
+    int width = size[0], height = size[1];
+    char name[64];
+    snprintf(name, sizeof(name), "/bayer_rg8_%dx%d.pam", width, height);
+    vector<uint8_t> expected = read_pam_rgb(test::golden_dir() + name, width, height);
+    CHECK(!expected.empty());
+    if (expected.empty()) continue;
+
+    // per pixel, edges and corners included
+    int stride = width + 3;
+    vector<uint8_t> pixels = mosaic(width, height, stride);
+    int mismatches = 0;
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        uint8_t bgr[3];
+        host::demosaic(pixels.data(), stride, width, height, x, y, bgr);
+        const uint8_t *rgb = &expected[(y * width + x) * 3];
+        if (bgr[0] != rgb[2] || bgr[1] != rgb[1] || bgr[2] != rgb[0]) mismatches++;
+      }
+    }
+    CHECK_EQ(mismatches, 0);
+
+    // the whole image through to_bgr, padded rows
+    vector<uint8_t> bgr((size_t)width * height * 3);
+    host::to_bgr(Image(pixels.data(), width, height, PixelFormat::BayerRG8, stride), bgr.data());
+    mismatches = 0;
+    for (int i = 0; i < width * height; ++i)
+      for (int c = 0; c < 3; ++c) mismatches += bgr[i * 3 + c] != expected[i * 3 + 2 - c];
+    CHECK_EQ(mismatches, 0);
+
+    // the sampler demosaics its taps: a pixel center is the pixel, a midpoint the average
+    vector<uint8_t> packed = mosaic(width, height, width);
+    PixelSource source;
+    source.format = PixelFormat::BayerRG8;
+    float out[3];
+    host::sample(packed.data(), width, height, source, 0, 0, 114, out);
+    CHECK_EQ(out[0], expected[2]);
+    CHECK_EQ(out[2], expected[0]);
+    host::sample(packed.data(), width, height, source, width - 1.5f, height - 1, 114, out);
+    const uint8_t *a = &expected[((height - 1) * width + width - 2) * 3];
+    for (int c = 0; c < 3; ++c) CHECK_EQ(out[c], (int)(0.5f * a[2 - c] + 0.5f * a[5 - c] + 0.5f));
+  }
+}
+
+TEST(preprocess_demosaic_small_mosaics_are_gray) {
+  const uint8_t pixels[4] = {10, 20, 30, 40};
+  uint8_t bgr[3];
+  host::demosaic(pixels, 2, 2, 2, 1, 1, bgr);
+  CHECK(bgr[0] == 40 && bgr[1] == 40 && bgr[2] == 40);
+  host::demosaic(pixels, 1, 1, 4, 0, 2, bgr);
+  CHECK(bgr[0] == 30 && bgr[1] == 30 && bgr[2] == 30);
+}
+
+TEST(preprocess_to_bgr_gray8_and_bgr) {
+  // odd 5 x 3 gray with padded rows
+  vector<uint8_t> gray(8 * 3, 0xEE);
+  for (int y = 0; y < 3; ++y)
+    for (int x = 0; x < 5; ++x) gray[y * 8 + x] = y * 5 + x;
+  vector<uint8_t> bgr(5 * 3 * 3);
+  host::to_bgr(Image(gray.data(), 5, 3, PixelFormat::Gray8, 8), bgr.data());
+  for (int i = 0; i < 15; ++i) {
+    CHECK_EQ(bgr[i * 3], i);
+    CHECK_EQ(bgr[i * 3 + 1], i);
+    CHECK_EQ(bgr[i * 3 + 2], i);
+  }
+
+  const uint8_t color[6] = {1, 2, 3, 4, 5, 6};
+  uint8_t copy[6] = {0};
+  host::to_bgr(Image(color, 2, 1), copy);
+  CHECK(memcmp(color, copy, 6) == 0);
+}
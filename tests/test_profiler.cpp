@@ -0,0 +1,107 @@
+#include <stdio.h>
+
+#include <string>
+
+#include "profiler.hpp"
+#include "test.hpp"
+
+using namespace std;
+
+// what Infer's IProfiler reports for three forwards: reportLayerTime per layer, then end_run
+static trt::LayerReport three_forwards() {
+  trt::LayerProfiler profiler;
+  const float conv[3] = {1, 3, 2};
+  for (int run = 0; run < 3; ++run) {
+    profiler.record("conv", conv[run]);
+    profiler.record("relu", 0.5f);
+    if (run == 1) profiler.record("head", 4);
+    profiler.record("tail", 0.5f);
+    profiler.end_run();
+  }
+  return profiler.report();
+}
+
+TEST(profiler_merges_layers_across_forwards) {
+  trt::LayerReport report = three_forwards();
+  CHECK_EQ(report.runs, 3);
+  CHECK_NEAR(report.total_ms, 13, 1e-5);
+  CHECK_NEAR(report.run_ms(), 13.0 / 3, 1e-5);
+  CHECK_EQ(report.layers.size(), 4u);
+
+  // slowest first, layers of equal totals in engine order
+  CHECK(report.layers[0].name == "conv");
+  CHECK(report.layers[1].name == "head");
+  CHECK(report.layers[2].name == "relu");
+  CHECK(report.layers[3].name == "tail");
+
+  const trt::LayerTime &conv = report.layers[0];
+  CHECK_EQ(conv.calls, 3);
+  CHECK_NEAR(conv.total_ms, 6, 1e-6);
+  CHECK_NEAR(conv.min_ms, 1, 1e-6);
+  CHECK_NEAR(conv.max_ms, 3, 1e-6);
+  CHECK_NEAR(conv.average_ms(), 2, 1e-6);
+  // a layer of one forward only averages over the forwards that ran it
+  CHECK_EQ(report.layers[1].calls, 1);
+  CHECK_NEAR(report.layers[1].average_ms(), 4, 1e-6);
+}
+
+TEST(profiler_reset_and_empty_report) {
+  trt::LayerProfiler profiler;
+  profiler.record("conv", 1);
+  profiler.record(nullptr, 2);
+  profiler.end_run();
+  CHECK_EQ(profiler.report().layers.size(), 2u);
+  CHECK(profiler.report().layers[0].name.empty());
+
+  profiler.reset();
+  trt::LayerReport report = profiler.report();
+  CHECK_EQ(report.runs, 0);
+  CHECK(report.layers.empty());
+  CHECK_EQ(report.run_ms(), 0);
+  CHECK(trt::format_json(report) ==
+        "{\n  \"runs\": 0,\n  \"run_ms\": 0.000000,\n  \"layers\": []\n}\n");
+}
+
+TEST(profiler_format_table) {
+  trt::LayerReport report = three_forwards();
+  CHECK(trt::format_table(report, 2) ==
+        "3 runs, 4.3333 ms per run\n"
+        "Layer     avg ms     min ms     max ms   total ms       %\n"
+        "conv      2.0000     1.0000     3.0000      6.000  46.15%\n"
+        "head      4.0000     4.0000     4.0000      4.000  30.77%\n");
+  CHECK_EQ(trt::format_table(report).size(), trt::format_table(report, 2).size() + 2 * 58);
+
+  // names longer than 64 characters are cut
+  report.layers.resize(1);
+  report.layers[0].name = string(80, 'n');
+  string table = trt::format_table(report);
+  CHECK(table.find(string(61, 'n') + "... ") != string::npos);
+  CHECK(table.find(string(62, 'n')) == string::npos);
+}
+
+TEST(profiler_format_json) {
+  trt::LayerReport report = three_forwards();
+  report.layers.resize(2);
+  report.layers[1].name = "he\"ad\n";
+  CHECK(trt::format_json(report) ==
+        "{\n  \"runs\": 3,\n  \"run_ms\": 4.333333,\n  \"layers\": [\n"
+        "    {\"name\": \"conv\", \"calls\": 3, \"average_ms\": 2.000000, \"min_ms\": 1.000000, "
+        "\"max_ms\": 3.000000, \"total_ms\": 6.000000, \"percent\": 46.154},\n"
+        "    {\"name\": \"he\\\"ad\\u000a\", \"calls\": 1, \"average_ms\": 4.000000, "
+        "\"min_ms\": 4.000000, \"max_ms\": 4.000000, \"total_ms\": 4.000000, "
+        "\"percent\": 30.769}\n  ]\n}\n");
+
+  const char *file = "yolo_tests_profile.json";
+  CHECK(trt::save_json(report, file));
+  FILE *handle = fopen(file, "rb");
+  CHECK(handle != nullptr);
+  if (handle == nullptr) return;
+  string saved;
+  char buffer[1024];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), handle)) > 0) saved.append(buffer, n);
+  fclose(handle);
+  remove(file);
+  CHECK(saved == trt::format_json(report));
+  CHECK(!trt::save_json(report, "no/such/directory/profile.json"));
+}
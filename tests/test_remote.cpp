@@ -0,0 +1,171 @@
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ipc.hpp"
+#include "remote.hpp"
+#include "test.hpp"
+
+using namespace std;
+
+namespace {
+
+// one box per frame spanning it, confidence, class and sub label from its first pixel
+class FrameInfer : public yolo::Infer {
+ public:
+  mutex lock;
+  vector<int> batches;
+
+  virtual yolo::BoxArray forward(const yolo::Image &image, void *stream = nullptr) override {
+    return forwards({image}, stream)[0];
+  }
+
+  virtual vector<yolo::BoxArray> forwards(const vector<yolo::Image> &images,
+                                          void *stream = nullptr) override {
+    {
+      unique_lock<mutex> l(lock);
+      batches.push_back(images.size());
+    }
+    vector<yolo::BoxArray> output(images.size());
+    for (int i = 0; i < (int)images.size(); ++i) {
+      const yolo::Image &image = images[i];
+      const uint8_t *pixel = (const uint8_t *)image.bgrptr;
+      yolo::Box box(0, 0, image.width, image.height, pixel[0] / 255.0f, pixel[1]);
+      box.sub_label = pixel[2];
+      output[i].push_back(box);
+    }
+    return output;
+  }
+
+  virtual shared_future<vector<yolo::BoxArray>> forwards_async(const vector<yolo::Image> &images,
+                                                               void *stream = nullptr) override {
+    promise<vector<yolo::BoxArray>> result;
+    result.set_value(forwards(images, stream));
+    return result.get_future().share();
+  }
+
+  virtual yolo::BoxBatch forwards_packed(const vector<yolo::Image> &images,
+                                         void *stream = nullptr) override {
+    return yolo::BoxBatch();
+  }
+
+  virtual future<yolo::BoxBatch> forwards_packed_async(const vector<yolo::Image> &images,
+                                                       void *stream = nullptr) override {
+    promise<yolo::BoxBatch> result;
+    result.set_value(yolo::BoxBatch());
+    return result.get_future();
+  }
+
+  virtual bool use_cuda_graph(bool enable) override { return false; }
+  virtual bool capture(const string &file) override { return false; }
+  virtual bool set_cascade(const string &classifier_file,
+                           const yolo::CascadeOptions &options) override {
+    return false;
+  }
+  virtual int num_classes() override { return 80; }
+  virtual bool set_class_thresholds(const vector<float> &thresholds,
+                                    const vector<uint8_t> &enabled = {}) override {
+    return false;
+  }
+  virtual bool set_profiling(bool enable) override { return false; }
+  virtual trt::LayerReport layer_report() override { return trt::LayerReport(); }
+  virtual bool set_mask_encoding(yolo::MaskEncoding encoding, float threshold) override {
+    return false;
+  }
+  virtual vector<yolo::Counts> count(const vector<yolo::Image> &images,
+                                     const vector<yolo::CountZone> &zones,
+                                     void *stream = nullptr) override {
+    return {};
+  }
+};
+
+// a channel of its own per run, ctest may run the suite in parallel with another build
+string channel_name(const char *test) {
+  return string("yolo_test_") + test + "_" + to_string(ipc::current_pid());
+}
+
+};  // namespace
+
+TEST(remote_frames_round_trip_through_the_ring) {
+  ipc::ChannelConfig config;
+  config.num_slots = 4;
+  config.max_width = 64;
+  config.max_height = 32;
+  config.num_classes = 80;
+
+  string name = channel_name("round_trip");
+  ipc::Channel channel;
+  CHECK(channel.create(name, config));
+
+  FrameInfer infer;
+  atomic<bool> running(true);
+  thread server([&]() { yolo::serve(channel, infer, name, 4, 2000, running); });
+
+  const int num_clients = 3, num_frames = 8;
+  atomic<int> answered(0), wrong(0);
+  vector<thread> clients;
+  for (int c = 0; c < num_clients; ++c) {
+    clients.emplace_back([&, c]() {
+      auto client = yolo::connect(name, 5000);
+      if (client == nullptr) {
+        wrong++;
+        return;
+      }
+      for (int k = 0; k < num_frames; ++k) {
+        int width = 16 + c, height = 8 + k;
+        vector<uint8_t> frame(width * height * 3);
+        for (int i = 0; i < width * height; ++i) {
+          frame[i * 3 + 0] = 10 * c + 1;
+          frame[i * 3 + 1] = k;
+          frame[i * 3 + 2] = c;
+        }
+        auto boxes = client->forward(yolo::Image(frame.data(), width, height));
+        bool ok = boxes.size() == 1 && boxes[0].right == width && boxes[0].bottom == height &&
+                  boxes[0].confidence == (10 * c + 1) / 255.0f && boxes[0].class_label == k &&
+                  boxes[0].sub_label == c;
+        if (ok)
+          answered++;
+        else
+          wrong++;
+      }
+    });
+  }
+  for (auto &client : clients) client.join();
+  CHECK_EQ(wrong.load(), 0);
+  CHECK_EQ(answered.load(), num_clients * num_frames);
+
+  // every frame went through the model once, batched up to max_batch
+  vector<int> batches;
+  {
+    unique_lock<mutex> l(infer.lock);
+    batches = infer.batches;
+  }
+  int total = 0;
+  for (int size : batches) {
+    CHECK(size >= 1 && size <= 4);
+    total += size;
+  }
+  CHECK_EQ(total, num_clients * num_frames);
+
+  // the clients released their slots, all of them can be claimed again
+  auto a = yolo::connect(name, 5000);
+  auto b = yolo::connect(name, 5000);
+  auto c = yolo::connect(name, 5000);
+  auto d = yolo::connect(name, 5000);
+  CHECK(a != nullptr && b != nullptr && c != nullptr && d != nullptr);
+  CHECK_EQ(a->num_classes(), 80);
+
+  // frames larger than the channel are refused before they reach the server
+  vector<uint8_t> large(65 * 8 * 3);
+  CHECK(a->forward(yolo::Image(large.data(), 65, 8)).empty());
+
+  running = false;
+  server.join();
+  channel.shutdown();
+
+  // a stopped server fails the call instead of blocking it
+  vector<uint8_t> frame(16 * 8 * 3, 1);
+  CHECK(b->forward(yolo::Image(frame.data(), 16, 8)).empty());
+}
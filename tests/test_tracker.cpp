@@ -0,0 +1,150 @@
+#include <math.h>
+
+#include <vector>
+
+#include "test.hpp"
+#include "tracker.hpp"
+
+using namespace std;
+
+static yolo::Box box(float cx, float cy, float size, float confidence, int label = 0) {
+  return yolo::Box(cx - size / 2, cy - size / 2, cx + size / 2, cy + size / 2, confidence, label);
+}
+
+TEST(tracker_keeps_id_of_moving_box) {
+  auto tracker = track::create_tracker();
+  int id = 0;
+  for (int frame = 0; frame < 20; ++frame) {
+    auto &tracks = tracker->update({box(100 + frame * 4, 100, 40, 0.9f)});
+    CHECK_EQ(tracks.size(), 1u);
+    if (tracks.empty()) return;
+    if (frame == 0) id = tracks[0].id;
+    CHECK_EQ(tracks[0].id, id);
+  }
+  CHECK_NEAR(tracker->tracks()[0].box.left, 100 + 19 * 4 - 20, 2);
+
+  // a second object starts a new track, a low score one does not
+  auto &tracks = tracker->update({box(180, 100, 40, 0.9f), box(400, 300, 40, 0.9f),
+                                  box(600, 300, 40, 0.2f)});
+  CHECK_EQ(tracks.size(), 2u);
+  CHECK(tracks.size() == 2 && tracks[0].id == id && tracks[1].id == id + 1);
+}
+
+TEST(tracker_class_must_match) {
+  auto tracker = track::create_tracker();
+  tracker->update({box(100, 100, 40, 0.9f, 0)});
+  auto &tracks = tracker->update({box(100, 100, 40, 0.9f, 1)});
+  CHECK_EQ(tracks.size(), 1u);
+  CHECK(tracks.size() == 1 && tracks[0].id == 2 && tracks[0].box.class_label == 1);
+}
+
+TEST(tracker_detect_interval_and_decay) {
+  track::Config config;
+  config.detect_interval = 3;
+  auto tracker = track::create_tracker(config);
+  CHECK(tracker->need_detect());
+  tracker->update({box(100, 100, 40, 0.9f)});
+  CHECK(!tracker->need_detect());
+  tracker->predict();
+  CHECK(!tracker->need_detect());
+  tracker->predict();
+  CHECK(tracker->need_detect());
+
+  // a decayed track asks for the detector before the interval is over
+  config.detect_interval = 100;
+  config.redetect_confidence = 0.5f;
+  tracker = track::create_tracker(config);
+  tracker->update({box(100, 100, 40, 0.6f)});
+  tracker->predict();
+  CHECK(!tracker->need_detect());
+  auto &tracks = tracker->predict();
+  CHECK(tracks.size() == 1 && tracks[0].box.confidence < config.redetect_confidence);
+  CHECK(tracker->need_detect());
+}
+
+TEST(tracker_drops_lost_tracks) {
+  track::Config config;
+  config.max_lost = 2;
+  auto tracker = track::create_tracker(config);
+  tracker->update({box(100, 100, 40, 0.9f)});
+  CHECK(tracker->update({}).empty());
+  tracker->update({});
+  // still remembered after two misses, a third one removes it
+  auto &found = tracker->update({box(100, 100, 40, 0.9f)});
+  CHECK(found.size() == 1 && found[0].id == 1);
+  for (int i = 0; i < 3; ++i) tracker->update({});
+  auto &fresh = tracker->update({box(100, 100, 40, 0.9f)});
+  CHECK(fresh.size() == 1 && fresh[0].id == 2);
+
+  tracker->reset();
+  CHECK(tracker->tracks().empty());
+  CHECK(tracker->need_detect());
+  CHECK_EQ(tracker->update({box(100, 100, 40, 0.9f)})[0].id, 1);
+}
+
+// ground truth object of a synthetic sequence, visible unless occluded at that frame
+struct Path {
+  float x, y, vx, vy;
+  int hidden_from, hidden_to;
+
+  float cx(int frame) const { return x + vx * frame; }
+  float cy(int frame) const { return y + vy * frame; }
+  bool visible(int frame) const { return frame < hidden_from || frame >= hidden_to; }
+};
+
+// track id that covers each path at every frame where it is visible, ID switches are counted
+// whenever a path is covered by another id than before. Frames where several tracks cover a
+// path (the boxes coincide) say nothing about identity and are skipped.
+static int id_switches(const vector<Path> &paths, int frames, int &unmatched) {
+  auto tracker = track::create_tracker();
+  vector<int> ids(paths.size(), 0);
+  int switches = 0;
+  unmatched = 0;
+  for (int frame = 0; frame < frames; ++frame) {
+    yolo::BoxArray detections;
+    for (auto &path : paths)
+      if (path.visible(frame)) detections.push_back(box(path.cx(frame), path.cy(frame), 40, 0.9f));
+    auto &tracks = tracker->update(detections);
+
+    for (size_t i = 0; i < paths.size(); ++i) {
+      if (!paths[i].visible(frame)) continue;
+      int id = 0, covering = 0;
+      for (auto &item : tracks) {
+        float cx = (item.box.left + item.box.right) / 2, cy = (item.box.top + item.box.bottom) / 2;
+        if (fabs(cx - paths[i].cx(frame)) < 4 && fabs(cy - paths[i].cy(frame)) < 4) {
+          id = item.id;
+          covering++;
+        }
+      }
+      if (covering == 0) unmatched++;
+      if (covering != 1) continue;
+      if (ids[i] != 0 && ids[i] != id) switches++;
+      ids[i] = id;
+    }
+  }
+  return switches;
+}
+
+TEST(tracker_crossing_tracks_keep_ids) {
+  // two boxes of the same class crossing at an angle, fully overlapped around frame 10
+  vector<Path> paths = {{100, 100, 6, 3, -1, -1}, {100, 160, 6, -3, -1, -1}};
+  int unmatched = 0;
+  CHECK_EQ(id_switches(paths, 24, unmatched), 0);
+  CHECK_EQ(unmatched, 0);
+
+  // head on, the velocities carry them apart again after the boxes coincide
+  vector<Path> head_on = {{100, 100, 6, 0, -1, -1}, {220, 100, -6, 0, -1, -1}};
+  CHECK_EQ(id_switches(head_on, 24, unmatched), 0);
+}
+
+TEST(tracker_occluded_track_keeps_id) {
+  // the first box disappears for 5 frames behind an occluder and comes back further on its path
+  vector<Path> paths = {{100, 100, 5, 0, 10, 15}, {300, 300, -2, 1, -1, -1}};
+  int unmatched = 0;
+  CHECK_EQ(id_switches(paths, 30, unmatched), 0);
+  CHECK_EQ(unmatched, 0);
+
+  // hidden for longer than max_lost, it comes back as a new track
+  vector<Path> gone = {{100, 100, 5, 0, 5, 40}};
+  CHECK_EQ(id_switches(gone, 45, unmatched), 1);
+}
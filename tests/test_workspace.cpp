@@ -0,0 +1,134 @@
+#include <thread>
+#include <vector>
+
+#include "infer.hpp"
+#include "preprocess.hpp"
+#include "test.hpp"
+#include "workspace.hpp"
+
+using namespace std;
+using namespace yolo;
+
+namespace {
+
+// host stand-in of trt::Memory: grows like BaseMemory::gpu_realloc, never shrinks, and records
+// each growth into counter the way trt::allocations() is fed
+struct GrowOnly {
+  size_t capacity = 0;
+  void need(size_t bytes, trt::AllocationCounter &counter, bool device = true) {
+    if (capacity >= bytes) return;
+    capacity = bytes;
+    counter.record(device, bytes);
+  }
+};
+
+// the buffers adjust_memory and preprocess size for one forward
+struct Workspace {
+  GrowOnly input, bbox, boxarray_gpu, boxarray_cpu, segment, mask;
+  vector<GrowOnly> preprocess_gpu, preprocess_cpu;
+
+  void adjust(const WorkspaceSizes &sizes, trt::AllocationCounter &counter) {
+    input.need(sizes.input * sizeof(float), counter);
+    bbox.need(sizes.bbox * sizeof(float), counter);
+    boxarray_gpu.need(sizes.boxarray * sizeof(float), counter);
+    boxarray_cpu.need(sizes.boxarray * sizeof(float), counter, false);
+    if (sizes.segment > 0) segment.need(sizes.segment * sizeof(float), counter);
+    if (sizes.mask > 0) mask.need(sizes.mask, counter);
+    if ((int)preprocess_gpu.size() < sizes.batch) {
+      preprocess_gpu.resize(sizes.batch);
+      preprocess_cpu.resize(sizes.batch);
+    }
+  }
+
+  void stage(int ibatch, const Image &image, trt::AllocationCounter &counter) {
+    size_t bytes = preprocess_matrix_bytes() + packed_bytes(image);
+    preprocess_gpu[ibatch].need(bytes, counter);
+    preprocess_cpu[ibatch].need(bytes, counter, false);
+  }
+};
+
+const vector<int> kBbox = {1, 8400, 116};
+const vector<int> kSegment = {1, 32, 160, 160};
+
+};  // namespace
+
+TEST(workspace_sizes_of_a_segment_model) {
+  WorkspaceSizes sizes = workspace_sizes(2, 640, 640, kBbox, kSegment, 1920, 1080);
+  CHECK_EQ(sizes.batch, 2);
+  CHECK_EQ(sizes.input, 2u * 640 * 640 * 3);
+  CHECK_EQ(sizes.bbox, 2u * 8400 * 116);
+  CHECK_EQ(sizes.boxarray, 2 * boxarray_numel());
+  CHECK_EQ(sizes.segment, 2u * 32 * 160 * 160);
+  CHECK_EQ(sizes.mask, 161u * 161);
+  CHECK_EQ(sizes.preprocess, preprocess_matrix_bytes() + 1920u * 1080 * 3);
+  CHECK_EQ(preprocess_matrix_bytes() % 32, 0u);
+  CHECK(preprocess_matrix_bytes() >= sizeof(AffineMatrix::d2i));
+
+  // detection only, an unknown image size and a smaller boxarray
+  sizes = workspace_sizes(1, 640, 640, {1, 8400, 84}, {}, 0, 0, 100);
+  CHECK_EQ(sizes.segment, 0u);
+  CHECK_EQ(sizes.mask, 0u);
+  CHECK_EQ(sizes.preprocess, 0u);
+  CHECK_EQ(sizes.boxarray, boxarray_numel(100));
+  CHECK_EQ(boxarray_numel(100), 32u + 100 * NUM_BOX_ELEMENT);
+}
+
+TEST(workspace_presized_forwards_do_not_allocate) {
+  trt::AllocationCounter counter;
+  Workspace workspace;
+
+  // prepare(): everything at the largest batch and image of the LoadOptions
+  const int max_batch = 4, max_width = 1920, max_height = 1080;
+  WorkspaceSizes presized =
+      workspace_sizes(max_batch, 640, 640, kBbox, kSegment, max_width, max_height);
+  workspace.adjust(presized, counter);
+  for (int i = 0; i < max_batch; ++i) {
+    workspace.preprocess_gpu[i].need(presized.preprocess, counter);
+    workspace.preprocess_cpu[i].need(presized.preprocess, counter, false);
+  }
+  unsigned long long presize_total = counter.total();
+  CHECK_EQ(presize_total, 6u + 2 * max_batch);
+  CHECK_EQ(counter.host_allocations(), 1u + max_batch);
+
+  // steady state: any batch and image up to the limits, in any format, reuses the buffers
+  const PixelFormat formats[] = {PixelFormat::BGR, PixelFormat::Gray8, PixelFormat::Gray16,
+                                 PixelFormat::BayerRG8};
+  for (int batch = 1; batch <= max_batch; ++batch) {
+    for (int size = 0; size < 3; ++size) {
+      Image image;
+      image.width = max_width >> size;
+      image.height = max_height >> size;
+      image.format = formats[(batch + size) % 4];
+      workspace.adjust(workspace_sizes(batch, 640, 640, kBbox, kSegment), counter);
+      for (int i = 0; i < batch; ++i) workspace.stage(i, image, counter);
+    }
+  }
+  CHECK_EQ(counter.total(), presize_total);
+
+  // a larger image than presized grows the staging buffers it lands in, once
+  Image large;
+  large.width = max_width * 2;
+  large.height = max_height;
+  workspace.adjust(workspace_sizes(2, 640, 640, kBbox, kSegment), counter);
+  for (int round = 0; round < 2; ++round)
+    for (int i = 0; i < 2; ++i) workspace.stage(i, large, counter);
+  CHECK_EQ(counter.total(), presize_total + 4);
+  CHECK_EQ(counter.device_allocations(), 5u + max_batch + 2);
+  CHECK_EQ(counter.host_allocations(), 1u + max_batch + 2);
+}
+
+TEST(allocation_counter_counts_across_threads) {
+  trt::AllocationCounter counter;
+  vector<thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&counter, t]() {
+      for (int i = 0; i < 1000; ++i) counter.record(t % 2 == 0, 16);
+    });
+  }
+  for (auto &t : threads) t.join();
+  CHECK_EQ(counter.device_allocations(), 2000u);
+  CHECK_EQ(counter.host_allocations(), 2000u);
+  CHECK_EQ(counter.device_bytes(), 32000u);
+  CHECK_EQ(counter.host_bytes(), 32000u);
+  CHECK_EQ(counter.total(), 4000u);
+}
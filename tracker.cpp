@@ -0,0 +1,241 @@
+#include "tracker.hpp"
+
+#include <algorithm>
+#include <tuple>
+
+namespace track {
+
+using namespace std;
+
+const float STD_WEIGHT_POSITION = 1.0f / 20;
+const float STD_WEIGHT_VELOCITY = 1.0f / 160;
+
+// Constant velocity filter of one coordinate. The ByteTrack 8x8 filter over
+// (cx, cy, aspect, height) has diagonal noise and per coordinate motion, so its covariance
+// stays block diagonal and is exactly four of these.
+struct Kalman1D {
+  float x = 0, v = 0;
+  float p00 = 0, p01 = 0, p11 = 0;
+
+  void init(float value, float std_x, float std_v) {
+    x = value;
+    v = 0;
+    p00 = std_x * std_x;
+    p01 = 0;
+    p11 = std_v * std_v;
+  }
+
+  void predict(float std_x, float std_v) {
+    x += v;
+    p00 += 2 * p01 + p11 + std_x * std_x;
+    p01 += p11;
+    p11 += std_v * std_v;
+  }
+
+  void update(float z, float std_z) {
+    float s = p00 + std_z * std_z;
+    float k0 = p00 / s;
+    float k1 = p01 / s;
+    float y = z - x;
+    x += k0 * y;
+    v += k1 * y;
+    p11 -= k1 * p01;
+    p00 *= 1 - k0;
+    p01 *= 1 - k0;
+  }
+};
+
+struct TrackState {
+  Track track;
+  Kalman1D cx, cy, aspect, height;
+
+  void init(const yolo::Box &box, int id) {
+    float w = box.right - box.left, h = box.bottom - box.top;
+    float std_x = 2 * STD_WEIGHT_POSITION * h, std_v = 10 * STD_WEIGHT_VELOCITY * h;
+    cx.init(box.left + w * 0.5f, std_x, std_v);
+    cy.init(box.top + h * 0.5f, std_x, std_v);
+    aspect.init(w / max(h, 1e-6f), 1e-2f, 1e-5f);
+    height.init(h, std_x, std_v);
+    track.id = id;
+    track.box = box;
+    track.box.seg.reset();
+    track.age = 0;
+    track.missed = 0;
+  }
+
+  void predict() {
+    float h = height.x;
+    float std_x = STD_WEIGHT_POSITION * h, std_v = STD_WEIGHT_VELOCITY * h;
+    cx.predict(std_x, std_v);
+    cy.predict(std_x, std_v);
+    aspect.predict(1e-2f, 1e-5f);
+    height.predict(std_x, std_v);
+    track.age++;
+    sync_box();
+  }
+
+  void update(const yolo::Box &box) {
+    float w = box.right - box.left, h = box.bottom - box.top;
+    float std_z = STD_WEIGHT_POSITION * height.x;
+    cx.update(box.left + w * 0.5f, std_z);
+    cy.update(box.top + h * 0.5f, std_z);
+    aspect.update(w / max(h, 1e-6f), 1e-1f);
+    height.update(h, std_z);
+    track.box.confidence = box.confidence;
+    track.box.class_label = box.class_label;
+    track.missed = 0;
+    sync_box();
+  }
+
+  void sync_box() {
+    float h = height.x;
+    float w = aspect.x * h;
+    track.box.left = cx.x - w * 0.5f;
+    track.box.top = cy.x - h * 0.5f;
+    track.box.right = cx.x + w * 0.5f;
+    track.box.bottom = cy.x + h * 0.5f;
+  }
+};
+
+static float box_iou(const yolo::Box &a, const yolo::Box &b) {
+  float cleft = max(a.left, b.left);
+  float ctop = max(a.top, b.top);
+  float cright = min(a.right, b.right);
+  float cbottom = min(a.bottom, b.bottom);
+
+  float c_area = max(cright - cleft, 0.0f) * max(cbottom - ctop, 0.0f);
+  if (c_area == 0.0f) return 0.0f;
+
+  float a_area = max(0.0f, a.right - a.left) * max(0.0f, a.bottom - a.top);
+  float b_area = max(0.0f, b.right - b.left) * max(0.0f, b.bottom - b.top);
+  return c_area / (a_area + b_area - c_area);
+}
+
+class TrackerImpl : public Tracker {
+ public:
+  Config config_;
+  vector<TrackState> states_;
+  vector<Track> output_;
+  int next_id_ = 1;
+  int frames_since_detect_ = 0;
+  bool has_detected_ = false;
+
+  // greedy assignment by descending iou, same class only
+  void associate(const vector<int> &track_indices, const vector<const yolo::Box *> &detections,
+                 float min_iou, vector<int> &track_matched, vector<bool> &detection_used) {
+    vector<tuple<float, int, int>> pairs;
+    for (int it : track_indices) {
+      if (track_matched[it] != -1) continue;
+      for (int id = 0; id < (int)detections.size(); ++id) {
+        if (detection_used[id]) continue;
+        if (detections[id]->class_label != states_[it].track.box.class_label) continue;
+        float iou = box_iou(states_[it].track.box, *detections[id]);
+        if (iou > min_iou) pairs.emplace_back(iou, it, id);
+      }
+    }
+    sort(pairs.begin(), pairs.end(),
+         [](const tuple<float, int, int> &a, const tuple<float, int, int> &b) {
+           return get<0>(a) > get<0>(b);
+         });
+
+    for (auto &pair : pairs) {
+      int it = get<1>(pair), id = get<2>(pair);
+      if (track_matched[it] != -1 || detection_used[id]) continue;
+      track_matched[it] = id;
+      detection_used[id] = true;
+      states_[it].update(*detections[id]);
+    }
+  }
+
+  virtual bool need_detect() override {
+    if (!has_detected_ || frames_since_detect_ + 1 >= config_.detect_interval) return true;
+    for (auto &state : states_) {
+      if (state.track.missed == 0 && state.track.box.confidence < config_.redetect_confidence)
+        return true;
+    }
+    return false;
+  }
+
+  virtual const vector<Track> &update(const yolo::BoxArray &detections) override {
+    has_detected_ = true;
+    frames_since_detect_ = 0;
+    for (auto &state : states_) state.predict();
+
+    vector<const yolo::Box *> high, low;
+    for (auto &box : detections) {
+      if (box.confidence >= config_.high_threshold)
+        high.push_back(&box);
+      else if (box.confidence >= config_.low_threshold)
+        low.push_back(&box);
+    }
+
+    // round 1: high score detections against every track, lost ones included
+    vector<int> all_tracks, active_tracks;
+    for (int i = 0; i < (int)states_.size(); ++i) {
+      all_tracks.push_back(i);
+      if (states_[i].track.missed == 0) active_tracks.push_back(i);
+    }
+    vector<int> track_matched(states_.size(), -1);
+    vector<bool> high_used(high.size(), false);
+    associate(all_tracks, high, config_.high_match_iou, track_matched, high_used);
+
+    // round 2: low score detections only continue tracks that were active
+    vector<bool> low_used(low.size(), false);
+    vector<int> low_matched(states_.size(), -1);
+    for (int i = 0; i < (int)states_.size(); ++i)
+      if (track_matched[i] != -1) low_matched[i] = -2;
+    associate(active_tracks, low, config_.low_match_iou, low_matched, low_used);
+
+    vector<TrackState> survivors;
+    survivors.reserve(states_.size() + high.size());
+    for (int i = 0; i < (int)states_.size(); ++i) {
+      if (track_matched[i] == -1 && low_matched[i] < 0) states_[i].track.missed++;
+      if (states_[i].track.missed <= config_.max_lost) survivors.push_back(states_[i]);
+    }
+
+    for (int id = 0; id < (int)high.size(); ++id) {
+      if (high_used[id]) continue;
+      TrackState state;
+      state.init(*high[id], next_id_++);
+      survivors.push_back(state);
+    }
+    states_.swap(survivors);
+    return collect();
+  }
+
+  virtual const vector<Track> &predict() override {
+    frames_since_detect_++;
+    for (auto &state : states_) {
+      state.predict();
+      state.track.box.confidence *= config_.confidence_decay;
+    }
+    return collect();
+  }
+
+  virtual const vector<Track> &tracks() override { return output_; }
+
+  virtual void reset() override {
+    states_.clear();
+    output_.clear();
+    next_id_ = 1;
+    frames_since_detect_ = 0;
+    has_detected_ = false;
+  }
+
+  const vector<Track> &collect() {
+    output_.clear();
+    for (auto &state : states_) {
+      if (state.track.missed == 0) output_.push_back(state.track);
+    }
+    return output_;
+  }
+};
+
+std::shared_ptr<Tracker> create_tracker(const Config &config) {
+  shared_ptr<TrackerImpl> instance(new TrackerImpl());
+  instance->config_ = config;
+  if (instance->config_.detect_interval < 1) instance->config_.detect_interval = 1;
+  return instance;
+}
+
+};  // namespace track
@@ -0,0 +1,53 @@
+#ifndef __TRACKER_HPP__
+#define __TRACKER_HPP__
+
+// ByteTrack style multi object tracker over yolo::BoxArray, with a mode that only asks for
+// a detector forward every N frames and propagates tracks with a kalman predictor between.
+
+#include <memory>
+#include <vector>
+
+#include "yolo.hpp"
+
+namespace track {
+
+struct Config {
+  int detect_interval = 1;            // run the detector at least every N frames
+  float redetect_confidence = 0.3f;   // or as soon as a track score decays below this
+  float confidence_decay = 0.9f;      // track score multiplier per frame without detection
+  float high_threshold = 0.5f;        // first association round, may start new tracks
+  float low_threshold = 0.1f;         // second association round, only continues tracks
+  float high_match_iou = 0.2f;
+  float low_match_iou = 0.5f;
+  int max_lost = 30;                  // detector frames a track may miss before removal
+};
+
+struct Track {
+  int id = 0;
+  yolo::Box box;    // predicted or updated box, box.confidence is the track score
+  int age = 0;      // frames since created
+  int missed = 0;   // consecutive detector frames without a match
+};
+
+class Tracker {
+ public:
+  virtual ~Tracker() = default;
+
+  // true when the next frame should go through the detector
+  virtual bool need_detect() = 0;
+
+  // frame with detector output
+  virtual const std::vector<Track> &update(const yolo::BoxArray &detections) = 0;
+
+  // frame without detector, tracks are propagated by the motion model only
+  virtual const std::vector<Track> &predict() = 0;
+
+  virtual const std::vector<Track> &tracks() = 0;
+  virtual void reset() = 0;
+};
+
+std::shared_ptr<Tracker> create_tracker(const Config &config = Config());
+
+};  // namespace track
+
+#endif  // __TRACKER_HPP__
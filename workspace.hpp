@@ -0,0 +1,59 @@
+#ifndef __WORKSPACE_HPP__
+#define __WORKSPACE_HPP__
+
+// Buffer sizes of one InferImpl, shared by the per forward adjustment and the presizing done
+// at load time so that both always agree. Host only.
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "postprocess.hpp"
+
+namespace yolo {
+
+// staging buffer of one image: the affine matrix padded to 32 bytes, then the bgr pixels
+inline size_t preprocess_matrix_bytes() { return (sizeof(AffineMatrix::d2i) + 31) / 32 * 32; }
+inline size_t preprocess_bytes(int image_width, int image_height) {
+  return preprocess_matrix_bytes() + (size_t)image_width * image_height * 3;
+}
+
+struct WorkspaceSizes {
+  int batch = 0;
+  size_t input = 0;       // floats, network input of the whole batch
+  size_t bbox = 0;        // floats, bbox head of the whole batch
+  size_t boxarray = 0;    // floats, decoded boxes of the whole batch
+  size_t segment = 0;     // floats, segment head of the whole batch, 0 without segment
+  size_t mask = 0;        // bytes, largest decoded mask of one box
+  size_t preprocess = 0;  // bytes per image, 0 when the image size is unknown
+};
+
+// floats of the boxarray of one image holding max_boxes items
+inline size_t boxarray_numel(int max_boxes = MAX_IMAGE_BOXES) {
+  return 32 + (size_t)max_boxes * NUM_BOX_ELEMENT;
+}
+
+// bbox_dims is the bbox head shape (the boxes output of an end-to-end engine), segment_dims
+// the segment head shape or empty, max_boxes the boxarray items of one image
+inline WorkspaceSizes workspace_sizes(int batch, int network_width, int network_height,
+                                      const std::vector<int> &bbox_dims,
+                                      const std::vector<int> &segment_dims, int image_width = 0,
+                                      int image_height = 0, int max_boxes = MAX_IMAGE_BOXES) {
+  WorkspaceSizes sizes;
+  sizes.batch = batch;
+  sizes.input = (size_t)batch * network_width * network_height * 3;
+  sizes.bbox = (size_t)batch * bbox_dims[1] * bbox_dims[2];
+  sizes.boxarray = (size_t)batch * boxarray_numel(max_boxes);
+  if (segment_dims.size() == 4) {
+    sizes.segment = (size_t)batch * segment_dims[1] * segment_dims[2] * segment_dims[3];
+    // boxes are clipped to the image, the rounding of mask_region adds at most one line
+    sizes.mask = (size_t)(segment_dims[2] + 1) * (segment_dims[3] + 1);
+  }
+  if (image_width > 0 && image_height > 0)
+    sizes.preprocess = preprocess_bytes(image_width, image_height);
+  return sizes;
+}
+
+};  // namespace yolo
+
+#endif  // __WORKSPACE_HPP__
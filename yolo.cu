@@ -1,4 +1,14 @@
+#include <limits>
+
+#include "capture.hpp"
+#include "cascade.hpp"
+#include "cpm.hpp"
+#include "device_pool.hpp"
+#include "graph_cache.hpp"
 #include "infer.hpp"
+#include "postprocess.hpp"
+#include "preprocess.hpp"
+#include "workspace.hpp"
 #include "yolo.hpp"
 
 namespace yolo {
@@ -10,9 +20,9 @@ using namespace std;
   do {                                                                                     \
     auto ___call__ret_code__ = (call);                                                     \
     if (___call__ret_code__ != cudaSuccess) {                                              \
-      INFO("CUDA Runtime error💥 %s # %s, code = %s [ %d ]", #call,                         \
-           cudaGetErrorString(___call__ret_code__), cudaGetErrorName(___call__ret_code__), \
-           ___call__ret_code__);                                                           \
+      INFOF("CUDA Runtime error💥 %s # %s, code = %s [ %d ]", #call,                        \
+            cudaGetErrorString(___call__ret_code__), cudaGetErrorName(___call__ret_code__), \
+            ___call__ret_code__);                                                          \
       abort();                                                                             \
     }                                                                                      \
   } while (0)
@@ -68,94 +78,76 @@ Norm Norm::alpha_beta(float alpha, float beta, ChannelType channel_type) {
 
 Norm Norm::None() { return Norm(); }
 
-const int NUM_BOX_ELEMENT = 8;  // left, top, right, bottom, confidence, class,
-                                // keepflag, row_index(output)
-const int MAX_IMAGE_BOXES = 1024;
 inline int upbound(int n, int align = 32) { return (n + align - 1) / align * align; }
-static __host__ __device__ void affine_project(float *matrix, float x, float y, float *ox,
+static __host__ __device__ void affine_project(const float *matrix, float x, float y, float *ox,
                                                float *oy) {
   *ox = matrix[0] * x + matrix[1] * y + matrix[2];
   *oy = matrix[3] * x + matrix[4] * y + matrix[5];
 }
 
-static __global__ void decode_kernel_common(float *predict, int num_bboxes, int num_classes,
-                                            int output_cdim, float confidence_threshold,
-                                            float *invert_affine_matrix, float *parray,
-                                            int MAX_IMAGE_BOXES) {
-  int position = blockDim.x * blockIdx.x + threadIdx.x;
-  if (position >= num_bboxes) return;
-
-  float *pitem = predict + output_cdim * position;
-  float objectness = pitem[4];
-  if (objectness < confidence_threshold) return;
-
-  float *class_confidence = pitem + 5;
-  float confidence = *class_confidence++;
-  int label = 0;
-  for (int i = 1; i < num_classes; ++i, ++class_confidence) {
-    if (*class_confidence > confidence) {
-      confidence = *class_confidence;
-      label = i;
-    }
+// best class among the ones passing their own threshold, disabled classes are +inf
+static __device__ inline void vote_class(float score, int i, const float *class_thresholds,
+                                         float &confidence, int &label) {
+  if (score > confidence && score >= class_thresholds[i]) {
+    confidence = score;
+    label = i;
   }
-
-  confidence *= objectness;
-  if (confidence < confidence_threshold) return;
-
-  int index = atomicAdd(parray, 1);
-  if (index >= MAX_IMAGE_BOXES) return;
-
-  float cx = *pitem++;
-  float cy = *pitem++;
-  float width = *pitem++;
-  float height = *pitem++;
-  float left = cx - width * 0.5f;
-  float top = cy - height * 0.5f;
-  float right = cx + width * 0.5f;
-  float bottom = cy + height * 0.5f;
-  affine_project(invert_affine_matrix, left, top, &left, &top);
-  affine_project(invert_affine_matrix, right, bottom, &right, &bottom);
-
-  float *pout_item = parray + 1 + index * NUM_BOX_ELEMENT;
-  *pout_item++ = left;
-  *pout_item++ = top;
-  *pout_item++ = right;
-  *pout_item++ = bottom;
-  *pout_item++ = confidence;
-  *pout_item++ = label;
-  *pout_item++ = 1;  // 1 = keep, 0 = ignore
 }
 
-static __global__ void decode_kernel_v8(float *predict, int num_bboxes, int num_classes,
-                                        int output_cdim, float confidence_threshold,
-                                        float *invert_affine_matrix, float *parray,
-                                        int MAX_IMAGE_BOXES) {
+// Decode of one head row per thread, see host::decode. CLASSES is the class count unrolled at
+// compile time (0 loops over num_classes), OBJECTNESS is set for v5 style heads and VECTORIZED
+// for 16 byte aligned rows, whose box and v8 class scores are read as float4. blockIdx.y is the
+// image of the batch, with its d2i 6 floats and its boxarray boxarray_stride floats apart.
+template <int CLASSES, bool OBJECTNESS, bool VECTORIZED>
+static __global__ void decode_kernel(const float *predict, int num_bboxes, int num_classes,
+                                     int output_cdim, float confidence_threshold,
+                                     const float *class_thresholds,
+                                     const float *invert_affine_matrices, float *parrays,
+                                     int boxarray_stride, int MAX_IMAGE_BOXES) {
   int position = blockDim.x * blockIdx.x + threadIdx.x;
   if (position >= num_bboxes) return;
 
-  float *pitem = predict + output_cdim * position;
-  float *class_confidence = pitem + 4;
-  float confidence = *class_confidence++;
-  int label = 0;
-  for (int i = 1; i < num_classes; ++i, ++class_confidence) {
-    if (*class_confidence > confidence) {
-      confidence = *class_confidence;
-      label = i;
+  const int count = CLASSES > 0 ? CLASSES : num_classes;
+  const float *pitem = predict + ((size_t)blockIdx.y * num_bboxes + position) * output_cdim;
+  const float *invert_affine_matrix = invert_affine_matrices + blockIdx.y * 6;
+  float *parray = parrays + (size_t)blockIdx.y * boxarray_stride;
+  float objectness = 1.0f;
+  if (OBJECTNESS) {
+    objectness = pitem[4];
+    if (objectness < confidence_threshold) return;
+  }
+
+  const float *class_confidence = pitem + (OBJECTNESS ? 5 : 4);
+  float confidence = -1.0f;
+  int label = -1;
+  int i = 0;
+  if (VECTORIZED && !OBJECTNESS) {
+#pragma unroll
+    for (; i + 4 <= count; i += 4) {
+      float4 scores = *(const float4 *)(class_confidence + i);
+      vote_class(scores.x, i, class_thresholds, confidence, label);
+      vote_class(scores.y, i + 1, class_thresholds, confidence, label);
+      vote_class(scores.z, i + 2, class_thresholds, confidence, label);
+      vote_class(scores.w, i + 3, class_thresholds, confidence, label);
     }
   }
-  if (confidence < confidence_threshold) return;
+#pragma unroll
+  for (; i < count; ++i)
+    vote_class(class_confidence[i] * objectness, i, class_thresholds, confidence, label);
+  if (label < 0) return;
 
   int index = atomicAdd(parray, 1);
   if (index >= MAX_IMAGE_BOXES) return;
 
-  float cx = *pitem++;
-  float cy = *pitem++;
-  float width = *pitem++;
-  float height = *pitem++;
-  float left = cx - width * 0.5f;
-  float top = cy - height * 0.5f;
-  float right = cx + width * 0.5f;
-  float bottom = cy + height * 0.5f;
+  float4 box;
+  if (VECTORIZED)
+    box = *(const float4 *)pitem;
+  else
+    box = make_float4(pitem[0], pitem[1], pitem[2], pitem[3]);
+  float left = box.x - box.z * 0.5f;
+  float top = box.y - box.w * 0.5f;
+  float right = box.x + box.z * 0.5f;
+  float bottom = box.y + box.w * 0.5f;
   affine_project(invert_affine_matrix, left, top, &left, &top);
   affine_project(invert_affine_matrix, right, bottom, &right, &bottom);
 
@@ -167,7 +159,7 @@ static __global__ void decode_kernel_v8(float *predict, int num_bboxes, int num_
   *pout_item++ = confidence;
   *pout_item++ = label;
   *pout_item++ = 1;  // 1 = keep, 0 = ignore
-  *pout_item++ = position;
+  if (!OBJECTNESS) *pout_item++ = position;
 }
 
 static __device__ float box_iou(float aleft, float atop, float aright, float abottom, float bleft,
@@ -185,26 +177,30 @@ static __device__ float box_iou(float aleft, float atop, float aright, float abo
   return c_area / (a_area + b_area - c_area);
 }
 
-static __global__ void fast_nms_kernel(float *bboxes, int MAX_IMAGE_BOXES, float threshold) {
-  int position = (blockDim.x * blockIdx.x + threadIdx.x);
+// NMS of every image of the batch in one launch: one block per image, its threads stride over
+// the candidates the image has. See host::fast_nms.
+static __global__ void fast_nms_kernel(float *parrays, int boxarray_stride, int MAX_IMAGE_BOXES,
+                                       float threshold) {
+  float *bboxes = parrays + (size_t)blockIdx.x * boxarray_stride;
   int count = min((int)*bboxes, MAX_IMAGE_BOXES);
-  if (position >= count) return;
 
-  // left, top, right, bottom, confidence, class, keepflag
-  float *pcurrent = bboxes + 1 + position * NUM_BOX_ELEMENT;
-  for (int i = 0; i < count; ++i) {
-    float *pitem = bboxes + 1 + i * NUM_BOX_ELEMENT;
-    if (i == position || pcurrent[5] != pitem[5]) continue;
+  for (int position = threadIdx.x; position < count; position += blockDim.x) {
+    // left, top, right, bottom, confidence, class, keepflag
+    float *pcurrent = bboxes + 1 + position * NUM_BOX_ELEMENT;
+    for (int i = 0; i < count; ++i) {
+      float *pitem = bboxes + 1 + i * NUM_BOX_ELEMENT;
+      if (i == position || pcurrent[5] != pitem[5]) continue;
 
-    if (pitem[4] >= pcurrent[4]) {
-      if (pitem[4] == pcurrent[4] && i < position) continue;
+      if (pitem[4] >= pcurrent[4]) {
+        if (pitem[4] == pcurrent[4] && i < position) continue;
 
-      float iou = box_iou(pcurrent[0], pcurrent[1], pcurrent[2], pcurrent[3], pitem[0], pitem[1],
-                          pitem[2], pitem[3]);
+        float iou = box_iou(pcurrent[0], pcurrent[1], pcurrent[2], pcurrent[3], pitem[0],
+                            pitem[1], pitem[2], pitem[3]);
 
-      if (iou > threshold) {
-        pcurrent[6] = 0;  // 1=keep, 0=ignore
-        return;
+        if (iou > threshold) {
+          pcurrent[6] = 0;  // 1=keep, 0=ignore
+          break;
+        }
       }
     }
   }
@@ -219,35 +215,208 @@ static dim3 block_dims(int numJobs) {
   return numJobs < GPU_BLOCK_THREADS ? numJobs : GPU_BLOCK_THREADS;
 }
 
-static void decode_kernel_invoker(float *predict, int num_bboxes, int num_classes, int output_cdim,
-                                  float confidence_threshold, float nms_threshold,
-                                  float *invert_affine_matrix, float *parray, int MAX_IMAGE_BOXES,
-                                  Type type, cudaStream_t stream) {
-  auto grid = grid_dims(num_bboxes);
-  auto block = block_dims(num_bboxes);
+template <int CLASSES, bool OBJECTNESS>
+static void decode_launch(dim3 grid, dim3 block, bool vectorized, const float *predict,
+                          int num_bboxes, int num_classes, int output_cdim,
+                          float confidence_threshold, const float *class_thresholds,
+                          const float *invert_affine_matrices, float *parrays,
+                          int boxarray_stride, int MAX_IMAGE_BOXES, cudaStream_t stream) {
+  if (vectorized) {
+    checkKernel(decode_kernel<CLASSES, OBJECTNESS, true><<<grid, block, 0, stream>>>(
+        predict, num_bboxes, num_classes, output_cdim, confidence_threshold, class_thresholds,
+        invert_affine_matrices, parrays, boxarray_stride, MAX_IMAGE_BOXES));
+  } else {
+    checkKernel(decode_kernel<CLASSES, OBJECTNESS, false><<<grid, block, 0, stream>>>(
+        predict, num_bboxes, num_classes, output_cdim, confidence_threshold, class_thresholds,
+        invert_affine_matrices, parrays, boxarray_stride, MAX_IMAGE_BOXES));
+  }
+}
+
+template <bool OBJECTNESS>
+static void decode_launch_classes(dim3 grid, dim3 block, const DecodeVariant &variant,
+                                  const float *predict, int num_bboxes, int num_classes,
+                                  int output_cdim, float confidence_threshold,
+                                  const float *class_thresholds,
+                                  const float *invert_affine_matrices, float *parrays,
+                                  int boxarray_stride, int MAX_IMAGE_BOXES, cudaStream_t stream) {
+  auto launch = decode_launch<0, OBJECTNESS>;
+  switch (variant.classes) {
+    case 1:
+      launch = decode_launch<1, OBJECTNESS>;
+      break;
+    case 2:
+      launch = decode_launch<2, OBJECTNESS>;
+      break;
+    case 4:
+      launch = decode_launch<4, OBJECTNESS>;
+      break;
+    case 80:
+      launch = decode_launch<80, OBJECTNESS>;
+      break;
+    default:
+      break;
+  }
+  launch(grid, block, variant.vectorized, predict, num_bboxes, num_classes, output_cdim,
+         confidence_threshold, class_thresholds, invert_affine_matrices, parrays,
+         boxarray_stride, MAX_IMAGE_BOXES, stream);
+}
 
-  if (type == Type::V8 || type == Type::V8Seg) {
-    checkKernel(decode_kernel_v8<<<grid, block, 0, stream>>>(
-        predict, num_bboxes, num_classes, output_cdim, confidence_threshold, invert_affine_matrix,
-        parray, MAX_IMAGE_BOXES));
+// Decode and NMS of num_images heads, num_bboxes * output_cdim floats apart: the counters
+// of the boxarrays are zeroed by one strided memset, then one launch decodes and one
+// suppresses the whole batch. invert_affine_matrices holds the d2i of every image.
+static void decode_kernel_invoker(const float *predict, int num_images, int num_bboxes,
+                                  int num_classes, int output_cdim, float confidence_threshold,
+                                  const float *class_thresholds, float nms_threshold,
+                                  const float *invert_affine_matrices, float *parrays,
+                                  int boxarray_stride, int MAX_IMAGE_BOXES,
+                                  const DecodeVariant &variant, cudaStream_t stream) {
+  checkRuntime(cudaMemset2DAsync(parrays, boxarray_stride * sizeof(float), 0, sizeof(float),
+                                 num_images, stream));
+
+  dim3 grid = grid_dims(num_bboxes);
+  dim3 block = block_dims(num_bboxes);
+  grid.y = num_images;
+  if (variant.objectness) {
+    decode_launch_classes<true>(grid, block, variant, predict, num_bboxes, num_classes,
+                                output_cdim, confidence_threshold, class_thresholds,
+                                invert_affine_matrices, parrays, boxarray_stride,
+                                MAX_IMAGE_BOXES, stream);
   } else {
-    checkKernel(decode_kernel_common<<<grid, block, 0, stream>>>(
-        predict, num_bboxes, num_classes, output_cdim, confidence_threshold, invert_affine_matrix,
-        parray, MAX_IMAGE_BOXES));
+    decode_launch_classes<false>(grid, block, variant, predict, num_bboxes, num_classes,
+                                 output_cdim, confidence_threshold, class_thresholds,
+                                 invert_affine_matrices, parrays, boxarray_stride,
+                                 MAX_IMAGE_BOXES, stream);
   }
 
-  grid = grid_dims(MAX_IMAGE_BOXES);
-  block = block_dims(MAX_IMAGE_BOXES);
-  checkKernel(fast_nms_kernel<<<grid, block, 0, stream>>>(parray, MAX_IMAGE_BOXES, nms_threshold));
+  checkKernel(fast_nms_kernel<<<num_images, block_dims(MAX_IMAGE_BOXES), 0, stream>>>(
+      parrays, boxarray_stride, MAX_IMAGE_BOXES, nms_threshold));
 }
 
-static __global__ void warp_affine_bilinear_and_normalize_plane_kernel(
-    uint8_t *src, int src_line_size, int src_width, int src_height, float *dst, int dst_width,
-    int dst_height, uint8_t const_value_st, float *warp_affine_matrix_2_3, Norm norm) {
-  int dx = blockDim.x * blockIdx.x + threadIdx.x;
-  int dy = blockDim.y * blockIdx.y + threadIdx.y;
-  if (dx >= dst_width || dy >= dst_height) return;
+// one block per image, see host::count
+static __global__ void count_kernel(const float *boxarrays, int stride, int max_image_boxes,
+                                    int num_classes, const CountZone *zones, int num_zones,
+                                    int *counts) {
+  const float *parray = boxarrays + blockIdx.x * stride;
+  int *pcounts = counts + blockIdx.x * num_classes * (1 + num_zones);
+  int count = min((int)*parray, max_image_boxes);
+  for (int i = threadIdx.x; i < count; i += blockDim.x) {
+    const float *pbox = parray + 1 + i * NUM_BOX_ELEMENT;
+    int label = pbox[5];
+    if ((int)pbox[6] != 1 || label < 0 || label >= num_classes) continue;
+
+    atomicAdd(pcounts + label, 1);
+    float cx = (pbox[0] + pbox[2]) * 0.5f;
+    float cy = (pbox[1] + pbox[3]) * 0.5f;
+    for (int z = 0; z < num_zones; ++z) {
+      const CountZone &zone = zones[z];
+      if (cx >= zone.left && cx < zone.right && cy >= zone.top && cy < zone.bottom)
+        atomicAdd(pcounts + (1 + z) * num_classes + label, 1);
+    }
+  }
+}
 
+static void count_invoker(const float *boxarrays, int stride, int num_images,
+                          int max_image_boxes, int num_classes, const CountZone *zones,
+                          int num_zones, int *counts, cudaStream_t stream) {
+  checkKernel(count_kernel<<<num_images, GPU_BLOCK_THREADS, 0, stream>>>(
+      boxarrays, stride, max_image_boxes, num_classes, zones, num_zones, counts));
+}
+
+// one thread per detection of an end-to-end engine, see host::end_to_end
+static __global__ void end_to_end_kernel(const int *num_dets, const float *boxes,
+                                         const float *scores, const void *classes,
+                                         bool integer_classes, int max_detections,
+                                         float confidence_threshold,
+                                         const float *class_thresholds, int num_classes,
+                                         float *invert_affine_matrix, float *parray) {
+  int position = blockDim.x * blockIdx.x + threadIdx.x;
+  if (position >= max_detections) return;
+
+  int count = min(max(*num_dets, 0), max_detections);
+  if (position == 0) *parray = count;
+  if (position >= count) return;
+
+  const float *pbox = boxes + position * 4;
+  float confidence = scores[position];
+  int label = integer_classes ? ((const int *)classes)[position]
+                              : (int)((const float *)classes)[position];
+  bool keep = confidence >= confidence_threshold &&
+              (label < 0 || label >= num_classes || confidence >= class_thresholds[label]);
+
+  float left, top, right, bottom;
+  affine_project(invert_affine_matrix, pbox[0], pbox[1], &left, &top);
+  affine_project(invert_affine_matrix, pbox[2], pbox[3], &right, &bottom);
+
+  float *pout_item = parray + 1 + position * NUM_BOX_ELEMENT;
+  *pout_item++ = left;
+  *pout_item++ = top;
+  *pout_item++ = right;
+  *pout_item++ = bottom;
+  *pout_item++ = confidence;
+  *pout_item++ = label;
+  *pout_item++ = keep ? 1 : 0;
+  *pout_item++ = position;
+}
+
+static void end_to_end_invoker(const int *num_dets, const float *boxes, const float *scores,
+                               const void *classes, bool integer_classes, int max_detections,
+                               float confidence_threshold, const float *class_thresholds,
+                               int num_classes, float *invert_affine_matrix, float *parray,
+                               cudaStream_t stream) {
+  auto grid = grid_dims(max_detections);
+  auto block = block_dims(max_detections);
+  checkKernel(end_to_end_kernel<<<grid, block, 0, stream>>>(
+      num_dets, boxes, scores, classes, integer_classes, max_detections, confidence_threshold,
+      class_thresholds, num_classes, invert_affine_matrix, parray));
+}
+
+// one channel of a single channel src, see host::sample
+static __device__ float gray_tap(const uint8_t *src, int src_line_size, int x, int y,
+                                 const PixelSource &source) {
+  if (source.format == PixelFormat::Gray8) return src[y * src_line_size + x];
+  float raw = ((const uint16_t *)(src + y * src_line_size))[x];
+  return fminf(fmaxf((raw - source.low) * source.scale, 0.0f), 255.0f);
+}
+
+// demosaiced bgr of one pixel of a RGGB mosaic, see host::demosaic
+static __device__ void bayer_tap(const uint8_t *src, int src_line_size, int src_width,
+                                 int src_height, int x, int y, float bgr[3]) {
+  if (src_width < 3 || src_height < 3) {
+    bgr[0] = bgr[1] = bgr[2] = src[y * src_line_size + x];
+    return;
+  }
+
+  x = min(max(x, 1), src_width - 2);
+  y = min(max(y, 1), src_height - 2);
+  const uint8_t *p = src + y * src_line_size + x;
+  int line = src_line_size;
+  int r, g, b;
+  if ((x & 1) == (y & 1)) {
+    int center = p[0];
+    int cross = (p[-1] + p[1] + p[-line] + p[line] + 2) >> 2;
+    int diagonal = (p[-line - 1] + p[-line + 1] + p[line - 1] + p[line + 1] + 2) >> 2;
+    g = cross;
+    r = (y & 1) ? diagonal : center;
+    b = (y & 1) ? center : diagonal;
+  } else {
+    int horizontal = (p[-1] + p[1] + 1) >> 1;
+    int vertical = (p[-line] + p[line] + 1) >> 1;
+    g = p[0];
+    r = (y & 1) ? vertical : horizontal;
+    b = (y & 1) ? horizontal : vertical;
+  }
+  bgr[0] = b;
+  bgr[1] = g;
+  bgr[2] = r;
+}
+
+// one pixel of the warp, bilinear sample of src normalized into the planes of dst. Gray
+// sources are replicated to the three planes, bayer ones demosaiced at the four taps only.
+static __device__ void warp_affine_pixel(const uint8_t *src, int src_line_size, int src_width,
+                                         int src_height, const PixelSource &source, float *dst,
+                                         int dst_width, int dst_height, int dx, int dy,
+                                         uint8_t const_value_st,
+                                         const float *warp_affine_matrix_2_3, const Norm &norm) {
   float m_x1 = warp_affine_matrix_2_3[0];
   float m_y1 = warp_affine_matrix_2_3[1];
   float m_z1 = warp_affine_matrix_2_3[2];
@@ -264,6 +433,52 @@ static __global__ void warp_affine_bilinear_and_normalize_plane_kernel(
     c0 = const_value_st;
     c1 = const_value_st;
     c2 = const_value_st;
+  } else if (source.format == PixelFormat::BayerRG8) {
+    int y_low = floorf(src_y);
+    int x_low = floorf(src_x);
+    int xs[4] = {x_low, x_low + 1, x_low, x_low + 1};
+    int ys[4] = {y_low, y_low, y_low + 1, y_low + 1};
+
+    float ly = src_y - y_low;
+    float lx = src_x - x_low;
+    float hy = 1 - ly;
+    float hx = 1 - lx;
+    float w[4] = {hy * hx, hy * lx, ly * hx, ly * lx};
+    float sum[3] = {0, 0, 0};
+    for (int i = 0; i < 4; ++i) {
+      float bgr[3] = {(float)const_value_st, (float)const_value_st, (float)const_value_st};
+      if (xs[i] >= 0 && xs[i] < src_width && ys[i] >= 0 && ys[i] < src_height)
+        bayer_tap(src, src_line_size, src_width, src_height, xs[i], ys[i], bgr);
+      sum[0] += w[i] * bgr[0];
+      sum[1] += w[i] * bgr[1];
+      sum[2] += w[i] * bgr[2];
+    }
+    c0 = floorf(sum[0] + 0.5f);
+    c1 = floorf(sum[1] + 0.5f);
+    c2 = floorf(sum[2] + 0.5f);
+  } else if (source.format != PixelFormat::BGR) {
+    int y_low = floorf(src_y);
+    int x_low = floorf(src_x);
+    int y_high = y_low + 1;
+    int x_high = x_low + 1;
+
+    float ly = src_y - y_low;
+    float lx = src_x - x_low;
+    float hy = 1 - ly;
+    float hx = 1 - lx;
+    float v1 = const_value_st, v2 = const_value_st, v3 = const_value_st, v4 = const_value_st;
+    if (y_low >= 0) {
+      if (x_low >= 0) v1 = gray_tap(src, src_line_size, x_low, y_low, source);
+      if (x_high < src_width) v2 = gray_tap(src, src_line_size, x_high, y_low, source);
+    }
+    if (y_high < src_height) {
+      if (x_low >= 0) v3 = gray_tap(src, src_line_size, x_low, y_high, source);
+      if (x_high < src_width) v4 = gray_tap(src, src_line_size, x_high, y_high, source);
+    }
+
+    c0 = floorf(hy * hx * v1 + hy * lx * v2 + ly * hx * v3 + ly * lx * v4 + 0.5f);
+    c1 = c0;
+    c2 = c0;
   } else {
     int y_low = floorf(src_y);
     int x_low = floorf(src_x);
@@ -276,10 +491,10 @@ static __global__ void warp_affine_bilinear_and_normalize_plane_kernel(
     float hy = 1 - ly;
     float hx = 1 - lx;
     float w1 = hy * hx, w2 = hy * lx, w3 = ly * hx, w4 = ly * lx;
-    uint8_t *v1 = const_value;
-    uint8_t *v2 = const_value;
-    uint8_t *v3 = const_value;
-    uint8_t *v4 = const_value;
+    const uint8_t *v1 = const_value;
+    const uint8_t *v2 = const_value;
+    const uint8_t *v3 = const_value;
+    const uint8_t *v4 = const_value;
     if (y_low >= 0) {
       if (x_low >= 0) v1 = src + y_low * src_line_size + x_low * 3;
 
@@ -323,17 +538,60 @@ static __global__ void warp_affine_bilinear_and_normalize_plane_kernel(
   *pdst_c2 = c2;
 }
 
+static __global__ void warp_affine_bilinear_and_normalize_plane_kernel(
+    uint8_t *src, int src_line_size, int src_width, int src_height, PixelSource source,
+    float *dst, int dst_width, int dst_height, uint8_t const_value_st,
+    float *warp_affine_matrix_2_3, Norm norm) {
+  int dx = blockDim.x * blockIdx.x + threadIdx.x;
+  int dy = blockDim.y * blockIdx.y + threadIdx.y;
+  if (dx >= dst_width || dy >= dst_height) return;
+
+  warp_affine_pixel(src, src_line_size, src_width, src_height, source, dst, dst_width,
+                    dst_height, dx, dy, const_value_st, warp_affine_matrix_2_3, norm);
+}
+
+// one cascade crop, src is a staged image on the device
+struct CropParams {
+  const uint8_t *src;
+  int line_size;  // bytes per staged row, filled on the host
+  int width, height;
+  PixelSource source;
+  float d2i[6];
+};
+
+// blockIdx.z is the crop, each crop fills one [3, dst_height, dst_width] input of the batch
+static __global__ void warp_affine_crops_kernel(const CropParams *crops, float *dst, int dst_width,
+                                                int dst_height, Norm norm) {
+  int dx = blockDim.x * blockIdx.x + threadIdx.x;
+  int dy = blockDim.y * blockIdx.y + threadIdx.y;
+  if (dx >= dst_width || dy >= dst_height) return;
+
+  const CropParams &crop = crops[blockIdx.z];
+  warp_affine_pixel(crop.src, crop.line_size, crop.width, crop.height, crop.source,
+                    dst + (size_t)blockIdx.z * 3 * dst_width * dst_height, dst_width, dst_height,
+                    dx, dy, 114, crop.d2i, norm);
+}
+
+static void warp_affine_crops(const CropParams *crops, int num_crops, float *dst, int dst_width,
+                              int dst_height, const Norm &norm, cudaStream_t stream) {
+  dim3 grid((dst_width + 31) / 32, (dst_height + 31) / 32, num_crops);
+  dim3 block(32, 32);
+
+  checkKernel(warp_affine_crops_kernel<<<grid, block, 0, stream>>>(crops, dst, dst_width,
+                                                                   dst_height, norm));
+}
+
 static void warp_affine_bilinear_and_normalize_plane(uint8_t *src, int src_line_size, int src_width,
-                                                     int src_height, float *dst, int dst_width,
-                                                     int dst_height, float *matrix_2_3,
-                                                     uint8_t const_value, const Norm &norm,
-                                                     cudaStream_t stream) {
+                                                     int src_height, const PixelSource &source,
+                                                     float *dst, int dst_width, int dst_height,
+                                                     float *matrix_2_3, uint8_t const_value,
+                                                     const Norm &norm, cudaStream_t stream) {
   dim3 grid((dst_width + 31) / 32, (dst_height + 31) / 32);
   dim3 block(32, 32);
 
   checkKernel(warp_affine_bilinear_and_normalize_plane_kernel<<<grid, block, 0, stream>>>(
-      src, src_line_size, src_width, src_height, dst, dst_width, dst_height, const_value,
-      matrix_2_3, norm));
+      src, src_line_size, src_width, src_height, source, dst, dst_width, dst_height,
+      const_value, matrix_2_3, norm));
 }
 
 static __global__ void decode_single_mask_kernel(int left, int top, float *mask_weights,
@@ -376,57 +634,63 @@ static void decode_single_mask(float left, float top, float *mask_weights, float
       out_height));
 }
 
-const char *type_name(Type type) {
-  switch (type) {
-    case Type::V5:
-      return "YoloV5";
-    case Type::V3:
-      return "YoloV3";
-    case Type::V7:
-      return "YoloV7";
-    case Type::X:
-      return "YoloX";
-    case Type::V8:
-      return "YoloV8";
-    default:
-      return "Unknow";
-  }
-}
-
-struct AffineMatrix {
-  float i2d[6];  // image to dst(network), 2x3 matrix
-  float d2i[6];  // dst to image, 2x3 matrix
-
-  void compute(const std::tuple<int, int> &from, const std::tuple<int, int> &to) {
-    float scale_x = get<0>(to) / (float)get<0>(from);
-    float scale_y = get<1>(to) / (float)get<1>(from);
-    float scale = std::min(scale_x, scale_y);
-    i2d[0] = scale;
-    i2d[1] = 0;
-    i2d[2] = -scale * get<0>(from) * 0.5 + get<0>(to) * 0.5 + scale * 0.5 - 0.5;
-    i2d[3] = 0;
-    i2d[4] = scale;
-    i2d[5] = -scale * get<1>(from) * 0.5 + get<1>(to) * 0.5 + scale * 0.5 - 0.5;
-
-    double D = i2d[0] * i2d[4] - i2d[1] * i2d[3];
-    D = D != 0. ? double(1.) / D : double(0.);
-    double A11 = i2d[4] * D, A22 = i2d[0] * D, A12 = -i2d[1] * D, A21 = -i2d[3] * D;
-    double b1 = -A11 * i2d[2] - A12 * i2d[5];
-    double b2 = -A21 * i2d[2] - A22 * i2d[5];
-
-    d2i[0] = A11;
-    d2i[1] = A12;
-    d2i[2] = b1;
-    d2i[3] = A21;
-    d2i[4] = A22;
-    d2i[5] = b2;
+const int RLE_BLOCK_THREADS = 256;
+
+// whether the foreground starts or ends at pixel p, the pixel before the first is background
+static __device__ inline bool mask_transition(const unsigned char *mask, int p,
+                                              unsigned char level) {
+  bool current = mask[p] >= level;
+  bool previous = p > 0 && mask[p - 1] >= level;
+  return current != previous;
+}
+
+// One block per mask, spans holds byte offset and pixels of every mask. The threads count the
+// transitions of contiguous chunks and scan the counts, so the positions are written in pixel
+// order from offsets[mask]. Without transitions only the count of every mask is written.
+// See host::encode_rle and host::rle_from_transitions.
+static __global__ void mask_rle_kernel(const unsigned char *masks, const unsigned int *spans,
+                                       unsigned char level, unsigned int *counts,
+                                       const unsigned int *offsets, unsigned int *transitions) {
+  __shared__ unsigned int scan[RLE_BLOCK_THREADS];
+  const unsigned char *mask = masks + spans[blockIdx.x * 2];
+  int pixels = spans[blockIdx.x * 2 + 1];
+  int chunk = (pixels + blockDim.x - 1) / blockDim.x;
+  int begin = min(pixels, (int)threadIdx.x * chunk);
+  int end = min(pixels, begin + chunk);
+
+  unsigned int n = 0;
+  for (int p = begin; p < end; ++p) n += mask_transition(mask, p, level);
+  scan[threadIdx.x] = n;
+  __syncthreads();
+  for (int offset = 1; offset < blockDim.x; offset <<= 1) {
+    unsigned int value = threadIdx.x >= offset ? scan[threadIdx.x - offset] : 0;
+    __syncthreads();
+    scan[threadIdx.x] += value;
+    __syncthreads();
   }
-};
+
+  if (transitions == nullptr) {
+    if (threadIdx.x == blockDim.x - 1) counts[blockIdx.x] = scan[threadIdx.x];
+    return;
+  }
+  unsigned int *out = transitions + offsets[blockIdx.x] + scan[threadIdx.x] - n;
+  for (int p = begin; p < end; ++p)
+    if (mask_transition(mask, p, level)) *out++ = p;
+}
+
+static void mask_rle_invoker(const unsigned char *masks, const unsigned int *spans,
+                             int num_masks, unsigned char level, unsigned int *counts,
+                             const unsigned int *offsets, unsigned int *transitions,
+                             cudaStream_t stream) {
+  checkKernel(mask_rle_kernel<<<num_masks, RLE_BLOCK_THREADS, 0, stream>>>(
+      masks, spans, level, counts, offsets, transitions));
+}
 
 InstanceSegmentMap::InstanceSegmentMap(int width, int height) {
   this->width = width;
   this->height = height;
   checkRuntime(cudaMallocHost(&this->data, width * height));
+  trt::allocations().record(false, width * height);
 }
 
 InstanceSegmentMap::~InstanceSegmentMap() {
@@ -438,16 +702,37 @@ InstanceSegmentMap::~InstanceSegmentMap() {
   this->height = 0;
 }
 
+// Buffers owned by one batch until its results are on the host. forwards uses the first slot,
+// forwards_async rotates through them so that a batch is staged while the previous one runs.
+struct BatchSlot {
+  vector<shared_ptr<trt::Memory<unsigned char>>> preprocess_buffers;
+  trt::Memory<float> output_boxarray;
+  trt::Memory<float> decode_matrices;  // d2i of every image, uploaded once for the batch decode
+  GraphCache graph_cache{
+      [](void *exec) { checkRuntime(cudaGraphExecDestroy((cudaGraphExec_t)exec)); }};
+  cudaEvent_t done = nullptr;
+  uint64_t ticket = 0;  // completion of the last batch staged in the slot
+};
+
+const int NUM_BATCH_SLOTS = 2;
+
+// a kept box whose mask is run length encoded, see InferImpl::encode_masks
+struct MaskJob {
+  int image = 0, box = 0, row = 0;
+  MaskRegion region;
+};
+
 class InferImpl : public Infer {
  public:
   shared_ptr<trt::Infer> trt_;
   string engine_file_;
   Type type_;
+  DecodeVariant decode_variant_;
   float confidence_threshold_;
   float nms_threshold_;
-  vector<shared_ptr<trt::Memory<unsigned char>>> preprocess_buffers_;
-  trt::Memory<float> input_buffer_, bbox_predict_, output_boxarray_;
+  trt::Memory<float> input_buffer_, bbox_predict_;
   trt::Memory<float> segment_predict_;
+  trt::Memory<float> class_thresholds_;
   int network_input_width_, network_input_height_;
   Norm normalize_;
   vector<int> bbox_head_dims_;
@@ -456,80 +741,459 @@ class InferImpl : public Infer {
   bool has_segment_ = false;
   bool isdynamic_model_ = false;
   vector<shared_ptr<trt::Memory<unsigned char>>> box_segment_cache_;
+  trt::Memory<unsigned char> packed_masks_;
+  MaskEncoding mask_encoding_ = MaskEncoding::Bitmap;
+  unsigned char mask_level_ = mask_level(0.5f);
+  // per mask: byte offset and pixels, transitions, their offset; then all the transitions
+  trt::Memory<unsigned int> mask_spans_, mask_counts_, mask_offsets_, mask_transitions_;
+  EndToEndBindings end_to_end_;  // valid when decode and NMS run inside the engine
+  trt::Memory<int> num_detections_;
+  trt::Memory<float> detection_scores_, detection_classes_;
+  int max_boxes_ = MAX_IMAGE_BOXES;  // boxarray items of one image
+  shared_ptr<trt::Infer> classifier_;
+  CascadeOptions cascade_options_;
+  Norm cascade_norm_;
+  int cascade_classes_ = 0;
+  trt::Memory<float> cascade_input_, cascade_output_;
+  trt::Memory<CropParams> crop_params_;
+  trt::Memory<int> counts_;
+  trt::Memory<CountZone> count_zones_;
+  shared_ptr<capture::Writer> capture_writer_;
+  bool use_cuda_graph_ = false;
+  bool share_activations_ = false;
+  cudaStream_t graph_stream_ = nullptr;
+  BatchSlot slots_[NUM_BATCH_SLOTS];
+  int next_slot_ = 0;
+  int device_id_ = 0;
+  cpm::CompletionQueue completions_;
+
+  virtual ~InferImpl() {
+    completions_.stop();
+    clear_graphs();
+    for (auto &slot : slots_)
+      if (slot.done) checkRuntime(cudaEventDestroy(slot.done));
+    if (graph_stream_) checkRuntime(cudaStreamDestroy(graph_stream_));
+  }
 
-  virtual ~InferImpl() = default;
+  void clear_graphs() {
+    for (auto &slot : slots_) slot.graph_cache.clear();
+  }
 
-  void adjust_memory(int batch_size) {
+  void adjust_memory(int batch_size, BatchSlot &slot) {
     // the inference batch_size
-    size_t input_numel = network_input_width_ * network_input_height_ * 3;
-    input_buffer_.gpu(batch_size * input_numel);
-    bbox_predict_.gpu(batch_size * bbox_head_dims_[1] * bbox_head_dims_[2]);
-    output_boxarray_.gpu(batch_size * (32 + MAX_IMAGE_BOXES * NUM_BOX_ELEMENT));
-    output_boxarray_.cpu(batch_size * (32 + MAX_IMAGE_BOXES * NUM_BOX_ELEMENT));
+    WorkspaceSizes sizes = workspace_sizes(batch_size, network_input_width_, network_input_height_,
+                                           bbox_head_dims_, segment_head_dims_, 0, 0, max_boxes_);
+    input_buffer_.gpu(sizes.input);
+    bbox_predict_.gpu(sizes.bbox);
+    if (end_to_end_.valid()) {
+      num_detections_.gpu(batch_size);
+      detection_scores_.gpu(batch_size * end_to_end_.max_detections);
+      detection_classes_.gpu(batch_size * end_to_end_.max_detections);
+    }
+    slot.output_boxarray.gpu(sizes.boxarray);
+    slot.output_boxarray.cpu(sizes.boxarray);
+    slot.decode_matrices.gpu(batch_size * 6);
+    slot.decode_matrices.cpu(batch_size * 6);
 
-    if (has_segment_)
-      segment_predict_.gpu(batch_size * segment_head_dims_[1] * segment_head_dims_[2] *
-                           segment_head_dims_[3]);
+    if (has_segment_) segment_predict_.gpu(sizes.segment);
 
-    if ((int)preprocess_buffers_.size() < batch_size) {
-      for (int i = preprocess_buffers_.size(); i < batch_size; ++i)
-        preprocess_buffers_.push_back(make_shared<trt::Memory<unsigned char>>());
+    if ((int)slot.preprocess_buffers.size() < batch_size) {
+      for (int i = slot.preprocess_buffers.size(); i < batch_size; ++i)
+        slot.preprocess_buffers.push_back(make_shared<trt::Memory<unsigned char>>());
     }
   }
 
-  void preprocess(int ibatch, const Image &image,
-                  shared_ptr<trt::Memory<unsigned char>> preprocess_buffer, AffineMatrix &affine,
-                  void *stream = nullptr) {
+  // Size every buffer for the largest batch and image up front, then run warm-up forwards so
+  // that TensorRT lazy initialization does not land on the first real frame.
+  bool prepare(const LoadOptions &options) {
+    auto input_dims = trt_->static_dims(0);
+    int max_batch = input_dims[0];
+    if (isdynamic_model_) {
+      max_batch = std::max(1, options.max_batch);
+      input_dims[0] = max_batch;
+      if (!trt_->set_run_dims(0, input_dims)) return false;
+    }
+
+    WorkspaceSizes sizes = workspace_sizes(max_batch, network_input_width_, network_input_height_,
+                                           bbox_head_dims_, segment_head_dims_, options.max_width,
+                                           options.max_height, max_boxes_);
+    for (auto &slot : slots_) {
+      adjust_memory(max_batch, slot);
+      for (int i = 0; i < max_batch && sizes.preprocess > 0; ++i) {
+        slot.preprocess_buffers[i]->gpu(sizes.preprocess);
+        slot.preprocess_buffers[i]->cpu(sizes.preprocess);
+      }
+    }
+    if (has_segment_) {
+      if (box_segment_cache_.empty())
+        box_segment_cache_.push_back(std::make_shared<trt::Memory<unsigned char>>());
+      box_segment_cache_[0]->gpu(sizes.mask);
+    }
+
+    if (options.warmup > 0) {
+      int width = options.max_width > 0 ? options.max_width : network_input_width_;
+      int height = options.max_height > 0 ? options.max_height : network_input_height_;
+      vector<uint8_t> blank((size_t)width * height * 3, 0);
+      vector<Image> images(max_batch, Image(blank.data(), width, height));
+      for (int i = 0; i < options.warmup; ++i) {
+        if ((int)forwards(images).size() != max_batch) {
+          INFOE("Warm-up forward %d failed", i);
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  // host side of preprocess: affine matrix and image are staged into the pinned workspace
+  void stage_preprocess(const Image &image,
+                        shared_ptr<trt::Memory<unsigned char>> preprocess_buffer,
+                        AffineMatrix &affine) {
     affine.compute(make_tuple(image.width, image.height),
                    make_tuple(network_input_width_, network_input_height_));
 
+    // single channel images stay single channel up to the warp kernel
+    size_t size_image = packed_bytes(image);
+    size_t size_matrix = preprocess_matrix_bytes();
+    preprocess_buffer->gpu(size_matrix + size_image);
+
+    uint8_t *cpu_workspace = preprocess_buffer->cpu(size_matrix + size_image);
+    float *affine_matrix_host = (float *)cpu_workspace;
+    uint8_t *image_host = cpu_workspace + size_matrix;
+
+    host::pack(image, image_host);
+    memcpy(affine_matrix_host, affine.d2i, sizeof(affine.d2i));
+  }
+
+  // device side of preprocess, only stream work so that it can be captured into a graph
+  void enqueue_preprocess(int ibatch, const Image &image,
+                          shared_ptr<trt::Memory<unsigned char>> preprocess_buffer,
+                          cudaStream_t stream) {
     size_t input_numel = network_input_width_ * network_input_height_ * 3;
     float *input_device = input_buffer_.gpu() + ibatch * input_numel;
-    size_t size_image = image.width * image.height * 3;
-    size_t size_matrix = upbound(sizeof(affine.d2i), 32);
-    uint8_t *gpu_workspace = preprocess_buffer->gpu(size_matrix + size_image);
+    size_t size_image = packed_bytes(image);
+    size_t size_matrix = preprocess_matrix_bytes();
+    uint8_t *gpu_workspace = preprocess_buffer->gpu();
     float *affine_matrix_device = (float *)gpu_workspace;
     uint8_t *image_device = gpu_workspace + size_matrix;
 
-    uint8_t *cpu_workspace = preprocess_buffer->cpu(size_matrix + size_image);
+    uint8_t *cpu_workspace = preprocess_buffer->cpu();
     float *affine_matrix_host = (float *)cpu_workspace;
     uint8_t *image_host = cpu_workspace + size_matrix;
 
-    // speed up
-    cudaStream_t stream_ = (cudaStream_t)stream;
-    memcpy(image_host, image.bgrptr, size_image);
-    memcpy(affine_matrix_host, affine.d2i, sizeof(affine.d2i));
     checkRuntime(
-        cudaMemcpyAsync(image_device, image_host, size_image, cudaMemcpyHostToDevice, stream_));
-    checkRuntime(cudaMemcpyAsync(affine_matrix_device, affine_matrix_host, sizeof(affine.d2i),
-                                 cudaMemcpyHostToDevice, stream_));
+        cudaMemcpyAsync(image_device, image_host, size_image, cudaMemcpyHostToDevice, stream));
+    checkRuntime(cudaMemcpyAsync(affine_matrix_device, affine_matrix_host,
+                                 sizeof(AffineMatrix::d2i), cudaMemcpyHostToDevice, stream));
+
+    warp_affine_bilinear_and_normalize_plane(
+        image_device, image.width * bytes_per_pixel(image.format), image.width, image.height,
+        pixel_source(image), input_device, network_input_width_, network_input_height_,
+        affine_matrix_device, 114, normalize_, stream);
+  }
 
-    warp_affine_bilinear_and_normalize_plane(image_device, image.width * 3, image.width,
-                                             image.height, input_device, network_input_width_,
-                                             network_input_height_, affine_matrix_device, 114,
-                                             normalize_, stream_);
+  // d2i of every image, for the decode of the whole batch
+  void stage_matrices(const vector<AffineMatrix> &affines, int num_image, BatchSlot &slot) {
+    float *matrices = slot.decode_matrices.cpu();
+    for (int i = 0; i < num_image; ++i)
+      memcpy(matrices + i * 6, affines[i].d2i, sizeof(affines[i].d2i));
   }
 
-  bool load(const string &engine_file, Type type, float confidence_threshold, float nms_threshold) {
-    trt_ = trt::load(engine_file);
+  // End-to-end engine: the plugin has decoded and suppressed already, the detections are only
+  // un-letterboxed into the boxarray layout.
+  bool enqueue_end_to_end(const vector<Image> &images, BatchSlot &slot, cudaStream_t stream,
+                          bool copy_boxes) {
+    int num_image = images.size();
+    vector<void *> bindings(trt_->num_bindings(), nullptr);
+    bindings[0] = input_buffer_.gpu();
+    bindings[end_to_end_.num_dets] = num_detections_.gpu();
+    bindings[end_to_end_.boxes] = bbox_predict_.gpu();
+    bindings[end_to_end_.scores] = detection_scores_.gpu();
+    bindings[end_to_end_.classes] = detection_classes_.gpu();
+    if (!trt_->forward(bindings, stream)) {
+      INFOE("Failed to tensorRT forward.");
+      return false;
+    }
+
+    // the engine writes its top K per image, only the first max_boxes_ reach the boxarray
+    const size_t stride = end_to_end_.max_detections;
+    for (int ib = 0; ib < num_image; ++ib) {
+      end_to_end_invoker(num_detections_.gpu() + ib, bbox_predict_.gpu() + ib * stride * 4,
+                         detection_scores_.gpu() + ib * stride,
+                         detection_classes_.gpu() + ib * stride,
+                         end_to_end_.integer_classes, max_boxes_, confidence_threshold_,
+                         class_thresholds_.gpu(), num_classes_,
+                         (float *)slot.preprocess_buffers[ib]->gpu(),
+                         slot.output_boxarray.gpu() + ib * boxarray_numel(max_boxes_), stream);
+    }
+    if (copy_boxes)
+      checkRuntime(cudaMemcpyAsync(slot.output_boxarray.cpu(), slot.output_boxarray.gpu(),
+                                   slot.output_boxarray.gpu_bytes(), cudaMemcpyDeviceToHost,
+                                   stream));
+    return true;
+  }
+
+  // preprocess -> tensorRT -> decode/nms -> boxarray D2H, everything before host post-process.
+  // Without copy_boxes the boxarrays stay on the device.
+  bool enqueue_pipeline(const vector<Image> &images, BatchSlot &slot, cudaStream_t stream,
+                        bool copy_boxes = true) {
+    int num_image = images.size();
+    for (int i = 0; i < num_image; ++i)
+      enqueue_preprocess(i, images[i], slot.preprocess_buffers[i], stream);
+    if (end_to_end_.valid()) return enqueue_end_to_end(images, slot, stream, copy_boxes);
+
+    float *bbox_output_device = bbox_predict_.gpu();
+    vector<void *> bindings{input_buffer_.gpu(), bbox_output_device};
+
+    if (has_segment_) {
+      bindings = {input_buffer_.gpu(), segment_predict_.gpu(), bbox_output_device};
+    }
+
+    if (!trt_->forward(bindings, stream)) {
+      INFOE("Failed to tensorRT forward.");
+      return false;
+    }
+
+    checkRuntime(cudaMemcpyAsync(slot.decode_matrices.gpu(), slot.decode_matrices.cpu(),
+                                 num_image * 6 * sizeof(float), cudaMemcpyHostToDevice, stream));
+    decode_kernel_invoker(bbox_output_device, num_image, bbox_head_dims_[1], num_classes_,
+                          bbox_head_dims_[2], confidence_threshold_, class_thresholds_.gpu(),
+                          nms_threshold_, slot.decode_matrices.gpu(), slot.output_boxarray.gpu(),
+                          boxarray_numel(MAX_IMAGE_BOXES), MAX_IMAGE_BOXES, decode_variant_,
+                          stream);
+    if (copy_boxes)
+      checkRuntime(cudaMemcpyAsync(slot.output_boxarray.cpu(), slot.output_boxarray.gpu(),
+                                   slot.output_boxarray.gpu_bytes(), cudaMemcpyDeviceToHost,
+                                   stream));
+    return true;
+  }
+
+  GraphKey graph_key(const vector<Image> &images, BatchSlot &slot, cudaStream_t stream) {
+    GraphKey key;
+    key.batch = images.size();
+    key.addresses = {stream,
+                     input_buffer_.gpu(),
+                     bbox_predict_.gpu(),
+                     segment_predict_.gpu(),
+                     num_detections_.gpu(),
+                     detection_scores_.gpu(),
+                     detection_classes_.gpu(),
+                     slot.output_boxarray.gpu(),
+                     slot.output_boxarray.cpu(),
+                     slot.decode_matrices.gpu(),
+                     slot.decode_matrices.cpu()};
+    for (int i = 0; i < key.batch; ++i) {
+      // the format and window are kernel arguments too
+      PixelSource source = pixel_source(images[i]);
+      int low = 0, scale = 0;
+      memcpy(&low, &source.low, sizeof(low));
+      memcpy(&scale, &source.scale, sizeof(scale));
+      key.shapes.push_back(images[i].width);
+      key.shapes.push_back(images[i].height);
+      key.shapes.push_back((int)source.format);
+      key.shapes.push_back(low);
+      key.shapes.push_back(scale);
+      key.addresses.push_back(slot.preprocess_buffers[i]->gpu());
+      key.addresses.push_back(slot.preprocess_buffers[i]->cpu());
+    }
+    return key;
+  }
+
+  // Replays the graph captured for this batch. On first use the pipeline runs eagerly, which
+  // also gives tensorRT its lazy initialization outside of capture, then it is captured for
+  // the next call. Only the pinned staging buffers change between replays.
+  bool graph_forward(const vector<Image> &images, BatchSlot &slot, cudaStream_t stream) {
+    GraphKey key = graph_key(images, slot, stream);
+    void *exec = nullptr;
+    GraphLookup state = slot.graph_cache.lookup(key, &exec);
+    if (state == GraphLookup::Hit) {
+      checkRuntime(cudaGraphLaunch((cudaGraphExec_t)exec, stream));
+      return true;
+    }
+
+    if (!enqueue_pipeline(images, slot, stream)) return false;
+
+    cudaGraph_t graph = nullptr;
+    checkRuntime(cudaStreamBeginCapture(stream, cudaStreamCaptureModeThreadLocal));
+    bool captured = enqueue_pipeline(images, slot, stream);
+    cudaError_t code = cudaStreamEndCapture(stream, &graph);
+    if (!captured || code != cudaSuccess || graph == nullptr) {
+      cudaGetLastError();
+      if (graph) checkRuntime(cudaGraphDestroy(graph));
+      INFOW("Failed to capture cuda graph for batch %d, fallback to eager launch.", key.batch);
+      clear_graphs();
+      use_cuda_graph_ = false;
+      return true;
+    }
+
+    if (state == GraphLookup::Update) {
+      cudaGraphNode_t error_node = nullptr;
+      cudaGraphExecUpdateResult result;
+      if (cudaGraphExecUpdate((cudaGraphExec_t)exec, graph, &error_node, &result) ==
+          cudaSuccess) {
+        slot.graph_cache.store(key, exec);
+        checkRuntime(cudaGraphDestroy(graph));
+        return true;
+      }
+      cudaGetLastError();
+    }
+
+    cudaGraphExec_t instance = nullptr;
+    checkRuntime(cudaGraphInstantiate(&instance, graph, nullptr, nullptr, 0));
+    checkRuntime(cudaGraphDestroy(graph));
+    slot.graph_cache.store(key, instance);
+    return true;
+  }
+
+  virtual bool capture(const string &file) override {
+    capture_writer_.reset();
+    if (file.empty()) return true;
+    if (end_to_end_.valid()) {
+      INFOW("End-to-end engines have no raw heads to capture.");
+      return false;
+    }
+
+    capture_writer_ = capture::create_writer(file);
+    return capture_writer_ != nullptr;
+  }
+
+  // one capture frame per image with the raw heads, affine matrices and thresholds
+  void capture_heads(const vector<Image> &images, const vector<AffineMatrix> &affines) {
+    size_t bbox_numel = bbox_head_dims_[1] * bbox_head_dims_[2];
+    size_t segment_numel = 0;
+    if (has_segment_)
+      segment_numel = segment_head_dims_[1] * segment_head_dims_[2] * segment_head_dims_[3];
+
+    vector<float> bbox(bbox_numel), segment(segment_numel);
+    for (int ib = 0; ib < (int)images.size(); ++ib) {
+      capture::FrameHeader header;
+      header.type = (int)type_;
+      header.num_classes = num_classes_;
+      header.image_width = images[ib].width;
+      header.image_height = images[ib].height;
+      header.network_width = network_input_width_;
+      header.network_height = network_input_height_;
+      header.bbox_dims[0] = bbox_head_dims_[1];
+      header.bbox_dims[1] = bbox_head_dims_[2];
+      if (has_segment_) {
+        header.segment_dims[0] = segment_head_dims_[1];
+        header.segment_dims[1] = segment_head_dims_[2];
+        header.segment_dims[2] = segment_head_dims_[3];
+      }
+      memcpy(header.i2d, affines[ib].i2d, sizeof(header.i2d));
+      memcpy(header.d2i, affines[ib].d2i, sizeof(header.d2i));
+      header.confidence_threshold = confidence_threshold_;
+      header.nms_threshold = nms_threshold_;
+
+      checkRuntime(cudaMemcpy(bbox.data(), bbox_predict_.gpu() + ib * bbox_numel,
+                              bbox_numel * sizeof(float), cudaMemcpyDeviceToHost));
+      if (has_segment_)
+        checkRuntime(cudaMemcpy(segment.data(), segment_predict_.gpu() + ib * segment_numel,
+                                segment_numel * sizeof(float), cudaMemcpyDeviceToHost));
+
+      if (!capture_writer_->write(header, bbox.data(), has_segment_ ? segment.data() : nullptr,
+                                  class_thresholds_.cpu())) {
+        capture_writer_.reset();
+        return;
+      }
+    }
+  }
+
+  virtual bool use_cuda_graph(bool enable) override {
+    if (enable && isdynamic_model_) {
+      INFO("CUDA graph is only supported by static shape model.");
+      enable = false;
+    }
+    if (enable && trt_->profiling()) {
+      INFO("CUDA graph is not supported while profiling.");
+      enable = false;
+    }
+    if (enable && trt_->shares_activations()) {
+      // the turns on the shared scratch are ordered by events outside any graph
+      INFO("CUDA graph is not supported with shared activations.");
+      enable = false;
+    }
+    if (!enable) clear_graphs();
+    use_cuda_graph_ = enable;
+    return use_cuda_graph_;
+  }
+
+  virtual bool set_profiling(bool enable) override {
+    if (enable && use_cuda_graph_) {
+      // replayed graphs never enqueue through the execution context
+      INFO("Profiling is not supported with CUDA graph, disable it first.");
+      return false;
+    }
+    completions_.drain();
+    trt_->set_profiling(enable);
+    return true;
+  }
+
+  virtual trt::LayerReport layer_report() override { return trt_->layer_report(); }
+
+  virtual bool set_mask_encoding(MaskEncoding encoding, float threshold) override {
+    if (encoding == MaskEncoding::RLE && !has_segment_) {
+      INFO("Mask encoding needs a segmentation model.");
+      return false;
+    }
+    mask_encoding_ = encoding;
+    mask_level_ = mask_level(threshold);
+    return true;
+  }
+
+  bool load(const string &engine_file, Type type, float confidence_threshold, float nms_threshold,
+            bool share_activations = false) {
+    share_activations_ = share_activations;
+    trt_ = trt::load(engine_file, share_activations);
     if (trt_ == nullptr) return false;
 
     trt_->print();
+    checkRuntime(cudaGetDevice(&device_id_));
+    for (auto &slot : slots_)
+      checkRuntime(
+          cudaEventCreateWithFlags(&slot.done, cudaEventDisableTiming | cudaEventBlockingSync));
 
     this->type_ = type;
     this->confidence_threshold_ = confidence_threshold;
     this->nms_threshold_ = nms_threshold;
 
     auto input_dim = trt_->static_dims(0);
+    network_input_width_ = input_dim[3];
+    network_input_height_ = input_dim[2];
+    isdynamic_model_ = trt_->has_dynamic_dim();
+
+    vector<BindingInfo> outputs;
+    for (int i = 0; i < trt_->num_bindings(); ++i) {
+      if (trt_->is_input(i)) continue;
+      BindingInfo info;
+      info.index = i;
+      info.name = trt_->name(i);
+      info.dims = trt_->static_dims(i);
+      info.integer = trt_->dtype(i) == trt::DType::INT32;
+      outputs.push_back(info);
+    }
+    end_to_end_ = find_end_to_end(outputs);
+    if (end_to_end_.valid()) {
+      if (type == Type::V8Seg) {
+        INFOE("End-to-end engines can not be used for segmentation.");
+        return false;
+      }
+      // num_classes stays 0, the plugin has applied its score threshold already
+      INFO("End-to-end engine, decode and NMS run inside the engine for %d detections.",
+           end_to_end_.max_detections);
+      bbox_head_dims_ = trt_->static_dims(end_to_end_.boxes);
+      max_boxes_ = std::min(end_to_end_.max_detections, MAX_IMAGE_BOXES);
+      normalize_ = type == Type::X ? Norm::None()
+                                   : Norm::alpha_beta(1 / 255.0f, 0.0f, ChannelType::SwapRB);
+      return set_class_thresholds({});
+    }
+
     bbox_head_dims_ = trt_->static_dims(1);
     has_segment_ = type == Type::V8Seg;
     if (has_segment_) {
       bbox_head_dims_ = trt_->static_dims(2);
       segment_head_dims_ = trt_->static_dims(1);
     }
-    network_input_width_ = input_dim[3];
-    network_input_height_ = input_dim[2];
-    isdynamic_model_ = trt_->has_dynamic_dim();
 
     if (type == Type::V5 || type == Type::V3 || type == Type::V7) {
       normalize_ = Norm::alpha_beta(1 / 255.0f, 0.0f, ChannelType::SwapRB);
@@ -549,6 +1213,137 @@ class InferImpl : public Infer {
     } else {
       INFO("Unsupport type %d", type);
     }
+    decode_variant_ = select_decode(num_classes_, bbox_head_dims_[2], type);
+    return set_class_thresholds(vector<float>(num_classes_, confidence_threshold));
+  }
+
+  virtual bool set_cascade(const string &classifier_file, const CascadeOptions &options) override {
+    completions_.drain();
+    classifier_.reset();
+    if (classifier_file.empty()) return true;
+
+    auto classifier = trt::load(classifier_file, share_activations_);
+    if (classifier == nullptr) return false;
+
+    classifier->print();
+    if (classifier->num_bindings() != 2 || !classifier->is_input(0) ||
+        classifier->dtype(0) != trt::DType::FLOAT || classifier->dtype(1) != trt::DType::FLOAT) {
+      INFOE("Classifier engine must have one float input and one float output.");
+      return false;
+    }
+    auto input_dims = classifier->static_dims(0);
+    auto output_dims = classifier->static_dims(1);
+    if (input_dims.size() != 4 || input_dims[1] != 3 || output_dims.size() < 2) {
+      INFOE("Classifier input must be [N, 3, H, W] and output [N, num_classes], got %s and %s",
+            trt::format_shape(input_dims).c_str(), trt::format_shape(output_dims).c_str());
+      return false;
+    }
+
+    cascade_classes_ = 1;
+    for (int i = 1; i < (int)output_dims.size(); ++i) cascade_classes_ *= output_dims[i];
+    ChannelType channel_type = options.swap_rb ? ChannelType::SwapRB : ChannelType::None;
+    cascade_norm_ = options.mean_std
+                        ? Norm::mean_std(options.mean, options.std, 1 / 255.0f, channel_type)
+                        : Norm::alpha_beta(1 / 255.0f, 0.0f, channel_type);
+    cascade_options_ = options;
+    classifier_ = classifier;
+    return true;
+  }
+
+  // Crops every kept box out of the images still staged in the slot and classifies the crops
+  // in batches, only the crop parameters go up and the scores come back.
+  bool classify_boxes(const vector<Image> &images, BatchSlot &slot, vector<BoxArray> &boxes,
+                      cudaStream_t stream) {
+    auto input_dims = classifier_->static_dims(0);
+    int width = input_dims[3], height = input_dims[2];
+    bool dynamic = classifier_->has_dynamic_dim();
+    int max_batch = dynamic ? std::max(1, cascade_options_.max_batch) : input_dims[0];
+    vector<CropJob> jobs = crop_jobs(images, boxes, width, height, cascade_options_.padding,
+                                     cascade_options_.letterbox);
+    if (jobs.empty()) return true;
+
+    float *input_device = cascade_input_.gpu((size_t)max_batch * 3 * width * height);
+    float *output_device = cascade_output_.gpu(max_batch * cascade_classes_);
+    float *output_host = cascade_output_.cpu(max_batch * cascade_classes_);
+    CropParams *params_device = crop_params_.gpu(max_batch);
+    CropParams *params_host = crop_params_.cpu(max_batch);
+    vector<float> scores(cascade_classes_);
+
+    for (auto &batch : crop_batches(jobs.size(), max_batch)) {
+      int num_crops = batch.second - batch.first;
+      if (dynamic) {
+        input_dims[0] = num_crops;
+        if (!classifier_->set_run_dims(0, input_dims)) {
+          INFOE("Failed to set classifier batch %d", num_crops);
+          return false;
+        }
+      }
+
+      for (int i = 0; i < num_crops; ++i) {
+        const CropJob &job = jobs[batch.first + i];
+        CropParams &params = params_host[i];
+        params.src = slot.preprocess_buffers[job.image]->gpu() + preprocess_matrix_bytes();
+        params.width = images[job.image].width;
+        params.height = images[job.image].height;
+        params.line_size = params.width * bytes_per_pixel(images[job.image].format);
+        params.source = pixel_source(images[job.image]);
+        memcpy(params.d2i, job.d2i, sizeof(params.d2i));
+      }
+      checkRuntime(cudaMemcpyAsync(params_device, params_host, num_crops * sizeof(CropParams),
+                                   cudaMemcpyHostToDevice, stream));
+      warp_affine_crops(params_device, num_crops, input_device, width, height, cascade_norm_,
+                        stream);
+      if (!classifier_->forward({input_device, output_device}, stream)) {
+        INFOE("Failed to tensorRT forward the classifier.");
+        return false;
+      }
+      checkRuntime(cudaMemcpyAsync(output_host, output_device,
+                                   num_crops * cascade_classes_ * sizeof(float),
+                                   cudaMemcpyDeviceToHost, stream));
+      // the pinned parameters are rewritten by the next batch
+      checkRuntime(cudaStreamSynchronize(stream));
+
+      for (int i = 0; i < num_crops; ++i) {
+        const CropJob &job = jobs[batch.first + i];
+        Box &box = boxes[job.image][job.box];
+        box.sub_label = classify_scores(output_host + i * cascade_classes_, cascade_classes_,
+                                        cascade_options_.softmax, scores.data());
+        box.sub_confidence = scores[box.sub_label];
+        if (cascade_options_.all_scores) box.sub_scores = scores;
+      }
+    }
+    return true;
+  }
+
+  virtual int num_classes() override { return num_classes_; }
+
+  virtual bool set_class_thresholds(const vector<float> &thresholds,
+                                    const vector<uint8_t> &enabled = {}) override {
+    if ((int)thresholds.size() != num_classes_ ||
+        (!enabled.empty() && (int)enabled.size() != num_classes_)) {
+      INFOE("Class thresholds must have %d elements, got %d thresholds and %d flags",
+           num_classes_, (int)thresholds.size(), (int)enabled.size());
+      return false;
+    }
+
+    if (num_classes_ == 0) return true;
+
+    // batches of forwards_async may still read the thresholds on their own streams
+    completions_.drain();
+    float *host = class_thresholds_.cpu(num_classes_);
+    float lowest = std::numeric_limits<float>::infinity();
+    for (int i = 0; i < num_classes_; ++i) {
+      bool on = enabled.empty() || enabled[i] != 0;
+      host[i] = on ? thresholds[i] : std::numeric_limits<float>::infinity();
+      lowest = std::min(lowest, host[i]);
+    }
+
+    // the device buffer keeps its address, captured graphs pick up the new values, but the
+    // objectness cut is a kernel argument baked into them
+    checkRuntime(cudaMemcpy(class_thresholds_.gpu(num_classes_), host,
+                            num_classes_ * sizeof(float), cudaMemcpyHostToDevice));
+    if (lowest != confidence_threshold_) clear_graphs();
+    confidence_threshold_ = lowest;
     return true;
   }
 
@@ -558,66 +1353,334 @@ class InferImpl : public Infer {
     return output[0];
   }
 
-  virtual vector<BoxArray> forwards(const vector<Image> &images, void *stream = nullptr) override {
-    int num_image = images.size();
-    if (num_image == 0) return {};
-
+  // batch the engine runs for num_image images, -1 when the engine can not take them
+  int run_batch(int num_image) {
     auto input_dims = trt_->static_dims(0);
     int infer_batch_size = input_dims[0];
     if (infer_batch_size != num_image) {
       if (isdynamic_model_) {
         infer_batch_size = num_image;
         input_dims[0] = num_image;
-        if (!trt_->set_run_dims(0, input_dims)) return {};
+        if (!trt_->set_run_dims(0, input_dims)) return -1;
       } else {
         if (infer_batch_size < num_image) {
-          INFO(
+          INFOW(
               "When using static shape model, number of images[%d] must be "
               "less than or equal to the maximum batch[%d].",
               num_image, infer_batch_size);
-          return {};
+          return -1;
         }
       }
     }
-    adjust_memory(infer_batch_size);
+    return infer_batch_size;
+  }
 
-    vector<AffineMatrix> affine_matrixs(num_image);
+  // stages the images into the slot and enqueues the whole pipeline, stream is replaced by
+  // the stream the work went to
+  bool submit(const vector<Image> &images, BatchSlot &slot, vector<AffineMatrix> &affines,
+              cudaStream_t &stream) {
+    int infer_batch_size = run_batch(images.size());
+    if (infer_batch_size == -1) return false;
+    adjust_memory(infer_batch_size, slot);
+
+    for (int i = 0; i < (int)images.size(); ++i)
+      stage_preprocess(images[i], slot.preprocess_buffers[i], affines[i]);
+    stage_matrices(affines, images.size(), slot);
+
+    if (use_cuda_graph_) {
+      // the legacy default stream can not be captured
+      if (stream == nullptr) {
+        if (graph_stream_ == nullptr)
+          checkRuntime(cudaStreamCreateWithFlags(&graph_stream_, cudaStreamNonBlocking));
+        stream = graph_stream_;
+      }
+      return graph_forward(images, slot, stream);
+    }
+    return enqueue_pipeline(images, slot, stream);
+  }
+
+  // Enqueues the batch into the next slot and returns, on_done runs on the completion thread
+  // once the boxes are on the host. While a batch is in flight the next one goes to another
+  // slot and only waits for that slot's previous batch.
+  bool enqueue_async(const vector<Image> &images, void *stream,
+                     const function<void(BatchSlot &slot)> &on_done) {
+    BatchSlot *slot = &slots_[next_slot_];
+    next_slot_ = (next_slot_ + 1) % NUM_BATCH_SLOTS;
+    completions_.wait(slot->ticket);
+
+    vector<AffineMatrix> affines(images.size());
     cudaStream_t stream_ = (cudaStream_t)stream;
-    for (int i = 0; i < num_image; ++i)
-      preprocess(i, images[i], preprocess_buffers_[i], affine_matrixs[i], stream);
+    if (!submit(images, *slot, affines, stream_)) return false;
+    checkRuntime(cudaEventRecord(slot->done, stream_));
+
+    cudaEvent_t done = slot->done;
+    int device_id = device_id_;
+    slot->ticket = completions_.push(
+        [done, device_id]() {
+          checkRuntime(cudaSetDevice(device_id));
+          checkRuntime(cudaEventSynchronize(done));
+        },
+        [slot, on_done]() { on_done(*slot); });
+    return true;
+  }
 
-    float *bbox_output_device = bbox_predict_.gpu();
-    vector<void *> bindings{input_buffer_.gpu(), bbox_output_device};
+  // Segmentation, head capture and the cascade read the device buffers after the boxes land,
+  // the async variants run them synchronously.
+  bool async_supported() const {
+    return !has_segment_ && capture_writer_ == nullptr && classifier_ == nullptr;
+  }
 
-    if (has_segment_) {
-      bindings = {input_buffer_.gpu(), segment_predict_.gpu(), bbox_output_device};
+  virtual shared_future<vector<BoxArray>> forwards_async(const vector<Image> &images,
+                                                         void *stream = nullptr) override {
+    auto result = make_shared<promise<vector<BoxArray>>>();
+    shared_future<vector<BoxArray>> future = result->get_future().share();
+    int num_image = images.size();
+    if (num_image == 0 || !async_supported()) {
+      result->set_value(forwards(images, stream));
+      return future;
     }
 
-    if (!trt_->forward(bindings, stream)) {
-      INFO("Failed to tensorRT forward.");
+    int max_boxes = max_boxes_;
+    bool queued = enqueue_async(images, stream, [num_image, max_boxes, result](BatchSlot &slot) {
+      vector<BoxArray> arrout(num_image);
+      for (int ib = 0; ib < num_image; ++ib)
+        host::collect(slot.output_boxarray.cpu() + ib * boxarray_numel(max_boxes), max_boxes,
+                      arrout[ib]);
+      result->set_value(move(arrout));
+    });
+    if (!queued) result->set_value({});
+    return future;
+  }
+
+  virtual future<BoxBatch> forwards_packed_async(const vector<Image> &images,
+                                                 void *stream = nullptr) override {
+    auto result = make_shared<promise<BoxBatch>>();
+    future<BoxBatch> output = result->get_future();
+    int num_image = images.size();
+    if (num_image == 0 || !async_supported()) {
+      result->set_value(forwards_packed(images, stream));
+      return output;
+    }
+
+    int max_boxes = max_boxes_;
+    bool queued = enqueue_async(images, stream, [num_image, max_boxes, result](BatchSlot &slot) {
+      BoxBatch boxes;
+      host::collect(slot.output_boxarray.cpu(), boxarray_numel(max_boxes), num_image, max_boxes,
+                    boxes);
+      result->set_value(move(boxes));
+    });
+    if (!queued) result->set_value(BoxBatch());
+    return output;
+  }
+
+  // eager launches only: the graphs of forwards end with the boxarray D2H this mode skips
+  virtual vector<Counts> count(const vector<Image> &images, const vector<CountZone> &zones,
+                               void *stream = nullptr) override {
+    int num_image = images.size();
+    if (num_image == 0) return {};
+    if (end_to_end_.valid()) {
+      INFOE("Count mode needs the class count of the head, end-to-end engines have none.");
       return {};
     }
 
+    completions_.drain();
+    BatchSlot &slot = slots_[0];
+    int infer_batch_size = run_batch(num_image);
+    if (infer_batch_size == -1) return {};
+    adjust_memory(infer_batch_size, slot);
+
+    vector<AffineMatrix> affine_matrixs(num_image);
+    for (int i = 0; i < num_image; ++i)
+      stage_preprocess(images[i], slot.preprocess_buffers[i], affine_matrixs[i]);
+    stage_matrices(affine_matrixs, num_image, slot);
+
+    cudaStream_t stream_ = (cudaStream_t)stream;
+    if (!enqueue_pipeline(images, slot, stream_, false)) return {};
+
+    int num_zones = zones.size();
+    int per_image = num_classes_ * (1 + num_zones);
+    int *counts_device = counts_.gpu(num_image * per_image);
+    int *counts_host = counts_.cpu(num_image * per_image);
+    CountZone *zones_device = nullptr;
+    if (num_zones > 0) {
+      CountZone *zones_host = count_zones_.cpu(num_zones);
+      memcpy(zones_host, zones.data(), num_zones * sizeof(CountZone));
+      zones_device = count_zones_.gpu(num_zones);
+      checkRuntime(cudaMemcpyAsync(zones_device, zones_host, num_zones * sizeof(CountZone),
+                                   cudaMemcpyHostToDevice, stream_));
+    }
+    checkRuntime(cudaMemsetAsync(counts_device, 0, num_image * per_image * sizeof(int), stream_));
+    count_invoker(slot.output_boxarray.gpu(), boxarray_numel(max_boxes_), num_image, max_boxes_,
+                  num_classes_, zones_device, num_zones, counts_device, stream_);
+    checkRuntime(cudaMemcpyAsync(counts_host, counts_device, num_image * per_image * sizeof(int),
+                                 cudaMemcpyDeviceToHost, stream_));
+    checkRuntime(cudaStreamSynchronize(stream_));
+    if (capture_writer_) capture_heads(images, affine_matrixs);
+
+    vector<Counts> output(num_image);
     for (int ib = 0; ib < num_image; ++ib) {
-      float *boxarray_device =
-          output_boxarray_.gpu() + ib * (32 + MAX_IMAGE_BOXES * NUM_BOX_ELEMENT);
-      float *affine_matrix_device = (float *)preprocess_buffers_[ib]->gpu();
-      float *image_based_bbox_output =
-          bbox_output_device + ib * (bbox_head_dims_[1] * bbox_head_dims_[2]);
-      checkRuntime(cudaMemsetAsync(boxarray_device, 0, sizeof(int), stream_));
-      decode_kernel_invoker(image_based_bbox_output, bbox_head_dims_[1], num_classes_,
-                            bbox_head_dims_[2], confidence_threshold_, nms_threshold_,
-                            affine_matrix_device, boxarray_device, MAX_IMAGE_BOXES, type_, stream_);
-    }
-    checkRuntime(cudaMemcpyAsync(output_boxarray_.cpu(), output_boxarray_.gpu(),
-                                 output_boxarray_.gpu_bytes(), cudaMemcpyDeviceToHost, stream_));
+      const int *pcounts = counts_host + ib * per_image;
+      output[ib].classes.assign(pcounts, pcounts + num_classes_);
+      output[ib].zones.assign(pcounts + num_classes_, pcounts + per_image);
+    }
+    return output;
+  }
+
+  virtual BoxBatch forwards_packed(const vector<Image> &images, void *stream = nullptr) override {
+    BoxBatch output;
+    int num_image = images.size();
+    if (num_image == 0) return output;
+
+    completions_.drain();
+    BatchSlot &slot = slots_[0];
+    vector<AffineMatrix> affine_matrixs(num_image);
+    cudaStream_t stream_ = (cudaStream_t)stream;
+    if (!submit(images, slot, affine_matrixs, stream_)) return output;
     checkRuntime(cudaStreamSynchronize(stream_));
+    if (capture_writer_) capture_heads(images, affine_matrixs);
+
+    const size_t stride = boxarray_numel(max_boxes_);
+    if (!has_segment_) {
+      host::collect(slot.output_boxarray.cpu(), stride, num_image, max_boxes_, output);
+      return output;
+    }
+
+    // masks of all boxes are decoded into one device block laid out like the mask area of
+    // the batch, then copied back at once
+    int total = 0;
+    size_t mask_bytes = 0;
+    for (int ib = 0; ib < num_image; ++ib) {
+      const float *parray = slot.output_boxarray.cpu() + ib * stride;
+      int count = min(max_boxes_, (int)*parray);
+      for (int i = 0; i < count; ++i) {
+        const float *pbox = parray + 1 + i * NUM_BOX_ELEMENT;
+        if ((int)pbox[6] != 1) continue;
+        MaskRegion region =
+            mask_region(affine_matrixs[ib].i2d, pbox, network_input_width_,
+                        network_input_height_, segment_head_dims_[3], segment_head_dims_[2]);
+        if (region.width > 0 && region.height > 0) mask_bytes += region.width * region.height;
+        total++;
+      }
+    }
+
+    output.reset(num_image, total, mask_bytes);
+    unsigned char *mask_device = mask_bytes > 0 ? packed_masks_.gpu(mask_bytes) : nullptr;
+    size_t segment_numel = segment_head_dims_[1] * segment_head_dims_[2] * segment_head_dims_[3];
+    for (int ib = 0; ib < num_image; ++ib) {
+      const float *parray = slot.output_boxarray.cpu() + ib * stride;
+      int count = min(max_boxes_, (int)*parray);
+      for (int i = 0; i < count; ++i) {
+        const float *pbox = parray + 1 + i * NUM_BOX_ELEMENT;
+        if ((int)pbox[6] != 1) continue;
+        int index = output.append(ib, pbox[0], pbox[1], pbox[2], pbox[3], pbox[4], (int)pbox[5]);
+        MaskRegion region =
+            mask_region(affine_matrixs[ib].i2d, pbox, network_input_width_,
+                        network_input_height_, segment_head_dims_[3], segment_head_dims_[2]);
+        unsigned char *mask = output.attach_mask(index, region.width, region.height);
+        if (mask == nullptr) continue;
+
+        int row_index = pbox[7];
+        float *mask_weights = bbox_predict_.gpu() +
+                              (ib * bbox_head_dims_[1] + row_index) * bbox_head_dims_[2] +
+                              num_classes_ + 4;
+        decode_single_mask(region.left, region.top, mask_weights,
+                           segment_predict_.gpu() + ib * segment_numel, segment_head_dims_[3],
+                           segment_head_dims_[2], mask_device + (mask - output.mask_data()),
+                           segment_head_dims_[1], region.width, region.height, stream_);
+      }
+    }
+
+    if (mask_bytes > 0) {
+      checkRuntime(cudaMemcpyAsync(output.mask_data(), mask_device, mask_bytes,
+                                   cudaMemcpyDeviceToHost, stream_));
+      checkRuntime(cudaStreamSynchronize(stream_));
+    }
+    return output;
+  }
 
+  // RLE mode of forwards: the masks of the jobs are decoded into one device block, binarized
+  // and encoded there. Only the transition counts and then the transitions come back.
+  void encode_masks(const vector<MaskJob> &jobs, vector<BoxArray> &arrout, cudaStream_t stream) {
+    int num_masks = jobs.size();
+    unsigned int *spans = mask_spans_.cpu(num_masks * 2);
+    size_t mask_bytes = 0;
+    for (int i = 0; i < num_masks; ++i) {
+      spans[i * 2] = mask_bytes;
+      spans[i * 2 + 1] = jobs[i].region.width * jobs[i].region.height;
+      mask_bytes += spans[i * 2 + 1];
+    }
+
+    unsigned char *mask_device = packed_masks_.gpu(mask_bytes);
+    size_t segment_numel = segment_head_dims_[1] * segment_head_dims_[2] * segment_head_dims_[3];
+    for (int i = 0; i < num_masks; ++i) {
+      const MaskJob &job = jobs[i];
+      float *mask_weights = bbox_predict_.gpu() +
+                            (job.image * bbox_head_dims_[1] + job.row) * bbox_head_dims_[2] +
+                            num_classes_ + 4;
+      decode_single_mask(job.region.left, job.region.top, mask_weights,
+                         segment_predict_.gpu() + job.image * segment_numel,
+                         segment_head_dims_[3], segment_head_dims_[2], mask_device + spans[i * 2],
+                         segment_head_dims_[1], job.region.width, job.region.height, stream);
+    }
+
+    checkRuntime(cudaMemcpyAsync(mask_spans_.gpu(num_masks * 2), spans,
+                                 num_masks * 2 * sizeof(unsigned int), cudaMemcpyHostToDevice,
+                                 stream));
+    mask_rle_invoker(mask_device, mask_spans_.gpu(), num_masks, mask_level_,
+                     mask_counts_.gpu(num_masks), nullptr, nullptr, stream);
+    unsigned int *counts = mask_counts_.cpu(num_masks);
+    checkRuntime(cudaMemcpyAsync(counts, mask_counts_.gpu(), num_masks * sizeof(unsigned int),
+                                 cudaMemcpyDeviceToHost, stream));
+    checkRuntime(cudaStreamSynchronize(stream));
+
+    unsigned int *offsets = mask_offsets_.cpu(num_masks);
+    size_t total = 0;
+    for (int i = 0; i < num_masks; ++i) {
+      offsets[i] = total;
+      total += counts[i];
+    }
+    checkRuntime(cudaMemcpyAsync(mask_offsets_.gpu(num_masks), offsets,
+                                 num_masks * sizeof(unsigned int), cudaMemcpyHostToDevice,
+                                 stream));
+    unsigned int *transitions_device = mask_transitions_.gpu(std::max(total, (size_t)1));
+    mask_rle_invoker(mask_device, mask_spans_.gpu(), num_masks, mask_level_, nullptr,
+                     mask_offsets_.gpu(), transitions_device, stream);
+    unsigned int *transitions = mask_transitions_.cpu(std::max(total, (size_t)1));
+    if (total > 0)
+      checkRuntime(cudaMemcpyAsync(transitions, transitions_device, total * sizeof(unsigned int),
+                                   cudaMemcpyDeviceToHost, stream));
+    checkRuntime(cudaStreamSynchronize(stream));
+
+    for (int i = 0; i < num_masks; ++i) {
+      const MaskJob &job = jobs[i];
+      auto rle = make_shared<MaskRLE>();
+      host::rle_from_transitions(transitions + offsets[i], counts[i], job.region.width,
+                                 job.region.height, *rle);
+      arrout[job.image][job.box].rle = rle;
+    }
+  }
+
+  virtual vector<BoxArray> forwards(const vector<Image> &images, void *stream = nullptr) override {
+    int num_image = images.size();
+    if (num_image == 0) return {};
+
+    // batches still in flight use the slots and the shared device buffers
+    completions_.drain();
+    BatchSlot &slot = slots_[0];
+    vector<AffineMatrix> affine_matrixs(num_image);
+    cudaStream_t stream_ = (cudaStream_t)stream;
+    if (!submit(images, slot, affine_matrixs, stream_)) return {};
+    checkRuntime(cudaStreamSynchronize(stream_));
+    if (capture_writer_) capture_heads(images, affine_matrixs);
+
+    float *bbox_output_device = bbox_predict_.gpu();
     vector<BoxArray> arrout(num_image);
     int imemory = 0;
+    bool encode = has_segment_ && mask_encoding_ == MaskEncoding::RLE;
+    vector<MaskJob> mask_jobs;
     for (int ib = 0; ib < num_image; ++ib) {
-      float *parray = output_boxarray_.cpu() + ib * (32 + MAX_IMAGE_BOXES * NUM_BOX_ELEMENT);
-      int count = min(MAX_IMAGE_BOXES, (int)*parray);
+      float *parray = slot.output_boxarray.cpu() + ib * boxarray_numel(max_boxes_);
+      int count = min(max_boxes_, (int)*parray);
       BoxArray &output = arrout[ib];
       output.reserve(count);
       for (int i = 0; i < count; ++i) {
@@ -626,7 +1689,16 @@ class InferImpl : public Infer {
         int keepflag = pbox[6];
         if (keepflag == 1) {
           Box result_object_box(pbox[0], pbox[1], pbox[2], pbox[3], pbox[4], label);
-          if (has_segment_) {
+          if (encode) {
+            MaskJob job;
+            job.image = ib;
+            job.box = output.size();
+            job.row = pbox[7];
+            job.region =
+                mask_region(affine_matrixs[ib].i2d, pbox, network_input_width_,
+                            network_input_height_, segment_head_dims_[3], segment_head_dims_[2]);
+            if (job.region.width > 0 && job.region.height > 0) mask_jobs.push_back(job);
+          } else if (has_segment_) {
             int row_index = pbox[7];
             int mask_dim = segment_head_dims_[1];
             float *mask_weights = bbox_output_device +
@@ -634,18 +1706,11 @@ class InferImpl : public Infer {
                                   num_classes_ + 4;
 
             float *mask_head_predict = segment_predict_.gpu();
-            float left, top, right, bottom;
-            float *i2d = affine_matrixs[ib].i2d;
-            affine_project(i2d, pbox[0], pbox[1], &left, &top);
-            affine_project(i2d, pbox[2], pbox[3], &right, &bottom);
-
-            float box_width = right - left;
-            float box_height = bottom - top;
-
-            float scale_to_predict_x = segment_head_dims_[3] / (float)network_input_width_;
-            float scale_to_predict_y = segment_head_dims_[2] / (float)network_input_height_;
-            int mask_out_width = box_width * scale_to_predict_x + 0.5f;
-            int mask_out_height = box_height * scale_to_predict_y + 0.5f;
+            MaskRegion region =
+                mask_region(affine_matrixs[ib].i2d, pbox, network_input_width_,
+                            network_input_height_, segment_head_dims_[3], segment_head_dims_[2]);
+            int mask_out_width = region.width;
+            int mask_out_height = region.height;
 
             if (mask_out_width > 0 && mask_out_height > 0) {
               if (imemory >= (int)box_segment_cache_.size()) {
@@ -659,7 +1724,7 @@ class InferImpl : public Infer {
 
               unsigned char *mask_out_device = box_segment_output_memory->gpu(bytes_of_mask_out);
               unsigned char *mask_out_host = result_object_box.seg->data;
-              decode_single_mask(left * scale_to_predict_x, top * scale_to_predict_y, mask_weights,
+              decode_single_mask(region.left, region.top, mask_weights,
                                  mask_head_predict + ib * segment_head_dims_[1] *
                                                          segment_head_dims_[2] *
                                                          segment_head_dims_[3],
@@ -675,7 +1740,9 @@ class InferImpl : public Infer {
       }
     }
 
+    if (!mask_jobs.empty()) encode_masks(mask_jobs, arrout, stream_);
     if (has_segment_) checkRuntime(cudaStreamSynchronize(stream_));
+    if (classifier_ && !classify_boxes(images, slot, arrout, stream_)) return {};
 
     return arrout;
   }
@@ -697,44 +1764,271 @@ shared_ptr<Infer> load(const string &engine_file, Type type, float confidence_th
       (InferImpl *)loadraw(engine_file, type, confidence_threshold, nms_threshold));
 }
 
-std::tuple<uint8_t, uint8_t, uint8_t> hsv2bgr(float h, float s, float v) {
-  const int h_i = static_cast<int>(h * 6);
-  const float f = h * 6 - h_i;
-  const float p = v * (1 - s);
-  const float q = v * (1 - f * s);
-  const float t = v * (1 - (1 - f) * s);
-  float r, g, b;
-  switch (h_i) {
-    case 0:
-      r = v, g = t, b = p;
-      break;
-    case 1:
-      r = q, g = v, b = p;
-      break;
-    case 2:
-      r = p, g = v, b = t;
-      break;
-    case 3:
-      r = p, g = q, b = v;
-      break;
-    case 4:
-      r = t, g = p, b = v;
-      break;
-    case 5:
-      r = v, g = p, b = q;
-      break;
-    default:
-      r = 1, g = 1, b = 1;
+shared_ptr<Infer> load(const string &engine_file, Type type, const LoadOptions &options,
+                       float confidence_threshold, float nms_threshold) {
+  shared_ptr<InferImpl> instance(new InferImpl());
+  if (!instance->load(engine_file, type, confidence_threshold, nms_threshold,
+                      options.share_activations) ||
+      !instance->prepare(options))
+    instance.reset();
+  return instance;
+}
+
+class PoolInferImpl : public Infer {
+ public:
+  // no device selector, every call switches with a trt::DeviceScope so that the current device
+  // of the calling thread is left as it was
+  pool::DevicePool<Infer> pool_;
+  // one per slot, a slot completes its batches in order so a wait never holds back the
+  // release of another device
+  vector<shared_ptr<cpm::CompletionQueue>> completions_;
+
+  virtual BoxArray forward(const Image &image, void *stream = nullptr) override {
+    auto output = forwards({image}, stream);
+    if (output.empty()) return {};
+    return output[0];
+  }
+
+  // a caller stream belongs to one device, every device works on its own streams
+  virtual vector<BoxArray> forwards(const vector<Image> &images, void *stream = nullptr) override {
+    auto lease = pool_.acquire();
+    if (!lease.valid()) return {};
+    trt::DeviceScope scope(lease.device_id());
+    return lease->forwards(images, nullptr);
+  }
+
+  // The lease is exclusive during the enqueue only, the slot stays counted in flight until the
+  // batch completes, so that pick() sees the work still running on the device.
+  virtual shared_future<vector<BoxArray>> forwards_async(const vector<Image> &images,
+                                                         void *stream = nullptr) override {
+    auto lease = pool_.acquire();
+    if (!lease.valid()) {
+      promise<vector<BoxArray>> empty;
+      empty.set_value({});
+      return empty.get_future().share();
+    }
+    trt::DeviceScope scope(lease.device_id());
+    auto output = lease->forwards_async(images, nullptr);
+    auto hold = lease.hold();
+    completions_[lease.index()]->push([output]() { output.wait(); },
+                                      [hold]() mutable { hold.reset(); });
+    return output;
+  }
+
+  virtual BoxBatch forwards_packed(const vector<Image> &images, void *stream = nullptr) override {
+    auto lease = pool_.acquire();
+    if (!lease.valid()) return BoxBatch();
+    trt::DeviceScope scope(lease.device_id());
+    return lease->forwards_packed(images, nullptr);
+  }
+
+  virtual future<BoxBatch> forwards_packed_async(const vector<Image> &images,
+                                                 void *stream = nullptr) override {
+    auto result = make_shared<promise<BoxBatch>>();
+    future<BoxBatch> output = result->get_future();
+    auto lease = pool_.acquire();
+    if (!lease.valid()) {
+      result->set_value(BoxBatch());
+      return output;
+    }
+    trt::DeviceScope scope(lease.device_id());
+    // BoxBatch is move only, the boxes are passed on through a promise of our own
+    auto inner = make_shared<future<BoxBatch>>(lease->forwards_packed_async(images, nullptr));
+    auto hold = lease.hold();
+    completions_[lease.index()]->push([inner]() { inner->wait(); },
+                                      [inner, hold, result]() mutable {
+                                        BoxBatch boxes = inner->get();
+                                        hold.reset();
+                                        result->set_value(move(boxes));
+                                      });
+    return output;
+  }
+
+  virtual int num_classes() override {
+    auto lease = pool_.acquire(0);
+    if (!lease.valid()) return 0;
+    trt::DeviceScope scope(lease.device_id());
+    return lease->num_classes();
+  }
+
+  virtual bool set_class_thresholds(const vector<float> &thresholds,
+                                    const vector<uint8_t> &enabled = {}) override {
+    bool status = pool_.size() > 0;
+    for (int i = 0; i < pool_.size(); ++i) {
+      auto lease = pool_.acquire(i);
+      trt::DeviceScope scope(lease.device_id());
+      status = lease->set_class_thresholds(thresholds, enabled) && status;
+    }
+    return status;
+  }
+
+  // one file per device, suffixed by the device index when there are several
+  virtual bool capture(const string &file) override {
+    bool status = pool_.size() > 0;
+    for (int i = 0; i < pool_.size(); ++i) {
+      auto lease = pool_.acquire(i);
+      trt::DeviceScope scope(lease.device_id());
+      string target = file;
+      if (!file.empty() && pool_.size() > 1) target += "." + to_string(i);
+      status = lease->capture(target) && status;
+    }
+    return status;
+  }
+
+  virtual bool use_cuda_graph(bool enable) override {
+    bool status = pool_.size() > 0;
+    for (int i = 0; i < pool_.size(); ++i) {
+      auto lease = pool_.acquire(i);
+      trt::DeviceScope scope(lease.device_id());
+      status = lease->use_cuda_graph(enable) && status;
+    }
+    return status;
+  }
+
+  virtual bool set_profiling(bool enable) override {
+    bool status = pool_.size() > 0;
+    for (int i = 0; i < pool_.size(); ++i) {
+      auto lease = pool_.acquire(i);
+      trt::DeviceScope scope(lease.device_id());
+      status = lease->set_profiling(enable) && status;
+    }
+    return status;
+  }
+
+  virtual bool set_mask_encoding(MaskEncoding encoding, float threshold) override {
+    bool status = pool_.size() > 0;
+    for (int i = 0; i < pool_.size(); ++i) {
+      auto lease = pool_.acquire(i);
+      trt::DeviceScope scope(lease.device_id());
+      status = lease->set_mask_encoding(encoding, threshold) && status;
+    }
+    return status;
+  }
+
+  // the engines of every device are the same, the first one speaks for them
+  virtual trt::LayerReport layer_report() override {
+    auto lease = pool_.acquire(0);
+    if (!lease.valid()) return trt::LayerReport();
+    trt::DeviceScope scope(lease.device_id());
+    return lease->layer_report();
+  }
+
+  virtual vector<Counts> count(const vector<Image> &images, const vector<CountZone> &zones,
+                               void *stream = nullptr) override {
+    auto lease = pool_.acquire();
+    if (!lease.valid()) return {};
+    trt::DeviceScope scope(lease.device_id());
+    return lease->count(images, zones, nullptr);
+  }
+
+  // every device deserializes its own classifier
+  virtual bool set_cascade(const string &classifier_file, const CascadeOptions &options) override {
+    bool status = pool_.size() > 0;
+    for (int i = 0; i < pool_.size(); ++i) {
+      auto lease = pool_.acquire(i);
+      trt::DeviceScope scope(lease.device_id());
+      status = lease->set_cascade(classifier_file, options) && status;
+    }
+    return status;
+  }
+};
+
+shared_ptr<Infer> load_pool(const string &engine_file, Type type, const vector<int> &devices,
+                            float confidence_threshold, float nms_threshold,
+                            const LoadOptions &options) {
+  vector<int> selected = devices;
+  if (selected.empty()) {
+    int count = 0;
+    checkRuntime(cudaGetDeviceCount(&count));
+    for (int i = 0; i < count; ++i) selected.push_back(i);
+  }
+
+  shared_ptr<PoolInferImpl> instance(new PoolInferImpl());
+  for (int device_id : selected) {
+    trt::DeviceScope scope(device_id);
+    auto model = load(engine_file, type, options, confidence_threshold, nms_threshold);
+    if (model == nullptr) {
+      INFO("Failed to load %s on device %d", engine_file.c_str(), device_id);
+      instance.reset();
       break;
+    }
+    instance->pool_.add(device_id, model);
+    instance->completions_.push_back(make_shared<cpm::CompletionQueue>());
   }
-  return make_tuple(static_cast<uint8_t>(b * 255), static_cast<uint8_t>(g * 255),
-                    static_cast<uint8_t>(r * 255));
+  if (instance && instance->pool_.size() == 0) instance.reset();
+  return instance;
 }
 
-std::tuple<uint8_t, uint8_t, uint8_t> random_color(int id) {
-  float h_plane = ((((unsigned int)id << 2) ^ 0x937151) % 100) / 100.0f;
-  float s_plane = ((((unsigned int)id << 3) ^ 0x315793) % 100) / 100.0f;
-  return hsv2bgr(h_plane, s_plane, 1);
+
+};  // namespace yolo
+
+namespace capture {
+
+ReplayOutput replay_device(const Frame &frame) {
+  using namespace yolo;
+
+  // kept per thread so that repeated replays do not allocate
+  struct Buffers {
+    trt::Memory<float> bbox, segment, thresholds, affine, boxarray;
+    trt::Memory<unsigned char> mask;
+  };
+  static thread_local Buffers buffers;
+
+  ReplayOutput output;
+  const FrameHeader &h = *frame.header;
+  int cdim = h.bbox_dims[1];
+  size_t bbox_numel = (size_t)h.bbox_dims[0] * cdim;
+  size_t segment_numel = (size_t)h.segment_dims[0] * h.segment_dims[1] * h.segment_dims[2];
+  size_t stride = boxarray_numel(MAX_IMAGE_BOXES);
+
+  vector<float> thresholds(h.num_classes, h.confidence_threshold);
+  const float *class_thresholds =
+      frame.class_thresholds ? frame.class_thresholds : thresholds.data();
+
+  checkRuntime(cudaMemcpy(buffers.bbox.gpu(bbox_numel), frame.bbox, bbox_numel * sizeof(float),
+                          cudaMemcpyHostToDevice));
+  checkRuntime(cudaMemcpy(buffers.thresholds.gpu(h.num_classes), class_thresholds,
+                          h.num_classes * sizeof(float), cudaMemcpyHostToDevice));
+  checkRuntime(cudaMemcpy(buffers.affine.gpu(6), h.d2i, sizeof(h.d2i), cudaMemcpyHostToDevice));
+  if (frame.segment)
+    checkRuntime(cudaMemcpy(buffers.segment.gpu(segment_numel), frame.segment,
+                            segment_numel * sizeof(float), cudaMemcpyHostToDevice));
+
+  float *boxarray_device = buffers.boxarray.gpu(stride);
+  decode_kernel_invoker(buffers.bbox.gpu(), 1, h.bbox_dims[0], h.num_classes, cdim,
+                        h.confidence_threshold, buffers.thresholds.gpu(), h.nms_threshold,
+                        buffers.affine.gpu(), boxarray_device, stride, MAX_IMAGE_BOXES,
+                        select_decode(h.num_classes, cdim, (Type)h.type), nullptr);
+  float *parray = buffers.boxarray.cpu(stride);
+  checkRuntime(cudaMemcpy(parray, boxarray_device, stride * sizeof(float),
+                          cudaMemcpyDeviceToHost));
+
+  int count = min(MAX_IMAGE_BOXES, (int)*parray);
+  for (int i = 0; i < count; ++i) {
+    float *pbox = parray + 1 + i * NUM_BOX_ELEMENT;
+    if ((int)pbox[6] != 1) continue;
+    output.boxes.emplace_back(pbox[0], pbox[1], pbox[2], pbox[3], pbox[4], (int)pbox[5]);
+    if (frame.segment == nullptr) continue;
+
+    Mask mask;
+    MaskRegion region = mask_region(h.i2d, pbox, h.network_width, h.network_height,
+                                    h.segment_dims[2], h.segment_dims[1]);
+    if (region.width > 0 && region.height > 0) {
+      int row_index = pbox[7];
+      mask.width = region.width;
+      mask.height = region.height;
+      mask.data.resize(mask.width * mask.height);
+      unsigned char *mask_device = buffers.mask.gpu(mask.data.size());
+      decode_single_mask(region.left, region.top,
+                         buffers.bbox.gpu() + row_index * cdim + h.num_classes + 4,
+                         buffers.segment.gpu(), h.segment_dims[2], h.segment_dims[1],
+                         mask_device, h.segment_dims[0], mask.width, mask.height, nullptr);
+      checkRuntime(cudaMemcpy(mask.data.data(), mask_device, mask.data.size(),
+                              cudaMemcpyDeviceToHost));
+    }
+    output.masks.push_back(mask);
+  }
+  return output;
 }
 
-};  // namespace yolo
\ No newline at end of file
+};  // namespace capture
@@ -1,11 +1,16 @@
 #ifndef __YOLO_HPP__
 #define __YOLO_HPP__
 
+#include <stdint.h>
+
 #include <future>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "box_batch.hpp"
+#include "profiler.hpp"
+
 namespace yolo {
 
 enum class Type : int {
@@ -25,10 +30,26 @@ struct InstanceSegmentMap {
   virtual ~InstanceSegmentMap();
 };
 
+// Run lengths of a binarized instance mask, row major over width * height. Runs alternate
+// between background and foreground starting with background, so the first may be 0 long.
+struct MaskRLE {
+  int width = 0, height = 0;
+  std::vector<uint32_t> counts;
+};
+
+enum class MaskEncoding : int {
+  Bitmap = 0,  // Box::seg, sigmoid * 255 per pixel
+  RLE = 1      // Box::rle, binarized and run length encoded on the device
+};
+
 struct Box {
   float left, top, right, bottom, confidence;
   int class_label;
   std::shared_ptr<InstanceSegmentMap> seg;  // valid only in segment task
+  std::shared_ptr<MaskRLE> rle;             // instead of seg with MaskEncoding::RLE
+  int sub_label = -1;                       // cascade classifier result, see Infer::set_cascade
+  float sub_confidence = 0;
+  std::vector<float> sub_scores;  // every classifier score, CascadeOptions::all_scores only
 
   Box() = default;
   Box(float left, float top, float right, float bottom, float confidence, int class_label)
@@ -40,16 +61,74 @@ struct Box {
         class_label(class_label) {}
 };
 
+// Pixel layout of an Image. Single channel formats are uploaded as they are, gray ones are
+// replicated to the three input planes by the warp kernel and bayer ones demosaiced by it.
+enum class PixelFormat : int {
+  BGR = 0,      // 3 bytes per pixel
+  Gray8 = 1,    // NI U8
+  Gray16 = 2,   // NI U16, windowed to 8 bit, see Image::window_low
+  BayerRG8 = 3  // raw RGGB mosaic, R at (0, 0), see host::demosaic
+};
+
+inline int bytes_per_pixel(PixelFormat format) {
+  switch (format) {
+    case PixelFormat::Gray8:
+    case PixelFormat::BayerRG8:
+      return 1;
+    case PixelFormat::Gray16:
+      return 2;
+    default:
+      return 3;
+  }
+}
+
 struct Image {
-  const void *bgrptr = nullptr;
+  const void *bgrptr = nullptr;  // pixels in format
   int width = 0, height = 0;
+  PixelFormat format = PixelFormat::BGR;
+  int stride = 0;  // bytes per row, 0 when the rows are packed
+  // Gray16 values from window_low to window_high map to 0..255, e.g. 0..4095 for 12 bit
+  float window_low = 0, window_high = 65535;
 
   Image() = default;
-  Image(const void *bgrptr, int width, int height) : bgrptr(bgrptr), width(width), height(height) {}
+  Image(const void *bgrptr, int width, int height, PixelFormat format = PixelFormat::BGR,
+        int stride = 0)
+      : bgrptr(bgrptr), width(width), height(height), format(format), stride(stride) {}
 };
 
 typedef std::vector<Box> BoxArray;
 
+// Rectangle in image pixels, a box is counted in it when its center lies inside
+struct CountZone {
+  float left = 0, top = 0, right = 0, bottom = 0;
+
+  CountZone() = default;
+  CountZone(float left, float top, float right, float bottom)
+      : left(left), top(top), right(right), bottom(bottom) {}
+};
+
+// Kept boxes of one image per class, see Infer::count
+struct Counts {
+  std::vector<int> classes;  // num_classes() elements
+  std::vector<int> zones;    // zones x num_classes(), zone major
+};
+
+// Second stage classifier run on every kept box. The crops are warped on the device from the
+// image already staged for detection and batched into the classifier engine, input
+// [N, 3, H, W] and one [N, num_classes] output.
+struct CascadeOptions {
+  float padding = 0.0f;   // added on every side of the box, as a fraction of its size,
+                          // the padded crop stays inside the image
+  bool letterbox = true;  // keep the aspect ratio and pad with 114, otherwise stretch
+  bool swap_rb = true;    // feed RGB
+  bool mean_std = false;  // (x / 255 - mean) / std, otherwise x / 255
+  float mean[3] = {0.485f, 0.456f, 0.406f};
+  float std[3] = {0.229f, 0.224f, 0.225f};
+  bool softmax = true;      // the engine outputs logits
+  bool all_scores = false;  // fill Box::sub_scores
+  int max_batch = 32;       // crops per forward of a dynamic shape engine
+};
+
 // [Preprocess]: 0.50736 ms
 // [Forward]: 3.96410 ms
 // [BoxDecode]: 0.12016 ms
@@ -59,14 +138,88 @@ class Infer {
   virtual BoxArray forward(const Image &image, void *stream = nullptr) = 0;
   virtual std::vector<BoxArray> forwards(const std::vector<Image> &images,
                                          void *stream = nullptr) = 0;
+
+  // Enqueue the batch and return at once, the future is fulfilled from a completion thread
+  // when the boxes reach the host. Images are copied before returning. Consecutive batches in
+  // flight must use the same stream.
+  virtual std::shared_future<std::vector<BoxArray>> forwards_async(
+      const std::vector<Image> &images, void *stream = nullptr) = 0;
+
+  // Same results packed in one BoxBatch (box_batch.hpp): one allocation per batch instead of
+  // a vector per image and a pinned buffer plus shared_ptr per mask.
+  virtual BoxBatch forwards_packed(const std::vector<Image> &images, void *stream = nullptr) = 0;
+  virtual std::future<BoxBatch> forwards_packed_async(const std::vector<Image> &images,
+                                                      void *stream = nullptr) = 0;
+
+  // Capture the whole pipeline into a CUDA graph per batch size and replay it afterwards.
+  // Static shape model only, return whether the mode is active.
+  virtual bool use_cuda_graph(bool enable) = 0;
+
+  // Dump the raw head tensors of every following forward to a capture file (capture.hpp),
+  // an empty file stops capturing.
+  virtual bool capture(const std::string &file) = 0;
+
+  // Classify the kept boxes of forward / forwards (and forwards_async, which then runs
+  // synchronously) with a second engine, the results land in Box::sub_*. Packed results are
+  // not classified. An empty file removes the classifier.
+  virtual bool set_cascade(const std::string &classifier_file,
+                           const CascadeOptions &options = CascadeOptions()) = 0;
+
+  // Per class confidence thresholds (num_classes() elements) and an optional enable mask,
+  // applied inside decode so filtered classes never reach NMS. Takes effect on next forward.
+  virtual int num_classes() = 0;
+  virtual bool set_class_thresholds(const std::vector<float> &thresholds,
+                                    const std::vector<uint8_t> &enabled = {}) = 0;
+
+  // Time every engine layer of the following forwards (trt::Infer::set_profiling), each of
+  // which then waits for the device. Not available with CUDA graphs, enabling starts over.
+  virtual bool set_profiling(bool enable) = 0;
+  // slowest layer first, format with trt::format_table / trt::format_json
+  virtual trt::LayerReport layer_report() = 0;
+
+  // Masks of forward / forwards as Box::rle: binarized at threshold and run length encoded on
+  // the device, only the run boundaries are copied back. Segmentation models only, packed
+  // results keep their bitmaps.
+  virtual bool set_mask_encoding(MaskEncoding encoding, float threshold = 0.5f) = 0;
+
+  // Count mode: the kept boxes are reduced on the device to per class counts, and per zone
+  // counts when zones are given, and only those integers are copied back. No BoxArray is
+  // built and the cascade does not run. Not available for end-to-end engines (no class count).
+  virtual std::vector<Counts> count(const std::vector<Image> &images,
+                                    const std::vector<CountZone> &zones = {},
+                                    void *stream = nullptr) = 0;
 };
 
+// Engines exported with the EfficientNMS or BatchedNMS plugin are recognised by their outputs
+// and run end to end: the boxes are only un-letterboxed, nms_threshold and the class
+// thresholds are unused (num_classes() is 0) and capture is not available.
 std::shared_ptr<Infer> load(const std::string &engine_file, Type type,
                             float confidence_threshold = 0.25f, float nms_threshold = 0.5f);
 
+// Presize every buffer for the largest batch and image and run warm-up forwards before
+// returning, so that steady state forwards do not allocate (see trt::allocations()).
+struct LoadOptions {
+  int max_batch = 0;  // dynamic shape model only, the engine batch is used for static shape
+  int max_width = 0, max_height = 0;  // largest input image, 0 leaves the staging buffers lazy
+  int warmup = 0;                     // forwards of a blank max_batch batch
+  // the engine context takes turns with the other shared models of the device on one
+  // activation scratch instead of holding its own, see trt::load
+  bool share_activations = false;
+};
+
+std::shared_ptr<Infer> load(const std::string &engine_file, Type type, const LoadOptions &options,
+                            float confidence_threshold = 0.25f, float nms_threshold = 0.5f);
+
 Infer *loadraw(const std::string &engine_file, Type type, 
 							float confidence_threshold = 0.25f, float nms_threshold = 0.5f);
 
+// deserialize the engine on every device (all visible devices when empty), each forwards
+// call goes to the device with the least work in flight
+std::shared_ptr<Infer> load_pool(const std::string &engine_file, Type type,
+                                 const std::vector<int> &devices,
+                                 float confidence_threshold = 0.25f, float nms_threshold = 0.5f,
+                                 const LoadOptions &options = LoadOptions());
+
 const char *type_name(Type type);
 std::tuple<uint8_t, uint8_t, uint8_t> hsv2bgr(float h, float s, float v);
 std::tuple<uint8_t, uint8_t, uint8_t> random_color(int id);
@@ -0,0 +1,722 @@
+// Offline benchmark of the detection pipeline.
+//
+// Replays a directory of images through yolo::Infer (backend gpu) or through the host
+// pre/post-processing path on synthetic head tensors (backend cpu, no engine needed),
+// sweeping batch size and thread count. With --capture the recorded head tensors of a
+// capture file are replayed through post-processing only, on either backend. Backend overlay
+// draws synthetic detections into RGB32 frames with overlay::Renderer next to the former
+// RGB32 -> BGR -> cv::rectangle / cv::putText -> RGBA conversion chain. Backend logger calls
+// the log rate limiter of one call site from every thread. Backend tracker follows synthetic
+// trajectories with track::Tracker at --detect-interval and reports the share of frames that
+// needed the detector. Results are written as JSON: throughput plus p50/p99/mean latency of
+// every stage in milliseconds (logger: nanoseconds per call).
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <opencv2/opencv.hpp>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capture.hpp"
+#include "infer.hpp"
+#include "logger.hpp"
+#include "overlay.hpp"
+#include "postprocess.hpp"
+#include "tracker.hpp"
+#include "yolo.hpp"
+
+using namespace std;
+
+struct Options {
+  string engine;
+  string images;
+  string json;
+  string capture;
+  yolo::Type type = yolo::Type::V8;
+  vector<int> batches{1};
+  vector<int> threads{1};
+  vector<string> backends{"gpu"};
+  int device = 0;
+  int iterations = 100;
+  int warmup = 5;
+  int input_width = 640, input_height = 640;
+  int num_classes = 80;
+  int num_anchors = 8400;
+  int overlay_boxes = 16;
+  int detect_interval = 1;
+  float density = 0.01f;  // fraction of synthetic anchors above the threshold
+  float confidence_threshold = 0.25f;
+  float nms_threshold = 0.5f;
+};
+
+struct RunResult {
+  string backend;
+  int batch = 0, threads = 0;
+  int images = 0;
+  double seconds = 0;
+  bool ok = true;
+  unsigned long long allocations = 0;  // device and pinned host allocations while measuring
+  double detect_ratio = -1;            // frames that went through the detector, backend tracker
+  map<string, vector<double>> stages;  // milliseconds per batch
+};
+
+static void usage(const char *program) {
+  printf(
+      "Usage: %s [options]\n"
+      "  --engine <file>       TensorRT engine, required for backend gpu\n"
+      "  --images <dir>        directory of images, synthetic 1920x1080 frames if omitted\n"
+      "  --capture <file>      replay recorded head tensors through post-processing only\n"
+      "  --type <v5|v8|x|..>   head type, default v8\n"
+      "  --backend <list>      gpu,cpu,overlay,logger,tracker\n"
+      "  --batch <list>        batch sizes, e.g. 1,4,8\n"
+      "  --threads <list>      submission threads, e.g. 1,2\n"
+      "  --device <id>         cuda device for backend gpu\n"
+      "  --iterations <n>      measured batches per thread, default 100\n"
+      "  --warmup <n>          unmeasured batches per thread, default 5\n"
+      "  --input <w>x<h>       network input of backend cpu, default 640x640\n"
+      "  --classes <n>         synthetic head classes, default 80\n"
+      "  --anchors <n>         synthetic head rows, default 8400\n"
+      "  --density <f>         synthetic candidate fraction, default 0.01\n"
+      "  --boxes <n>           boxes per frame of backend overlay and tracker, default 16\n"
+      "  --detect-interval <n> detector every n frames of backend tracker, default 1\n"
+      "  --json <file>         also write the report to file\n",
+      program);
+}
+
+static vector<string> split(const string &value) {
+  vector<string> output;
+  stringstream ss(value);
+  string item;
+  while (getline(ss, item, ',')) {
+    if (!item.empty()) output.push_back(item);
+  }
+  return output;
+}
+
+static vector<int> split_int(const string &value) {
+  vector<int> output;
+  for (auto &item : split(value)) output.push_back(atoi(item.c_str()));
+  return output;
+}
+
+static bool parse_type(const string &name, yolo::Type &type) {
+  static const map<string, yolo::Type> types = {{"v3", yolo::Type::V3}, {"v5", yolo::Type::V5},
+                                                {"v7", yolo::Type::V7}, {"v8", yolo::Type::V8},
+                                                {"v8seg", yolo::Type::V8Seg},
+                                                {"x", yolo::Type::X}};
+  auto iter = types.find(name);
+  if (iter == types.end()) return false;
+  type = iter->second;
+  return true;
+}
+
+static bool parse_options(int argc, char **argv, Options &options) {
+  for (int i = 1; i < argc; ++i) {
+    string key = argv[i];
+    if (key == "--help" || key == "-h") return false;
+    if (i + 1 >= argc) {
+      printf("Missing value of %s\n", key.c_str());
+      return false;
+    }
+
+    string value = argv[++i];
+    if (key == "--engine") {
+      options.engine = value;
+    } else if (key == "--images") {
+      options.images = value;
+    } else if (key == "--capture") {
+      options.capture = value;
+    } else if (key == "--json") {
+      options.json = value;
+    } else if (key == "--type") {
+      if (!parse_type(value, options.type)) {
+        printf("Unknow type %s\n", value.c_str());
+        return false;
+      }
+    } else if (key == "--backend") {
+      options.backends = split(value);
+    } else if (key == "--batch") {
+      options.batches = split_int(value);
+    } else if (key == "--threads") {
+      options.threads = split_int(value);
+    } else if (key == "--device") {
+      options.device = atoi(value.c_str());
+    } else if (key == "--iterations") {
+      options.iterations = atoi(value.c_str());
+    } else if (key == "--warmup") {
+      options.warmup = atoi(value.c_str());
+    } else if (key == "--input") {
+      if (sscanf(value.c_str(), "%dx%d", &options.input_width, &options.input_height) != 2)
+        return false;
+    } else if (key == "--classes") {
+      options.num_classes = atoi(value.c_str());
+    } else if (key == "--anchors") {
+      options.num_anchors = atoi(value.c_str());
+    } else if (key == "--density") {
+      options.density = atof(value.c_str());
+    } else if (key == "--boxes") {
+      options.overlay_boxes = atoi(value.c_str());
+    } else if (key == "--detect-interval") {
+      options.detect_interval = max(1, atoi(value.c_str()));
+    } else {
+      printf("Unknow option %s\n", key.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+static vector<cv::Mat> load_images(const Options &options) {
+  vector<cv::Mat> images;
+  if (!options.images.empty()) {
+    vector<cv::String> files;
+    cv::glob(options.images + "/*", files, false);
+    for (auto &file : files) {
+      cv::Mat image = cv::imread(file);
+      if (!image.empty()) images.push_back(image);
+    }
+    printf("Loaded %d images from %s\n", (int)images.size(), options.images.c_str());
+  }
+
+  if (images.empty()) {
+    cv::Mat image(1080, 1920, CV_8UC3);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(255));
+    images.push_back(image);
+  }
+  return images;
+}
+
+// rows of [cx, cy, w, h, (objectness), classes...] in network coordinates, candidates are
+// clustered so that NMS has overlapping boxes to resolve
+static vector<float> synthetic_head(const Options &options, unsigned seed) {
+  bool is_v8 = options.type == yolo::Type::V8 || options.type == yolo::Type::V8Seg;
+  int cdim = options.num_classes + (is_v8 ? 4 : 5);
+  vector<float> head(options.num_anchors * cdim);
+
+  mt19937 rng(seed);
+  uniform_real_distribution<float> unit(0.0f, 1.0f);
+  for (int i = 0; i < options.num_anchors; ++i) {
+    float *row = &head[i * cdim];
+    int cluster = i % 16;
+    row[0] = (cluster % 4 + 0.5f) * options.input_width / 4 + unit(rng) * 8;
+    row[1] = (cluster / 4 + 0.5f) * options.input_height / 4 + unit(rng) * 8;
+    row[2] = 40 + unit(rng) * 20;
+    row[3] = 40 + unit(rng) * 20;
+
+    float *scores = row + 4;
+    if (!is_v8) *scores++ = unit(rng) < options.density ? 0.9f : unit(rng) * 0.1f;
+    for (int c = 0; c < options.num_classes; ++c) scores[c] = unit(rng) * 0.1f;
+    if (unit(rng) < options.density)
+      scores[cluster % options.num_classes] = 0.3f + unit(rng) * 0.7f;
+  }
+  return head;
+}
+
+static double elapsed_ms(chrono::steady_clock::time_point start) {
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+static void merge(RunResult &result, map<string, vector<double>> &stages, mutex &lock) {
+  unique_lock<mutex> l(lock);
+  for (auto &item : stages) {
+    auto &target = result.stages[item.first];
+    target.insert(target.end(), item.second.begin(), item.second.end());
+  }
+}
+
+static RunResult run_gpu(const Options &options, const vector<cv::Mat> &images, int batch,
+                         int threads) {
+  RunResult result;
+  result.backend = "gpu";
+  result.batch = batch;
+  result.threads = threads;
+
+  // one engine instance per thread, dispatched by the device pool, presized for the largest
+  // image so that the run itself should not allocate
+  yolo::LoadOptions load_options;
+  load_options.max_batch = batch;
+  load_options.warmup = 1;
+  for (auto &image : images) {
+    load_options.max_width = max(load_options.max_width, image.cols);
+    load_options.max_height = max(load_options.max_height, image.rows);
+  }
+  auto model = yolo::load_pool(options.engine, options.type, vector<int>(threads, options.device),
+                               options.confidence_threshold, options.nms_threshold, load_options);
+  if (model == nullptr) {
+    result.ok = false;
+    return result;
+  }
+  unsigned long long allocations = trt::allocations().total();
+
+  mutex lock;
+  vector<thread> workers;
+  auto start = chrono::steady_clock::now();
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t]() {
+      map<string, vector<double>> stages;
+      vector<yolo::Image> inputs(batch);
+      for (int it = 0; it < options.warmup + options.iterations; ++it) {
+        for (int i = 0; i < batch; ++i) {
+          const cv::Mat &image = images[(t + it * batch + i) % images.size()];
+          inputs[i] = yolo::Image(image.data, image.cols, image.rows);
+        }
+
+        auto tick = chrono::steady_clock::now();
+        auto boxes = model->forwards(inputs);
+        double forward = elapsed_ms(tick);
+        if ((int)boxes.size() != batch) {
+          unique_lock<mutex> l(lock);
+          result.ok = false;
+          return;
+        }
+        if (it >= options.warmup) stages["forward"].push_back(forward);
+      }
+      merge(result, stages, lock);
+    });
+  }
+  for (auto &worker : workers) worker.join();
+  result.seconds = elapsed_ms(start) / 1000.0;
+  result.images = threads * (options.warmup + options.iterations) * batch;
+  result.allocations = trt::allocations().total() - allocations;
+  return result;
+}
+
+static RunResult run_cpu(const Options &options, const vector<cv::Mat> &images, int batch,
+                         int threads) {
+  RunResult result;
+  result.backend = "cpu";
+  result.batch = batch;
+  result.threads = threads;
+
+  bool is_v8 = options.type == yolo::Type::V8 || options.type == yolo::Type::V8Seg;
+  int cdim = options.num_classes + (is_v8 ? 4 : 5);
+  vector<float> thresholds(options.num_classes, options.confidence_threshold);
+  // the instantiation the device decode of such a head would use
+  yolo::DecodeVariant variant = yolo::select_decode(options.num_classes, cdim, options.type);
+
+  mutex lock;
+  vector<thread> workers;
+  auto start = chrono::steady_clock::now();
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t]() {
+      map<string, vector<double>> stages;
+      vector<float> head = synthetic_head(options, 1234 + t);
+      vector<float> boxarray(1 + yolo::MAX_IMAGE_BOXES * yolo::NUM_BOX_ELEMENT);
+      int plane = options.input_width * options.input_height;
+      vector<float> input(plane * 3);
+      cv::Mat warped, normalized;
+      yolo::BoxArray output;
+      yolo::BoxBatch packed;
+
+      for (int it = 0; it < options.warmup + options.iterations; ++it) {
+        double preprocess = 0, decode = 0, nms = 0, collect = 0, pack = 0;
+        for (int i = 0; i < batch; ++i) {
+          const cv::Mat &image = images[(t + it * batch + i) % images.size()];
+          yolo::AffineMatrix affine;
+          affine.compute(make_tuple(image.cols, image.rows),
+                         make_tuple(options.input_width, options.input_height));
+
+          auto tick = chrono::steady_clock::now();
+          cv::warpAffine(image, warped, cv::Mat(2, 3, CV_32F, affine.i2d),
+                         cv::Size(options.input_width, options.input_height), cv::INTER_LINEAR,
+                         cv::BORDER_CONSTANT, cv::Scalar::all(114));
+          warped.convertTo(normalized, CV_32FC3, 1 / 255.0f);
+          vector<cv::Mat> planes = {cv::Mat(warped.size(), CV_32F, &input[plane * 2]),
+                                    cv::Mat(warped.size(), CV_32F, &input[plane * 1]),
+                                    cv::Mat(warped.size(), CV_32F, &input[plane * 0])};
+          cv::split(normalized, planes);
+          preprocess += elapsed_ms(tick);
+
+          tick = chrono::steady_clock::now();
+          boxarray[0] = 0;
+          yolo::host::decode(head.data(), options.num_anchors, options.num_classes, cdim,
+                             options.confidence_threshold, thresholds.data(), affine.d2i,
+                             boxarray.data(), yolo::MAX_IMAGE_BOXES, variant);
+          decode += elapsed_ms(tick);
+
+          tick = chrono::steady_clock::now();
+          yolo::host::fast_nms(boxarray.data(), yolo::MAX_IMAGE_BOXES, options.nms_threshold);
+          nms += elapsed_ms(tick);
+
+          tick = chrono::steady_clock::now();
+          yolo::host::collect(boxarray.data(), yolo::MAX_IMAGE_BOXES, output);
+          collect += elapsed_ms(tick);
+
+          // same boxes into the reused struct of arrays batch
+          tick = chrono::steady_clock::now();
+          yolo::host::collect(boxarray.data(), boxarray.size(), 1, yolo::MAX_IMAGE_BOXES,
+                              packed);
+          pack += elapsed_ms(tick);
+        }
+
+        if (it < options.warmup) continue;
+        stages["preprocess"].push_back(preprocess);
+        stages["decode"].push_back(decode);
+        stages["nms"].push_back(nms);
+        stages["collect"].push_back(collect);
+        stages["pack"].push_back(pack);
+      }
+      merge(result, stages, lock);
+    });
+  }
+  for (auto &worker : workers) worker.join();
+  result.seconds = elapsed_ms(start) / 1000.0;
+  result.images = threads * (options.warmup + options.iterations) * batch;
+  return result;
+}
+
+// decode, NMS and masks of captured frames, batch frames per measured sample
+static RunResult run_replay(const Options &options, shared_ptr<capture::Reader> reader,
+                            const string &backend, int batch, int threads) {
+  RunResult result;
+  result.backend = backend;
+  result.batch = batch;
+  result.threads = threads;
+  capture::Backend target = backend == "gpu" ? capture::Backend::Device : capture::Backend::Host;
+
+  mutex lock;
+  vector<thread> workers;
+  auto start = chrono::steady_clock::now();
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t]() {
+      map<string, vector<double>> stages;
+      for (int it = 0; it < options.warmup + options.iterations; ++it) {
+        auto tick = chrono::steady_clock::now();
+        for (int i = 0; i < batch; ++i)
+          capture::replay(reader->frame((t + it * batch + i) % reader->size()), target);
+        if (it >= options.warmup) stages["replay"].push_back(elapsed_ms(tick));
+      }
+      merge(result, stages, lock);
+    });
+  }
+  for (auto &worker : workers) worker.join();
+  result.seconds = elapsed_ms(start) / 1000.0;
+  result.images = threads * (options.warmup + options.iterations) * batch;
+  return result;
+}
+
+// boxes on a grid over the frame, some of them with the caption clipped at the top
+static yolo::BoxArray synthetic_boxes(const Options &options, int width, int height) {
+  yolo::BoxArray boxes;
+  int columns = max(1, (int)ceil(sqrt((double)options.overlay_boxes)));
+  int rows = (options.overlay_boxes + columns - 1) / columns;
+  for (int i = 0; i < options.overlay_boxes; ++i) {
+    float cell_width = (float)width / columns, cell_height = (float)height / max(1, rows);
+    float left = (i % columns) * cell_width + cell_width * 0.1f;
+    float top = (i / columns) * cell_height + cell_height * 0.1f;
+    boxes.emplace_back(left, top, left + cell_width * 0.8f, top + cell_height * 0.8f,
+                       0.5f + (i % 50) * 0.01f, i % options.num_classes);
+  }
+  return boxes;
+}
+
+// the same boxes drawn into RGB32 frames by overlay::Renderer (stage overlay) and by the
+// conversion chain it replaced (stage opencv), batch frames per measured sample
+static RunResult run_overlay(const Options &options, const vector<cv::Mat> &images, int batch,
+                             int threads) {
+  RunResult result;
+  result.backend = "overlay";
+  result.batch = batch;
+  result.threads = threads;
+
+  vector<cv::Mat> frames(images.size());
+  for (size_t i = 0; i < images.size(); ++i)
+    cv::cvtColor(images[i], frames[i], cv::COLOR_BGR2RGBA);
+  vector<string> class_names;
+  for (int i = 0; i < options.num_classes; ++i) class_names.push_back("class" + to_string(i));
+  auto renderer = overlay::create_renderer();
+
+  mutex lock;
+  vector<thread> workers;
+  auto start = chrono::steady_clock::now();
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t]() {
+      map<string, vector<double>> stages;
+      cv::Mat dest, bgr, rgba;
+      for (int it = 0; it < options.warmup + options.iterations; ++it) {
+        double drawn = 0, converted = 0;
+        for (int i = 0; i < batch; ++i) {
+          const cv::Mat &frame = frames[(t + it * batch + i) % frames.size()];
+          auto boxes = synthetic_boxes(options, frame.cols, frame.rows);
+
+          frame.copyTo(dest);
+          auto tick = chrono::steady_clock::now();
+          overlay::Canvas canvas(dest.data, dest.cols, dest.rows, dest.step);
+          renderer->draw_boxes(canvas, boxes, class_names);
+          drawn += elapsed_ms(tick);
+
+          frame.copyTo(dest);
+          tick = chrono::steady_clock::now();
+          cv::cvtColor(dest, bgr, cv::COLOR_RGBA2BGR);
+          for (auto &box : boxes) {
+            uint8_t b, g, r;
+            tie(b, g, r) = yolo::random_color(box.class_label);
+            cv::rectangle(bgr, cv::Point(box.left, box.top), cv::Point(box.right, box.bottom),
+                          cv::Scalar(b, g, r), 5);
+            auto caption = cv::format("%s %.2f", class_names[box.class_label].c_str(),
+                                      box.confidence);
+            int width = cv::getTextSize(caption, 0, 1, 2, nullptr).width + 10;
+            cv::rectangle(bgr, cv::Point(box.left - 3, box.top - 33),
+                          cv::Point(box.left + width, box.top), cv::Scalar(b, g, r), -1);
+            cv::putText(bgr, caption, cv::Point(box.left, box.top - 5), 0, 1,
+                        cv::Scalar::all(0), 2, 16);
+          }
+          cv::cvtColor(bgr, rgba, cv::COLOR_BGR2RGBA);
+          rgba.copyTo(dest);
+          converted += elapsed_ms(tick);
+        }
+
+        if (it < options.warmup) continue;
+        stages["overlay"].push_back(drawn);
+        stages["opencv"].push_back(converted);
+      }
+      merge(result, stages, lock);
+    });
+  }
+  for (auto &worker : workers) worker.join();
+  result.seconds = elapsed_ms(start) / 1000.0;
+  result.images = threads * (options.warmup + options.iterations) * batch;
+  return result;
+}
+
+// one shared call site hammered by every thread, mostly over its limit as under a log storm,
+// stage allow is in nanoseconds per call
+static RunResult run_logger(const Options &options, int batch, int threads) {
+  const int calls = 100000;
+  RunResult result;
+  result.backend = "logger";
+  result.batch = batch;
+  result.threads = threads;
+
+  // starts the drain thread that keeps the coarse clock of the limiters
+  trt::log_flush();
+  this_thread::sleep_for(chrono::milliseconds(10));
+
+  trt::LogRateLimiter limiter;
+  atomic<long long> allowed_total(0);  // keeps the calls
+  mutex lock;
+  vector<thread> workers;
+  auto start = chrono::steady_clock::now();
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&]() {
+      map<string, vector<double>> stages;
+      int allowed = 0;
+      for (int it = 0; it < options.warmup + options.iterations; ++it) {
+        auto tick = chrono::steady_clock::now();
+        for (int i = 0; i < batch * calls; ++i) allowed += limiter.allow();
+        double ns = elapsed_ms(tick) * 1e6 / (batch * calls);
+        if (it >= options.warmup) stages["allow"].push_back(ns);
+      }
+      allowed_total += allowed;
+      merge(result, stages, lock);
+    });
+  }
+  for (auto &worker : workers) worker.join();
+  result.seconds = elapsed_ms(start) / 1000.0;
+  result.images = threads * (options.warmup + options.iterations) * batch * calls;
+  return result;
+}
+
+// objects moving at constant speed over a 1920x1080 frame and bouncing off its edges, the
+// detector sees them with jitter and misses one in twenty. Stage frame is the tracker time
+// per frame, detections are generated outside of it.
+static RunResult run_tracker(const Options &options, int batch, int threads) {
+  const float width = 1920, height = 1080, size = 60;
+  RunResult result;
+  result.backend = "tracker";
+  result.batch = batch;
+  result.threads = threads;
+
+  track::Config config;
+  config.detect_interval = options.detect_interval;
+
+  mutex lock;
+  vector<thread> workers;
+  long long frames = 0, detected = 0;
+  auto start = chrono::steady_clock::now();
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t]() {
+      map<string, vector<double>> stages;
+      auto tracker = track::create_tracker(config);
+      mt19937 rng(1234 + t);
+      uniform_real_distribution<float> unit(0.0f, 1.0f);
+      normal_distribution<float> jitter(0.0f, 1.5f);
+
+      int num_objects = max(1, options.overlay_boxes);
+      vector<float> x(num_objects), y(num_objects), vx(num_objects), vy(num_objects);
+      for (int i = 0; i < num_objects; ++i) {
+        x[i] = unit(rng) * (width - size);
+        y[i] = unit(rng) * (height - size);
+        vx[i] = (unit(rng) - 0.5f) * 16;
+        vy[i] = (unit(rng) - 0.5f) * 16;
+      }
+
+      long long thread_frames = 0, thread_detected = 0;
+      yolo::BoxArray detections;
+      for (int it = 0; it < options.warmup + options.iterations; ++it) {
+        double elapsed = 0;
+        for (int f = 0; f < batch; ++f) {
+          for (int i = 0; i < num_objects; ++i) {
+            x[i] += vx[i];
+            y[i] += vy[i];
+            if (x[i] < 0 || x[i] > width - size) vx[i] = -vx[i];
+            if (y[i] < 0 || y[i] > height - size) vy[i] = -vy[i];
+          }
+
+          auto tick = chrono::steady_clock::now();
+          bool detect = tracker->need_detect();
+          elapsed += elapsed_ms(tick);
+          if (detect) {
+            detections.clear();
+            for (int i = 0; i < num_objects; ++i) {
+              if (unit(rng) < 0.05f) continue;
+              float left = x[i] + jitter(rng), top = y[i] + jitter(rng);
+              detections.emplace_back(left, top, left + size, top + size,
+                                      0.6f + unit(rng) * 0.3f, i % options.num_classes);
+            }
+            tick = chrono::steady_clock::now();
+            tracker->update(detections);
+          } else {
+            tick = chrono::steady_clock::now();
+            tracker->predict();
+          }
+          elapsed += elapsed_ms(tick);
+
+          if (it < options.warmup) continue;
+          thread_frames++;
+          thread_detected += detect;
+        }
+        if (it >= options.warmup) stages["frame"].push_back(elapsed / batch);
+      }
+
+      {
+        unique_lock<mutex> l(lock);
+        frames += thread_frames;
+        detected += thread_detected;
+      }
+      merge(result, stages, lock);
+    });
+  }
+  for (auto &worker : workers) worker.join();
+  result.seconds = elapsed_ms(start) / 1000.0;
+  result.images = threads * (options.warmup + options.iterations) * batch;
+  result.detect_ratio = frames > 0 ? (double)detected / frames : 0;
+  return result;
+}
+
+static double percentile(vector<double> samples, double p) {
+  if (samples.empty()) return 0;
+  sort(samples.begin(), samples.end());
+  size_t index = min(samples.size() - 1, (size_t)(p * (samples.size() - 1) + 0.5));
+  return samples[index];
+}
+
+static string to_json(const Options &options, const vector<RunResult> &results) {
+  stringstream output;
+  char buf[512];
+  output << "{\n  \"engine\": \"" << options.engine << "\",\n  \"type\": \""
+         << yolo::type_name(options.type) << "\",\n  \"runs\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    auto &result = results[i];
+    snprintf(buf, sizeof(buf),
+             "%s\n    {\"backend\": \"%s\", \"batch\": %d, \"threads\": %d, \"ok\": %s, "
+             "\"images\": %d, \"seconds\": %.4f, \"throughput\": %.2f, \"allocations\": %llu, ",
+             i == 0 ? "" : ",", result.backend.c_str(), result.batch, result.threads,
+             result.ok ? "true" : "false", result.images, result.seconds,
+             result.seconds > 0 ? result.images / result.seconds : 0.0, result.allocations);
+    output << buf;
+    if (result.detect_ratio >= 0) {
+      snprintf(buf, sizeof(buf), "\"detect_interval\": %d, \"detect_ratio\": %.4f, ",
+               options.detect_interval, result.detect_ratio);
+      output << buf;
+    }
+
+    output << "\"stages\": {";
+    bool first = true;
+    for (auto &stage : result.stages) {
+      double mean = 0;
+      for (double v : stage.second) mean += v;
+      if (!stage.second.empty()) mean /= stage.second.size();
+      snprintf(buf, sizeof(buf), "%s\"%s\": {\"p50\": %.4f, \"p99\": %.4f, \"mean\": %.4f}",
+               first ? "" : ", ", stage.first.c_str(), percentile(stage.second, 0.5),
+               percentile(stage.second, 0.99), mean);
+      output << buf;
+      first = false;
+    }
+    output << "}}";
+  }
+  output << "\n  ]\n}\n";
+  return output.str();
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parse_options(argc, argv, options)) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  shared_ptr<capture::Reader> reader;
+  if (!options.capture.empty()) {
+    reader = capture::open_reader(options.capture);
+    if (reader == nullptr) return -1;
+    printf("Loaded %d captured frames from %s\n", reader->size(), options.capture.c_str());
+  }
+
+  auto images = load_images(options);
+  vector<RunResult> results;
+  for (auto &backend : options.backends) {
+    if (backend == "gpu" && options.engine.empty() && reader == nullptr) {
+      printf("Backend gpu needs --engine, skipped\n");
+      continue;
+    }
+    if (backend != "gpu" && backend != "cpu" && backend != "overlay" && backend != "logger" &&
+        backend != "tracker") {
+      printf("Unknow backend %s, skipped\n", backend.c_str());
+      continue;
+    }
+
+    for (int batch : options.batches) {
+      for (int threads : options.threads) {
+        if (batch < 1 || threads < 1) continue;
+        printf("Run %s batch=%d threads=%d\n", backend.c_str(), batch, threads);
+        if (backend == "overlay")
+          results.push_back(run_overlay(options, images, batch, threads));
+        else if (backend == "logger")
+          results.push_back(run_logger(options, batch, threads));
+        else if (backend == "tracker")
+          results.push_back(run_tracker(options, batch, threads));
+        else if (reader)
+          results.push_back(run_replay(options, reader, backend, batch, threads));
+        else if (backend == "gpu")
+          results.push_back(run_gpu(options, images, batch, threads));
+        else
+          results.push_back(run_cpu(options, images, batch, threads));
+      }
+    }
+  }
+
+  string report = to_json(options, results);
+  printf("%s", report.c_str());
+  if (!options.json.empty()) {
+    ofstream out(options.json);
+    out << report;
+  }
+
+  for (auto &result : results) {
+    if (!result.ok) return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,193 @@
+// Local inference server.
+//
+// Owns the TensorRT engines and the one CUDA context of the PC so that every LabVIEW process
+// connects to it (remote.hpp) instead of loading its own engine copy. Each --model is
+// published on its own shared memory channel (ipc.hpp) and served by one thread that batches
+// the pending frames of all clients into a single forwards call. A CUDA failure takes down
+// this process only, the clients see failed calls and reconnect once it is restarted.
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "infer.hpp"
+#include "ipc.hpp"
+#include "remote.hpp"
+#include "yolo.hpp"
+
+using namespace std;
+
+struct ModelOption {
+  string name;
+  string engine;
+  yolo::Type type = yolo::Type::V8;
+};
+
+struct Options {
+  vector<ModelOption> models;
+  int max_batch = 8;
+  int max_width = 1920, max_height = 1080;
+  int slots = 16;
+  int window_us = 500;  // how long a batch waits for more frames
+  int warmup = 2;
+  bool cuda_graph = false;
+  bool share_activations = false;
+  float confidence_threshold = 0.25f;
+  float nms_threshold = 0.5f;
+};
+
+static atomic<bool> g_running(true);
+
+static void on_signal(int) { g_running = false; }
+
+static void usage(const char *program) {
+  printf(
+      "Usage: %s --model <name>=<engine>[:<type>] [options]\n"
+      "  --model <spec>        served model, repeatable, type v3|v5|v7|v8|x, default v8\n"
+      "  --max-batch <n>       frames per forward, at most the engine batch, default 8\n"
+      "  --max-size <w>x<h>    largest client frame, default 1920x1080\n"
+      "  --slots <n>           clients per model, default 16\n"
+      "  --window <us>         time a batch waits for more frames, default 500\n"
+      "  --warmup <n>          warm-up forwards per model, default 2\n"
+      "  --cuda-graph <0|1>    replay captured CUDA graphs, static shape engines only\n"
+      "  --share-activations <0|1>  models take turns on one activation scratch\n"
+      "  --confidence <f>      default 0.25\n"
+      "  --nms <f>             default 0.5\n",
+      program);
+}
+
+static bool parse_type(const string &name, yolo::Type &type) {
+  static const map<string, yolo::Type> types = {{"v3", yolo::Type::V3}, {"v5", yolo::Type::V5},
+                                                {"v7", yolo::Type::V7}, {"v8", yolo::Type::V8},
+                                                {"x", yolo::Type::X}};
+  auto iter = types.find(name);
+  if (iter == types.end()) return false;
+  type = iter->second;
+  return true;
+}
+
+static bool parse_model(const string &value, ModelOption &model) {
+  size_t equal = value.find('=');
+  if (equal == string::npos || equal == 0) return false;
+  model.name = value.substr(0, equal);
+  model.engine = value.substr(equal + 1);
+
+  // a drive letter is not a type separator
+  size_t colon = model.engine.rfind(':');
+  if (colon != string::npos && colon > 1) {
+    if (!parse_type(model.engine.substr(colon + 1), model.type)) return false;
+    model.engine = model.engine.substr(0, colon);
+  }
+  return !model.engine.empty();
+}
+
+static bool parse_options(int argc, char **argv, Options &options) {
+  for (int i = 1; i < argc; ++i) {
+    string key = argv[i];
+    if (key == "--help" || key == "-h") return false;
+    if (i + 1 >= argc) {
+      printf("Missing value of %s\n", key.c_str());
+      return false;
+    }
+
+    string value = argv[++i];
+    if (key == "--model") {
+      ModelOption model;
+      if (!parse_model(value, model)) {
+        printf("Invalid model %s\n", value.c_str());
+        return false;
+      }
+      options.models.push_back(model);
+    } else if (key == "--max-batch") {
+      options.max_batch = max(1, atoi(value.c_str()));
+    } else if (key == "--max-size") {
+      if (sscanf(value.c_str(), "%dx%d", &options.max_width, &options.max_height) != 2)
+        return false;
+    } else if (key == "--slots") {
+      options.slots = max(1, atoi(value.c_str()));
+    } else if (key == "--window") {
+      options.window_us = max(0, atoi(value.c_str()));
+    } else if (key == "--warmup") {
+      options.warmup = atoi(value.c_str());
+    } else if (key == "--cuda-graph") {
+      options.cuda_graph = atoi(value.c_str()) != 0;
+    } else if (key == "--share-activations") {
+      options.share_activations = atoi(value.c_str()) != 0;
+    } else if (key == "--confidence") {
+      options.confidence_threshold = atof(value.c_str());
+    } else if (key == "--nms") {
+      options.nms_threshold = atof(value.c_str());
+    } else {
+      printf("Unknow option %s\n", key.c_str());
+      return false;
+    }
+  }
+  return !options.models.empty();
+}
+
+// publishes the model on its channel and answers its clients until the server stops
+static void serve(const ModelOption &model, shared_ptr<yolo::Infer> infer,
+                  const Options &options) {
+  ipc::ChannelConfig config;
+  config.num_slots = options.slots;
+  config.max_width = options.max_width;
+  config.max_height = options.max_height;
+  config.num_classes = infer->num_classes();
+
+  ipc::Channel channel;
+  if (!channel.create(model.name, config)) {
+    INFOE("Failed to publish model %s", model.name.c_str());
+    g_running = false;
+    return;
+  }
+  INFO("Serving %s as %s, %d slots", model.engine.c_str(), model.name.c_str(), options.slots);
+
+  yolo::serve(channel, *infer, model.name, options.max_batch, options.window_us, g_running);
+  channel.shutdown();
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parse_options(argc, argv, options)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  yolo::LoadOptions load_options;
+  load_options.max_batch = options.max_batch;
+  load_options.max_width = options.max_width;
+  load_options.max_height = options.max_height;
+  load_options.warmup = options.warmup;
+  load_options.share_activations = options.share_activations;
+
+  vector<shared_ptr<yolo::Infer>> models;
+  for (auto &model : options.models) {
+    auto infer = yolo::load(model.engine, model.type, load_options, options.confidence_threshold,
+                            options.nms_threshold);
+    if (infer == nullptr) {
+      INFOE("Failed to load %s", model.engine.c_str());
+      return 1;
+    }
+    if (options.cuda_graph) infer->use_cuda_graph(true);
+    models.push_back(infer);
+  }
+
+  vector<thread> workers;
+  for (int i = 0; i < (int)models.size(); ++i)
+    workers.emplace_back(serve, options.models[i], models[i], options);
+  for (auto &worker : workers) worker.join();
+
+  trt::log_flush();
+  return 0;
+}
@@ -9,6 +9,7 @@
 #include <string>
 #include <vector>
 #include <fstream>
+#include <mutex>
 
 //#include <openvino/openvino.hpp> //openvino header file
 #include <opencv2/opencv.hpp>    //opencv header file
@@ -17,7 +18,12 @@
 #include "NIVisionExtLib.h"
 #include "NIVisionExtExports.h"
 #include "cpm.hpp"
+#include "gate.hpp"
 #include "infer.hpp"
+#include "model_slot.hpp"
+#include "overlay.hpp"
+#include "remote.hpp"
+#include "tracker.hpp"
 #include "yolo.hpp"
 //#include "infer.cu"
 //#include "yolo.cu"
@@ -49,19 +55,343 @@ double getSeconds(chrono::time_point<chrono::system_clock>& start,
 //ov::CompiledModel compiled_model;
 
 // 定义一个智能指针指向ov::CompiledModel对象
-std::shared_ptr<yolo::Infer> net;
+// 每次调用取当前模型的快照, reload_net在后台加载新模型后原子替换, 进行中的调用在旧模型上完成
+model::Slot<yolo::Infer> net;
+std::shared_ptr<overlay::Renderer> renderer;
+std::shared_ptr<track::Tracker> tracker;
+std::shared_ptr<gate::ChangeGate> change_gate;
+yolo::LoadOptions load_options;
 // 用ov::Core::compile_model()方法创建对象
 // 释放compiled_model
 
+// 热替换时带到新模型上的设置
+struct ModelSettings {
+    bool has_thresholds = false;
+    std::vector<float> thresholds;
+    std::vector<uint8_t> enabled;
+    std::string cascade;
+    yolo::CascadeOptions cascade_options;
+    bool cuda_graph = false;
+    bool pool = false;  // load_net_devices加载
+    std::vector<int> devices;
+};
+ModelSettings model_settings;
+std::mutex settings_lock;
+// change_gate缓存的结果所属的模型
+unsigned int gate_generation = 0;
+
+// 当前模型, 未加载时抛出NI错误而不是访问空指针
+static std::shared_ptr<yolo::Infer> current_net() {
+    auto model = net.get();
+    if (model == nullptr) ThrowNIError(NI_ERR_NULL_POINTER);
+    return model;
+}
+
+static void apply_settings(yolo::Infer &model, const ModelSettings &settings) {
+    if (settings.has_thresholds) model.set_class_thresholds(settings.thresholds, settings.enabled);
+    if (!settings.cascade.empty()) model.set_cascade(settings.cascade, settings.cascade_options);
+    if (settings.cuda_graph) model.use_cuda_graph(true);
+}
+
 // 图片转换函数
 yolo::Image cvimg(const cv::Mat &image) { return yolo::Image(image.data, image.cols, image.rows); }
 
+// U16图像的显示窗口, [mono_low, mono_high]线性映射到0..255
+float mono_low = 0, mono_high = 65535;
+// U8图像按RGGB Bayer原始图处理, 在GPU预处理中去马赛克
+bool bayer_input = false;
+
+// NI图像转yolo::Image: RGB32转换为BGR存入bgr, U8/U16直接引用NI图像内存, 单通道在GPU上展开
+static yolo::Image niimg(NIImage &source, cv::Mat &bgr) {
+    switch (source.GetNIImageType()) {
+        case NIImage_U8:
+            return yolo::Image(source.pixelPtr, source.width, source.height,
+                               bayer_input ? yolo::PixelFormat::BayerRG8 : yolo::PixelFormat::Gray8,
+                               static_cast<int>(source.stepInBytes));
+        case NIImage_U16: {
+            yolo::Image image(source.pixelPtr, source.width, source.height, yolo::PixelFormat::Gray16,
+                              static_cast<int>(source.stepInBytes));
+            image.window_low = mono_low;
+            image.window_high = mono_high;
+            return image;
+        }
+        case NIImage_RGB32: {
+            cv::Mat sourceMat;
+            ThrowNIError(source.ImageToMat(sourceMat));
+            cv::cvtColor(sourceMat, bgr, CV_RGB2BGR);
+            return cvimg(bgr);
+        }
+        default:
+            ThrowNIError(NI_ERR_INVALID_IMAGE_TYPE);
+    }
+    return yolo::Image();
+}
+
+// LabVIEW的exist数组按类别累加count, 只写[0, capacity)内的类别
+static void add_exist(int32_t *exist, int32_t capacity, int label, int32_t count = 1) {
+    if (exist && label >= 0 && label < capacity) exist[label] += count;
+}
+
+static int ni_bytes_per_pixel(NIImage &source) {
+    switch (source.GetNIImageType()) {
+        case NIImage_U8:
+            return 1;
+        case NIImage_U16:
+            return 2;
+        default:
+            return 4;
+    }
+}
+
+// 直接在目标NI图像上绘制, 源和目标不同时只拷贝一次原图
+// 单通道源图像无法绘制彩色框: 目标为源图像时不绘制, 否则先把源图像按窗口转换为RGB32
+static void draw_result(NIImage &source_src, NIImageHandle sourceHandle_src, NIImageHandle destHandle,
+                        const yolo::BoxArray &objs) {
+    NIImage dest;
+    NIImage *target = &source_src;
+    bool mono = source_src.GetNIImageType() != NIImage_RGB32;
+    if (destHandle == sourceHandle_src && mono) return;
+    if (destHandle != sourceHandle_src) {
+        ThrowNIError(dest.SetImageHandle(destHandle));
+        if (dest.GetNIImageType() != NIImage_RGB32) ThrowNIError(NI_ERR_INVALID_IMAGE_TYPE);
+        if (mono) {
+            bool wide = source_src.GetNIImageType() == NIImage_U16;
+            cv::Mat gray(source_src.height, source_src.width, wide ? CV_16UC1 : CV_8UC1,
+                         source_src.pixelPtr, source_src.stepInBytes);
+            cv::Mat gray8, bgra;
+            if (wide) {
+                double scale = 255.0 / std::max(mono_high - mono_low, 1.0f);
+                gray.convertTo(gray8, CV_8U, scale, -mono_low * scale);
+            } else {
+                gray8 = gray;
+            }
+            if (bayer_input && !wide) {
+                cv::Mat bgr;
+                cv::cvtColor(gray8, bgr, CV_BayerBG2BGR);  // OpenCV的BG即RGGB
+                cv::cvtColor(bgr, bgra, CV_BGR2BGRA);
+            } else {
+                cv::cvtColor(gray8, bgra, CV_GRAY2BGRA);
+            }
+            ThrowNIError(dest.SetImage(bgra.data, bgra.cols, bgra.rows, static_cast<int>(bgra.step)));
+        } else {
+            ThrowNIError(dest.SetImage(source_src.pixelPtr, source_src.width, source_src.height,
+                                       static_cast<int>(source_src.stepInBytes)));
+        }
+        target = &dest;
+    }
+    if (renderer == nullptr) renderer = overlay::create_renderer();
+    overlay::Canvas canvas(target->pixelPtr, target->width, target->height, target->stepInBytes);
+    renderer->draw_boxes(canvas, objs, class_names);
+}
+
 EXTERN_C void NI_EXPORT load_net(char *path, double *score_threshold) {
 
+    float confidence_threshold = score_threshold ? (float)*score_threshold : 0.25f;
+    float nms_threshold = 0.5f;
+    {
+        std::unique_lock<std::mutex> l(settings_lock);
+        model_settings = ModelSettings();
+    }
+    net.exchange(yolo::load(path, yolo::Type::V8, load_options, confidence_threshold, nms_threshold));
+}
+
+// 热替换模型: 立即返回, 新模型在后台加载并预热(至少一次), 沿用当前的类别阈值/级联分类器/CUDA Graph
+// 设置和load_net_devices的GPU, 完成后原子替换. 替换前的调用继续使用旧模型, 产线不停.
+// status: 1已开始, 0上一次替换尚未完成
+EXTERN_C void NI_EXPORT reload_net(char *path, double *score_threshold, int32_t *status) {
+    std::string file = path ? path : "";
+    float confidence_threshold = score_threshold ? (float)*score_threshold : 0.25f;
+    float nms_threshold = 0.5f;
+    yolo::LoadOptions options = load_options;
+    options.warmup = std::max(options.warmup, 1);
+    ModelSettings settings;
+    {
+        std::unique_lock<std::mutex> l(settings_lock);
+        settings = model_settings;
+    }
+
+    bool started = net.reload([=]() {
+        std::shared_ptr<yolo::Infer> next;
+        if (settings.pool)
+            next = yolo::load_pool(file, yolo::Type::V8, settings.devices, confidence_threshold,
+                                   nms_threshold, options);
+        else
+            next = yolo::load(file, yolo::Type::V8, options, confidence_threshold, nms_threshold);
+        if (next != nullptr) apply_settings(*next, settings);
+        return next;
+    });
+    if (status) *status = started ? 1 : 0;
+}
+
+// status: 0未替换过, 1加载中, 2已替换, 3加载失败(仍使用旧模型); generation每次替换模型加1
+EXTERN_C void NI_EXPORT get_reload_status(int32_t *status, uint32_t *generation) {
+    if (status) *status = static_cast<int32_t>(net.status());
+    if (generation) *generation = net.generation();
+}
+
+// 在load_net之前调用: 按最大batch和最大输入分辨率预分配所有缓冲区, 并在加载时执行warmup次预热推理,
+// 避免首帧卡顿. 全部为0时恢复为按需分配
+EXTERN_C void NI_EXPORT set_load_options(int32_t max_batch, int32_t max_width, int32_t max_height,
+                                         int32_t warmup) {
+    load_options.max_batch = max_batch;
+    load_options.max_width = max_width;
+    load_options.max_height = max_height;
+    load_options.warmup = warmup;
+}
+
+// 在load_net之前调用: 同一GPU上以共享方式加载的模型轮流使用一块激活显存(按其中最大的模型分配), 不再各占一份
+EXTERN_C void NI_EXPORT set_share_activations(int32_t enable) {
+    load_options.share_activations = enable != 0;
+}
+
+// 指定GPU上共享激活显存的实际大小, 若各模型独占时的总大小, 及共享的模型数
+EXTERN_C void NI_EXPORT get_activation_memory(int32_t device_id, uint64_t *pool_bytes,
+                                              uint64_t *private_bytes, int32_t *num_models) {
+    uint64_t total = 0;
+    int32_t count = 0;
+    for (auto &usage : trt::activation_usage()) {
+        if (usage.device_id != device_id) continue;
+        total += usage.bytes;
+        count++;
+    }
+    if (pool_bytes) *pool_bytes = trt::activation_pool_bytes(device_id);
+    if (private_bytes) *private_bytes = total;
+    if (num_models) *num_models = count;
+}
+
+// 在detect_all等之前调用: U16图像推理前按[low, high]线性映射到0..255, 如12位相机用0和4095
+EXTERN_C void NI_EXPORT set_mono_window(double low, double high) {
+    mono_low = (float)low;
+    mono_high = (float)high;
+}
+
+// 1: 之后的U8图像为RGGB Bayer原始图(R在左上角), 不再需要在CPU上去马赛克; 0: U8为灰度图
+EXTERN_C void NI_EXPORT set_bayer_input(int32_t enable) {
+    bayer_input = enable != 0;
+}
+
+// 进程内显存和锁页内存的累计分配次数, 稳定运行后两次读取应相同
+EXTERN_C void NI_EXPORT get_allocation_count(uint64_t *count) {
+    if (count) *count = trt::allocations().total();
+}
+
+// 每类置信度阈值及启用标志(enabled可为空), 长度须等于模型类别数, 无需重新加载模型
+EXTERN_C void NI_EXPORT set_class_thresholds(const double *thresholds, const int32_t *enabled,
+                                             int32_t num_classes, int32_t *status) {
+    bool ok = false;
+    auto model = net.get();
+    if (model != nullptr && thresholds != nullptr) {
+        std::vector<float> values(thresholds, thresholds + num_classes);
+        std::vector<uint8_t> flags;
+        for (int i = 0; enabled && i < num_classes; ++i) flags.push_back(enabled[i] != 0);
+        ok = model->set_class_thresholds(values, flags);
+        // 缓存的结果按旧阈值过滤, 作废
+        if (ok && change_gate) change_gate->reset();
+        if (ok) {
+            std::unique_lock<std::mutex> l(settings_lock);
+            model_settings.has_thresholds = true;
+            model_settings.thresholds = values;
+            model_settings.enabled = flags;
+        }
+    }
+    if (status) *status = ok ? 1 : 0;
+}
+
+// 保存网络输出头张量用于离线回放后处理, path为空字符串时停止
+EXTERN_C void NI_EXPORT set_capture(char *path, int32_t *status) {
+    bool ok = false;
+    auto model = net.get();
+    if (model != nullptr) ok = model->capture(path ? path : "");
+    if (status) *status = ok ? 1 : 0;
+}
+
+// 多GPU: 每个设备各加载一份模型, 推理分发到负载最小的设备, num_devices为0时使用全部GPU
+EXTERN_C void NI_EXPORT load_net_devices(char *path, const int32_t *devices, int32_t num_devices) {
+
     float confidence_threshold = 0.25f;
     float nms_threshold = 0.5f;
-    net = yolo::load(path, yolo::Type::V8, confidence_threshold, nms_threshold);
+    std::vector<int> selected;
+    for (int i = 0; devices && i < num_devices; ++i) selected.push_back(devices[i]);
+    {
+        std::unique_lock<std::mutex> l(settings_lock);
+        model_settings = ModelSettings();
+        model_settings.pool = true;
+        model_settings.devices = selected;
+    }
+    net.exchange(yolo::load_pool(path, yolo::Type::V8, selected, confidence_threshold, nms_threshold,
+                                 load_options));
+}
+
+// 二级分类: 每个检测框在GPU上裁剪后送入分类模型, 结果写入Box::sub_label, path为空字符串时关闭
+EXTERN_C void NI_EXPORT set_cascade(char *path, double padding, int32_t letterbox, int32_t *status) {
+    bool ok = false;
+    auto model = net.get();
+    if (model != nullptr) {
+        yolo::CascadeOptions options;
+        options.padding = padding;
+        options.letterbox = letterbox != 0;
+        ok = model->set_cascade(path ? path : "", options);
+        if (ok) {
+            std::unique_lock<std::mutex> l(settings_lock);
+            model_settings.cascade = path ? path : "";
+            model_settings.cascade_options = options;
+        }
+    }
+    if (status) *status = ok ? 1 : 0;
+}
+
+// 连接本机yolo_server发布的模型(共享内存), 本进程不加载引擎也不创建CUDA上下文; 服务崩溃只会使推理调用失败
+EXTERN_C void NI_EXPORT connect_server(char *name, int32_t timeout_ms, int32_t *status) {
+    {
+        std::unique_lock<std::mutex> l(settings_lock);
+        model_settings = ModelSettings();
+    }
+    auto model = yolo::connect(name ? name : "", timeout_ms > 0 ? timeout_ms : 10000);
+    net.exchange(model);
+    if (status) *status = model != nullptr ? 1 : 0;
+}
+
+EXTERN_C void NI_EXPORT set_cuda_graph(int32_t enable, int32_t *enabled) {
+    bool status = false;
+    auto model = net.get();
+    if (model != nullptr) status = model->use_cuda_graph(enable != 0);
+    if (model != nullptr) {
+        std::unique_lock<std::mutex> l(settings_lock);
+        model_settings.cuda_graph = status;
+    }
+    if (enabled) *enabled = status ? 1 : 0;
+}
+
+// 逐层耗时统计: 开启后每次推理都等待GPU完成并累计各层耗时, 开启时清空之前的统计, 与CUDA graph互斥
+EXTERN_C void NI_EXPORT set_profiling(int32_t enable, int32_t *status) {
+    bool ok = false;
+    auto model = net.get();
+    if (model != nullptr) ok = model->set_profiling(enable != 0);
+    if (status) *status = ok ? 1 : 0;
 }
+
+// 按总耗时降序的逐层耗时表(top为0时输出全部), 写入table, 超出size的部分截断
+EXTERN_C void NI_EXPORT get_layer_profile(int32_t top, char *table, int32_t size, int32_t *runs) {
+    trt::LayerReport report;
+    auto model = net.get();
+    if (model != nullptr) report = model->layer_report();
+    if (table && size > 0) {
+        std::string text = trt::format_table(report, top);
+        size_t count = std::min(text.size(), (size_t)size - 1);
+        memcpy(table, text.data(), count);
+        table[count] = 0;
+    }
+    if (runs) *runs = report.runs;
+}
+
+// 逐层耗时保存为JSON, 便于对比不同版本的引擎
+EXTERN_C void NI_EXPORT save_layer_profile(char *path, int32_t *status) {
+    bool ok = false;
+    auto model = net.get();
+    if (model != nullptr && path != nullptr) ok = trt::save_json(model->layer_report(), path);
+    if (status) *status = ok ? 1 : 0;
+}
+
 EXTERN_C void NI_EXPORT load_class_list(char *path)
 //void load_class_list(const string &path)
 {
@@ -88,46 +418,182 @@ detect_all(NIImageHandle sourceHandle_src, NIImageHandle destHandle, NIErrorHand
             ThrowNIError(NI_ERR_NULL_POINTER);
         }
         NIImage source_src(sourceHandle_src);
-        NIImage dest(destHandle);
+        auto start = chrono::system_clock::now(); // 开始时间
+        unsigned int generation = net.generation();
+        auto model = current_net();
 
-        cv::Mat sourceMat_src;
-        cv::Mat destMat;
-// ni图片转Mat
-        ThrowNIError(source_src.ImageToMat(sourceMat_src));
-        cv::cvtColor(sourceMat_src, sourceMat_src, CV_RGB2BGR);
+// 画面无变化时直接复用上次推理结果, 模型替换后旧结果作废
+        yolo::BoxArray objs;
+        gate::Signature signature;
+        bool unchanged = false;
+        if (change_gate && gate_generation != generation) {
+            change_gate->reset();
+            gate_generation = generation;
+        }
+        if (change_gate) {
+            signature = gate::compute_signature(source_src.pixelPtr, source_src.width, source_src.height,
+                                                source_src.stepInBytes, ni_bytes_per_pixel(source_src),
+                                                change_gate->config().grid, mono_low, mono_high);
+            unchanged = change_gate->lookup(signature, objs);
+        }
+
+        if (!unchanged) {
+            cv::Mat inputMat;
+// ni图片转换, U8/U16不做颜色转换
+            yolo::Image input = niimg(source_src, inputMat);
 //        cv::imwrite("D:/srcimg.png",sourceMat_src);
 //        outfile << source_src.type << endl;
-        auto start = chrono::system_clock::now(); // 开始时间
-// Preprocess the image
-
 
 //        if (net == nullptr) outfile << "no load net" << endl;
 
-        auto objs = net->forward(cvimg(sourceMat_src));
+            objs = model->forward(input);
 //        outfile << "forward!" << endl;
-
-        for (auto &obj : objs) {
-//            outfile << "1111--" << endl;
-            uint8_t b, g, r;
-            tie(b, g, r) = yolo::random_color(obj.class_label);
-            cv::rectangle(sourceMat_src, cv::Point(obj.left, obj.top), cv::Point(obj.right, obj.bottom),
-                          cv::Scalar(b, g, r), 5);
-
-            auto name = class_names[int(obj.class_label)];
-            auto caption = cv::format("%s %.2f", name.c_str(), obj.confidence);
-            int width = cv::getTextSize(caption, 0, 1, 2, nullptr).width + 10;
-            exist[obj.class_label] = exist[obj.class_label]+1;
-            cv::rectangle(sourceMat_src, cv::Point(obj.left - 3, obj.top - 33),
-                          cv::Point(obj.left + width, obj.top), cv::Scalar(b, g, r), -1);
-            cv::putText(sourceMat_src, caption, cv::Point(obj.left, obj.top - 5), 0, 1, cv::Scalar::all(0), 2, 16);
+            if (change_gate) change_gate->store(signature, objs);
         }
 
+// exist按模型类别数计数, 超出范围的类别忽略
+        int num_classes = model->num_classes() > 0 ? model->num_classes() : (int)class_names.size();
+        for (auto &obj : objs) add_exist(exist, num_classes, obj.class_label);
+
+        draw_result(source_src, sourceHandle_src, destHandle, objs);
+
         auto end = chrono::system_clock::now(); // 结束时间
         *time = getSeconds(start, end);
-        cv::cvtColor(sourceMat_src, destMat, CV_BGR2RGBA);
 
-        ThrowNIError(dest.MatToImage(destMat));
+    }
+    catch (NIERROR &_err) {
+        error = _err;
+    }
+    catch (std::string e) {
+        error = NI_ERR_OCV_USER;
+    }
+    ProcessNIError(error, errorHandle);
+}
+
+// 只计数不输出检测框: NMS后的结果在GPU上归约为每类数量(exist, 容量capacity), 可选按区域计数,
+// zones为每个区域的left/top/right/bottom(图像像素, 框中心落在区域内即计入),
+// zone_counts按区域排列, 每个区域capacity个. 不构造检测框也不绘制
+EXTERN_C void NI_EXPORT
+count_all(NIImageHandle sourceHandle_src, NIErrorHandle errorHandle, double *time, int32_t *exist,
+          int32_t capacity, const float *zones, int32_t num_zones, int32_t *zone_counts) {
+    NIERROR error = NI_ERR_SUCCESS;
+    ReturnOnPreviousError(errorHandle);
+    try {
+        if (!sourceHandle_src || !errorHandle || !exist) {
+            ThrowNIError(NI_ERR_NULL_POINTER);
+        }
+        NIImage source_src(sourceHandle_src);
+        auto start = chrono::system_clock::now();
+
+        cv::Mat inputMat;
+        yolo::Image input = niimg(source_src, inputMat);
+
+        std::vector<yolo::CountZone> regions;
+        for (int i = 0; zones && zone_counts && i < num_zones; ++i)
+            regions.emplace_back(zones[i * 4], zones[i * 4 + 1], zones[i * 4 + 2], zones[i * 4 + 3]);
+
+        auto counts = current_net()->count({input}, regions);
+        if (!counts.empty()) {
+            const yolo::Counts &result = counts[0];
+            int num_classes = (int)result.classes.size();
+            for (int i = 0; i < num_classes; ++i) add_exist(exist, capacity, i, result.classes[i]);
+            for (int z = 0; z < (int)regions.size(); ++z) {
+                for (int i = 0; i < num_classes; ++i)
+                    add_exist(zone_counts + z * capacity, capacity, i, result.zones[z * num_classes + i]);
+            }
+        }
+
+        auto end = chrono::system_clock::now();
+        if (time) *time = getSeconds(start, end);
+    }
+    catch (NIERROR &_err) {
+        error = _err;
+    }
+    catch (std::string e) {
+        error = NI_ERR_OCV_USER;
+    }
+    ProcessNIError(error, errorHandle);
+}
+
+// 只输出检测框不绘制: 结果按列直接拷贝到LabVIEW数组(容量capacity), count为检测框总数(可能大于capacity)
+EXTERN_C void NI_EXPORT
+detect_boxes(NIImageHandle sourceHandle_src, NIErrorHandle errorHandle, float *lefts, float *tops,
+             float *rights, float *bottoms, float *scores, int32_t *labels, int32_t capacity,
+             int32_t *count) {
+    NIERROR error = NI_ERR_SUCCESS;
+    ReturnOnPreviousError(errorHandle);
+    try {
+        if (!sourceHandle_src || !errorHandle || !count) {
+            ThrowNIError(NI_ERR_NULL_POINTER);
+        }
+        NIImage source_src(sourceHandle_src);
+        cv::Mat inputMat;
+        yolo::BoxBatch boxes = current_net()->forwards_packed({niimg(source_src, inputMat)});
+        int n = std::min(boxes.size(), (int)std::max(capacity, 0));
+        if (lefts) boxes.copy_column(yolo::BoxBatch::Left, 0, n, lefts);
+        if (tops) boxes.copy_column(yolo::BoxBatch::Top, 0, n, tops);
+        if (rights) boxes.copy_column(yolo::BoxBatch::Right, 0, n, rights);
+        if (bottoms) boxes.copy_column(yolo::BoxBatch::Bottom, 0, n, bottoms);
+        if (scores) boxes.copy_column(yolo::BoxBatch::Confidence, 0, n, scores);
+        if (labels) boxes.copy_column(yolo::BoxBatch::Label, 0, n, labels);
+        *count = boxes.size();
+    }
+    catch (NIERROR &_err) {
+        error = _err;
+    }
+    catch (std::string e) {
+        error = NI_ERR_OCV_USER;
+    }
+    ProcessNIError(error, errorHandle);
+}
+
+// 跟踪模式: 每detect_interval帧或轨迹置信度衰减到redetect_confidence以下时才推理
+EXTERN_C void NI_EXPORT set_tracking(int32_t detect_interval, double redetect_confidence) {
+    track::Config config;
+    config.detect_interval = detect_interval;
+    config.redetect_confidence = (float)redetect_confidence;
+    tracker = track::create_tracker(config);
+}
+
+// exist按类别计数(容量capacity, 超出范围的类别忽略), track_ids按输出顺序写入轨迹ID(最多max_tracks个)
+EXTERN_C void NI_EXPORT
+track_all(NIImageHandle sourceHandle_src, NIImageHandle destHandle, NIErrorHandle errorHandle,
+          double *time, int32_t *exist, int32_t capacity, int32_t *track_ids, int32_t max_tracks,
+          int32_t *num_tracks, int32_t *detected) {
+    NIERROR error = NI_ERR_SUCCESS;
+    ReturnOnPreviousError(errorHandle);
+    try {
+        if (!sourceHandle_src || !destHandle || !errorHandle) {
+            ThrowNIError(NI_ERR_NULL_POINTER);
+        }
+        if (tracker == nullptr) tracker = track::create_tracker();
+        NIImage source_src(sourceHandle_src);
+
+        auto start = chrono::system_clock::now(); // 开始时间
+        bool run_detector = tracker->need_detect();
+        const std::vector<track::Track> *tracks = nullptr;
+        if (run_detector) {
+            cv::Mat inputMat;
+            tracks = &tracker->update(current_net()->forward(niimg(source_src, inputMat)));
+        } else {
+            tracks = &tracker->predict();
+        }
+
+        yolo::BoxArray objs;
+        objs.reserve(tracks->size());
+        int count = 0;
+        for (auto &item : *tracks) {
+            objs.emplace_back(item.box);
+            add_exist(exist, capacity, item.box.class_label);
+            if (track_ids && count < max_tracks) track_ids[count++] = item.id;
+        }
+        if (num_tracks) *num_tracks = count;
+        if (detected) *detected = run_detector ? 1 : 0;
+
+        draw_result(source_src, sourceHandle_src, destHandle, objs);
 
+        auto end = chrono::system_clock::now(); // 结束时间
+        *time = getSeconds(start, end);
     }
     catch (NIERROR &_err) {
         error = _err;
@@ -138,6 +604,38 @@ detect_all(NIImageHandle sourceHandle_src, NIImageHandle destHandle, NIErrorHand
     ProcessNIError(error, errorHandle);
 }
 
+// tolerance为分块均值的最大允许差异(8bit灰度级), enable为0时关闭
+EXTERN_C void NI_EXPORT set_change_gate(int32_t enable, double tolerance, int32_t max_skips) {
+    if (!enable) {
+        change_gate = nullptr;
+        return;
+    }
+    gate::Config config;
+    config.tolerance = (float)tolerance;
+    config.max_skips = max_skips;
+    change_gate = std::make_shared<gate::ChangeGate>(config);
+}
+
+EXTERN_C void NI_EXPORT get_change_gate_stats(uint32_t *hits, uint32_t *misses) {
+    if (hits) *hits = change_gate ? (uint32_t)change_gate->hits() : 0;
+    if (misses) *misses = change_gate ? (uint32_t)change_gate->misses() : 0;
+}
+
+// 日志写入文件(path为空字符串时写stdout), level: 0 debug 1 info 2 warning 3 error,
+// rate_limit: 每个调用点每秒最多输出的条数, 0不限制
+EXTERN_C void NI_EXPORT set_log(char *path, int32_t level, int32_t rate_limit) {
+    trt::set_log_file(path ? path : "");
+    trt::set_log_level((trt::LogLevel)std::max(0, std::min(level, 3)));
+    trt::set_log_rate_limit(rate_limit);
+}
+
+// 卸载dll前调用: 等待后台替换结束, 释放模型并停止日志线程, dll卸载时(持有loader lock)不再等待任何线程
 EXTERN_C void NI_EXPORT release_model() {
-    net = nullptr;
+    net.wait();
+    net.reset();
+    if (tracker) tracker->reset();
+    if (change_gate) change_gate->reset();
+    trt::log_flush();
+    // 停止日志后台线程, 之后的日志由调用线程同步写出
+    trt::log_shutdown();
 }
\ No newline at end of file